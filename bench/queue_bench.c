@@ -0,0 +1,115 @@
+/*
+ * Microbenchmark for the chunk queue backends.
+ *
+ * Every thread repeatedly enqueues a chunk and then dequeues one (the classic
+ * enqueue/dequeue-pair workload), so the queue never grows beyond the number of
+ * threads and no thread can block forever. Reports total operations per second
+ * for the mutex list and the lock-free ring at 1..64 threads.
+ *
+ * Usage: queue_bench [pairs_per_thread] [max_threads]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <image.h>
+
+volatile sig_atomic_t stop_flag = 0;
+
+// The benchmark owns its chunks; queues never free them here
+void free_image_chunk(image_chunk_t *chunk) {
+    (void)chunk;
+}
+
+typedef struct {
+    chunk_queue_t *queue;
+    image_chunk_t *chunk;
+    size_t pairs;
+    pthread_barrier_t *start;
+} bench_thread_arg_t;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void *bench_thread(void *arg) {
+    bench_thread_arg_t *bench = (bench_thread_arg_t *)arg;
+    image_chunk_t *chunk = bench->chunk;
+
+    pthread_barrier_wait(bench->start);
+
+    for (size_t i = 0; i < bench->pairs; i++) {
+        chunk_enqueue(bench->queue, chunk);
+        chunk = chunk_dequeue(bench->queue);
+    }
+
+    return NULL;
+}
+
+static double run_bench(chunk_queue_backend_t backend, size_t num_threads, size_t pairs) {
+    chunk_queue_t queue;
+    int status = (backend == CHUNK_QUEUE_RING)
+        ? chunk_queue_init_ring(&queue, 1024)
+        : chunk_queue_init(&queue);
+
+    if (status != 0)
+        return -1.0;
+
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    bench_thread_arg_t *args = malloc(num_threads * sizeof(bench_thread_arg_t));
+    image_chunk_t *chunks = calloc(num_threads, sizeof(image_chunk_t));
+    pthread_barrier_t start;
+
+    if (threads == NULL || args == NULL || chunks == NULL) {
+        perror("queue_bench: Failed to allocate thread state");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_barrier_init(&start, NULL, (unsigned)num_threads + 1);
+
+    for (size_t i = 0; i < num_threads; i++) {
+        chunks[i].chunk_id = (int)i;
+        args[i] = (bench_thread_arg_t){ &queue, &chunks[i], pairs, &start };
+        pthread_create(&threads[i], NULL, bench_thread, &args[i]);
+    }
+
+    // Read the clock before releasing the workers so none of their work happens before `begin`
+    double begin = now_seconds();
+    pthread_barrier_wait(&start);
+
+    for (size_t i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    double elapsed = now_seconds() - begin;
+
+    pthread_barrier_destroy(&start);
+    chunk_queue_destroy(&queue);
+    free(chunks);
+    free(args);
+    free(threads);
+
+    return (double)(2 * pairs * num_threads) / elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    size_t pairs = (argc > 1)? strtoull(argv[1], NULL, 10): 200000;
+    size_t max_threads = (argc > 2)? strtoull(argv[2], NULL, 10): 64;
+
+    printf("%8s %16s %16s %8s\n", "threads", "list ops/s", "ring ops/s", "speedup");
+
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        double list_ops = run_bench(CHUNK_QUEUE_LIST, threads, pairs);
+        double ring_ops = run_bench(CHUNK_QUEUE_RING, threads, pairs);
+
+        printf("%8zu %16.0f %16.0f %7.2fx\n", threads, list_ops, ring_ops, ring_ops / list_ops);
+        fflush(stdout);
+    }
+
+    return EXIT_SUCCESS;
+}
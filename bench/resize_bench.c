@@ -0,0 +1,171 @@
+/*
+ * Verification and throughput benchmark for the resize stage.
+ *
+ * Resizes a random image (1, 3 and 4 channels) with every filter to a few
+ * scales, checks that every kernel set the CPU supports stays within one level
+ * of the scalar reference (the vector kernels use fused multiply-adds, which
+ * round differently), and reports the throughput in output megapixels per
+ * second. The first run of every size builds the weight tables; the timed runs
+ * reuse them.
+ *
+ * Usage: resize_bench [width] [height] [repetitions]
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <resize.h>
+
+// image.c (the memory budget) expects the pipeline's stop flag and chunk destructor
+volatile sig_atomic_t stop_flag = 0;
+
+void free_image_chunk(image_chunk_t *chunk) {
+    (void)chunk;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static const char *const isa_names[] = { "scalar", "avx2" };
+
+// A whole-image chunk holding a copy of `pixels`; resize_apply frees it
+static int make_image(const unsigned char *pixels, size_t width, size_t height, int channels, image_chunk_t *chunk) {
+    memset(chunk, 0, sizeof(*chunk));
+
+    size_t bytes = width * height * channels;
+    chunk->pixel_data = malloc(bytes);
+    if (chunk->pixel_data == NULL)
+        return -1;
+
+    memcpy(chunk->pixel_data, pixels, bytes);
+    chunk->data_size_bytes = bytes;
+    chunk->width = width;
+    chunk->height = height;
+    chunk->channels = channels;
+    chunk->row_stride = width * channels;
+    chunk->original_image_width = (int)width;
+    chunk->original_image_height = (int)height;
+    return 0;
+}
+
+static int max_difference(const image_chunk_t *a, const image_chunk_t *b) {
+    if (a->width != b->width || a->height != b->height)
+        return 256;
+
+    int worst = 0;
+    for (size_t y = 0; y < a->height; y++) {
+        const unsigned char *p = a->pixel_data + y * a->row_stride;
+        const unsigned char *q = b->pixel_data + y * b->row_stride;
+        for (size_t i = 0; i < a->width * a->channels; i++) {
+            int d = abs((int)p[i] - (int)q[i]);
+            if (d > worst)
+                worst = d;
+        }
+    }
+    return worst;
+}
+
+int main(int argc, char *argv[]) {
+    size_t width = (argc > 1)? strtoull(argv[1], NULL, 10): 1920;
+    size_t height = (argc > 2)? strtoull(argv[2], NULL, 10): 1080;
+    int repetitions = (argc > 3)? atoi(argv[3]): 5;
+    const double percents[] = { 25.0, 50.0, 75.0, 150.0 };
+    const size_t num_percents = sizeof(percents) / sizeof(percents[0]);
+    const int channel_counts[] = { 1, 3, 4 };
+
+    if (width == 0 || height == 0 || repetitions <= 0) {
+        fprintf(stderr, "Usage: %s [width] [height] [repetitions]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    size_t bytes = width * height * 4;
+    unsigned char *original = malloc(bytes);
+
+    if (original == NULL) {
+        perror("resize_bench: Failed to allocate the image");
+        return EXIT_FAILURE;
+    }
+
+    srand(42);
+    for (size_t i = 0; i < bytes; i++)
+        original[i] = (unsigned char)rand();
+
+    resize_kernels_t reference;
+    resize_kernels_get(RESIZE_ISA_SCALAR, &reference);
+    printf("dispatch selects: %s, %zux%zu source\n", resize_kernels()->name, width, height);
+    printf("%-8s %-9s %8s %8s %12s\n", "isa", "filter", "scale", "channels", "out Mpx/s");
+
+    int failures = 0;
+
+    for (int isa = RESIZE_ISA_SCALAR; isa < RESIZE_ISA_COUNT; isa++) {
+        resize_kernels_t kernels;
+        if (resize_kernels_get((resize_isa_t)isa, &kernels) != 0) {
+            printf("%-8s %-9s %8s %8s %12s\n", isa_names[isa], "-", "-", "-", "unsupported");
+            continue;
+        }
+
+        for (int f = RESIZE_BOX; f <= RESIZE_LANCZOS; f++) {
+            for (size_t p = 0; p < num_percents; p++) {
+                resize_spec_t spec = { .filter = (resize_filter_t)f, .percent = percents[p] };
+                resize_t resize;
+                if (resize_init(&resize, &spec) != 0) {
+                    fprintf(stderr, "resize_bench: Failed to prepare %g%%\n", percents[p]);
+                    return EXIT_FAILURE;
+                }
+
+                for (size_t c = 0; c < sizeof(channel_counts) / sizeof(channel_counts[0]); c++) {
+                    int channels = channel_counts[c];
+                    image_chunk_t expected, actual;
+
+                    if (make_image(original, width, height, channels, &expected) != 0 ||
+                        make_image(original, width, height, channels, &actual) != 0) {
+                        perror("resize_bench: Failed to allocate a copy");
+                        return EXIT_FAILURE;
+                    }
+
+                    resize_apply(&resize, &reference, &expected);
+                    resize_apply(&resize, &kernels, &actual);
+
+                    int difference = max_difference(&expected, &actual);
+                    if (difference > 1) {
+                        fprintf(stderr, "MISMATCH: %s kernels, %s %g%%, %d channels, off by %d\n",
+                                kernels.name, resize_filter_name(spec.filter), percents[p], channels, difference);
+                        failures++;
+                    }
+
+                    size_t out_pixels = actual.width * actual.height;
+                    free(expected.pixel_data);
+                    free(actual.pixel_data);
+
+                    double elapsed = 0.0;
+                    for (int r = 0; r < repetitions; r++) {
+                        if (make_image(original, width, height, channels, &actual) != 0) {
+                            perror("resize_bench: Failed to allocate a copy");
+                            return EXIT_FAILURE;
+                        }
+
+                        // Only the resize itself is timed, not the copy of the source
+                        double begin = now_seconds();
+                        resize_apply(&resize, &kernels, &actual);
+                        elapsed += now_seconds() - begin;
+                        free(actual.pixel_data);
+                    }
+
+                    printf("%-8s %-9s %7g%% %8d %12.1f\n", kernels.name, resize_filter_name(spec.filter), percents[p],
+                           channels, (double)out_pixels * repetitions / elapsed / 1e6);
+                }
+
+                resize_destroy(&resize);
+            }
+        }
+    }
+
+    free(original);
+    return (failures == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -4,13 +4,21 @@
 #include<dirent.h>
 #include<errno.h>
 #include<stdio.h>
+#include<string.h>
+#include<getopt.h>
 
 #include<image.h>
 #include<image_queue.h>
 #include<file_tracker.h>
+#include<content_dedup.h>
 #include<image_chunker.h>
 #include<directory_monitor.h>
 #include<chunk_threader.h>
+#include<reconstruction_threader.h>
+#include<greyscale.h>
+#include<filter_chain.h>
+#include<planar.h>
+#include<log.h>
 
 image_name_queue_t name_queue;
 chunk_queue_t chunker_filtering_queue;
@@ -20,15 +28,391 @@ volatile sig_atomic_t stop_flag = 0;
 
 void ExitHandler(int signum) {
     stop_flag = 1;
+    directory_monitor_wake();
     const char msg[] = "\nSignal received, initiating shutdown...\n";
     write(STDOUT_FILENO, msg, sizeof(msg) - 1);
 }
 
-int main(void) {
-    const char *directoryPath = "../images";
+static void print_usage(const char *program) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -f, --filter-threads N   Number of filter worker threads (default: number of cores)\n"
+        "  -r, --reconstruction-threads N  Number of reconstruction worker threads (default: 2)\n"
+        "  -i, --input DIR          Directory watched for images; repeat for several roots (default: ../images)\n"
+        "  -R, --recursive          Also watch the subdirectories of every root; outputs mirror the tree\n"
+        "  -o, --output-dir DIR     Where reconstructed images are written (default: ../output)\n"
+        "  -q, --queue-capacity N   Max chunks buffered between chunker and filters, 0 = unbounded (default: 4096)\n"
+        "  -Q, --queue-memory MB    Max pixel MiB buffered between chunker and filters, 0 = unbounded (default: 256)\n"
+        "  -m, --memory-cap MB      Max pixel MiB held by chunks across the pipeline, 0 = unbounded (default: 1024)\n"
+        "  -b, --queue-backend B    Chunk queue implementation: 'list' (mutex) or 'ring' (lock-free) (default: list)\n"
+        "  -s, --scheduler S        Filter scheduling: 'queue' (shared queue) or 'steal' (work stealing) (default: queue)\n"
+        "  -F, --fuse N             Chunker threads filter their own tiles, leaving at most N per thread\n"
+        "                           for idle filter workers to steal (implies --scheduler steal)\n"
+        "  -t, --tiling T           Chunk shape: 'tiles' (square) or 'strips' (full-width bands) (default: tiles)\n"
+        "  -c, --chunk-size N       Tile edge or strip height in pixels, 0 = default (128 / ~64 KiB strips)\n"
+        "  -p, --filters CHAIN      Comma-separated filters applied in order (default: greyscale):\n"
+        "                           greyscale, posterize:LEVELS, brightness:B[:CONTRAST], gamma:G,\n"
+        "                           curve:IN=OUT/IN=OUT[/...], blur:LINE_SIZE, gaussian:SIGMA[:fir|iir],\n"
+        "                           median:RADIUS, conv:PRESET, conv:WxH:W0/W1/...[:SCALE[:BIAS]],\n"
+        "                           resize:WxH[:FILTER], resize:PERCENT%%[:FILTER] (last filter only)\n"
+        "                           (presets: sharpen, emboss, edge, laplacian, sobel-x, sobel-y, box3, box5;\n"
+        "                           resize filters: box, bilinear, lanczos; W or H 0 keeps the aspect ratio)\n"
+        "  -z, --zero-copy          Chunks are views into the shared decoded image instead of tile copies\n"
+        "  -L, --layout L           Pixel layout filters work on: 'interleaved' (RGBRGB...) or 'planar'\n"
+        "                           (one aligned plane per channel) (default: interleaved)\n"
+        "  -S, --samples T          Sample type images are decoded to and filtered in: 'u8', 'u16' or 'f32'\n"
+        "                           (16-bit PNGs keep their precision, HDR files decode to floats) (default: u8)\n"
+        "  -O, --output-depth N     Bits per sample of the images written from u16/f32 samples: 8 or 16 (default: 16)\n"
+        "  -w, --settle MS          Files found by a directory scan (not reported by inotify) are ingested once\n"
+        "                           unmodified for MS milliseconds (default: 1000)\n"
+        "  -j, --journal FILE       Record of the files already processed, kept across restarts; '' keeps it in\n"
+        "                           memory only (default: .processed_files in the first output directory)\n"
+        "  -D, --no-dedup           Process every input, even one whose bytes match an earlier input's (by default\n"
+        "                           its output is hard-linked to the earlier output)\n"
+        "  -l, --log-level L        trace, debug, info, warn, error or off (default: info)\n"
+        "  -h, --help               Show this message\n"
+        "-o and -p given after an -i apply to that root only; before the first -i they set the default for all.\n",
+        program);
+}
+
+// One watched root and where its images go: an -i with the -o and -p that follow it
+typedef struct {
+    const char *input_dir;
+    const char *output_dir;     // NULL: the default
+    const char *filter_spec;    // NULL: the default
+    filter_chain_t chain;
+    filter_plan_t plan;
+} route_options_t;
+
+static int parse_count(const char *arg, size_t *out, bool allow_zero) {
+    char *end = NULL;
+    errno = 0;
+    long long value = strtoll(arg, &end, 10);
+
+    if (errno != 0 || end == arg || *end != '\0' || value < 0 || (value == 0 && !allow_zero))
+        return -1;
+
+    *out = (size_t)value;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *output_dir = "../output";
+    route_options_t *routes = calloc(IMAGE_MAX_ROUTES, sizeof(route_options_t));
+    size_t num_routes = 0;
+    bool recursive = false;
+
+    if (routes == NULL) {
+        perror("Failed to allocate memory for the input roots");
+        return EXIT_FAILURE;
+    }
 
     long cores = sysconf(_SC_NPROCESSORS_ONLN);
     const size_t num_chunker_threads = (cores > 1)? (size_t)cores: 2; 
+    size_t num_filter_threads = (cores > 1)? (size_t)cores: 2;
+    size_t num_reconstruction_threads = 2;
+    size_t queue_capacity = 4096;
+    size_t queue_memory_mb = 256;
+    size_t memory_cap_mb = 1024;
+    chunk_queue_backend_t queue_backend = CHUNK_QUEUE_LIST;
+    filter_scheduler_t scheduler = FILTER_SCHEDULER_QUEUE;
+    bool fuse = false;
+    size_t fuse_threshold = 0;
+    bool zero_copy = false;
+    bool dedup = true;
+    chunk_tiling_t tiling = CHUNK_TILING_TILES;
+    image_layout_t layout = IMAGE_LAYOUT_INTERLEAVED;
+    image_sample_t sample = IMAGE_SAMPLE_U8;
+    size_t output_depth = 16;
+    size_t chunk_size = 0;
+    size_t settle_ms = MONITOR_DEFAULT_SETTLE_MS;
+    const char *journal_path = NULL;
+    int log_level = LOG_LEVEL_INFO;
+    const char *filter_spec = "greyscale";
+
+    static const struct option long_options[] = {
+        { "filter-threads", required_argument, NULL, 'f' },
+        { "reconstruction-threads", required_argument, NULL, 'r' },
+        { "input",          required_argument, NULL, 'i' },
+        { "recursive",      no_argument,       NULL, 'R' },
+        { "output-dir",     required_argument, NULL, 'o' },
+        { "queue-capacity", required_argument, NULL, 'q' },
+        { "queue-memory",   required_argument, NULL, 'Q' },
+        { "memory-cap",     required_argument, NULL, 'm' },
+        { "queue-backend",  required_argument, NULL, 'b' },
+        { "scheduler",      required_argument, NULL, 's' },
+        { "fuse",           required_argument, NULL, 'F' },
+        { "filters",        required_argument, NULL, 'p' },
+        { "zero-copy",      no_argument,       NULL, 'z' },
+        { "layout",         required_argument, NULL, 'L' },
+        { "samples",        required_argument, NULL, 'S' },
+        { "output-depth",   required_argument, NULL, 'O' },
+        { "tiling",         required_argument, NULL, 't' },
+        { "chunk-size",     required_argument, NULL, 'c' },
+        { "settle",         required_argument, NULL, 'w' },
+        { "journal",        required_argument, NULL, 'j' },
+        { "no-dedup",       no_argument,       NULL, 'D' },
+        { "log-level",      required_argument, NULL, 'l' },
+        { "help",           no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "f:r:i:Ro:q:Q:m:b:s:F:zL:S:O:t:c:p:w:j:Dl:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'f':
+                if (parse_count(optarg, &num_filter_threads, false) != 0) {
+                    fprintf(stderr, "Invalid filter thread count: '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'r':
+                if (parse_count(optarg, &num_reconstruction_threads, false) != 0) {
+                    fprintf(stderr, "Invalid reconstruction thread count: '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'i': {
+                if (num_routes == IMAGE_MAX_ROUTES) {
+                    fprintf(stderr, "At most %d input directories\n", IMAGE_MAX_ROUTES);
+                    return EXIT_FAILURE;
+                }
+
+                // Paths are compared by prefix downstream: no trailing slash
+                size_t length = strlen(optarg);
+                while (length > 1 && optarg[length - 1] == '/')
+                    optarg[--length] = '\0';
+
+                routes[num_routes++].input_dir = optarg;
+                break;
+            }
+            case 'R':
+                recursive = true;
+                break;
+            case 'o':
+                if (num_routes > 0)
+                    routes[num_routes - 1].output_dir = optarg;
+                else
+                    output_dir = optarg;
+                break;
+            case 'q':
+                if (parse_count(optarg, &queue_capacity, true) != 0) {
+                    fprintf(stderr, "Invalid queue capacity: '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'Q':
+                if (parse_count(optarg, &queue_memory_mb, true) != 0) {
+                    fprintf(stderr, "Invalid queue memory limit: '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'm':
+                if (parse_count(optarg, &memory_cap_mb, true) != 0) {
+                    fprintf(stderr, "Invalid memory cap: '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'b':
+                if (strcmp(optarg, "list") == 0)
+                    queue_backend = CHUNK_QUEUE_LIST;
+                else if (strcmp(optarg, "ring") == 0)
+                    queue_backend = CHUNK_QUEUE_RING;
+                else {
+                    fprintf(stderr, "Unknown queue backend: '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 's':
+                if (strcmp(optarg, "queue") == 0)
+                    scheduler = FILTER_SCHEDULER_QUEUE;
+                else if (strcmp(optarg, "steal") == 0)
+                    scheduler = FILTER_SCHEDULER_STEAL;
+                else {
+                    fprintf(stderr, "Unknown scheduler: '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'F':
+                if (parse_count(optarg, &fuse_threshold, true) != 0) {
+                    fprintf(stderr, "Invalid fusion threshold: '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                fuse = true;
+                break;
+            case 't':
+                if (strcmp(optarg, "tiles") == 0)
+                    tiling = CHUNK_TILING_TILES;
+                else if (strcmp(optarg, "strips") == 0)
+                    tiling = CHUNK_TILING_STRIPS;
+                else {
+                    fprintf(stderr, "Unknown tiling: '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'c':
+                if (parse_count(optarg, &chunk_size, true) != 0 || chunk_size > 65536) {
+                    fprintf(stderr, "Invalid chunk size: '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'p':
+                if (num_routes > 0)
+                    routes[num_routes - 1].filter_spec = optarg;
+                else
+                    filter_spec = optarg;
+                break;
+            case 'z':
+                zero_copy = true;
+                break;
+            case 'L':
+                if (strcmp(optarg, "interleaved") == 0)
+                    layout = IMAGE_LAYOUT_INTERLEAVED;
+                else if (strcmp(optarg, "planar") == 0)
+                    layout = IMAGE_LAYOUT_PLANAR;
+                else {
+                    fprintf(stderr, "Unknown layout: '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'S':
+                if (strcmp(optarg, "u8") == 0)
+                    sample = IMAGE_SAMPLE_U8;
+                else if (strcmp(optarg, "u16") == 0)
+                    sample = IMAGE_SAMPLE_U16;
+                else if (strcmp(optarg, "f32") == 0)
+                    sample = IMAGE_SAMPLE_F32;
+                else {
+                    fprintf(stderr, "Unknown sample type: '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'O':
+                if (parse_count(optarg, &output_depth, false) != 0 || (output_depth != 8 && output_depth != 16)) {
+                    fprintf(stderr, "Invalid output depth: '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'w':
+                if (parse_count(optarg, &settle_ms, true) != 0 || settle_ms > 3600000) {
+                    fprintf(stderr, "Invalid settle time: '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'j':
+                journal_path = optarg;
+                break;
+            case 'D':
+                dedup = false;
+                break;
+            case 'l':
+                log_level = log_level_from_string(optarg);
+                if (log_level < 0) {
+                    fprintf(stderr, "Unknown log level: '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    // Before anything is logged: the level and the timestamps' origin are set here
+    if (log_init(log_level) != 0)
+        fprintf(stderr, "Falling back to synchronous logging.\n");
+
+    // Fusion runs on the chunkers' work-stealing deques
+    if (fuse)
+        scheduler = FILTER_SCHEDULER_STEAL;
+
+    // Without -i, a single root with the defaults
+    if (num_routes == 0)
+        routes[num_routes++].input_dir = "../images";
+
+    // Compile every root's filter chain once; the filter threads share the plans
+    bool any_halo = false;
+
+    for (size_t r = 0; r < num_routes; r++) {
+        route_options_t *route = &routes[r];
+        const char *spec = (route->filter_spec != NULL)? route->filter_spec: filter_spec;
+
+        if (route->output_dir == NULL)
+            route->output_dir = output_dir;
+
+        if (filter_chain_parse(spec, &route->chain) != 0) {
+            fprintf(stderr, "Invalid filter chain: '%s'\n", spec);
+            log_shutdown();
+            return EXIT_FAILURE;
+        }
+
+        if (filter_plan_build(&route->chain, sample, &route->plan) != 0) {
+            fprintf(stderr, "Failed to build the filter plan.\n");
+            log_shutdown();
+            return EXIT_FAILURE;
+        }
+
+        char plan_description[256];
+        filter_plan_describe(&route->plan, plan_description, sizeof(plan_description));
+        LOG_INFO("%s -> %s, filter chain: %s (%zu filters, %zu passes, halo %zux%zu): %s", route->input_dir,
+                 route->output_dir, spec, route->plan.num_filters, route->plan.num_stages, route->plan.halo_x,
+                 route->plan.halo_y, plan_description);
+
+        filter_pool_set_plan((int)r, &route->plan);
+
+        // Neighbourhood filters need the pixels around every tile; a resize reaches further the more it shrinks
+        chunker_set_halo((int)r, route->plan.halo_x, route->plan.halo_y);
+        if (route->plan.resizes)
+            chunker_set_halo_fn((int)r, filter_plan_halo, &route->plan);
+
+        if (route->plan.halo_x > 0 || route->plan.halo_y > 0)
+            any_halo = true;
+
+        // The same bytes through the same chain give the same output
+        if (dedup) {
+            char signature[512];
+            snprintf(signature, sizeof(signature), "%s|%s|%d|%zu", spec, plan_description, (int)sample, output_depth);
+            dedup_set_signature((int)r, signature);
+        }
+    }
+
+    // Pick the filter kernels for this CPU once, before any worker needs them
+    LOG_INFO("Greyscale kernels: %s, LUT kernel: %s, Gaussian kernels: %s, convolution kernels: %s, resize kernels: %s",
+             greyscale_kernels()->name, lut_kernel_name(), gaussian_kernels()->name, convolution_kernels()->name,
+             resize_kernels()->name);
+
+    if (zero_copy && any_halo) {
+        LOG_WARN("Zero-copy views cannot carry a halo for the filter chain; copying tiles instead");
+        zero_copy = false;
+    }
+
+    // Planes are split out of the decoded image, so planar chunks are always copies
+    if (zero_copy && layout == IMAGE_LAYOUT_PLANAR) {
+        LOG_WARN("Zero-copy views cannot be planar; copying tiles instead");
+        zero_copy = false;
+    }
+
+    // The planar kernels move bytes
+    if (layout == IMAGE_LAYOUT_PLANAR && sample != IMAGE_SAMPLE_U8) {
+        LOG_WARN("Planar chunks hold 8-bit samples only; using interleaved chunks");
+        layout = IMAGE_LAYOUT_INTERLEAVED;
+    }
+
+    if (sample != IMAGE_SAMPLE_U8)
+        LOG_INFO("%s samples, written as %zu-bit images", (sample == IMAGE_SAMPLE_U16)? "16-bit": "Float", output_depth);
+
+    if (layout == IMAGE_LAYOUT_PLANAR)
+        LOG_INFO("Planar chunks, split/merge kernels: %s", planar_kernel_name());
+
+    chunker_set_sample_type(sample);
+    reconstruction_set_output_bits((int)output_depth);
+    chunker_set_layout(layout);
+    chunker_set_zero_copy(zero_copy);
+    chunker_set_tiling(tiling, (int)chunk_size);
+    directory_monitor_set_settle((long)settle_ms);
 
     pthread_t watcher_thread;
     pthread_t *chunker_threads = NULL;
@@ -49,33 +433,63 @@ int main(void) {
         return EXIT_FAILURE;
     }
 
-    DIR *dir_check = opendir(directoryPath);
-    if (dir_check == NULL) {
-        char err_msg[512];
-        snprintf(err_msg, sizeof(err_msg), "Target directory '%s' does not exist or cannot be opened", directoryPath);
-        perror(err_msg);
-        fprintf(stderr, "Please ensure the '../images' directory exists relative to the build directory.\n");
-        return EXIT_FAILURE;
-    }
+    for (size_t r = 0; r < num_routes; r++) {
+        DIR *dir_check = opendir(routes[r].input_dir);
+        if (dir_check == NULL) {
+            char err_msg[512];
+            snprintf(err_msg, sizeof(err_msg), "Target directory '%s' does not exist or cannot be opened",
+                     routes[r].input_dir);
+            perror(err_msg);
+            fprintf(stderr, "Please ensure the '../images' directory exists relative to the build directory.\n");
+            return EXIT_FAILURE;
+        }
 
-    closedir(dir_check);
+        closedir(dir_check);
+    }
 
     if (image_name_queue_init(&name_queue) != 0) {
         fprintf(stderr, "Failed to initialize name queue.\n");
         return EXIT_FAILURE;
     }
 
-    if (chunk_queue_init(&chunker_filtering_queue) != 0) {
+    if (chunk_memory_budget_init(memory_cap_mb << 20) != 0) {
+        fprintf(stderr, "Failed to initialize the chunk memory budget.\n");
+        image_name_queue_destroy(&name_queue);
+        return EXIT_FAILURE;
+    }
+
+    // The ring is always bounded; an unbounded request falls back to its default size
+    size_t ring_capacity = (queue_capacity > 0)? queue_capacity: 4096;
+
+    int queue_status = (queue_backend == CHUNK_QUEUE_RING)
+        ? chunk_queue_init_ring(&chunker_filtering_queue, ring_capacity)
+        : chunk_queue_init_bounded(&chunker_filtering_queue, queue_capacity, queue_memory_mb << 20);
+
+    if (queue_status != 0) {
         fprintf(stderr, "Failed to initialize chunker->filtering queue.\n");
         image_name_queue_destroy(&name_queue); // Cleanup previous init
         return EXIT_FAILURE;
     }
 
+    queue_status = (queue_backend == CHUNK_QUEUE_RING)
+        ? chunk_queue_init_ring(&filtering_reconstruction_queue, ring_capacity)
+        : chunk_queue_init(&filtering_reconstruction_queue);
+
+    if (queue_status != 0) {
+        fprintf(stderr, "Failed to initialize filtering->reconstruction queue.\n");
+        image_name_queue_destroy(&name_queue);
+        chunk_queue_destroy(&chunker_filtering_queue);
+        return EXIT_FAILURE;
+    }
+
     if (discarded_images_init()) {
         fprintf(stderr, "Failed to initialize discarded images table.\n");
         return EXIT_FAILURE;
     }
 
+    if (directory_monitor_init() != 0)
+        fprintf(stderr, "The directory watcher will check for shutdown once a second.\n");
+
     chunker_threads = malloc(num_chunker_threads * sizeof(pthread_t));
     if (chunker_threads == NULL) {
         perror("Failed to allocate memory for chunker thread IDs");
@@ -84,8 +498,61 @@ int main(void) {
         return EXIT_FAILURE;
     }
     
-    printf("Starting image watcher thread for directory: %s\n", directoryPath);
-    if (pthread_create(&watcher_thread, NULL, read_images_from_directory, (void *)directoryPath) != 0) { // Removed watcher_attr
+    // Stages start back to front so every producer finds its consumer running
+    for (size_t r = 0; r < num_routes; r++) {
+        if (reconstruction_set_route((int)r, routes[r].input_dir, routes[r].output_dir) != 0) {
+            fprintf(stderr, "Failed to prepare the output directory '%s'.\n", routes[r].output_dir);
+            stop_flag = 1;
+        }
+    }
+
+    // The tracker's journal lives next to the outputs it vouches for, unless told otherwise
+    char default_journal[1024];
+    if (journal_path == NULL) {
+        snprintf(default_journal, sizeof(default_journal), "%s/.processed_files", routes[0].output_dir);
+        journal_path = default_journal;
+    }
+
+    int journal_status = file_tracker_open((journal_path[0] != '\0')? journal_path: NULL);
+    if (journal_status == TRACKER_JOURNAL_IN_USE) {
+        // Two runs on one journal would both claim and write the same images
+        fprintf(stderr, "Another instance is running with the journal '%s'; stop it or pass another --journal.\n", journal_path);
+        free(chunker_threads);
+        directory_monitor_destroy();
+        free_processed_files();
+        image_name_queue_destroy(&name_queue);
+        chunk_queue_destroy(&chunker_filtering_queue);
+        chunk_queue_destroy(&filtering_reconstruction_queue);
+        free_discarded_images_table();
+        log_shutdown();
+        return EXIT_FAILURE;
+    }
+    if (journal_status != 0)
+        fprintf(stderr, "Continuing without a journal: every image will be processed again at the next start.\n");
+
+    printf("Starting %zu reconstruction threads...\n", num_reconstruction_threads);
+    if (!stop_flag && reconstruction_start(num_reconstruction_threads) != 0) {
+        fprintf(stderr, "Failed to start the reconstruction stage.\n");
+        stop_flag = 1;
+    }
+
+    // The filter stage goes before the chunkers: they register their deques with it as they start
+    printf("Starting %zu filter worker threads...\n", num_filter_threads);
+    if (filter_pool_start(num_filter_threads, num_chunker_threads, scheduler) != 0) {
+        fprintf(stderr, "Failed to start the filter worker pool.\n");
+        stop_flag = 1;
+    } else if (fuse) {
+        filter_pool_enable_fusion(fuse_threshold);
+        printf("Chunker threads filter their own tiles (backlog threshold: %zu).\n", fuse_threshold);
+    }
+
+    for (size_t r = 0; r < num_routes; r++) {
+        directory_monitor_add_root(routes[r].input_dir, (int)r, recursive);
+        printf("Starting image watcher thread for directory: %s%s\n", routes[r].input_dir,
+               recursive? " (recursive)": "");
+    }
+
+    if (pthread_create(&watcher_thread, NULL, read_images_from_directory, NULL) != 0) { // Removed watcher_attr
         perror("Failed to create watcher thread");
         return EXIT_FAILURE;
     }
@@ -96,14 +563,18 @@ int main(void) {
             perror("Failed to create a chunker thread");
 
             stop_flag = 1; 
+            directory_monitor_wake();
 
             pthread_mutex_lock(&name_queue.lock); 
             pthread_cond_broadcast(&name_queue.cond_not_empty);
             pthread_mutex_unlock(&name_queue.lock); 
 
-            pthread_mutex_lock(&chunker_filtering_queue.lock); 
-            pthread_cond_broadcast(&chunker_filtering_queue.cond_not_empty);
-            pthread_mutex_unlock(&chunker_filtering_queue.lock); 
+            chunk_queue_wake_all(&chunker_filtering_queue);
+            chunk_memory_wake_all();
+            filter_pool_stop();
+            filter_pool_destroy();
+            reconstruction_stop();
+            reconstruction_destroy();
 
             for (size_t j = 0; j < i; ++j) {
                 pthread_join(chunker_threads[j], NULL);
@@ -116,14 +587,13 @@ int main(void) {
         }
     }
     
-    assign_threads_to_chunk();
-
     printf("Watcher thread started. Waiting for signal (SIGINT/SIGTERM)...\n");
     while (!stop_flag) 
         sleep(1);
 
     printf("\nShutdown signal received.\n");
     printf("Attempting to cancel watcher & chunker thread (if possible)...\n");
+    directory_monitor_wake();
     pthread_join(watcher_thread, NULL); 
 
     printf("Broadcasting to chunker threads...\n");
@@ -131,9 +601,8 @@ int main(void) {
     pthread_cond_broadcast(&name_queue.cond_not_empty);
     pthread_mutex_unlock(&name_queue.lock); 
 
-    pthread_mutex_lock(&chunker_filtering_queue.lock); 
-    pthread_cond_broadcast(&chunker_filtering_queue.cond_not_empty);
-    pthread_mutex_unlock(&chunker_filtering_queue.lock); 
+    chunk_queue_wake_all(&chunker_filtering_queue);
+    chunk_memory_wake_all();
 
     printf("Waiting for chunker threads to finish...\n");
     for (size_t i = 0; i < num_chunker_threads; ++i) {
@@ -142,15 +611,36 @@ int main(void) {
     }
 
     printf("All chunker threads finished.\n");
+    directory_monitor_destroy();
+
+    printf("Waiting for filter workers to drain the queue...\n");
+    filter_pool_stop();
+    filter_pool_report();
+    filter_pool_destroy();
+
+    printf("Waiting for reconstruction threads to write the remaining images...\n");
+    reconstruction_stop();
+    reconstruction_report();
+    reconstruction_destroy();
+    dedup_report();
+    dedup_destroy();
 
     printf("Cleaning up resources...\n");
 
+    free(chunker_threads);
     free_processed_files(); 
     image_name_queue_destroy(&name_queue);
     chunk_queue_destroy(&chunker_filtering_queue);
+    chunk_queue_destroy(&filtering_reconstruction_queue);
+    chunk_memory_budget_destroy();
     free_discarded_images_table();
+    for (size_t r = 0; r < num_routes; r++)
+        filter_plan_destroy(&routes[r].plan);
+    free(routes);
 
     printf("Cleanup complete. Exiting.\n");
 
+    log_shutdown();
+
     return 0; 
 }
\ No newline at end of file
@@ -0,0 +1,64 @@
+#pragma once
+
+#include<stdbool.h>
+#include<stddef.h>
+
+/*
+    Content deduplication: an input whose bytes (CityHash128) and filter chain match an image already written
+    gets a hard link to that output instead of being decoded, filtered and encoded again. The table is
+    shared by the chunker threads (lookups at ingest) and the reconstruction workers (completed outputs);
+    it is bounded to DEDUP_MAX_ENTRIES contents, the oldest forgotten first, and lives for one run.
+*/
+
+/** @brief Most contents remembered at once. */
+#define DEDUP_MAX_ENTRIES 65536
+
+/**
+ * @brief Enables deduplication for a route. Inputs are only matched with
+ *        earlier ones of the same signature. Call before the chunkers start.
+ *
+ * @param signature Text that changes whenever the output of the same input
+ *        would (the filter chain, sample type, output depth...); copied.
+ */
+void dedup_set_signature(int route, const char *signature);
+
+/**
+ * @brief Looks up an input file's bytes at ingest. If an earlier input of the
+ *        same content and signature was written and its output is unchanged,
+ *        links (or, across file systems, copies) that output to this input's
+ *        output path and marks the input processed
+ *        (directory_monitor_commit()). If that earlier input is still in the
+ *        pipeline, this one waits for its output. Otherwise claims the content
+ *        for this input, so its output can serve the next duplicate.
+ *        Thread-safe.
+ *
+ * @param filename The input's path, as queued.
+ * @param data, size The whole file.
+ * @return true if the input needs no processing: its output is in place, or
+ *         will be once the earlier input's is.
+ */
+bool dedup_reuse(const char *filename, int route, const void *data, size_t size);
+
+/**
+ * @brief Records the output written for an input that claimed its content,
+ *        and gives it to the inputs waiting for it. Called by the
+ *        reconstruction workers. Thread-safe.
+ */
+void dedup_complete(const char *filename, const char *output_path);
+
+/**
+ * @brief Releases the content claimed by an input that failed. Inputs waiting
+ *        for its output are queued again. Thread-safe; a no-op for an input
+ *        that holds no claim.
+ */
+void dedup_abandon(const char *filename);
+
+/**
+ * @brief Prints how many inputs were hashed and how many reused an output.
+ */
+void dedup_report(void);
+
+/**
+ * @brief Frees the table. Call after the chunker and reconstruction threads are joined.
+ */
+void dedup_destroy(void);
@@ -1,11 +1,121 @@
 #pragma once
 
+#include<stdbool.h>
+#include<sys/stat.h>
+
+/** @brief Default time a scanned file must go unmodified before it is ingested, in milliseconds. */
+#define MONITOR_DEFAULT_SETTLE_MS 1000
+
+/**
+ * @brief Sets how long a file found by a directory scan must keep its size and
+ *        mtime before it is queued (files reported by inotify are queued at
+ *        once). A negative value restores the default.
+ */
+void directory_monitor_set_settle(long ms);
+
+/**
+ * @brief Adds a directory to watch. Its images are queued with `route`, which
+ *        selects their filter chain and output directory downstream. Must be
+ *        called before starting the monitor thread.
+ *
+ * @param path Directory, without a trailing slash; must outlive the monitor.
+ *        Roots must not overlap (one inside a recursive other).
+ * @param recursive Also watch every subdirectory, present and future (hidden
+ *        ones excepted).
+ * @return 0 on success, -1 if IMAGE_MAX_ROUTES roots were added already.
+ */
+int directory_monitor_add_root(const char *path, int route, bool recursive);
+
+/**
+ * @brief Prepares the monitor's shutdown wake-up (an eventfd). Call before
+ *        starting the monitor thread.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int directory_monitor_init(void);
+
+/**
+ * @brief Wakes the monitor thread so it notices stop_flag. Async-signal-safe:
+ *        the SIGINT/SIGTERM handler calls it after raising the flag.
+ */
+void directory_monitor_wake(void);
+
 /**
- * @brief Thread function to continuously scan a directory for new image files
- *        (.jpg, .png) and process them if they haven't been processed before.
- *        Uses functions from image_table.h to track processed files.
+ * @brief Releases what directory_monitor_init() set up. Call after the monitor
+ *        thread and the chunker threads have been joined.
+ */
+void directory_monitor_destroy(void);
+
+/**
+ * @brief Reports an image that failed to load, possibly because it was still
+ *        being written. Thread-safe. Like every function that hands a file
+ *        back, it ends the file's claim (see file_tracker.h) from the monitor
+ *        thread.
+ *
+ *        If the file was modified recently, the monitor queues it again once
+ *        it has changed and settled; a file left unchanged for a minute is
+ *        given up on. Old files are taken as corrupt right away. Every file
+ *        given up on is logged.
+ *
+ * @param path The path that was queued.
+ * @param route The route it was queued with.
+ */
+void directory_monitor_retry(const char *path, int route);
+
+/**
+ * @brief Hands back an image that looks cut short while it is still changing
+ *        (see directory_monitor_settled()). The monitor queues it again once
+ *        its size and mtime have stopped changing for the settle time.
+ *        Thread-safe.
+ */
+void directory_monitor_defer(const char *path, int route);
+
+/**
+ * @brief Hands back an image that will not be processed (its output could
+ *        not be written, or shutdown interrupted it). Its claim is released,
+ *        and it is only queued again if it changed while in the pipeline, or
+ *        when it changes later. Thread-safe.
+ */
+void directory_monitor_discard(const char *path, int route);
+
+/**
+ * @brief Marks an image processed once its output is written
+ *        (file_tracker_commit()). If it changed while in the pipeline, the new
+ *        version is queued once it settles. Thread-safe.
+ */
+void directory_monitor_commit(const char *path, int route);
+
+/**
+ * @brief Tells whether a file has gone unmodified for the settle time, so its
+ *        content is taken as final. Thread-safe.
+ *
+ * @param st The file's stat, taken after its content was read.
+ */
+bool directory_monitor_settled(const struct stat *st);
+
+/**
+ * @brief Thread function that feeds new image files (.jpg, .jpeg, .png) of the
+ *        roots to the shared name queue, skipping files already processed (see
+ *        file_tracker.h).
+ *
+ *        The roots are scanned in full once at startup. After that, inotify
+ *        reports files as they are closed after writing or moved in, and the
+ *        thread sleeps in epoll until an event or directory_monitor_wake()
+ *        arrives. Under a recursive root, every subdirectory gets its own watch,
+ *        and new subdirectories are watched and scanned as they appear. A full
+ *        scan runs again only when the kernel's event queue overflowed or a root
+ *        had to be watched again; directories beyond the inotify watch limit are
+ *        rescanned every 5 seconds. Without inotify the thread falls back to
+ *        scanning every 5 seconds.
+ *
+ *        Files found by a scan may still be in the middle of a copy: those
+ *        modified within the settle time wait until their size and mtime stop
+ *        changing. Hidden names and names with any other extension (such as
+ *        "photo.jpg.part") are ignored, so writers can also write under a
+ *        temporary name and rename the file into place.
  *
- * @param arg A void pointer expected to hold the path (const char *) to the directory to scan.
- * @return void* Always returns NULL in the current implementation (infinite loop).
+ * @param arg Path (const char *) of a single, non-recursive directory watched
+ *        with route 0 if no root was added; otherwise unused.
+ * @return void* Always returns NULL, once stop_flag is raised.
  */
-void *read_images_from_directory(void *arg);
\ No newline at end of file
+void *read_images_from_directory(void *arg);
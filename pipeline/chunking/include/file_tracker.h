@@ -1,22 +1,116 @@
 #pragma once
 
-#include<uthash.h>
 #include<stdbool.h>
+#include<stddef.h>
+#include<sys/stat.h>
 
-typedef void (*char_process_function_ptr)(const char*);
-typedef void (*void_process_function_ptr)(void);
+/*
+    Record of the input files already handled, shared by the directory monitor (lookups and claims), the
+    reconstruction workers (completions) and, through the journal, the next run of the program.
 
-// Structure for the hash table entries
-typedef struct {
-    char name[256];
-    UT_hash_handle hh; 
-/*     char_process_function_ptr add_processed_file;
-    char_process_function_ptr was_file_processed;
-    void_process_function_ptr free_processed_files; */
-} processed_file_t;
+    A file is known by a 64-bit hash of its path plus its size and mtime. A file is claimed while it is in
+    the pipeline and never queued twice at once, since images are keyed by name downstream: a new version
+    seen meanwhile marks the claim dirty, and the caller that ends the claim (file_tracker_commit() or
+    file_tracker_release()) queues the file again. Every function is thread-safe: lookups take a read lock
+    and proceed in parallel, changes take the write lock.
+*/
 
-void add_processed_file(const char *filename);
-bool was_file_processed(const char *filename);
-void free_processed_files(void);
+/** @brief Journal records below which the journal is never compacted. */
+#define TRACKER_COMPACT_MIN_RECORDS 4096
+
+/** @brief Returned by file_tracker_open() when another process holds the journal. */
+#define TRACKER_JOURNAL_IN_USE (-2)
+
+/**
+ * @brief Loads the journal of a previous run, if any, and appends to it from then on.
+ *
+ *        The journal is a text file with one record per completed (+) or
+ *        forgotten (-) file. It is rewritten with only the live entries once
+ *        it holds twice as many records as there are entries (see
+ *        file_tracker_maintain()), and right away if the previous run left a
+ *        torn last record. An flock(), taken before the journal is read,
+ *        keeps two runs from sharing it.
+ *
+ *        Records are written without fsync: a crash of the program loses
+ *        nothing, a crash of the machine at most the last few seconds of
+ *        completions (those images are processed again).
+ *
+ * @param journal_path File to keep the journal in; NULL keeps the record in memory only.
+ * @return 0 on success, TRACKER_JOURNAL_IN_USE if another process holds the
+ *         journal (nothing is loaded), or -1 if it could not be read or opened
+ *         (the tracker then works in memory only).
+ */
+int file_tracker_open(const char *journal_path);
+
+/**
+ * @brief Tells whether a file still needs processing. Marks the entry as
+ *        present for the sweep in progress (see file_tracker_begin_sweep()).
+ *
+ * @param st The file's current stat.
+ * @return true if the file is claimed (a new size or mtime marks the claim
+ *         dirty), or was completed or failed with the same size and mtime.
+ */
+bool was_file_processed(const char *filename, const struct stat *st);
+
+/**
+ * @brief Claims a file about to be queued, replacing an older version's entry.
+ *        Claims stay in memory until file_tracker_commit() or
+ *        file_tracker_release().
+ *
+ * @return true if the file is claimed for the caller to queue; false if it
+ *         is claimed already (marked dirty if `st` is a new version).
+ */
+bool add_processed_file(const char *filename, const struct stat *st);
+
+/**
+ * @brief Records that a claimed file's output was written, in memory and in
+ *        the journal, with the size and mtime it was claimed with.
+ *
+ * @return true if the claim was dirty: the file changed (or was removed)
+ *         while in the pipeline and must be queued again.
+ */
+bool file_tracker_commit(const char *filename);
 
-extern processed_file_t *processed_files; 
\ No newline at end of file
+/**
+ * @brief Ends the claim of a file that could not be processed. The file is
+ *        not queued again until its size or mtime changes.
+ *
+ * @return true if the claim was dirty (see file_tracker_commit()).
+ */
+bool file_tracker_release(const char *filename);
+
+/**
+ * @brief Drops the entry of a file that was deleted or moved away. A claimed
+ *        entry is marked dirty instead, and dropped once its claim ends and
+ *        the file is found gone.
+ */
+void file_tracker_forget(const char *filename);
+
+/**
+ * @brief Starts a sweep: entries not looked up or claimed before
+ *        file_tracker_sweep() are taken as gone. Call before a full scan of
+ *        every input root.
+ */
+void file_tracker_begin_sweep(void);
+
+/**
+ * @brief Ends a sweep, evicting the entries of files the scan did not see.
+ *        Only call after a scan that covered every root completely.
+ *
+ * @return The number of entries evicted.
+ */
+size_t file_tracker_sweep(void);
+
+/**
+ * @brief Compacts the journal if it has grown past twice the live entries
+ *        (and TRACKER_COMPACT_MIN_RECORDS), or if a sweep evicted completed
+ *        files. Lookups proceed meanwhile. Called by the directory monitor
+ *        between events.
+ */
+void file_tracker_maintain(void);
+
+/**
+ * @brief Compacts and closes the journal, then frees every entry. Call after
+ *        the reconstruction stage has been stopped.
+ */
+void free_processed_files(void);
@@ -3,18 +3,100 @@
 #include<image.h> 
 
 /**
- * @brief Loads an image from a file. (Remains the same)
+ * @brief Decodes an image file already read into memory.
  *
  * Uses stb_image to load the image. The returned pixel data must be freed
  * using stbi_image_free().
  *
- * @param filename Path to the image file.
+ * Wide samples keep the full precision of 16-bit PNGs: 8-bit sources are
+ * widened (v * 257, or v / 255 as floats), and HDR files are decoded straight
+ * to linear floats for IMAGE_SAMPLE_F32.
+ *
+ * @param filename Path to the image file, for the log.
+ * @param file_data, file_size The whole file.
+ * @param sample Type of the returned samples.
  * @param width Pointer to store the image width.
  * @param height Pointer to store the image height.
  * @param channels Pointer to store the number of color channels.
  * @return unsigned char* Pointer to the loaded pixel data, or NULL on failure.
  */
-unsigned char *load_image(const char *filename, int *width, int *height, int *channels);
+unsigned char *load_image(const char *filename, const unsigned char *file_data, size_t file_size, image_sample_t sample,
+                          int *width, int *height, int *channels);
+
+/**
+ * @brief How the chunker splits an image.
+ */
+typedef enum {
+    CHUNK_TILING_TILES,     /**< Square tiles (default 128 x 128). */
+    CHUNK_TILING_STRIPS,    /**< Full-width horizontal bands: one contiguous copy per chunk. */
+} chunk_tiling_t;
+
+/** @brief Default tile edge in pixels for CHUNK_TILING_TILES. */
+#define CHUNK_DEFAULT_TILE_SIZE 128
+
+/** @brief Approximate bytes per strip when no strip height is given. */
+#define CHUNK_DEFAULT_STRIP_BYTES (64 * 1024)
+
+/**
+ * @brief Selects the tiling strategy. Must be called before the chunker threads are started.
+ *
+ * @param tiling Tiles or strips.
+ * @param size Tile edge (tiles) or strip height in rows (strips); 0 picks the
+ *        default: CHUNK_DEFAULT_TILE_SIZE, or as many rows as fit in
+ *        CHUNK_DEFAULT_STRIP_BYTES for the image at hand.
+ */
+void chunker_set_tiling(chunk_tiling_t tiling, int size);
+
+/**
+ * @brief Sets the halo copied around every tile of a route's images for
+ *        neighbourhood filters.
+ *
+ * Tiles carry up to `halo_x` extra pixels left and right and `halo_y` extra rows
+ * above and below (fewer at the image edges). Views (zero-copy) never carry a
+ * halo: their neighbours are being filtered in place by other threads. Must be
+ * called before the chunker threads are started.
+ */
+void chunker_set_halo(int route, size_t halo_x, size_t halo_y);
+
+/**
+ * @brief Computes the halo for an image of `width` x `height` pixels.
+ */
+typedef void (*chunk_halo_fn)(size_t width, size_t height, size_t *halo_x, size_t *halo_y, const void *context);
+
+/**
+ * @brief Asks `fn` for the halo of every image of a route instead of using a fixed one.
+ *
+ * For filter chains whose reach depends on the image size (resizing). Must be
+ * called before the chunker threads are started.
+ */
+void chunker_set_halo_fn(int route, chunk_halo_fn fn, const void *context);
+
+/**
+ * @brief Sets the layout of the tiles the chunker copies.
+ *
+ * With IMAGE_LAYOUT_PLANAR every tile (halo included) is split into one
+ * 64-byte aligned plane per channel as it is copied, and reconstruction merges
+ * the planes back. Views (zero-copy) stay interleaved. Must be called before
+ * the chunker threads are started.
+ */
+void chunker_set_layout(image_layout_t layout);
+
+/**
+ * @brief Sets the sample type images are decoded to and chunks carry.
+ *
+ * The filter plan must be built for the same type. Planar tiles need 8-bit
+ * samples. Must be called before the chunker threads are started.
+ */
+void chunker_set_sample_type(image_sample_t sample);
+
+/**
+ * @brief Makes chunker threads emit zero-copy views instead of tile copies.
+ *
+ * When enabled, every chunk of an image points into one shared, reference-counted
+ * decoded buffer (see image_buffer_t) and filters modify the image in place.
+ * Must be called before the chunker threads are started.
+ */
+void chunker_set_zero_copy(bool enabled);
 
 /**
  * @brief Thread function to divide loaded image data into multiple chunks.
@@ -30,6 +112,14 @@ unsigned char *load_image(const char *filename, int *width, int *height, int *ch
  */
 void *chunk_image_thread(void *arg);
 
+/**
+ * @brief Gives up on an image that failed anywhere in the pipeline: records it
+ *        as discarded, releases its content claim (dedup_abandon()) and hands
+ *        it back to the directory monitor (directory_monitor_discard()).
+ *        Every stage discards images through here. Thread-safe.
+ */
+void discard_image(const char *filename, int route);
+
 /**
  * @brief Frees the memory allocated for an array of an image chunk. (Remains the same)
  *
@@ -38,6 +128,4 @@ void *chunk_image_thread(void *arg);
  * IMPORTANT: free the chunk after reconstruction
  * @param chunk The pointer to image_chunk_t.
  */
-void free_image_chunk(image_chunk_t *chunk);
-
-void assign_threads_to_chunk(void);
\ No newline at end of file
+void free_image_chunk(image_chunk_t *chunk);
\ No newline at end of file
@@ -11,6 +11,7 @@ struct image_name_queue_node;
 typedef struct image_name_queue_node {
     struct image_name_queue_node* next; /**< Pointer to the next node, or NULL if last. */
     char* name;                         /**< Dynamically allocated copy of the filename. */
+    int route;                          /**< Input root the file was found under. */
 } image_name_queue_node_t;
 
 /**
@@ -46,9 +47,10 @@ int image_name_queue_init(image_name_queue_t* q);
  *
  * @param q Pointer to the image_name_queue_t structure.
  * @param name The filename string to enqueue. A copy will be made.
+ * @param route Input root the file was found under, handed back by dequeue_image_name().
  * @return 0 on success, -1 on memory allocation failure or mutex/cond error.
  */
-int enqueue_image_name(image_name_queue_t *q, const char *name);
+int enqueue_image_name(image_name_queue_t *q, const char *name, int route);
 
 /**
  * @brief Dequeues an image filename from the thread-safe queue.
@@ -58,10 +60,11 @@ int enqueue_image_name(image_name_queue_t *q, const char *name);
  * the returned string using free().
  *
  * @param q Pointer to the image_name_queue_t structure.
+ * @param route Receives the input root the file was enqueued with (may be NULL).
  * @return A pointer to a dynamically allocated filename string, or NULL if
  *         an error occurs or shutdown is signaled (implementation dependent).
  */
-char* dequeue_image_name(image_name_queue_t *q);
+char* dequeue_image_name(image_name_queue_t *q, int *route);
 
 /**
  * @brief Destroys an image name queue, freeing all nodes and associated resources.
@@ -0,0 +1,388 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdbool.h>
+#include<stdint.h>
+#include<stdatomic.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<pthread.h>
+#include<sys/stat.h>
+#include<uthash.h>
+#include<image.h>
+#include<content_hash.h>
+#include<content_dedup.h>
+#include<directory_monitor.h>
+#include<image_chunker.h>
+#include<image_queue.h>
+#include<reconstruction_threader.h>
+#include<log.h>
+
+extern image_name_queue_t name_queue;
+
+// Hash key: the file's bytes and what would be done to them (no padding: compared as raw bytes)
+typedef struct {
+    content_hash_t content;
+    uint64_t signature;
+} dedup_key_t;
+
+// An input that arrived while the first of its content was still in the pipeline
+typedef struct dedup_follower {
+    char *filename;
+    int route;
+    size_t size;
+    struct dedup_follower *next;
+} dedup_follower_t;
+
+typedef struct {
+    dedup_key_t key;
+    char *owner;                // Input being processed into the first output of this content; NULL once written
+    char *output_path;          // NULL until written
+    dev_t dev;                  // Identity of the output when written: a rewritten or removed output is not reused
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    dedup_follower_t *followers;    // Waiting for the owner's output
+    UT_hash_handle hh;          // Every entry, by key, oldest first
+    UT_hash_handle hh_owner;    // Claimed entries, by owner
+} dedup_entry_t;
+
+// Set once by main() before the chunker threads start
+static struct {
+    bool enabled;
+    uint64_t value;
+} signatures[IMAGE_MAX_ROUTES];
+
+static dedup_entry_t *dedup_table = NULL;
+static dedup_entry_t *dedup_owners = NULL;
+static pthread_mutex_t dedup_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static _Atomic uint64_t inputs_hashed = 0;
+static _Atomic uint64_t inputs_reused = 0;
+static _Atomic uint64_t bytes_reused = 0;
+
+void dedup_set_signature(int route, const char *signature) {
+    if (route < 0 || route >= IMAGE_MAX_ROUTES || signature == NULL)
+        return;
+
+    signatures[route].value = content_hash64(signature, strlen(signature));
+    signatures[route].enabled = true;
+}
+
+static void free_followers(dedup_follower_t *follower) {
+    while (follower != NULL) {
+        dedup_follower_t *next = follower->next;
+        free(follower->filename);
+        free(follower);
+        follower = next;
+    }
+}
+
+/*
+    Called without dedup_lock: the name queue may block, and a follower that cannot be queued is discarded,
+    which abandons its dedup state too.
+*/
+static void requeue_follower(const dedup_follower_t *follower) {
+    if (enqueue_image_name(&name_queue, follower->filename, follower->route) != 0) {
+        LOG_ERROR("Deduplication: Failed to queue %s again", follower->filename);
+        discard_image(follower->filename, follower->route);
+    }
+}
+
+/*
+    The followers of an entry that will not get its output go back to the name queue: the first of them to
+    be picked up claims the content, the others follow it. Callers collect them under dedup_lock (see
+    remove_entry()) and pass them here once it is released.
+*/
+static void requeue_followers(dedup_follower_t *followers) {
+    for (dedup_follower_t *follower = followers; follower != NULL; follower = follower->next)
+        requeue_follower(follower);
+
+    free_followers(followers);
+}
+
+/*
+    Caller holds dedup_lock. The entry's followers are moved to `*requeue` for requeue_followers(), or
+    freed if `requeue` is NULL (shutting down).
+*/
+static void remove_entry(dedup_entry_t *entry, dedup_follower_t **requeue) {
+    if (requeue == NULL) {
+        free_followers(entry->followers);
+    } else if (entry->followers != NULL) {
+        dedup_follower_t *last = entry->followers;
+        while (last->next != NULL)
+            last = last->next;
+        last->next = *requeue;
+        *requeue = entry->followers;
+    }
+    entry->followers = NULL;
+
+    if (entry->owner != NULL)
+        HASH_DELETE(hh_owner, dedup_owners, entry);
+    HASH_DEL(dedup_table, entry);
+    free(entry->owner);
+    free(entry->output_path);
+    free(entry);
+}
+
+/*
+    Caller holds dedup_lock. Makes `filename` the input whose output will serve this content. Followers of
+    entries dropped on the way are moved to `*requeue`.
+*/
+static void claim(dedup_entry_t *entry, const char *filename, dedup_follower_t **requeue) {
+    // An input claims one content at a time: a retried file may come back with other bytes
+    dedup_entry_t *previous;
+    HASH_FIND(hh_owner, dedup_owners, filename, strlen(filename), previous);
+    if (previous != NULL && previous != entry)
+        remove_entry(previous, requeue);
+
+    if (entry->owner != NULL) {
+        HASH_DELETE(hh_owner, dedup_owners, entry);
+        free(entry->owner);
+    }
+    free(entry->output_path);
+    entry->output_path = NULL;
+
+    entry->owner = strdup(filename);
+    if (entry->owner == NULL) {
+        remove_entry(entry, requeue);
+        return;
+    }
+
+    HASH_ADD_KEYPTR(hh_owner, dedup_owners, entry->owner, strlen(entry->owner), entry);
+}
+
+static bool output_unchanged(const dedup_entry_t *entry) {
+    struct stat st;
+    return stat(entry->output_path, &st) == 0 && st.st_dev == entry->dev && st.st_ino == entry->ino &&
+           st.st_size == entry->size && st.st_mtim.tv_sec == entry->mtime.tv_sec &&
+           st.st_mtim.tv_nsec == entry->mtime.tv_nsec;
+}
+
+static int copy_file(const char *source, const char *target) {
+    int in = open(source, O_RDONLY | O_CLOEXEC);
+    if (in < 0)
+        return -1;
+
+    int out = open(target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) {
+        close(in);
+        return -1;
+    }
+
+    char buffer[65536];
+    ssize_t length;
+    int status = 0;
+
+    while ((length = read(in, buffer, sizeof(buffer))) != 0) {
+        if (length < 0) {
+            if (errno == EINTR)
+                continue;
+            status = -1;
+            break;
+        }
+        if (write(out, buffer, (size_t)length) != length) {
+            status = -1;
+            break;
+        }
+    }
+
+    close(in);
+    if (close(out) != 0)
+        status = -1;
+    return status;
+}
+
+/*
+    Puts `source` at `target` the way reconstruction writes outputs: under a temporary name, renamed into
+    place. A hard link where possible; a copy across file systems or where links are not supported.
+*/
+static int place_output(const char *source, const char *target) {
+    char *tmp_path = malloc(strlen(target) + 5);
+    if (tmp_path == NULL)
+        return -1;
+    sprintf(tmp_path, "%s.tmp", target);
+    unlink(tmp_path);
+
+    int status = link(source, tmp_path);
+    if (status != 0 && (errno == EXDEV || errno == EPERM || errno == EMLINK || errno == ENOTSUP))
+        status = copy_file(source, tmp_path);
+
+    if (status == 0)
+        status = rename(tmp_path, target);
+    if (status != 0)
+        unlink(tmp_path);
+
+    free(tmp_path);
+    return status;
+}
+
+// Gives `filename` the output `source` and marks it processed
+static bool reuse_output(const char *source, const char *filename, int route, size_t size) {
+    char *target = reconstruction_output_path(filename, route);
+    bool reused = (target != NULL) && (strcmp(source, target) == 0 || place_output(source, target) == 0);
+
+    if (reused) {
+        LOG_INFO("Deduplication: %s has the content of an earlier input, reused %s", filename, source);
+        directory_monitor_commit(filename, route);
+        atomic_fetch_add_explicit(&inputs_reused, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&bytes_reused, size, memory_order_relaxed);
+    } else {
+        LOG_WARN("Deduplication: Failed to reuse %s for %s (%s), processing it", source, filename, strerror(errno));
+    }
+
+    free(target);
+    return reused;
+}
+
+bool dedup_reuse(const char *filename, int route, const void *data, size_t size) {
+    if (route < 0 || route >= IMAGE_MAX_ROUTES || !signatures[route].enabled)
+        return false;
+
+    dedup_key_t key;
+    memset(&key, 0, sizeof(key));
+    key.content = content_hash(data, size);
+    key.signature = signatures[route].value;
+    atomic_fetch_add_explicit(&inputs_hashed, 1, memory_order_relaxed);
+
+    char *source = NULL;
+    dedup_follower_t *requeue = NULL;
+
+    pthread_mutex_lock(&dedup_lock);
+
+    dedup_entry_t *entry;
+    HASH_FIND(hh, dedup_table, &key, sizeof(key), entry);
+
+    if (entry == NULL) {
+        entry = calloc(1, sizeof(dedup_entry_t));
+        if (entry != NULL) {
+            entry->key = key;
+            HASH_ADD(hh, dedup_table, key, sizeof(entry->key), entry);
+            claim(entry, filename, &requeue);
+        }
+
+        // Oldest first; the new entry is the last to go
+        while (HASH_COUNT(dedup_table) > DEDUP_MAX_ENTRIES)
+            remove_entry(dedup_table, &requeue);
+    } else if (entry->output_path != NULL && output_unchanged(entry)) {
+        source = strdup(entry->output_path);
+    } else if (entry->output_path != NULL) {
+        claim(entry, filename, &requeue);  // The output was removed or rewritten since
+    } else if (strcmp(entry->owner, filename) != 0) {
+        // The first input of this content is still in the pipeline: wait for its output
+        dedup_follower_t *follower = calloc(1, sizeof(dedup_follower_t));
+        if (follower != NULL && (follower->filename = strdup(filename)) != NULL) {
+            follower->route = route;
+            follower->size = size;
+            follower->next = entry->followers;
+            entry->followers = follower;
+            LOG_DEBUG("Deduplication: %s has the content of %s, waiting for its output", filename, entry->owner);
+            pthread_mutex_unlock(&dedup_lock);
+            return true;
+        }
+        free(follower);
+    }
+    // Otherwise this input claimed the content already (a retry): processed again
+
+    pthread_mutex_unlock(&dedup_lock);
+    requeue_followers(requeue);
+
+    if (source == NULL)
+        return false;
+
+    bool reused = reuse_output(source, filename, route, size);
+
+    if (!reused) {
+        pthread_mutex_lock(&dedup_lock);
+        HASH_FIND(hh, dedup_table, &key, sizeof(key), entry);
+        if (entry != NULL && entry->owner == NULL)
+            claim(entry, filename, &requeue);
+        pthread_mutex_unlock(&dedup_lock);
+        requeue_followers(requeue);
+    }
+
+    free(source);
+    return reused;
+}
+
+void dedup_complete(const char *filename, const char *output_path) {
+    dedup_follower_t *followers = NULL;
+    bool written = true;
+
+    pthread_mutex_lock(&dedup_lock);
+
+    dedup_entry_t *entry;
+    HASH_FIND(hh_owner, dedup_owners, filename, strlen(filename), entry);
+
+    if (entry != NULL) {
+        HASH_DELETE(hh_owner, dedup_owners, entry);
+        free(entry->owner);
+        entry->owner = NULL;
+
+        struct stat st;
+        entry->output_path = (stat(output_path, &st) == 0)? strdup(output_path): NULL;
+
+        if (entry->output_path == NULL) {
+            written = false;
+            remove_entry(entry, &followers);
+        } else {
+            entry->dev = st.st_dev;
+            entry->ino = st.st_ino;
+            entry->size = st.st_size;
+            entry->mtime = st.st_mtim;
+            followers = entry->followers;
+            entry->followers = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&dedup_lock);
+
+    // No output after all: the followers are queued again as they are
+    if (!written) {
+        requeue_followers(followers);
+        return;
+    }
+
+    for (dedup_follower_t *follower = followers; follower != NULL; follower = follower->next) {
+        if (!reuse_output(output_path, follower->filename, follower->route, follower->size))
+            requeue_follower(follower);
+    }
+    free_followers(followers);
+}
+
+void dedup_abandon(const char *filename) {
+    pthread_mutex_lock(&dedup_lock);
+
+    dedup_entry_t *entry;
+    dedup_follower_t *requeue = NULL;
+    HASH_FIND(hh_owner, dedup_owners, filename, strlen(filename), entry);
+    if (entry != NULL)
+        remove_entry(entry, &requeue);
+
+    pthread_mutex_unlock(&dedup_lock);
+    requeue_followers(requeue);
+}
+
+void dedup_report(void) {
+    uint64_t hashed = atomic_load(&inputs_hashed);
+    if (hashed == 0)
+        return;
+
+    uint64_t reused = atomic_load(&inputs_reused);
+    printf("Deduplication report: %llu inputs hashed, %llu reused an earlier output (%.1f%%, %llu input bytes not decoded)\n",
+        (unsigned long long)hashed, (unsigned long long)reused, 100.0 * (double)reused / (double)hashed,
+        (unsigned long long)atomic_load(&bytes_reused));
+}
+
+void dedup_destroy(void) {
+    pthread_mutex_lock(&dedup_lock);
+
+    dedup_entry_t *entry, *tmp;
+    HASH_ITER(hh, dedup_table, entry, tmp) {
+        // Shutting down: followers are processed at the next start instead
+        remove_entry(entry, NULL);
+    }
+
+    pthread_mutex_unlock(&dedup_lock);
+}
@@ -1,120 +1,778 @@
-#include<stdio.h> 
-#include<dirent.h>         
-#include<string.h>         
-#include<unistd.h>        
-#include<pthread.h>    
-#include<stdbool.h>      
-#include<signal.h>        
-#include<stdlib.h>     
+#include<stdio.h>
+#include<dirent.h>
+#include<string.h>
+#include<strings.h>
+#include<unistd.h>
+#include<pthread.h>
+#include<stdbool.h>
+#include<signal.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<errno.h>
+#include<time.h>
+#include<sys/stat.h>
+#include<sys/inotify.h>
+#include<sys/epoll.h>
+#include<sys/eventfd.h>
+#include<uthash.h>
+#include<image.h>
 #include<directory_monitor.h>
 #include<file_tracker.h>
-#include<image_queue.h>       
+#include<image_queue.h>
+#include<log.h>
 
-extern volatile sig_atomic_t stop_flag; 
+/** @brief Seconds between retries (and between scans when inotify is unavailable). */
+#define MONITOR_RETRY_SECONDS 5
+
+/** @brief A file that failed to decode and has not changed for this long is taken as corrupt. */
+#define MONITOR_GIVE_UP_SECONDS 60
+
+/** @brief Events that mean a file is complete in the directory or left it, or that the watch is gone (plus
+ *         IN_CREATE for new subdirectories when recursing). */
+#define MONITOR_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF | IN_MOVE_SELF | \
+                        IN_ONLYDIR)
+
+extern volatile sig_atomic_t stop_flag;
 extern image_name_queue_t name_queue;
 
-void *read_images_from_directory(void *arg) {
-    const char *directoryPath = (const char *)arg;
-    struct dirent *entry;
-    DIR *dir = NULL;
+/**
+ * @brief A file the monitor has seen but not queued (yet, or again).
+ */
+typedef struct pending_file {
+    char path[1024];
+    int route;                  /**< Input root the file belongs to. */
+    bool retry;                 /**< Failed to decode: waits for new content instead of stable content. */
+    bool claimed;               /**< Handed back still claimed (see file_tracker.h): released when collected. */
+    bool discard;               /**< Not to be processed: only queued again if it changed while claimed. */
+    off_t size;                 /**< Size and mtime when last looked at. */
+    struct timespec mtime;
+    double since;               /**< Monotonic time at which size and mtime last changed (or were first seen). */
+    struct pending_file *next;
+} pending_file_t;
+
+/**
+ * @brief An input root given to directory_monitor_add_root().
+ */
+typedef struct {
+    const char *path;
+    int route;
+    bool recursive;
+    int wd;                     /**< Watch on the root itself; -1 while missing (retried on a timer). */
+    bool rescan;                /**< Scan in full at the next turn of the loop. */
+} monitor_root_t;
+
+/**
+ * @brief A watched directory: a root or, when recursing, one of its subdirectories.
+ */
+typedef struct {
+    int wd;                     /**< inotify watch descriptor (hash key). */
+    char *path;
+    int root;                   /**< Index in `monitor_roots`. */
+    dev_t dev;                  /**< Identity of the directory when watched, to tell a directory moved away */
+    ino_t ino;                  /**< from one renamed in place. */
+    UT_hash_handle hh;
+} watched_dir_t;
+
+static monitor_root_t monitor_roots[IMAGE_MAX_ROUTES];
+static size_t num_roots = 0;
+
+// Monitor thread only
+static int inotify_fd = -1;
+static watched_dir_t *watched_dirs = NULL;
+static bool watches_exhausted = false;  // Some directories could not be watched: rescan them on a timer
+
+// Written by directory_monitor_wake() (possibly from a signal handler), polled with the inotify descriptor
+static int wake_fd = -1;
+
+static long settle_ms = MONITOR_DEFAULT_SETTLE_MS;
+
+// Files waiting to be stable; only the monitor thread touches this list
+static pending_file_t *pending = NULL;
+
+// Files handed back by the chunker and reconstruction threads, picked up by the monitor thread
+static pending_file_t *retry_inbox = NULL;
+static pthread_mutex_t retry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void directory_monitor_set_settle(long ms) {
+    settle_ms = (ms >= 0)? ms: MONITOR_DEFAULT_SETTLE_MS;
+}
+
+int directory_monitor_add_root(const char *path, int route, bool recursive) {
+    if (path == NULL || num_roots >= IMAGE_MAX_ROUTES || route < 0 || route >= IMAGE_MAX_ROUTES)
+        return -1;
+
+    monitor_root_t *root = &monitor_roots[num_roots++];
+    root->path = path;
+    root->route = route;
+    root->recursive = recursive;
+    root->wd = -1;
+    root->rescan = true;
+    return 0;
+}
+
+int directory_monitor_init(void) {
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        perror("directory_monitor_init: Failed to create the wake-up eventfd");
+        return -1;
+    }
+    return 0;
+}
+
+void directory_monitor_wake(void) {
+    if (wake_fd < 0)
+        return;
+
+    uint64_t one = 1;
+    ssize_t written = write(wake_fd, &one, sizeof(one));
+    (void)written; // Only fails when the counter is saturated: the thread is already awake
+}
+
+static void free_pending_list(pending_file_t *list) {
+    while (list != NULL) {
+        pending_file_t *next = list->next;
+        free(list);
+        list = next;
+    }
+}
+
+void directory_monitor_destroy(void) {
+    if (wake_fd >= 0)
+        close(wake_fd);
+    wake_fd = -1;
+
+    pthread_mutex_lock(&retry_lock);
+    free_pending_list(retry_inbox);
+    retry_inbox = NULL;
+    pthread_mutex_unlock(&retry_lock);
+}
+
+// Hands a file back to the monitor thread: to wait for new content (`retry`) or for the current one to settle
+static void report_file(const char *path, int route, bool retry, bool claimed, bool discard) {
+    pending_file_t *entry = calloc(1, sizeof(*entry));
+    if (entry == NULL) {
+        LOG_ERROR("Thread %lu: Failed to allocate memory for a retry, dropping %s", pthread_self(), path);
+        if (claimed)
+            file_tracker_release(path);
+        return;
+    }
+
+    snprintf(entry->path, sizeof(entry->path), "%s", path);
+    entry->route = route;
+    entry->retry = retry;
+    entry->claimed = claimed;
+    entry->discard = discard;
+
+    pthread_mutex_lock(&retry_lock);
+    entry->next = retry_inbox;
+    retry_inbox = entry;
+    pthread_mutex_unlock(&retry_lock);
+
+    directory_monitor_wake();
+}
+
+void directory_monitor_retry(const char *path, int route) {
+    report_file(path, route, true, true, false);
+}
+
+void directory_monitor_defer(const char *path, int route) {
+    report_file(path, route, false, true, false);
+}
+
+void directory_monitor_discard(const char *path, int route) {
+    report_file(path, route, false, true, true);
+}
+
+void directory_monitor_commit(const char *path, int route) {
+    // The claim ends here: a new version seen meanwhile is queued once it settles
+    if (file_tracker_commit(path))
+        report_file(path, route, false, false, false);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Seconds since the file was last modified; negative if its mtime is ahead of the clock
+static double mtime_age(const struct stat *st) {
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    return (double)(wall.tv_sec - st->st_mtim.tv_sec) + (double)(wall.tv_nsec - st->st_mtim.tv_nsec) / 1e9;
+}
+
+bool directory_monitor_settled(const struct stat *st) {
+    double age = mtime_age(st);
+
+    // An mtime well ahead of the clock (a skewed network file system) says nothing: not held back for it
+    return age * 1000.0 >= (double)settle_ms || age < -1.0;
+}
+
+static bool has_suffix(const char *name, const char *suffix) {
+    size_t length = strlen(name), suffix_length = strlen(suffix);
+    return length > suffix_length && strcasecmp(name + length - suffix_length, suffix) == 0;
+}
+
+/*
+    Images are recognised by extension. Writers that cannot rely on close-after-write (copies over the
+    network, tools that reopen the file) should write under a temporary name and rename when done:
+    hidden names (".name.jpg", rsync's ".name.jpg.XXXXXX") and any other extension ("name.jpg.part",
+    "name.png.tmp") are ignored until the rename.
+*/
+static bool is_image_name(const char *name) {
+    if (name[0] == '.')
+        return false;
+    return has_suffix(name, ".jpg") || has_suffix(name, ".jpeg") || has_suffix(name, ".png");
+}
+
+static void queue_file(const char *path, int route) {
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return; // Gone before it could be queued
+
+    // Claims it with its current content; a file still in the pipeline is queued again once done instead
+    if (!add_processed_file(path, &st)) {
+        LOG_DEBUG("Thread %lu: %s is still in the pipeline, queueing it again once done", pthread_self(), path);
+        return;
+    }
+
+    // Never reached the pipeline: drop the claim, so the file is queued again once it changes
+    if (enqueue_image_name(&name_queue, path, route) != 0) {
+        LOG_ERROR("Thread %lu: Failed to enqueue image %s", pthread_self(), path);
+        file_tracker_release(path);
+    }
+}
+
+static pending_file_t **find_pending(const char *path) {
+    pending_file_t **link = &pending;
+    while (*link != NULL && strcmp((*link)->path, path) != 0)
+        link = &(*link)->next;
+    return link;
+}
+
+static void drop_pending(pending_file_t **link) {
+    pending_file_t *entry = *link;
+    *link = entry->next;
+    free(entry);
+}
+
+static bool same_time(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+/*
+    Queues one directory entry if it is an image not seen before. `complete` is true when inotify reported
+    the file closed after writing or moved in: it is queued right away, as is a pending file (a retried one
+    included). A file found by a scan is queued only if it has not been modified for the settle time;
+    otherwise it waits in the pending list.
+*/
+static void consider_file(const char *directoryPath, const char *name, int route, bool complete) {
+    if (!is_image_name(name))
+        return;
+
+    char imagePath[1024];
+    snprintf(imagePath, sizeof(imagePath), "%s/%s", directoryPath, name);
+
+    if (complete) {
+        pending_file_t **link = find_pending(imagePath);
+        if (*link != NULL) {
+            drop_pending(link);
+            queue_file(imagePath, route);
+            return;
+        }
+    }
+
+    struct stat st;
+    if (stat(imagePath, &st) != 0 || !S_ISREG(st.st_mode))
+        return;
+
+    if (was_file_processed(imagePath, &st))
+        return;
+
+    if (complete) {
+        queue_file(imagePath, route);
+        return;
+    }
+
+    if (*find_pending(imagePath) != NULL)
+        return; // check_pending() follows it
+
+    double age = mtime_age(&st);
+
+    if (age * 1000.0 >= (double)settle_ms) {
+        queue_file(imagePath, route);
+        return;
+    }
+
+    pending_file_t *entry = calloc(1, sizeof(*entry));
+    if (entry == NULL) {
+        queue_file(imagePath, route); // Better early than never
+        return;
+    }
+
+    snprintf(entry->path, sizeof(entry->path), "%s", imagePath);
+    entry->route = route;
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtim;
+    entry->since = now_seconds();
+    entry->next = pending;
+    pending = entry;
+    LOG_DEBUG("Thread %lu: %s was modified %.0f ms ago, waiting for it to settle", pthread_self(), imagePath, age * 1000.0);
+}
+
+/*
+    Moves the files handed back (decode failures, files still changing, files changed while in the pipeline)
+    to the pending list. Their claims end here, on the thread that queues files, so that a file cannot be
+    queued again before its claim is gone.
+*/
+static void collect_retries(void) {
+    pthread_mutex_lock(&retry_lock);
+    pending_file_t *inbox = retry_inbox;
+    retry_inbox = NULL;
+    pthread_mutex_unlock(&retry_lock);
+
+    double now = now_seconds();
+
+    while (inbox != NULL) {
+        pending_file_t *entry = inbox;
+        inbox = inbox->next;
+
+        struct stat st;
+
+        // Changed while it was in the pipeline: whatever went wrong, the new version only has to settle
+        if (entry->claimed && file_tracker_release(entry->path)) {
+            entry->retry = false;
+            entry->discard = false;
+        }
+
+        if (entry->discard) {
+            free(entry); // The thread that discarded it logged why
+            continue;
+        }
+
+        if (stat(entry->path, &st) != 0) {
+            LOG_WARN("Thread %lu: Dropping %s: it is gone (%s)", pthread_self(), entry->path, strerror(errno));
+            file_tracker_forget(entry->path);
+            free(entry);
+            continue;
+        }
+
+        // Already followed: check_pending() queues it once it settles
+        if (*find_pending(entry->path) != NULL) {
+            free(entry);
+            continue;
+        }
+
+        // Failed to load and untouched for long enough to be simply corrupt: nothing to wait for
+        if (entry->retry && mtime_age(&st) >= MONITOR_GIVE_UP_SECONDS) {
+            LOG_ERROR("Thread %lu: Giving up on %s: it failed to load and was last modified over %d s ago",
+                      pthread_self(), entry->path, MONITOR_GIVE_UP_SECONDS);
+            free(entry);
+            continue;
+        }
+
+        entry->size = st.st_size;
+        entry->mtime = st.st_mtim;
+        entry->since = now;
+        entry->next = pending;
+        pending = entry;
+
+        if (entry->retry)
+            LOG_WARN("Thread %lu: %s may still be written, retrying it once it changes", pthread_self(), entry->path);
+        else
+            LOG_DEBUG("Thread %lu: %s is still changing, queueing it again once it settles", pthread_self(), entry->path);
+    }
+}
+
+/*
+    Revisits the pending files. One that kept its size and mtime for the settle time is queued (a retried
+    file must change first); one that disappeared is forgotten; a retried file that never changes is given
+    up on after MONITOR_GIVE_UP_SECONDS.
+*/
+static void check_pending(void) {
+    double now = now_seconds();
+    pending_file_t **link = &pending;
+
+    while (*link != NULL) {
+        pending_file_t *entry = *link;
+        struct stat st;
+
+        if (stat(entry->path, &st) != 0) {
+            drop_pending(link);
+            continue;
+        }
+
+        if (st.st_size != entry->size || !same_time(&st.st_mtim, &entry->mtime)) {
+            entry->size = st.st_size;
+            entry->mtime = st.st_mtim;
+            entry->since = now;
+            entry->retry = false; // New content: now it only has to settle
+        } else if (!entry->retry && (now - entry->since) * 1000.0 >= (double)settle_ms) {
+            queue_file(entry->path, entry->route);
+            drop_pending(link);
+            continue;
+        } else if (entry->retry && now - entry->since >= MONITOR_GIVE_UP_SECONDS) {
+            LOG_ERROR("Thread %lu: Giving up on %s: unchanged since it failed to load", pthread_self(), entry->path);
+            drop_pending(link);
+            continue;
+        }
+
+        link = &entry->next;
+    }
+}
+
+// Starts watching a directory, or updates the path of a watch that follows it after a rename. Returns the wd or -1.
+static int watch_directory(const char *path, int root) {
+    uint32_t mask = MONITOR_EVENTS | (monitor_roots[root].recursive? IN_CREATE: 0);
+    int wd = inotify_add_watch(inotify_fd, path, mask);
+
+    if (wd < 0) {
+        if (errno == ENOSPC && !watches_exhausted) {
+            LOG_ERROR("Thread %lu: Out of inotify watches at %s; raise fs.inotify.max_user_watches. "
+                      "Unwatched directories are rescanned every %d seconds.", pthread_self(), path, MONITOR_RETRY_SECONDS);
+            watches_exhausted = true;
+        } else if (errno != ENOENT && errno != ENOSPC) {
+            LOG_ERROR("Thread %lu: Unable to watch %s: %s", pthread_self(), path, strerror(errno));
+        }
+        return -1;
+    }
+
+    watched_dir_t *dir;
+    HASH_FIND_INT(watched_dirs, &wd, dir);
+
+    if (dir == NULL) {
+        dir = calloc(1, sizeof(*dir));
+        if (dir == NULL) {
+            perror("watch_directory: Failed to allocate memory for a watch");
+            inotify_rm_watch(inotify_fd, wd);
+            return -1;
+        }
+        dir->wd = wd;
+        HASH_ADD_INT(watched_dirs, wd, dir);
+    }
+
+    char *copy = strdup(path);
+    if (copy != NULL) {
+        free(dir->path);
+        dir->path = copy;
+    }
+
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        dir->dev = st.st_dev;
+        dir->ino = st.st_ino;
+    }
+
+    dir->root = root;
+    return wd;
+}
+
+static void forget_watch(watched_dir_t *dir) {
+    if (monitor_roots[dir->root].wd == dir->wd)
+        monitor_roots[dir->root].wd = -1;
+
+    HASH_DEL(watched_dirs, dir);
+    free(dir->path);
+    free(dir);
+}
+
+// Drops the watches of a directory that left its path, and of everything below it (their paths are stale too)
+static void unwatch_tree(const char *path) {
+    size_t length = strlen(path);
+    watched_dir_t *dir, *tmp;
+
+    // The IN_IGNORED events that follow remove the table entries
+    HASH_ITER(hh, watched_dirs, dir, tmp) {
+        if (strncmp(dir->path, path, length) == 0 && (dir->path[length] == '\0' || dir->path[length] == '/'))
+            inotify_rm_watch(inotify_fd, dir->wd);
+    }
+}
+
+static bool is_directory(const char *parent, const struct dirent *entry) {
+    if (entry->d_type == DT_DIR)
+        return true;
+    if (entry->d_type != DT_UNKNOWN)
+        return false;
 
-    // --- Initial Scan ---
-    printf("Thread %lu: Performing initial scan of directory: %s\n", pthread_self(), directoryPath);
-    dir = opendir(directoryPath);
+    char path[1024];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", parent, entry->d_name);
+    return lstat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/*
+    Full readdir pass over a directory (and its subdirectories for a recursive root): at startup, after an
+    event queue overflow, when a watch is re-established and when a subdirectory appears. Every directory is
+    watched before it is read, so no file can land between the two unseen. Hidden subdirectories are skipped.
+*/
+static int scan_tree(const char *path, int root) {
+    if (inotify_fd >= 0) {
+        int wd = watch_directory(path, root);
+        if (strcmp(path, monitor_roots[root].path) == 0)
+            monitor_roots[root].wd = wd;
+    }
+
+    DIR *dir = opendir(path);
     if (dir == NULL) {
         char err_msg[512];
-        snprintf(err_msg, sizeof(err_msg), "Thread %lu: Unable to open directory for initial scan (%s)", pthread_self(), directoryPath);
+        snprintf(err_msg, sizeof(err_msg), "Thread %lu: Unable to scan directory (%s)", pthread_self(), path);
         perror(err_msg);
-        return NULL; 
+        return -1;
     }
 
+    struct dirent *entry;
     while ((entry = readdir(dir)) != NULL) {
         if (stop_flag) {
-            printf("Thread %lu: Stop flag detected during initial scan.\n", pthread_self());
-            break; 
+            LOG_INFO("Thread %lu: Stop flag detected during scan.", pthread_self());
+            break;
         }
 
-        bool should_process = false;
-        char current_filename[256];
-        strncpy(current_filename, entry->d_name, sizeof(current_filename) - 1);
-        current_filename[sizeof(current_filename) - 1] = '\0';
+        if (monitor_roots[root].recursive && is_directory(path, entry)) {
+            if (entry->d_name[0] == '.')
+                continue;
 
-        if (strstr(current_filename, ".jpg") || strstr(current_filename, ".png")) {
-            if (!was_file_processed(current_filename)) {
-                add_processed_file(current_filename);
-                should_process = true;
-            }
+            char subdir[1024];
+            snprintf(subdir, sizeof(subdir), "%s/%s", path, entry->d_name);
+            scan_tree(subdir, root);
+            continue;
         }
 
-        if (should_process) {
-            char imagePath[1024];
-            snprintf(imagePath, sizeof(imagePath), "%s/%s", directoryPath, current_filename);
-            if (enqueue_image_name(&name_queue, imagePath) != 0) 
-                fprintf(stderr, "Thread %lu: Failed to enqueue image %s\n", pthread_self(), imagePath);
-        }
+        consider_file(path, entry->d_name, monitor_roots[root].route, false);
     }
 
     closedir(dir);
-    dir = NULL; 
-    if (stop_flag) {
-        printf("Thread %lu: Stop flag detected after initial scan.\n", pthread_self());
-        return NULL; 
+    return 0;
+}
+
+/*
+    Scans the roots flagged for it (and, when `retry_due`, the missing and partly unwatched ones). When that
+    covers every root and all of them could be read, the tracker evicts the files the scan did not find:
+    they were deleted or moved away, possibly while the program was not running.
+*/
+static bool scan_roots(bool retry_due) {
+    bool full = true, scanned = false, complete = true;
+
+    for (size_t r = 0; r < num_roots; r++) {
+        const monitor_root_t *root = &monitor_roots[r];
+        full = full && (root->rescan || inotify_fd < 0);
     }
 
-    printf("Thread %lu: Initial scan complete. Monitoring...\n", pthread_self());
+    if (full)
+        file_tracker_begin_sweep();
 
-    // --- Monitoring Loop ---
-    while (!stop_flag) { 
-        dir = opendir(directoryPath);
-        if (dir == NULL) {
-            char err_msg[512];
-            snprintf(err_msg, sizeof(err_msg), "Thread %lu: Unable to open directory for monitoring (%s)", pthread_self(), directoryPath);
-            perror(err_msg);
-            if (stop_flag) break;
-            sleep(5); 
-            continue; 
-        }
-
-        while ((entry = readdir(dir)) != NULL) {
-            if (stop_flag) {
-                printf("Thread %lu: Stop flag detected during monitoring scan.\n", pthread_self());
-                break; 
-            }
+    for (size_t r = 0; r < num_roots && !stop_flag; r++) {
+        monitor_root_t *root = &monitor_roots[r];
 
-            bool should_process = false;
-            char current_filename[256];
-            strncpy(current_filename, entry->d_name, sizeof(current_filename) - 1);
-            current_filename[sizeof(current_filename) - 1] = '\0';
+        if (root->rescan || inotify_fd < 0 || ((root->wd < 0 || watches_exhausted) && retry_due)) {
+            root->rescan = false;
+            if (scan_tree(root->path, (int)r) != 0)
+                complete = false;
+            scanned = true;
+        }
+    }
 
-            if (strstr(current_filename, ".jpg") || strstr(current_filename, ".png")) {
-                if (!was_file_processed(current_filename)) {
-                    add_processed_file(current_filename);
-                    should_process = true;
-                }
-            }
+    if (full && complete && !stop_flag) {
+        size_t evicted = file_tracker_sweep();
+        if (evicted > 0)
+            LOG_INFO("Thread %lu: Forgot %zu processed files no longer present", pthread_self(), evicted);
+    }
 
-            if (should_process) {
-                char imagePath[1024];
-                snprintf(imagePath, sizeof(imagePath), "%s/%s", directoryPath, current_filename);
-                if (enqueue_image_name(&name_queue, imagePath) != 0) 
-                    fprintf(stderr, "Thread %lu: Failed to enqueue image %s\n", pthread_self(), imagePath);
-            }
+    return scanned;
+}
+
+// The pre-inotify behaviour: rescan every few seconds
+static void poll_roots(void) {
+    while (!stop_flag) {
+        collect_retries();
+        check_pending();
+        scan_roots(true);
+        file_tracker_maintain();
+        if (stop_flag)
+            break;
+        sleep(MONITOR_RETRY_SECONDS);
+    }
+}
+
+static void handle_event(const struct inotify_event *event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        LOG_WARN("Thread %lu: inotify queue overflowed, rescanning every root", pthread_self());
+        for (size_t r = 0; r < num_roots; r++)
+            monitor_roots[r].rescan = true;
+        return;
+    }
+
+    watched_dir_t *dir;
+    HASH_FIND_INT(watched_dirs, &event->wd, dir);
+    if (dir == NULL)
+        return; // A watch already dropped
+
+    const monitor_root_t *root = &monitor_roots[dir->root];
+
+    if (event->mask & IN_IGNORED) {
+        if (root->wd == dir->wd)
+            LOG_WARN("Thread %lu: Lost the watch on %s, retrying", pthread_self(), root->path);
+        forget_watch(dir);
+        return;
+    }
+
+    // Still at its path (renamed back, or re-watched under the new name already)? Otherwise it left the tree
+    if (event->mask & IN_MOVE_SELF) {
+        struct stat st;
+        if (stat(dir->path, &st) != 0 || st.st_dev != dir->dev || st.st_ino != dir->ino)
+            unwatch_tree(dir->path);
+        return;
+    }
+
+    if (event->len == 0)
+        return;
+
+    if (event->mask & IN_ISDIR) {
+        if (root->recursive && (event->mask & (IN_CREATE | IN_MOVED_TO)) && event->name[0] != '.') {
+            char subdir[1024];
+            snprintf(subdir, sizeof(subdir), "%s/%s", dir->path, event->name);
+            scan_tree(subdir, dir->root);
         }
-        
-        closedir(dir);
-        dir = NULL; 
+        return;
+    }
 
-        if (stop_flag) {
-            printf("Thread %lu: Stop flag detected after monitoring scan.\n", pthread_self());
+    if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+        consider_file(dir->path, event->name, root->route, true);
+    } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", dir->path, event->name);
+        file_tracker_forget(path);
+    }
+}
+
+// Drains the inotify descriptor
+static void handle_events(void) {
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (!stop_flag) {
+        ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+        if (length < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                LOG_ERROR("Thread %lu: Failed to read inotify events: %s", pthread_self(), strerror(errno));
             break;
         }
 
-        sleep(5); 
+        for (char *p = buffer; p < buffer + length; ) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+            handle_event(event);
+        }
+    }
+}
+
+static void release_watches(void) {
+    watched_dir_t *dir, *tmp;
+    HASH_ITER(hh, watched_dirs, dir, tmp) {
+        HASH_DEL(watched_dirs, dir);
+        free(dir->path);
+        free(dir);
+    }
+
+    free_pending_list(pending);
+    pending = NULL;
+}
+
+void *read_images_from_directory(void *arg) {
+    // A single directory given the old way
+    if (num_roots == 0 && arg != NULL)
+        directory_monitor_add_root((const char *)arg, 0, false);
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    int epoll_fd = (inotify_fd >= 0)? epoll_create1(EPOLL_CLOEXEC): -1;
+
+    if (epoll_fd >= 0) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.fd = inotify_fd };
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, inotify_fd, &ev) != 0) {
+            close(epoll_fd);
+            epoll_fd = -1;
+        }
+    }
+
+    if (epoll_fd >= 0 && wake_fd >= 0) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.fd = wake_fd };
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) != 0) {
+            close(epoll_fd);
+            epoll_fd = -1;
+        }
+    }
+
+    if (epoll_fd < 0) {
+        LOG_WARN("Thread %lu: inotify unavailable (%s), polling every %d seconds",
+                 pthread_self(), strerror(errno), MONITOR_RETRY_SECONDS);
+        if (inotify_fd >= 0)
+            close(inotify_fd);
+        inotify_fd = -1;
+        poll_roots();
+        release_watches();
+        LOG_INFO("Thread %lu: Exiting gracefully.", pthread_self());
+        return NULL;
+    }
+
+    LOG_INFO("Thread %lu: Performing initial scan of %zu director%s", pthread_self(), num_roots, (num_roots == 1)? "y": "ies");
+    double retry_at = 0.0;
+
+    while (!stop_flag) {
+        // Missing roots and directories past the watch limit are looked at again every few seconds
+        double now = now_seconds();
+        bool retry_due = (now >= retry_at);
+        bool scanned = scan_roots(retry_due), waiting = watches_exhausted;
+
+        for (size_t r = 0; r < num_roots; r++)
+            waiting = waiting || (monitor_roots[r].wd < 0);
+
+        if (retry_due)
+            retry_at = now + MONITOR_RETRY_SECONDS;
+        if (scanned)
+            LOG_INFO("Thread %lu: Scan complete, %u directories watched. Monitoring...", pthread_self(), HASH_COUNT(watched_dirs));
+
+        collect_retries();
+        check_pending();
+        file_tracker_maintain();
+
+        if (stop_flag)
+            break;
+
+        // Sleep until an event or a wake-up; wake on a timer only while files settle or directories are unwatched
+        struct epoll_event events[2];
+        int timeout = -1;
+        if (waiting) {
+            double left = retry_at - now_seconds();
+            timeout = (left > 0.0)? (int)(left * 1000.0) + 1: 0;
+        }
+        if (pending != NULL && (timeout < 0 || timeout > settle_ms))
+            timeout = (settle_ms > 0)? (int)settle_ms: 1;
+        if (wake_fd < 0 && (timeout < 0 || timeout > 1000))
+            timeout = 1000; // Nothing will wake us: check stop_flag every second
+        int ready = epoll_wait(epoll_fd, events, 2, timeout);
+
+        if (ready < 0 && errno != EINTR) {
+            LOG_ERROR("Thread %lu: epoll_wait failed: %s", pthread_self(), strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            if (events[i].data.fd == wake_fd) {
+                uint64_t count;
+                ssize_t drained = read(wake_fd, &count, sizeof(count));
+                (void)drained;
+            } else {
+                handle_events();
+            }
+        }
     }
 
-    if (dir != NULL)
-        closedir(dir);
+    close(epoll_fd);
+    close(inotify_fd);
+    inotify_fd = -1;
+    release_watches();
 
-    printf("Thread %lu: Exiting gracefully.\n", pthread_self());
+    LOG_INFO("Thread %lu: Exiting gracefully.", pthread_self());
     return NULL;
-}
\ No newline at end of file
+}
@@ -1,36 +1,495 @@
-#include<stdio.h>     
-#include<stdlib.h>     
-#include<string.h>     
-#include<stdbool.h>    
-#include<file_tracker.h> 
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdbool.h>
+#include<stdint.h>
+#include<inttypes.h>
+#include<stdatomic.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<pthread.h>
+#include<sys/file.h>
+#include<uthash.h>
+#include<file_tracker.h>
+#include<log.h>
 
-processed_file_t *processed_files = NULL; 
+#define TRACKER_JOURNAL_HEADER "# ParallelPixels processed files v1\n"
 
-// Function to add a filename to the hash table
-void add_processed_file(const char *filename) {
-    processed_file_t *entry = malloc(sizeof(processed_file_t));
-    if (!entry) {
-        perror("add_processed_file: Failed to allocate memory for hash entry");
-        return; 
+// Hash table entry: no path is kept, only its hash (the hash key) and the identity of the file's content
+typedef struct {
+    uint64_t key;               // FNV-1a hash of the path
+    int64_t size;
+    int64_t mtime_ns;
+    _Atomic uint32_t seen;      // Sweep generation in which the file was last looked up (set under the read lock)
+    bool done;                  // Output written and journaled
+    bool claimed;               // Queued and still in the pipeline; neither claimed nor done: failed, until it changes
+    atomic_bool dirty;          // Claimed, and seen since with another size or mtime (set under the read lock)
+    UT_hash_handle hh;
+} processed_file_t;
+
+static processed_file_t *processed_files = NULL;
+static pthread_rwlock_t tracker_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t compact_lock = PTHREAD_MUTEX_INITIALIZER;   // Compaction runs under the read lock
+
+// Under the write lock (or the read lock for compaction, which excludes every writer too)
+static size_t num_done = 0;             // Entries with `done` set: the live records of the journal
+static uint32_t generation = 0;
+
+static struct {
+    char *path;                 // NULL: memory only
+    int fd;
+    size_t records;             // Records in the file, live or not
+    bool failed;                // A write failed: logged once, then memory only
+    atomic_bool compact_due;    // Set by a sweep that evicted completed files, or a torn journal
+} journal = { NULL, -1, 0, false, false };
+
+static uint64_t path_key(const char *path) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *)path; *p != '\0'; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
     }
+    return hash;
+}
+
+static int64_t mtime_ns_of(const struct stat *st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
 
-    strncpy(entry->name, filename, sizeof(entry->name) - 1);
-    entry->name[sizeof(entry->name) - 1] = '\0'; 
-    HASH_ADD_STR(processed_files, name, entry);
+static bool same_version(const processed_file_t *entry, const struct stat *st) {
+    return entry->size == (int64_t)st->st_size && entry->mtime_ns == mtime_ns_of(st);
 }
 
-// Function to check if a filename is in the hash table
-bool was_file_processed(const char *filename) {
+static processed_file_t *find_entry(uint64_t key) {
     processed_file_t *entry;
-    HASH_FIND_STR(processed_files, filename, entry);
-    return entry != NULL;
+    HASH_FIND(hh, processed_files, &key, sizeof(key), entry);
+    return entry;
+}
+
+static processed_file_t *insert_entry(uint64_t key) {
+    processed_file_t *entry = calloc(1, sizeof(processed_file_t));
+    if (!entry) {
+        perror("file_tracker: Failed to allocate memory for hash entry");
+        return NULL;
+    }
+
+    entry->key = key;
+    HASH_ADD(hh, processed_files, key, sizeof(entry->key), entry);
+    return entry;
+}
+
+static void delete_entry(processed_file_t *entry) {
+    if (entry->done)
+        num_done--;
+    HASH_DEL(processed_files, entry);
+    free(entry);
+}
+
+// Caller holds the write lock
+static void append_record(const char *record, size_t length) {
+    if (journal.fd < 0 || journal.failed)
+        return;
+
+    // O_APPEND and a single write: a crash leaves at most the last record torn
+    if (write(journal.fd, record, length) != (ssize_t)length) {
+        LOG_ERROR("File tracker: Failed to append to %s (%s); keeping the record in memory only from now on",
+                  journal.path, strerror(errno));
+        journal.failed = true;
+        return;
+    }
+
+    journal.records++;
+}
+
+/*
+    Opens and locks the journal. A compaction by the process that held the lock before may have renamed a
+    new journal over the file just opened: the lock only counts once it is held on the file the path names.
+*/
+static int open_for_append(void) {
+    while (1) {
+        int fd = open(journal.path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            LOG_ERROR("File tracker: Failed to open %s: %s", journal.path, strerror(errno));
+            return -1;
+        }
+
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+            int error = errno;
+            close(fd);
+
+            if (error == EWOULDBLOCK) {
+                LOG_ERROR("File tracker: %s is in use by another process", journal.path);
+                return TRACKER_JOURNAL_IN_USE;
+            }
+
+            LOG_ERROR("File tracker: Failed to lock %s: %s", journal.path, strerror(error));
+            return -1;
+        }
+
+        struct stat held, named;
+        if (fstat(fd, &held) == 0 && stat(journal.path, &named) == 0 &&
+            held.st_dev == named.st_dev && held.st_ino == named.st_ino) {
+            journal.fd = fd;
+            return 0;
+        }
+
+        close(fd);
+    }
+}
+
+/*
+    Rewrites the journal with one record per completed file, then renames it over the old one, so a crash
+    at any point leaves either journal whole. Caller holds the write lock, or the read lock and compact_lock.
+*/
+static int compact_journal(void) {
+    size_t length = strlen(journal.path);
+    char *tmp_path = malloc(length + 5);
+    if (tmp_path == NULL) {
+        perror("file_tracker: Failed to allocate memory for the journal path");
+        return -1;
+    }
+    sprintf(tmp_path, "%s.tmp", journal.path);
+
+    FILE *out = fopen(tmp_path, "w");
+    if (out == NULL) {
+        LOG_ERROR("File tracker: Failed to create %s: %s", tmp_path, strerror(errno));
+        free(tmp_path);
+        return -1;
+    }
+
+    fputs(TRACKER_JOURNAL_HEADER, out);
+
+    processed_file_t *entry, *tmp;
+    HASH_ITER(hh, processed_files, entry, tmp) {
+        if (entry->done)
+            fprintf(out, "+ %016" PRIx64 " %" PRId64 " %" PRId64 "\n", entry->key, entry->size, entry->mtime_ns);
+    }
+
+    bool ok = (fflush(out) == 0 && fdatasync(fileno(out)) == 0);
+    ok = (fclose(out) == 0) && ok;
+
+    if (!ok || rename(tmp_path, journal.path) != 0) {
+        LOG_ERROR("File tracker: Failed to compact %s: %s", journal.path, strerror(errno));
+        unlink(tmp_path);
+        free(tmp_path);
+        return -1;
+    }
+
+    free(tmp_path);
+
+    // The old descriptor (and its lock) belongs to the replaced file
+    if (journal.fd >= 0)
+        close(journal.fd);
+    journal.fd = -1;
+
+    if (open_for_append() != 0) {
+        journal.failed = true;
+        return -1;
+    }
+
+    LOG_DEBUG("File tracker: Compacted %s from %zu to %zu records", journal.path, journal.records, num_done);
+    journal.records = num_done;
+    atomic_store(&journal.compact_due, false);
+    return 0;
+}
+
+static bool compaction_due(void) {
+    if (journal.fd < 0 || journal.failed)
+        return false;
+    if (atomic_load(&journal.compact_due))
+        return true;
+    return journal.records > TRACKER_COMPACT_MIN_RECORDS && journal.records > 2 * num_done;
+}
+
+/*
+    Replays a journal into the table. A line that does not parse (the torn last record of a crash) is
+    skipped and makes the journal due for compaction. Returns -1 if the file is not a journal.
+*/
+static int load_journal(FILE *in) {
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    bool first = true;
+
+    while ((length = getline(&line, &capacity, in)) > 0) {
+        if (first) {
+            first = false;
+            if (strcmp(line, TRACKER_JOURNAL_HEADER) != 0) {
+                free(line);
+                return -1;
+            }
+            continue;
+        }
+
+        uint64_t key;
+        int64_t size, mtime_ns;
+        char tail;
+
+        journal.records++;
+
+        if (line[length - 1] != '\n') {
+            atomic_store(&journal.compact_due, true);
+        } else if (sscanf(line, "+ %" SCNx64 " %" SCNd64 " %" SCNd64 "%c", &key, &size, &mtime_ns, &tail) == 4) {
+            processed_file_t *entry = find_entry(key);
+            if (entry == NULL && (entry = insert_entry(key)) == NULL)
+                break;
+            if (!entry->done)
+                num_done++;
+            entry->size = size;
+            entry->mtime_ns = mtime_ns;
+            entry->done = true;
+        } else if (sscanf(line, "- %" SCNx64 "%c", &key, &tail) == 2) {
+            processed_file_t *entry = find_entry(key);
+            if (entry != NULL)
+                delete_entry(entry);
+        } else {
+            atomic_store(&journal.compact_due, true);
+        }
+    }
+
+    free(line);
+    return 0;
+}
+
+int file_tracker_open(const char *journal_path) {
+    if (journal_path == NULL)
+        return 0;
+
+    journal.path = strdup(journal_path);
+    if (journal.path == NULL) {
+        perror("file_tracker_open: Failed to allocate memory for the journal path");
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&tracker_lock);
+
+    // Locked before it is read: a journal another run is still appending to is not loaded half written
+    int status = open_for_append();
+    if (status != 0) {
+        pthread_rwlock_unlock(&tracker_lock);
+        return status;
+    }
+
+    int read_fd = dup(journal.fd);
+    FILE *in = (read_fd >= 0)? fdopen(read_fd, "r"): NULL;
+    if (in == NULL) {
+        LOG_ERROR("File tracker: Failed to read %s: %s", journal.path, strerror(errno));
+        if (read_fd >= 0)
+            close(read_fd);
+        close(journal.fd);
+        journal.fd = -1;
+        pthread_rwlock_unlock(&tracker_lock);
+        return -1;
+    }
+
+    status = load_journal(in);
+    fclose(in);
+
+    if (status != 0) {
+        LOG_ERROR("File tracker: %s is not a processed-files journal; leaving it alone", journal.path);
+        close(journal.fd);
+        journal.fd = -1;
+        pthread_rwlock_unlock(&tracker_lock);
+        return -1;
+    }
+
+    bool fresh = (journal.records == 0 && HASH_COUNT(processed_files) == 0);
+
+    if (fresh) {
+        // Empty or new: start it with the header
+        if (ftruncate(journal.fd, 0) != 0 ||
+            write(journal.fd, TRACKER_JOURNAL_HEADER, strlen(TRACKER_JOURNAL_HEADER)) < 0) {
+            LOG_ERROR("File tracker: Failed to write %s: %s", journal.path, strerror(errno));
+            close(journal.fd);
+            journal.fd = -1;
+            status = -1;
+        }
+    } else if (compaction_due()) {
+        compact_journal();
+    }
+
+    if (status == 0)
+        LOG_INFO("File tracker: %zu processed files from %s (%zu records)", num_done, journal.path, journal.records);
+
+    pthread_rwlock_unlock(&tracker_lock);
+    return status;
+}
+
+bool was_file_processed(const char *filename, const struct stat *st) {
+    uint64_t key = path_key(filename);
+    bool processed = false;
+
+    pthread_rwlock_rdlock(&tracker_lock);
+
+    processed_file_t *entry = find_entry(key);
+    if (entry != NULL) {
+        atomic_store_explicit(&entry->seen, generation, memory_order_relaxed);
+        processed = entry->claimed || same_version(entry, st);
+
+        // A claimed file is not queued twice (images are keyed by name downstream): it is queued again once done
+        if (entry->claimed && !same_version(entry, st))
+            atomic_store_explicit(&entry->dirty, true, memory_order_relaxed);
+    }
+
+    pthread_rwlock_unlock(&tracker_lock);
+    return processed;
+}
+
+bool add_processed_file(const char *filename, const struct stat *st) {
+    uint64_t key = path_key(filename);
+    bool claimed = false;
+
+    pthread_rwlock_wrlock(&tracker_lock);
+
+    processed_file_t *entry = find_entry(key);
+    if (entry == NULL)
+        entry = insert_entry(key);
+
+    if (entry != NULL && entry->claimed) {
+        if (!same_version(entry, st))
+            atomic_store_explicit(&entry->dirty, true, memory_order_relaxed);
+    } else if (entry != NULL) {
+        // A new version stays out of the journal until it is done too; the old record holds until then
+        if (entry->done)
+            num_done--;
+        entry->done = false;
+        entry->claimed = true;
+        atomic_store_explicit(&entry->dirty, false, memory_order_relaxed);
+        entry->size = (int64_t)st->st_size;
+        entry->mtime_ns = mtime_ns_of(st);
+        atomic_store_explicit(&entry->seen, generation, memory_order_relaxed);
+        claimed = true;
+    }
+
+    pthread_rwlock_unlock(&tracker_lock);
+
+    // Without memory for an entry the file is queued untracked, as before the tracker
+    return claimed || entry == NULL;
+}
+
+bool file_tracker_commit(const char *filename) {
+    uint64_t key = path_key(filename);
+    bool dirty = false;
+
+    pthread_rwlock_wrlock(&tracker_lock);
+
+    processed_file_t *entry = find_entry(key);
+    if (entry != NULL && entry->claimed) {
+        // The version that was processed is the one journaled, changed since or not
+        entry->claimed = false;
+        entry->done = true;
+        num_done++;
+        dirty = atomic_exchange_explicit(&entry->dirty, false, memory_order_relaxed);
+
+        char record[64];
+        int length = snprintf(record, sizeof(record), "+ %016" PRIx64 " %" PRId64 " %" PRId64 "\n",
+                              entry->key, entry->size, entry->mtime_ns);
+        append_record(record, (size_t)length);
+    }
+
+    pthread_rwlock_unlock(&tracker_lock);
+    return dirty;
+}
+
+bool file_tracker_release(const char *filename) {
+    uint64_t key = path_key(filename);
+    bool dirty = false;
+
+    pthread_rwlock_wrlock(&tracker_lock);
+
+    // Kept, neither claimed nor done: not queued again until its size or mtime changes
+    processed_file_t *entry = find_entry(key);
+    if (entry != NULL && entry->claimed) {
+        entry->claimed = false;
+        dirty = atomic_exchange_explicit(&entry->dirty, false, memory_order_relaxed);
+    }
+
+    pthread_rwlock_unlock(&tracker_lock);
+    return dirty;
+}
+
+void file_tracker_forget(const char *filename) {
+    uint64_t key = path_key(filename);
+
+    pthread_rwlock_wrlock(&tracker_lock);
+
+    processed_file_t *entry = find_entry(key);
+    if (entry != NULL && entry->claimed) {
+        // Still in the pipeline: dropped once done, when it is found gone
+        atomic_store_explicit(&entry->dirty, true, memory_order_relaxed);
+    } else if (entry != NULL) {
+        if (entry->done) {
+            char record[32];
+            int length = snprintf(record, sizeof(record), "- %016" PRIx64 "\n", entry->key);
+            append_record(record, (size_t)length);
+        }
+        delete_entry(entry);
+    }
+
+    pthread_rwlock_unlock(&tracker_lock);
+}
+
+void file_tracker_begin_sweep(void) {
+    pthread_rwlock_wrlock(&tracker_lock);
+    generation++;
+    pthread_rwlock_unlock(&tracker_lock);
+}
+
+size_t file_tracker_sweep(void) {
+    size_t evicted = 0;
+    bool journaled = false;
+
+    pthread_rwlock_wrlock(&tracker_lock);
+
+    // No "-" records: the compaction that follows drops them all at once (a crash before it is harmless,
+    // the next sweep evicts them again)
+    processed_file_t *entry, *tmp;
+    HASH_ITER(hh, processed_files, entry, tmp) {
+        if (atomic_load_explicit(&entry->seen, memory_order_relaxed) != generation && !entry->claimed) {
+            journaled = journaled || entry->done;
+            delete_entry(entry);
+            evicted++;
+        }
+    }
+
+    if (journaled)
+        atomic_store(&journal.compact_due, true);
+
+    pthread_rwlock_unlock(&tracker_lock);
+    return evicted;
+}
+
+void file_tracker_maintain(void) {
+    pthread_rwlock_rdlock(&tracker_lock);
+    pthread_mutex_lock(&compact_lock);
+    if (compaction_due())
+        compact_journal();
+    pthread_mutex_unlock(&compact_lock);
+    pthread_rwlock_unlock(&tracker_lock);
 }
 
 // Function to free the hash table (call this at cleanup)
 void free_processed_files(void) {
+    pthread_rwlock_wrlock(&tracker_lock);
+
+    if (compaction_due())
+        compact_journal();
+
+    if (journal.fd >= 0) {
+        fdatasync(journal.fd);
+        close(journal.fd);
+        journal.fd = -1;
+    }
+    free(journal.path);
+    journal.path = NULL;
+
     processed_file_t *current_entry, *tmp;
     HASH_ITER(hh, processed_files, current_entry, tmp) {
-        HASH_DEL(processed_files, current_entry); 
-        free(current_entry); 
+        HASH_DEL(processed_files, current_entry);
+        free(current_entry);
     }
-}
\ No newline at end of file
+    num_done = 0;
+
+    pthread_rwlock_unlock(&tracker_lock);
+}
@@ -6,33 +6,216 @@
 #include<math.h>      
 #include<signal.h>     
 #include<pthread.h>    
+#include<stdbool.h>
+#include<limits.h>
+#include<errno.h>
+#include<sys/stat.h>
 #include<stb_image.h>  
 #include<image_chunker.h>     
 #include<image_queue.h>      
+#include<directory_monitor.h>
+#include<content_dedup.h>
 #include<image.h>
+#include<planar.h>
+#include<chunk_threader.h>
+#include<log.h>
 
 extern volatile sig_atomic_t stop_flag;
 extern image_name_queue_t name_queue;
 extern chunk_queue_t chunker_filtering_queue;
 
-unsigned char *load_image(const char *filename, int *width, int *height, int *channels) {
-    unsigned char *data = stbi_load(filename, width, height, channels, 0);
+// Set once by main() before the chunker threads start
+static bool chunker_zero_copy = false;
+
+static chunk_tiling_t chunker_tiling = CHUNK_TILING_TILES;
+static int chunker_chunk_size = 0;
+
+// Every route has the halo of its own filter chain
+static struct {
+    size_t halo_x, halo_y;
+    chunk_halo_fn fn;
+    const void *context;
+} chunker_halos[IMAGE_MAX_ROUTES];
+
+static image_layout_t chunker_layout = IMAGE_LAYOUT_INTERLEAVED;
+
+static image_sample_t chunker_sample = IMAGE_SAMPLE_U8;
+
+void chunker_set_zero_copy(bool enabled) {
+    chunker_zero_copy = enabled;
+}
+
+void chunker_set_tiling(chunk_tiling_t tiling, int size) {
+    chunker_tiling = tiling;
+    chunker_chunk_size = (size > 0)? size: 0;
+}
+
+void chunker_set_halo(int route, size_t halo_x, size_t halo_y) {
+    if (route < 0 || route >= IMAGE_MAX_ROUTES)
+        return;
+    chunker_halos[route].halo_x = halo_x;
+    chunker_halos[route].halo_y = halo_y;
+}
+
+void chunker_set_halo_fn(int route, chunk_halo_fn fn, const void *context) {
+    if (route < 0 || route >= IMAGE_MAX_ROUTES)
+        return;
+    chunker_halos[route].fn = fn;
+    chunker_halos[route].context = context;
+}
+
+void chunker_set_layout(image_layout_t layout) {
+    chunker_layout = layout;
+}
+
+void chunker_set_sample_type(image_sample_t sample) {
+    chunker_sample = sample;
+}
+
+static inline size_t min_size(size_t a, size_t b) {
+    return (a < b)? a: b;
+}
+
+// 16-bit samples as floats in 0..1, in a new buffer; `samples` is freed
+static float *widen_to_float(stbi_us *samples, size_t count) {
+    float *data = (float *)malloc(count * sizeof(float));
+
+    if (data != NULL) {
+        for (size_t i = 0; i < count; i++)
+            data[i] = samples[i] * (1.0f / 65535.0f);
+    }
+
+    stbi_image_free(samples);
+    return data;
+}
+
+/*
+    The whole file in a malloc'd buffer: decoded from memory, and hashed for deduplication on the way. `st`
+    receives the file's stat once it has been read, to tell whether it was still being written.
+*/
+static unsigned char *read_image_file(const char *filename, size_t *size, struct stat *st) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        LOG_ERROR("Error opening image '%s': %s", filename, strerror(errno));
+        return NULL;
+    }
+
+    unsigned char *data = NULL;
+    long length = (fseek(file, 0, SEEK_END) == 0)? ftell(file): -1;
+
+    if (length >= 0 && length <= INT_MAX && fseek(file, 0, SEEK_SET) == 0 && (data = malloc((size_t)length + 1)) != NULL) {
+        *size = fread(data, 1, (size_t)length, file);
+        if (ferror(file) || fstat(fileno(file), st) != 0) {
+            free(data);
+            data = NULL;
+        }
+    }
+
+    if (data == NULL)
+        LOG_ERROR("Error reading image '%s'", filename);
+
+    fclose(file);
+    return data;
+}
+
+/*
+    A JPEG ends with an EOI marker and a PNG with its IEND chunk; a file caught in the middle of a copy has
+    neither. The decoders do not always notice (a truncated JPEG decodes, grey from the cut on), so the end
+    is checked before decoding. The marker is looked for in the last few KiB to allow trailing padding; a
+    file with more after it (a motion photo, appended metadata) only waits until it stops changing.
+    Other formats are left to the decoder.
+*/
+static bool image_file_complete(const unsigned char *data, size_t size) {
+    bool jpeg = size >= 2 && data[0] == 0xFF && data[1] == 0xD8;
+    bool png = size >= 8 && memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0;
+    bool complete = !jpeg && !png;
+    size_t from = (size > 4096)? size - 4096: 0;
+
+    for (size_t i = size; i >= from + 4 && !complete; i--) {
+        const unsigned char *p = data + i - 4;
+        complete = jpeg? (p[2] == 0xFF && p[3] == 0xD9): (memcmp(p, "IEND", 4) == 0);
+    }
+
+    return complete;
+}
+
+unsigned char *load_image(const char *filename, const unsigned char *file_data, size_t file_size, image_sample_t sample,
+                          int *width, int *height, int *channels) {
+    unsigned char *data;
+    const char *depth = "8-bit";
+    int length = (int)file_size; // read_image_file() keeps it within int
+
+    if (sample == IMAGE_SAMPLE_U8) {
+        data = stbi_load_from_memory(file_data, length, width, height, channels, 0);
+    } else if (sample == IMAGE_SAMPLE_F32 && stbi_is_hdr_from_memory(file_data, length)) {
+        // Linear radiance as decoded, no tone mapping
+        data = (unsigned char *)stbi_loadf_from_memory(file_data, length, width, height, channels, 0);
+        depth = "HDR";
+    } else {
+        // 8-bit sources come back widened to 16 bits
+        if (stbi_is_16_bit_from_memory(file_data, length))
+            depth = "16-bit";
+        data = (unsigned char *)stbi_load_16_from_memory(file_data, length, width, height, channels, 0);
+
+        if (data != NULL && sample == IMAGE_SAMPLE_F32) {
+            data = (unsigned char *)widen_to_float((stbi_us *)data, (size_t)*width * *height * *channels);
+            if (data == NULL) {
+                LOG_ERROR("Error converting image '%s' to float samples", filename);
+                return NULL;
+            }
+        }
+    }
+
     if (data == NULL) {
-        fprintf(stderr, "Error loading image '%s': %s\n", filename, stbi_failure_reason());
+        LOG_ERROR("Error loading image '%s': %s", filename, stbi_failure_reason());
         return NULL;
     }
 
-    printf("Loaded image '%s' (%d x %d, %d channels)\n", filename, *width, *height, *channels);
+    LOG_INFO("Loaded image '%s' (%d x %d, %d channels, %s)", filename, *width, *height, *channels, depth);
     return data;
 }
 
-static int create_chunks_internal(const char *original_filename,
+/*
+    Hands `*count` chunks to the filter stage in one batch (the chunker->filtering queue, or this thread's
+    deque under the work-stealing scheduler). On a partial submit (shutdown or allocation failure) the
+    chunks that were not taken are moved to the front of the array and `*count` is updated so the caller
+    can free them.
+*/
+static int publish_chunks(image_chunk_t **chunks, size_t *count, int *published, const char *original_filename) {
+    if (*count == 0)
+        return 0;
+
+    size_t enqueued = filter_pool_submit(chunks, *count);
+    *published += (int)enqueued;
+
+    if (enqueued != *count) {
+        LOG_ERROR("Thread %lu: create_chunks_internal: Failed to enqueue chunk %d for %s",
+                pthread_self(), chunks[enqueued]->chunk_id, original_filename);
+
+        memmove(chunks, chunks + enqueued, (*count - enqueued) * sizeof(image_chunk_t *));
+        *count -= enqueued;
+        return -1;
+    }
+
+    *count = 0;
+    return 0;
+}
+
+// Numbers every decode, so reconstruction can tell an image queued again from an abandoned earlier attempt
+static _Atomic uint64_t next_ingest = 1;
+
+/*
+    With `source` set, chunks are views into the shared decoded image instead of copies: no per-tile
+    allocation or memcpy, and the memory budget is charged once for the whole buffer.
+*/
+static int create_chunks_internal(const char *original_filename, int route,
                                               unsigned char *image_data,
                                               int width, int height, int channels,
-                                              int chunk_width, int chunk_height)
+                                              int chunk_width, int chunk_height,
+                                              image_buffer_t *source)
 {
     if (!image_data || width <= 0 || height <= 0 || channels <= 0 || chunk_width <= 0 || chunk_height <= 0) {
-        fprintf(stderr, "Thread %lu: create_chunks_internal: Invalid input parameters for %s.\n", pthread_self(), original_filename);
+        LOG_ERROR("Thread %lu: create_chunks_internal: Invalid input parameters for %s.", pthread_self(), original_filename);
         return -1;
     }
 
@@ -41,25 +224,39 @@ static int create_chunks_internal(const char *original_filename,
     int num_chunks_total = num_chunks_x * num_chunks_y;
 
     if (num_chunks_total <= 0) {
-         fprintf(stderr, "Thread %lu: create_chunks_internal: Calculated zero chunks for %s.\n", pthread_self(), original_filename);
+         LOG_ERROR("Thread %lu: create_chunks_internal: Calculated zero chunks for %s.", pthread_self(), original_filename);
          return -1;
     }
 
-/*     image_chunk_t **chunks = (image_chunk_t **)malloc(*num_chunks_total * sizeof(image_chunk_t *));
-    if (chunks == NULL) {
-        perror("create_chunks_internal: Failed to allocate memory for chunk array");
-        return NULL; // Should return -1 to match function signature
-    } */
+    /*
+        Chunks are published one row of tiles at a time, so the queue lock is taken (and consumers woken)
+        once per row instead of once per tile.
+    */
 
+    image_chunk_t **row_chunks = (image_chunk_t **)malloc(num_chunks_x * sizeof(image_chunk_t *));
+    if (row_chunks == NULL) {
+        perror("create_chunks_internal: Failed to allocate memory for chunk row");
+        discard_image(original_filename, route);
+        return -1;
+    }
+
+    size_t row_count = 0;       // chunks of the current row not yet handed to the queue
     int current_chunk_index = 0;
+    int published_chunks = 0;
     int exit_status = 0; // Track if any chunk fails
 
     // channels -> RGB, Grayscale, etc.
-    // RGB contains 3 bytes per pixel (0-255, 0-255, 0-255)
+    // RGB contains 3 samples per pixel (0-255, 0-255, 0-255 with 8-bit samples)
+
+    size_t bytes_per_pixel = channels * image_sample_bytes(chunker_sample);
+
+    size_t halo_x = chunker_halos[route].halo_x, halo_y = chunker_halos[route].halo_y;
+    if (chunker_halos[route].fn != NULL)
+        chunker_halos[route].fn((size_t)width, (size_t)height, &halo_x, &halo_y, chunker_halos[route].context);
 
-    size_t bytes_per_pixel = channels;
+    LOG_DEBUG("Thread %lu: Creating %d chunks for %s...", pthread_self(), num_chunks_total, original_filename);
 
-    printf("Thread %lu: Creating %d chunks for %s...\n", pthread_self(), num_chunks_total, original_filename);
+    uint64_t ingest = atomic_fetch_add(&next_ingest, 1);
 
     for (int cy = 0; cy < num_chunks_y && !stop_flag; cy++) { // Check stop_flag
         for (int cx = 0; cx < num_chunks_x && !stop_flag; cx++) { // Check stop_flag
@@ -72,7 +269,14 @@ static int create_chunks_internal(const char *original_filename,
             }
 
             chunk->original_image_name = NULL;
+            chunk->route = route;
+            chunk->ingest = ingest;
             chunk->pixel_data = NULL;
+            chunk->source = NULL;
+            chunk->halo_left = chunk->halo_top = chunk->halo_right = chunk->halo_bottom = 0;
+            chunk->sample = chunker_sample;
+            chunk->layout = IMAGE_LAYOUT_INTERLEAVED;
+            chunk->plane_size = 0;
 
 
             chunk->offset_x = cx * chunk_width;
@@ -102,104 +306,236 @@ static int create_chunks_internal(const char *original_filename,
             }
 
             chunk->data_size_bytes = chunk->width * chunk->height * bytes_per_pixel;
-            chunk->pixel_data = (unsigned char*)malloc(chunk->data_size_bytes);
-            if (chunk->pixel_data == NULL) {
-                perror("create_chunks_internal: Failed to allocate memory for chunk pixel data");
-                free_image_chunk(chunk);
-                exit_status = -1;
-                goto cleanup_loop;
-            }
 
-            /*
-                The pixel data in the orignal image & chunk is saved as a linear sequeunce of bytes, within each byte is contained
-                a single value of R, G or B for a pixel:
+            if (source != NULL) {
+                image_buffer_retain(source);
+                chunk->source = source;
+                chunk->row_stride = source->row_stride;
+                chunk->pixel_data = source->pixels + chunk->offset_y * source->row_stride + chunk->offset_x * bytes_per_pixel;
+            } else {
+                // Neighbouring pixels the filters need, as far as the image extends
+                chunk->halo_left = min_size(halo_x, chunk->offset_x);
+                chunk->halo_top = min_size(halo_y, chunk->offset_y);
+                chunk->halo_right = min_size(halo_x, width - (chunk->offset_x + chunk->width));
+                chunk->halo_bottom = min_size(halo_y, height - (chunk->offset_y + chunk->height));
+
+                size_t copy_width = chunk->halo_left + chunk->width + chunk->halo_right;
+                size_t copy_height = chunk->halo_top + chunk->height + chunk->halo_bottom;
+                size_t copy_x = chunk->offset_x - chunk->halo_left;
+                size_t copy_y = chunk->offset_y - chunk->halo_top;
+
+                // Planes are split byte-wise: wide samples stay interleaved
+                bool planar = (chunker_layout == IMAGE_LAYOUT_PLANAR && chunker_sample == IMAGE_SAMPLE_U8);
+                size_t plane_stride = planar_row_stride(copy_width);
+
+                chunk->data_size_bytes = planar? plane_stride * copy_height * bytes_per_pixel:
+                                                 copy_width * copy_height * bytes_per_pixel;
+
+                // Throttle here when the pipeline already holds the configured amount of pixel data. The partial
+                // row is published first: its tiles count against the budget and must be able to drain.
+                if (chunk_memory_try_acquire(chunk->data_size_bytes) != 0) {
+                    if (publish_chunks(row_chunks, &row_count, &published_chunks, original_filename) != 0 ||
+                        chunk_memory_acquire(chunk->data_size_bytes) != 0) {
+                        free_image_chunk(chunk);
+                        exit_status = -1;
+                        goto cleanup_loop;
+                    }
+                }
+
+                // Planes start on cache lines: every plane is a whole number of 64-byte rows
+                unsigned char *buffer = planar? (unsigned char*)aligned_alloc(PLANAR_ALIGNMENT, chunk->data_size_bytes):
+                                                (unsigned char*)malloc(chunk->data_size_bytes);
+                if (buffer == NULL) {
+                    perror("create_chunks_internal: Failed to allocate memory for chunk pixel data");
+                    chunk_memory_release(chunk->data_size_bytes);
+                    free_image_chunk(chunk);
+                    exit_status = -1;
+                    goto cleanup_loop;
+                }
 
-                For Example: Consider an image containing 2 pixels only (each pixel takes 3 bytes due to RGB channel)
-                unsigned char* image_data = [0, 255, 255, 255, 255, 255]
+                /*
+                    The pixel data in the orignal image & chunk is saved as a linear sequeunce of bytes, within each byte is contained
+                    a single value of R, G or B for a pixel:
 
-                The sequence of bytes is stored as follows: [P(0, 0)-R, P(0, 0)-G, P(0, 0)-B, P(0, 1)-R, P(0, 1)-G, P(0, 1)-B]
-            */
+                    For Example: Consider an image containing 2 pixels only (each pixel takes 3 bytes due to RGB channel)
+                    unsigned char* image_data = [0, 255, 255, 255, 255, 255]
 
-            size_t src_row_stride = width * bytes_per_pixel; // bytes per row in the image
-            size_t chunk_row_bytes = chunk->width * bytes_per_pixel; // Bytes to copy per row for this chunk
+                    The sequence of bytes is stored as follows: [P(0, 0)-R, P(0, 0)-G, P(0, 0)-B, P(0, 1)-R, P(0, 1)-G, P(0, 1)-B]
+                */
 
-            for(size_t row = 0; row < chunk->height; row++) {
+                size_t src_row_stride = width * bytes_per_pixel; // bytes per row in the image
+                size_t chunk_row_bytes = copy_width * bytes_per_pixel; // Bytes to copy per row for this chunk, halo included
 
-                /*
-                    Writing the bytes row by row, because data for a single chunk is not contigously stored.
-                    `(chunk->offset_y + row) * src_row_stride` is the number of bytes to skip from the start of the image.
-                    `chunk->offset_x * bytes_per_pixel` is the number of bytes to skip from the start of the row
-                */
+                if (planar) {
+                    unsigned char *planes[PLANAR_MAX_CHANNELS];
+                    size_t plane_size = plane_stride * copy_height;
 
-                unsigned char *src_ptr = image_data + (chunk->offset_y + row) * src_row_stride + chunk->offset_x * bytes_per_pixel;
+                    for (int c = 0; c < channels; c++)
+                        planes[c] = buffer + c * plane_size;
 
-                /*
-                    The destination pointer only needs to calculate the pointer offset for the current row; Since,
-                    only the chunk width number of bytes needs to be written
+                    planar_deinterleave(image_data + copy_y * src_row_stride + copy_x * bytes_per_pixel, src_row_stride,
+                                        channels, copy_width, copy_height, planes, plane_stride);
 
-                */
+                    chunk->layout = IMAGE_LAYOUT_PLANAR;
+                    chunk->plane_size = plane_size;
+                    chunk->row_stride = plane_stride;
+                    chunk->pixel_data = buffer + chunk->halo_top * plane_stride + chunk->halo_left;
+                }
 
-                unsigned char *dst_ptr = chunk->pixel_data + row * chunk_row_bytes; // Use chunk_row_bytes for destination offset
+                // A full-width strip is one contiguous block of the image
+                else if (chunk_row_bytes == src_row_stride) {
+                    memcpy(buffer, image_data + copy_y * src_row_stride, chunk->data_size_bytes);
+                }
 
+                else for(size_t row = 0; row < copy_height; row++) {
 
-                memcpy(dst_ptr, src_ptr, chunk_row_bytes); // Copy only the chunk's width worth of bytes
-            }
+                    /*
+                        Writing the bytes row by row, because data for a single chunk is not contigously stored.
+                        `(copy_y + row) * src_row_stride` is the number of bytes to skip from the start of the image.
+                        `copy_x * bytes_per_pixel` is the number of bytes to skip from the start of the row
+                    */
 
-            // Enqueueing the chunk as it is created
+                    unsigned char *src_ptr = image_data + (copy_y + row) * src_row_stride + copy_x * bytes_per_pixel;
 
-            chunk->processing_status = CHUNK_STATUS_CREATED;
-            if (chunk_enqueue(&chunker_filtering_queue, chunk) != 0) {
-                fprintf(stderr, "Thread %lu: create_chunks_internal: Failed to enqueue chunk %d for %s\n",
-                        pthread_self(), current_chunk_index, original_filename);
-                free_image_chunk(chunk); 
-                exit_status = -1;
-                goto cleanup_loop; 
-            } else {
-                // Successfully enqueued, ownership transferred to queue.
-                // Do NOT free 'chunk' here.
+                    /*
+                        The destination pointer only needs to calculate the pointer offset for the current row; Since,
+                        only the chunk width number of bytes needs to be written
+
+                    */
+
+                    unsigned char *dst_ptr = buffer + row * chunk_row_bytes; // Use chunk_row_bytes for destination offset
+
+
+                    memcpy(dst_ptr, src_ptr, chunk_row_bytes); // Copy only the chunk's width worth of bytes
+                }
+
+                if (!planar) {
+                    chunk->row_stride = chunk_row_bytes;
+                    chunk->pixel_data = buffer + chunk->halo_top * chunk_row_bytes + chunk->halo_left * bytes_per_pixel;
+                }
             }
 
+            chunk->processing_status = CHUNK_STATUS_CREATED;
             current_chunk_index++;
+
+            // Fused mode: filter the tile right away, while the copy above is still in cache
+            if (filter_pool_fused()) {
+                published_chunks++;
+                if (filter_pool_submit_fused(chunk) != 0) {
+                    exit_status = -1;
+                    goto cleanup_loop;
+                }
+                continue;
+            }
+
+            row_chunks[row_count++] = chunk;
+        }
+
+        if (stop_flag)
+            break;
+
+        // Publish the finished row; blocks while the bounded chunker->filtering queue is full
+        if (publish_chunks(row_chunks, &row_count, &published_chunks, original_filename) != 0) {
+            exit_status = -1;
+            goto cleanup_loop;
         }
     }
 
     cleanup_loop: 
+        // Chunks of a partially built or unpublished row are still owned here
+        for (size_t i = 0; i < row_count; i++)
+            free_image_chunk(row_chunks[i]);
+
+        // Fused mode: finish the tiles no worker stole before moving on to the next image
+        filter_pool_drain_fused();
+
+        free(row_chunks);
+
         if (stop_flag) {
-            printf("Thread %lu: Stop flag detected during chunk creation for %s.\n", pthread_self(), original_filename);
+            LOG_INFO("Thread %lu: Stop flag detected during chunk creation for %s.", pthread_self(), original_filename);
             exit_status = -1; 
         }
 
         if (exit_status == 0) 
-            printf("Thread %lu: Finished creating %d chunks for %s.\n", pthread_self(), current_chunk_index, original_filename);
+            LOG_INFO("Thread %lu: Finished creating %d chunks for %s.", pthread_self(), published_chunks, original_filename);
         else {
-            fprintf(stderr, "Thread %lu: Failed or stopped during chunk creation for %s (processed %d chunks).\n", pthread_self(), original_filename, current_chunk_index);
-            discarded_images_table_add(original_filename);
+            LOG_ERROR("Thread %lu: Failed or stopped during chunk creation for %s (processed %d chunks).", pthread_self(), original_filename, published_chunks);
+            discard_image(original_filename, route);
         }
 
     return exit_status; 
 }
 
 void *chunk_image_thread(void *arg) {
+    // Under the work-stealing scheduler this thread's tiles go to its own deque
+    filter_pool_register_producer();
+
     while(!stop_flag) {
 
-        char* filename = dequeue_image_name(&name_queue);    
+        int route = 0;
+        char* filename = dequeue_image_name(&name_queue, &route);    
         if (filename == NULL) {
-            fprintf(stderr, "Chunk Image Thread: Cannot proceed - filename = NULL\n");
+            LOG_DEBUG("Chunk Image Thread: Cannot proceed - filename = NULL");
             free(filename);
             continue;
         }
 
         int width, height, channels;
-        
-        unsigned char* image_data = load_image(filename, &width, &height, &channels);    
+        size_t file_size = 0;
+        struct stat st;
+
+        unsigned char *file_data = read_image_file(filename, &file_size, &st);
+        if (file_data == NULL) {
+            directory_monitor_retry(filename, route);
+            free(filename);
+            continue;
+        }
+
+        // No end marker: cut short only while the file still changes; once it is stable the decoder decides
+        if (!image_file_complete(file_data, file_size)) {
+            if (st.st_size != (off_t)file_size || !directory_monitor_settled(&st)) {
+                LOG_WARN("Thread %lu: %s looks truncated, not decoding it until it settles", pthread_self(), filename);
+                directory_monitor_defer(filename, route);
+                free(file_data);
+                free(filename);
+                continue;
+            }
+
+            LOG_DEBUG("Thread %lu: %s has no end marker near its end but is not changing, decoding it",
+                      pthread_self(), filename);
+        }
+
+        // Seen before under another name: its output is linked in place, nothing to decode
+        if (dedup_reuse(filename, route, file_data, file_size)) {
+            free(file_data);
+            free(filename);
+            continue;
+        }
+
+        unsigned char* image_data = load_image(filename, file_data, file_size, chunker_sample, &width, &height, &channels);
+        free(file_data);
         if (image_data == NULL) {
-            fprintf(stderr, "Chunk Image Thread: Cannot proceed - Image Data = NULL\n");
+            LOG_ERROR("Chunk Image Thread: Cannot proceed - Image Data = NULL");
+            // It may have been caught half-written; the monitor decides whether to queue it again
+            dedup_abandon(filename);
+            directory_monitor_retry(filename, route);
             free(filename);
             continue;
         }
 
-        const int fixed_chunk_width = 128; 
-        const int fixed_chunk_height = 128; 
+        int fixed_chunk_width, fixed_chunk_height;
+
+        if (chunker_tiling == CHUNK_TILING_STRIPS) {
+            // Full-width bands; by default about CHUNK_DEFAULT_STRIP_BYTES of pixels each
+            size_t row_bytes = (size_t)width * channels * image_sample_bytes(chunker_sample);
+            size_t auto_rows = (row_bytes > 0)? CHUNK_DEFAULT_STRIP_BYTES / row_bytes: 1;
+
+            fixed_chunk_width = width;
+            fixed_chunk_height = (chunker_chunk_size > 0)? chunker_chunk_size: (auto_rows > 0)? (int)auto_rows: 1;
+        } else {
+            fixed_chunk_width = (chunker_chunk_size > 0)? chunker_chunk_size: CHUNK_DEFAULT_TILE_SIZE;
+            fixed_chunk_height = fixed_chunk_width;
+        }
 
         int calc_chunk_width = (width < fixed_chunk_width)? width: fixed_chunk_width;
         int calc_chunk_height = (height < fixed_chunk_height)? height: fixed_chunk_height;
@@ -207,37 +543,76 @@ void *chunk_image_thread(void *arg) {
         if (width > 0 && calc_chunk_width <= 0) calc_chunk_width = 1;
         if (height > 0 && calc_chunk_height <= 0) calc_chunk_height = 1;
 
-        printf("Chunker thread %lu: Processing %s with target chunk size: %dx%d\n",
+        LOG_DEBUG("Chunker thread %lu: Processing %s with target chunk size: %dx%d",
             pthread_self(), filename, calc_chunk_width, calc_chunk_height);
 
+        /*
+            Zero-copy: the decoded image itself is shared by the chunks and lives until the last of them is
+            freed. Its whole size is charged to the memory budget up front, in place of the per-tile charges.
+        */
+        image_buffer_t *source = NULL;
+        if (chunker_zero_copy) {
+            size_t image_bytes = (size_t)width * height * channels * image_sample_bytes(chunker_sample);
+
+            if (chunk_memory_acquire(image_bytes) != 0) {
+                // Shutdown while waiting for the budget
+                discard_image(filename, route);
+                stbi_image_free(image_data);
+                free(filename);
+                continue;
+            }
+
+            source = image_buffer_create(image_data, width, height, channels, chunker_sample, stbi_image_free, image_bytes);
+            if (source == NULL)
+                chunk_memory_release(image_bytes); // fall back to copying the tiles
+        }
+
         int output = create_chunks_internal(
-            filename,
+            filename, route,
             image_data,
             width, height, channels,
-            calc_chunk_width, calc_chunk_height 
+            calc_chunk_width, calc_chunk_height,
+            source
         );
 
         if (output != 0) 
-            fprintf(stderr, "Chunker thread failed for %s.\n", filename);
+            LOG_ERROR("Chunker thread failed for %s.", filename);
             // need handling;
 
-        stbi_image_free(image_data);
+        // The views hold their own references; the pixels go away with the last one
+        if (source != NULL)
+            image_buffer_release(source);
+        else
+            stbi_image_free(image_data);
         image_data = NULL;
         free(filename); 
         filename = NULL;
     }
 
-    printf("Chunker thread finished successfully.\n");
+    LOG_INFO("Chunker thread finished successfully.");
     
     
     return NULL;
 }
 
+void discard_image(const char *filename, int route) {
+    discarded_images_table_add(filename);
+    dedup_abandon(filename);
+    directory_monitor_discard(filename, route);
+}
+
 void free_image_chunk(image_chunk_t *chunk) {
     if (chunk == NULL)
         return;
 
+    if (chunk->source != NULL) {
+        // A view: the shared buffer accounts for (and frees) the pixels
+        image_buffer_release(chunk->source);
+    } else if (chunk->pixel_data != NULL) {
+        chunk_memory_release(chunk->data_size_bytes);
+        free(image_chunk_halo_origin(chunk));
+    }
+
     free(chunk->original_image_name);
-    free(chunk->pixel_data);
     free(chunk);
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include<pthread.h>    
 #include<errno.h>      
 #include<image_queue.h>       
+#include<log.h>
 
 extern volatile sig_atomic_t stop_flag;
 
@@ -29,7 +30,7 @@ int image_name_queue_init(image_name_queue_t* q) {
     return 0;
 }
 
-int enqueue_image_name(image_name_queue_t *q, const char *name) {
+int enqueue_image_name(image_name_queue_t *q, const char *name, int route) {
     if (q == NULL || name == NULL) 
         return EINVAL;
 
@@ -39,6 +40,7 @@ int enqueue_image_name(image_name_queue_t *q, const char *name) {
         return -1;
     }
     new_node->next = NULL;
+    new_node->route = route;
 
     new_node->name = strdup(name);
     if (new_node->name == NULL) {
@@ -53,7 +55,7 @@ int enqueue_image_name(image_name_queue_t *q, const char *name) {
         
         // very unlikely to happen
         if (q->head != NULL) {
-            fprintf(stderr, "enqueue_image_name: Queue inconsistency detected (tail is NULL, head is not)\n");
+            LOG_ERROR("enqueue_image_name: Queue inconsistency detected (tail is NULL, head is not)");
             pthread_mutex_unlock(&q->lock);
             free(new_node->name);
             free(new_node);
@@ -72,12 +74,12 @@ int enqueue_image_name(image_name_queue_t *q, const char *name) {
     pthread_cond_signal(&q->cond_not_empty);
     pthread_mutex_unlock(&q->lock);
 
-    printf("image name enqueued successfully: %s\n", name); // Debugging
+    LOG_DEBUG("image name enqueued successfully: %s", name);
 
     return 0;
 }
 
-char* dequeue_image_name(image_name_queue_t *q) {
+char* dequeue_image_name(image_name_queue_t *q, int *route) {
     if (q == NULL) 
         return NULL; 
 
@@ -88,12 +90,14 @@ char* dequeue_image_name(image_name_queue_t *q) {
 
     if (stop_flag && q->head == NULL) { 
         pthread_mutex_unlock(&q->lock);
-        printf("dequeue: Stop flag detected, returning NULL.\n"); 
+        LOG_DEBUG("dequeue: Stop flag detected, returning NULL.");
         return NULL; 
     }
 
     image_name_queue_node_t* dequeue_node = q->head;
     char* name = dequeue_node->name; 
+    if (route != NULL)
+        *route = dequeue_node->route;
 
     q->head = dequeue_node->next;
 
@@ -104,7 +108,7 @@ char* dequeue_image_name(image_name_queue_t *q) {
 
     free(dequeue_node); 
 
-    printf("image name dequeued successfully: %s\n", name); 
+    LOG_DEBUG("image name dequeued successfully: %s", name);
 
     return name; 
 }
@@ -129,5 +133,5 @@ void image_name_queue_destroy(image_name_queue_t* q) {
     pthread_mutex_destroy(&q->lock);
     pthread_cond_destroy(&q->cond_not_empty);
 
-    printf("Image Name queue destroyed successfully\n");
+    LOG_DEBUG("Image Name queue destroyed successfully");
 }
\ No newline at end of file
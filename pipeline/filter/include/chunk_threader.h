@@ -1,5 +1,166 @@
 #pragma once
 
-void assign_threads_to_chunk(void);
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
-void *process_chunk(void *arg);
\ No newline at end of file
+#include <image.h>
+#include <filter_chain.h>
+
+/**
+ * @brief Bookkeeping for a single filter-stage worker thread.
+ *
+ * Counters are only written by the owning worker and are read by
+ * `filter_pool_report()` once the pool has been joined.
+ */
+typedef struct {
+    pthread_t thread;           /**< Handle of the worker thread. */
+    size_t index;               /**< Position of this worker in the pool. */
+    uint64_t chunks_processed;  /**< Number of chunks filtered and forwarded. */
+    uint64_t busy_ns;           /**< Time spent filtering and forwarding chunks. */
+    uint64_t idle_ns;           /**< Time spent blocked waiting for chunks. */
+} filter_worker_t;
+
+/**
+ * @brief How chunks are distributed over the filter workers.
+ */
+typedef enum {
+    FILTER_SCHEDULER_QUEUE,     /**< Every worker dequeues from `chunker_filtering_queue`. */
+    FILTER_SCHEDULER_STEAL      /**< Per-worker deques with work stealing; the queue only injects work. */
+} filter_scheduler_t;
+
+/**
+ * @brief Fixed-size pool of filter workers draining `chunker_filtering_queue`.
+ */
+typedef struct {
+    filter_worker_t *workers;       /**< Array of `num_workers` worker slots. */
+    size_t num_workers;             /**< Number of workers that were started. */
+    filter_scheduler_t scheduler;   /**< Scheduling mode chosen at start. */
+    bool fused;                     /**< Producers filter their own tiles (see `filter_pool_enable_fusion()`). */
+    size_t fuse_threshold;          /**< Tiles a fusing producer leaves on its deque for other workers. */
+    _Atomic uint64_t fused_chunks;  /**< Chunks filtered by producer threads. */
+} filter_pool_t;
+
+/**
+ * @brief Starts the filter stage with a fixed number of joinable workers.
+ *
+ * Each worker filters chunks and forwards them to `filtering_reconstruction_queue`
+ * until `stop_flag` is set and no work is left. With FILTER_SCHEDULER_QUEUE the
+ * workers share `chunker_filtering_queue`; with FILTER_SCHEDULER_STEAL every worker
+ * owns a deque, `chunker_filtering_queue` serves as the global injection queue and
+ * idle workers steal from the others.
+ *
+ * Must be called before any producer calls `filter_pool_submit()`.
+ *
+ * @param num_workers Number of workers to start (must be > 0).
+ * @param num_producers Number of producer threads that may call
+ *        `filter_pool_register_producer()` (ignored in queue mode).
+ * @param scheduler Scheduling mode.
+ * @return 0 on success, -1 if allocation or thread creation fails (workers that
+ *         were already started are stopped and joined before returning).
+ */
+int filter_pool_start(size_t num_workers, size_t num_producers, filter_scheduler_t scheduler);
+
+/**
+ * @brief Sets the filters the chunks of a route go through (greyscale alone if never set).
+ *
+ * The plan is shared read-only by all filtering threads and must outlive the
+ * pool; call before `filter_pool_start()`.
+ */
+void filter_pool_set_plan(int route, const filter_plan_t *plan);
+
+/**
+ * @brief Gives the calling thread its own deque for `filter_pool_submit()`.
+ *
+ * Chunks submitted afterwards by this thread stay on its deque until a worker
+ * steals them. Does nothing in queue mode; threads that never register (or
+ * register after all producer deques are taken) submit through the injection queue.
+ */
+void filter_pool_register_producer(void);
+
+/**
+ * @brief Lets producer threads filter the tiles they create themselves.
+ *
+ * A fusing producer hands each new tile to `filter_pool_submit_fused()`, which
+ * filters it on the spot while its pixels are still in the producer's cache.
+ * Only the `backlog_threshold` oldest tiles of the producer's deque are left for
+ * idle workers to steal; everything beyond that is filtered locally, newest
+ * first. A threshold of 0 filters every tile on the producer thread.
+ *
+ * Requires the work-stealing scheduler; call after `filter_pool_start()` and
+ * before starting the producers.
+ *
+ * @return 0 on success, -1 if the pool is not running with FILTER_SCHEDULER_STEAL.
+ */
+int filter_pool_enable_fusion(size_t backlog_threshold);
+
+/**
+ * @brief Returns true if producers should use `filter_pool_submit_fused()`.
+ */
+bool filter_pool_fused(void);
+
+/**
+ * @brief Submits a freshly created tile from a fusing producer.
+ *
+ * The tile goes onto the calling thread's deque; while the deque holds more than
+ * the fusion threshold, the newest tiles are taken back, filtered and forwarded
+ * to `filtering_reconstruction_queue` by the caller. Ownership of the chunk is
+ * transferred in every case.
+ *
+ * @return 0 on success, -1 if a filtered chunk could not be forwarded (it was freed).
+ */
+int filter_pool_submit_fused(image_chunk_t *chunk);
+
+/**
+ * @brief Filters every tile still on the calling producer's deque.
+ *
+ * Called by a fusing producer when it has finished an image, so no tile of it
+ * waits for a thief while the producer decodes the next one.
+ */
+void filter_pool_drain_fused(void);
+
+/**
+ * @brief Hands chunks to the filter stage.
+ *
+ * May block while a bounded `chunker_filtering_queue` is full.
+ *
+ * @param chunks Chunks to submit.
+ * @param n Number of chunks.
+ * @return Number of chunks accepted (a prefix of `chunks`); the caller keeps
+ *         ownership of the rest (shutdown or allocation failure).
+ */
+size_t filter_pool_submit(image_chunk_t **chunks, size_t n);
+
+/**
+ * @brief Wakes every idle filter worker and joins them.
+ *
+ * Must be called after `stop_flag` has been set. Safe to call if the pool was
+ * never started.
+ */
+void filter_pool_stop(void);
+
+/**
+ * @brief Prints per-worker throughput and utilisation (busy / (busy + idle)).
+ *
+ * Intended to be called after `filter_pool_stop()`.
+ */
+void filter_pool_report(void);
+
+/**
+ * @brief Releases the worker slots and scheduler state (freeing chunks still
+ *        queued on deques). Call after `filter_pool_stop()`.
+ */
+void filter_pool_destroy(void);
+
+/**
+ * @brief Filters a single chunk and forwards it to the reconstruction queue.
+ *
+ * Ownership of the chunk is transferred: it is either enqueued on
+ * `filtering_reconstruction_queue` or freed on failure, and its image discarded.
+ *
+ * @param chunk The chunk to process.
+ * @return 0 on success, -1 if the chunk could not be forwarded.
+ */
+int process_chunk(image_chunk_t *chunk);
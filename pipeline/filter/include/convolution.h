@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <image.h>
+
+/*
+ * Generic 2D convolution.
+ *
+ * Effects are kernels (data): sharpen, emboss, edge detection, Sobel, box
+ * blurs or any custom matrix up to CONVOLUTION_MAX_SIZE on a side. When a
+ * kernel is prepared, an SVD tells whether it is rank 1, i.e. the outer product
+ * of a column and a row; such kernels can run as a vertical and a horizontal 1D
+ * pass (h + w taps per pixel instead of h * w). The extra pass over a 16-bit
+ * intermediate costs about as much as the taps it saves on 3 x 3 kernels, so
+ * the two passes are only used when the 2D pass has more than twice as many
+ * (non-zero) taps. Everything else runs as a direct 2D pass.
+ *
+ * Both paths work in fixed point: weights are quantised to 16 bits with the
+ * largest shift that cannot overflow the 32-bit accumulators, samples are
+ * widened to 16 bits, and results are rounded, shifted and saturated to 0..255.
+ * The vector kernels multiply-add pairs of taps (pmaddwd) and produce the same
+ * bytes as the scalar ones.
+ *
+ * 16-bit and float samples run a direct 2D pass in float with the exact
+ * weights; the bias is given in 8-bit units and scaled to the sample range.
+ *
+ * All channels but alpha are convolved. Pixels outside the chunk's halo are
+ * treated as copies of the nearest edge pixel.
+ */
+
+/** @brief Largest kernel width or height (odd sizes only). */
+#define CONVOLUTION_MAX_SIZE 15
+
+/**
+ * @brief A convolution kernel as the user describes it.
+ *
+ * output = bias + scale * sum of weights[ky * width + kx] * input(x + kx - width / 2, y + ky - height / 2)
+ */
+typedef struct {
+    int width;          /**< Odd, 1..CONVOLUTION_MAX_SIZE. */
+    int height;         /**< Odd, 1..CONVOLUTION_MAX_SIZE. */
+    float weights[CONVOLUTION_MAX_SIZE * CONVOLUTION_MAX_SIZE];    /**< Row-major, `width` * `height` used. */
+    float scale;        /**< Multiplies every weight (e.g. 1 / 9 for a 3 x 3 box). */
+    float bias;         /**< Added to every result (e.g. 128 for signed gradients). */
+} convolution_kernel_t;
+
+/**
+ * @brief Fills `kernel` with a named effect.
+ *
+ * Known names: sharpen, emboss, edge, laplacian, sobel-x, sobel-y, box3, box5.
+ *
+ * @return 0 on success, -1 for an unknown name.
+ */
+int convolution_kernel_preset(const char *name, convolution_kernel_t *kernel);
+
+/**
+ * @brief A kernel prepared for execution (read-only once initialised).
+ */
+typedef struct {
+    int width, height;
+    bool rank1;                 /**< The kernel factorises: `column` and `row` are valid. */
+    bool separable;             /**< Run as two 1D passes (rank 1 and cheaper that way). */
+    int bias;                   /**< Rounded bias. */
+
+    int16_t weights[CONVOLUTION_MAX_SIZE * CONVOLUTION_MAX_SIZE];  /**< 2D path: quantised weights. */
+    int shift;                  /**< 2D path: fractional bits of `weights`. */
+
+    int16_t column[CONVOLUTION_MAX_SIZE];   /**< Separable path: vertical taps. */
+    int column_shift;                       /**< Fractional bits of `column`. */
+    int16_t row[CONVOLUTION_MAX_SIZE];      /**< Separable path: horizontal taps. */
+    int row_shift;                          /**< Fractional bits of `row`. */
+    int intermediate_bits;                  /**< Fractional bits kept between the passes. */
+
+    float exact[CONVOLUTION_MAX_SIZE * CONVOLUTION_MAX_SIZE];    /**< 16-bit and float samples: scaled, unquantised weights. */
+    float exact_bias;           /**< 16-bit and float samples: bias in 8-bit units. */
+
+    size_t reach_x, reach_y;    /**< Halo pixels needed on each side: width / 2 and height / 2. */
+} convolution_t;
+
+/**
+ * @brief Quantises `kernel` and detects separability.
+ *
+ * @return 0 on success, -1 if the size is invalid, every weight is zero, or
+ *         a weight is too large to quantise.
+ */
+int convolution_init(convolution_t *conv, const convolution_kernel_t *kernel);
+
+/**
+ * @brief Instruction set levels the row kernels are built for.
+ */
+typedef enum {
+    CONVOLUTION_ISA_SCALAR, /**< Portable reference implementation. */
+    CONVOLUTION_ISA_AVX2,   /**< AVX2: 16 samples per pmaddwd pair. */
+    CONVOLUTION_ISA_COUNT
+} convolution_isa_t;
+
+/**
+ * @brief Row kernels: out[i] = finish(sum over t of weights[t] * in[i + offsets[t]]) for i < count.
+ *
+ * finish() rounds and shifts right by `shift`, adds `bias` and saturates to the output type.
+ */
+typedef struct {
+    convolution_isa_t isa;
+    const char *name;
+
+    /** @brief Bytes to bytes (2D path). */
+    void (*bytes_to_bytes)(const unsigned char *in, const ptrdiff_t *offsets, const int16_t *weights, int taps,
+                           int shift, int bias, unsigned char *out, size_t count);
+
+    /** @brief Bytes to 16-bit intermediates (vertical pass, no bias). */
+    void (*bytes_to_words)(const unsigned char *in, const ptrdiff_t *offsets, const int16_t *weights, int taps,
+                           int shift, int16_t *out, size_t count);
+
+    /** @brief 16-bit intermediates to bytes (horizontal pass). */
+    void (*words_to_bytes)(const int16_t *in, const ptrdiff_t *offsets, const int16_t *weights, int taps,
+                           int shift, int bias, unsigned char *out, size_t count);
+} convolution_kernels_t;
+
+/**
+ * @brief Fills `out` with the kernels of one ISA level.
+ *
+ * @return 0 on success, -1 if the CPU (or the build) does not support `isa`.
+ */
+int convolution_kernels_get(convolution_isa_t isa, convolution_kernels_t *out);
+
+/**
+ * @brief The fastest kernels for the running CPU (detected on first use).
+ */
+const convolution_kernels_t *convolution_kernels(void);
+
+/**
+ * @brief Convolves a chunk in place, reading up to `reach_x` / `reach_y` pixels of halo.
+ */
+void convolution_apply(const convolution_t *conv, const convolution_kernels_t *kernels, image_chunk_t *chunk);
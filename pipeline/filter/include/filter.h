@@ -4,4 +4,16 @@
 
 void greyscale(image_chunk_t* chunk);
 void posterize(image_chunk_t* chunk, int levels);
-void directional_blur(image_chunk_t* chunk, int line_size);
\ No newline at end of file
+void directional_blur(image_chunk_t* chunk, int line_size);
+
+/** @brief Largest radius median_filter() accepts (window counts must fit in 16 bits). */
+#define MEDIAN_MAX_RADIUS 127
+
+/**
+ * @brief Median of the (2 * radius + 1)^2 window around every pixel, per colour channel.
+ *
+ * Constant time per pixel in the radius (Perreault-Hebert) for 8-bit samples,
+ * O(radius^2) for 16-bit and float ones. Reads up to `radius` pixels of halo
+ * and repeats the edge pixels beyond it; alpha is left untouched.
+ */
+void median_filter(image_chunk_t* chunk, int radius);
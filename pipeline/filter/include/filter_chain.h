@@ -0,0 +1,201 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <image.h>
+#include <lut.h>
+#include <gaussian.h>
+#include <convolution.h>
+#include <resize.h>
+
+/*
+ * Filter chains.
+ *
+ * A chain is the ordered list of filters every chunk goes through, configured
+ * once at startup. Before it runs, the chain is compiled into a plan: runs of
+ * consecutive point-wise filters (the output byte only depends on the input
+ * byte(s) of the same pixel) become a single fused stage, in which adjacent
+ * lookup-table filters are composed into one table and every operation is
+ * applied to an L1-sized band of rows before moving on to the next band, so
+ * the tile is walked once per stage rather than once per filter.
+ *
+ * Neighbourhood filters read past the pixel they write. The plan adds up how
+ * far every stage reaches and asks the chunker for that much halo; each stage
+ * then also filters the part of the halo that later stages will still read,
+ * so tiles come out exactly as if the chain had run on the whole image.
+ * A resize can only end a chain: its reach depends on the size of the image,
+ * so the halo is asked for per image (see `filter_plan_halo()`).
+ *
+ * Plans are built for one sample type. Filter parameters are always given in
+ * 8-bit units (brightness:20, curve:64=80, ...); 16-bit and float plans apply
+ * the same functions to normalised intensities through wide tables.
+ */
+
+/** @brief Maximum number of filters in a chain. */
+#define FILTER_CHAIN_MAX 16
+
+/** @brief Maximum number of control points of a curve filter. */
+#define FILTER_CURVE_MAX_POINTS 16
+
+/**
+ * @brief Filters that can appear in a chain.
+ */
+typedef enum {
+    FILTER_GREYSCALE,   /**< BT.601 luma (point-wise). */
+    FILTER_POSTERIZE,   /**< Quantise every channel to `levels` steps (lookup table). */
+    FILTER_BRIGHTNESS,  /**< Brightness and contrast of the colour channels (lookup table). */
+    FILTER_GAMMA,       /**< Gamma correction of the colour channels (lookup table). */
+    FILTER_CURVE,       /**< Piecewise-linear tone curve of the colour channels (lookup table). */
+    FILTER_BLUR,        /**< Horizontal motion blur over the `line_size` pixels centred on each pixel (reads the halo). */
+    FILTER_GAUSSIAN,    /**< Separable Gaussian blur (reads the halo). */
+    FILTER_MEDIAN,      /**< Square-window median, constant time in the radius (reads the halo). */
+    FILTER_CONVOLVE,    /**< Arbitrary convolution kernel, preset or custom (reads the halo). */
+    FILTER_RESIZE       /**< Resampling to another size; last filter of a chain only (reads the halo). */
+} filter_kind_t;
+
+/**
+ * @brief One filter of a chain with its parameters.
+ */
+typedef struct {
+    filter_kind_t kind;
+    union {
+        int levels;                 /**< FILTER_POSTERIZE: 1..256. */
+        struct {
+            int brightness;         /**< Added after scaling, -255..255. */
+            double contrast;        /**< Scale around mid-grey, >= 0. */
+        } tone;                     /**< FILTER_BRIGHTNESS. */
+        double gamma;               /**< FILTER_GAMMA: > 0. */
+        struct {
+            uint8_t inputs[FILTER_CURVE_MAX_POINTS];
+            uint8_t outputs[FILTER_CURVE_MAX_POINTS];
+            size_t count;
+        } curve;                    /**< FILTER_CURVE: 2.. control points, increasing inputs. */
+        int line_size;              /**< FILTER_BLUR: > 0. */
+        struct {
+            double sigma;           /**< Standard deviation in pixels. */
+            gaussian_method_t method;
+        } gaussian;                 /**< FILTER_GAUSSIAN. */
+        int radius;                 /**< FILTER_MEDIAN: 1..MEDIAN_MAX_RADIUS. */
+        convolution_kernel_t kernel;    /**< FILTER_CONVOLVE. */
+        resize_spec_t resize;           /**< FILTER_RESIZE. */
+    } params;
+} filter_desc_t;
+
+/**
+ * @brief An ordered list of filters.
+ */
+typedef struct {
+    filter_desc_t filters[FILTER_CHAIN_MAX];
+    size_t count;
+} filter_chain_t;
+
+/**
+ * @brief Parses a chain specification such as "greyscale,posterize:4".
+ *
+ * Filters are separated by commas, parameters by colons:
+ *   greyscale | posterize:LEVELS | brightness:B[:CONTRAST] | gamma:G |
+ *   curve:IN=OUT/IN=OUT[/...] | blur:LINE_SIZE | gaussian:SIGMA[:fir|iir] |
+ *   median:RADIUS | conv:PRESET | conv:WxH:W0/W1/...[:SCALE[:BIAS]] |
+ *   resize:WxH[:box|bilinear|lanczos] | resize:PERCENT%[:FILTER]
+ *
+ * Custom kernels list their W * H weights row by row; see
+ * `convolution_kernel_preset()` for the presets. A resize to WxH keeps the
+ * aspect ratio when W or H is 0, and must be the last filter.
+ *
+ * @return 0 on success, -1 on a syntax error, an unknown filter, an invalid
+ *         parameter or more than FILTER_CHAIN_MAX filters (the reason is logged).
+ */
+int filter_chain_parse(const char *spec, filter_chain_t *chain);
+
+/**
+ * @brief Operations a fused stage runs on every band of rows.
+ */
+typedef enum {
+    FILTER_OP_GREYSCALE,    /**< greyscale_rows() with the dispatched kernels. */
+    FILTER_OP_LUT           /**< One composed table for the colour channels and one for alpha. */
+} filter_op_kind_t;
+
+/**
+ * @brief A single operation of a fused point-wise stage.
+ */
+typedef struct {
+    filter_op_kind_t kind;
+    pixel_lut_t colour;     /**< FILTER_OP_LUT: table for the colour (or grey) channels. */
+    pixel_lut_t alpha;      /**< FILTER_OP_LUT: table for the alpha channel. */
+    bool alpha_is_colour;   /**< FILTER_OP_LUT: both tables are equal (one pass over all channels). */
+    bool alpha_is_identity; /**< FILTER_OP_LUT: alpha is left untouched. */
+    pixel_lut_wide_t wide_colour;   /**< FILTER_OP_LUT on 16-bit or float samples: replaces `colour`. */
+    pixel_lut_wide_t wide_alpha;    /**< FILTER_OP_LUT on 16-bit or float samples: replaces `alpha`. */
+} filter_op_t;
+
+/**
+ * @brief A step of a compiled plan.
+ */
+typedef struct {
+    enum {
+        FILTER_STAGE_POINT,     /**< Fused point-wise operations, applied band by band. */
+        FILTER_STAGE_BLUR,      /**< directional_blur() over the chunk and its extent. */
+        FILTER_STAGE_GAUSSIAN,  /**< gaussian_blur() over the chunk and its extent. */
+        FILTER_STAGE_MEDIAN,    /**< median_filter() over the chunk and its extent. */
+        FILTER_STAGE_CONVOLVE,  /**< convolution_apply() over the chunk and its extent. */
+        FILTER_STAGE_RESIZE     /**< resize_apply(): the chunk becomes a tile of the output image (always last). */
+    } kind;
+    filter_op_t *ops;           /**< FILTER_STAGE_POINT: the fused operations, in order. */
+    size_t num_ops;
+    int line_size;              /**< FILTER_STAGE_BLUR. */
+    gaussian_t gaussian;        /**< FILTER_STAGE_GAUSSIAN. */
+    int radius;                 /**< FILTER_STAGE_MEDIAN. */
+    convolution_t convolution;  /**< FILTER_STAGE_CONVOLVE. */
+    resize_t resize;            /**< FILTER_STAGE_RESIZE. */
+    size_t reach_x, reach_y;    /**< Pixels the stage reads on each side of the pixel it writes (resize: at least). */
+    size_t extent_x, extent_y;  /**< Halo pixels on each side the stage filters for the stages after it. */
+} filter_stage_t;
+
+/**
+ * @brief A chain compiled for execution. Read-only once built, so a single plan
+ *        is shared by every filter thread.
+ */
+typedef struct {
+    filter_stage_t *stages;
+    size_t num_stages;
+    size_t num_filters;     /**< Filters in the chain the plan was built from. */
+    image_sample_t sample;  /**< Sample type of the chunks the plan filters. */
+    size_t halo_x, halo_y;  /**< Halo every tile needs (see `chunker_set_halo()`); at least, when resizing. */
+    bool resizes;           /**< The last stage is a resize. */
+} filter_plan_t;
+
+/**
+ * @brief Compiles `chain` into `plan` for chunks of `sample`, fusing point-wise filters.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+int filter_plan_build(const filter_chain_t *chain, image_sample_t sample, filter_plan_t *plan);
+
+/**
+ * @brief Halo the tiles of a `width` x `height` image need.
+ *
+ * `halo_x` / `halo_y` plus, when resizing, the part of the resize's reach that
+ * depends on the image size. Matches `chunk_halo_fn`, with the plan as context.
+ */
+void filter_plan_halo(size_t width, size_t height, size_t *halo_x, size_t *halo_y, const void *plan);
+
+/**
+ * @brief Runs every stage of `plan` on `chunk` in place.
+ *
+ * Tiles with less halo than the plan asks for (at the image edges, or views)
+ * are filtered as if the image ended at the edge of the halo. Chunks of
+ * another sample type than the plan's are rejected.
+ */
+void filter_plan_apply(const filter_plan_t *plan, image_chunk_t *chunk);
+
+/**
+ * @brief Writes a one-line description of the plan, e.g. "[greyscale+lut] -> [blur:8]".
+ */
+void filter_plan_describe(const filter_plan_t *plan, char *buffer, size_t size);
+
+/**
+ * @brief Releases the stages of a plan.
+ */
+void filter_plan_destroy(filter_plan_t *plan);
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <image.h>
+
+/*
+ * Separable Gaussian blur.
+ *
+ * The blur runs on one channel at a time, converted to a float plane: a
+ * vertical pass over the rows, then the plane is transposed in 8 x 8 blocks so
+ * the horizontal pass is another vertical pass over contiguous rows, and
+ * transposed back. Every pass works across the columns of a row, which is what
+ * the vector kernels parallelise.
+ *
+ * Two ways to compute a pass:
+ *   - FIR: a sampled Gaussian of radius ceil(3 sigma). Exact, but the cost
+ *     grows with sigma.
+ *   - IIR: the recursive Young / van Vliet approximation (3rd-order forward
+ *     and backward filters). A fixed 8 multiply-adds per pixel and pass,
+ *     whatever sigma is.
+ *
+ * Pixels outside the chunk's halo are treated as copies of the nearest edge
+ * pixel, which is the image edge for tiles that border it. With a full halo,
+ * FIR tiles are identical to blurring the whole image; IIR tiles can differ by
+ * one level, since the recursion only sees `reach` pixels of run-in.
+ */
+
+/** @brief Sigma above which GAUSSIAN_AUTO switches from FIR to IIR. */
+#define GAUSSIAN_FIR_MAX_SIGMA 2.0
+
+/** @brief Largest supported sigma. */
+#define GAUSSIAN_MAX_SIGMA 256.0
+
+/**
+ * @brief How a blur computes its passes.
+ */
+typedef enum {
+    GAUSSIAN_AUTO,  /**< FIR up to GAUSSIAN_FIR_MAX_SIGMA, IIR above. */
+    GAUSSIAN_FIR,   /**< Convolution with the sampled kernel. */
+    GAUSSIAN_IIR    /**< Recursive filter, constant cost per pixel. */
+} gaussian_method_t;
+
+/**
+ * @brief A blur of a given sigma, ready to run (read-only once initialised).
+ */
+typedef struct {
+    gaussian_method_t method;   /**< GAUSSIAN_FIR or GAUSSIAN_IIR (never AUTO). */
+    double sigma;
+    size_t reach;               /**< Halo pixels on every side for a tile to match the whole image. */
+    int radius;                 /**< FIR: taps on each side of the centre. */
+    float *weights;             /**< FIR: 2 * radius + 1 taps summing to 1. */
+    float iir[4];               /**< IIR: B, b1 / b0, b2 / b0, b3 / b0. */
+} gaussian_t;
+
+/**
+ * @brief Prepares a blur.
+ *
+ * @return 0 on success, -1 if sigma is outside (0, GAUSSIAN_MAX_SIGMA], below
+ *         0.5 for IIR, or allocation failed.
+ */
+int gaussian_init(gaussian_t *gaussian, double sigma, gaussian_method_t method);
+
+/**
+ * @brief Releases a blur prepared by `gaussian_init()`.
+ */
+void gaussian_destroy(gaussian_t *gaussian);
+
+/**
+ * @brief Instruction set levels the pass kernels are built for.
+ */
+typedef enum {
+    GAUSSIAN_ISA_SCALAR,    /**< Portable reference implementation. */
+    GAUSSIAN_ISA_AVX2,      /**< AVX2: 8 columns per instruction. */
+    GAUSSIAN_ISA_COUNT
+} gaussian_isa_t;
+
+/**
+ * @brief Pass kernels over float planes (`stride` floats between rows).
+ */
+typedef struct {
+    gaussian_isa_t isa;
+    const char *name;
+
+    /** @brief out[y][x] = sum over k of weights[k] * in[y + k][x], for `rows` output rows (`in` has rows + 2 * radius). */
+    void (*fir_columns)(const float *in, float *out, size_t width, size_t rows, size_t stride,
+                        const float *weights, int radius);
+
+    /** @brief Forward and backward recursive filter down each column, in place. */
+    void (*iir_columns)(float *data, size_t width, size_t rows, size_t stride, const float coefficients[4]);
+
+    /** @brief out[x][y] = in[y][x] for a `rows` x `cols` block. */
+    void (*transpose)(const float *in, size_t in_stride, float *out, size_t out_stride, size_t rows, size_t cols);
+} gaussian_kernels_t;
+
+/**
+ * @brief Fills `out` with the kernels of one ISA level.
+ *
+ * @return 0 on success, -1 if the CPU (or the build) does not support `isa`.
+ */
+int gaussian_kernels_get(gaussian_isa_t isa, gaussian_kernels_t *out);
+
+/**
+ * @brief The fastest kernels for the running CPU (detected on first use).
+ */
+const gaussian_kernels_t *gaussian_kernels(void);
+
+/**
+ * @brief Blurs the colour channels of a chunk in place (alpha is left untouched).
+ *
+ * Reads up to `gaussian->reach` pixels of halo on every side.
+ */
+void gaussian_blur(const gaussian_t *gaussian, const gaussian_kernels_t *kernels, image_chunk_t *chunk);
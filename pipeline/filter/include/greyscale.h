@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <image.h>
+
+/*
+ * Greyscale conversion kernels.
+ *
+ * grey = (77 R + 150 G + 29 B + 128) >> 8, the BT.601 luma weights in 8.8
+ * fixed point. Every kernel produces bit-identical results to the scalar
+ * reference; the vector ones only differ in how many pixels they convert at a
+ * time. The best kernels for the running CPU are picked once, via cpuid.
+ *
+ * 16-bit samples use the same weights with 32-bit sums (exact for every
+ * input); float samples use them as fractions of 256.
+ */
+
+/** @brief BT.601 luma weights scaled by 256 (they sum to 256). */
+#define GREY_WEIGHT_R 77
+#define GREY_WEIGHT_G 150
+#define GREY_WEIGHT_B 29
+
+/**
+ * @brief Converts `width` interleaved pixels of one row in place.
+ */
+typedef void (*greyscale_row_fn)(unsigned char *row, size_t width);
+
+/**
+ * @brief Converts `width` interleaved pixels of 16-bit samples in place.
+ */
+typedef void (*greyscale_row16_fn)(uint16_t *row, size_t width);
+
+/**
+ * @brief Converts `width` pixels of one row of separate R, G and B planes in place.
+ *
+ * The grey value is written to all three planes.
+ */
+typedef void (*greyscale_planes_fn)(unsigned char *r, unsigned char *g, unsigned char *b, size_t width);
+
+/**
+ * @brief Instruction set levels a kernel set can be built for.
+ */
+typedef enum {
+    GREYSCALE_ISA_SCALAR,   /**< Portable reference implementation. */
+    GREYSCALE_ISA_SSE2,     /**< SSE2 (RGB additionally needs SSSE3 byte shuffles). */
+    GREYSCALE_ISA_AVX2,     /**< AVX2. */
+    GREYSCALE_ISA_AVX512,   /**< AVX-512BW (RGB additionally uses VBMI byte permutes when present). */
+    GREYSCALE_ISA_COUNT
+} greyscale_isa_t;
+
+/**
+ * @brief Row kernels for each supported channel layout.
+ *
+ * 1- and 2-channel (grey, grey + alpha) data is already grey and needs no kernel.
+ */
+typedef struct {
+    greyscale_isa_t isa;    /**< Level the kernels were selected for. */
+    const char *name;       /**< Human-readable description, e.g. "avx2". */
+    greyscale_row_fn rgb;   /**< 3 channels. */
+    greyscale_row_fn rgba;  /**< 4 channels; alpha is left untouched. */
+    greyscale_planes_fn planar; /**< R, G and B planes (planar chunks; any alpha plane is left untouched). */
+    greyscale_row16_fn rgb16;   /**< 3 channels of 16-bit samples. */
+    greyscale_row16_fn rgba16;  /**< 4 channels of 16-bit samples; alpha is left untouched. */
+} greyscale_kernels_t;
+
+/**
+ * @brief Fills `out` with the kernels of one ISA level.
+ *
+ * Layouts the CPU cannot run at that level fall back to the best lower one.
+ *
+ * @return 0 on success, -1 if the CPU (or the build) does not support `isa`.
+ */
+int greyscale_kernels_get(greyscale_isa_t isa, greyscale_kernels_t *out);
+
+/**
+ * @brief The fastest kernels for the running CPU (detected on first use).
+ */
+const greyscale_kernels_t *greyscale_kernels(void);
+
+/**
+ * @brief Converts a strided block of pixels in place.
+ *
+ * @param kernels Kernel set to use (e.g. greyscale_kernels()).
+ * @param pixels First pixel of the block.
+ * @param width Pixels per row.
+ * @param height Number of rows.
+ * @param stride Bytes between the starts of two rows.
+ * @param channels Interleaved channels per pixel (1 to 4).
+ */
+void greyscale_rows(const greyscale_kernels_t *kernels, unsigned char *pixels,
+                    size_t width, size_t height, size_t stride, int channels);
+
+/**
+ * @brief Converts a strided block of R, G and B planes in place.
+ *
+ * @param planes First pixel of the block in the R, G and B planes.
+ * @param stride Bytes between the starts of two rows of a plane.
+ */
+void greyscale_planes(const greyscale_kernels_t *kernels, unsigned char *const planes[3],
+                      size_t width, size_t height, size_t stride);
+
+/**
+ * @brief Converts a strided block of pixels of any sample type in place.
+ *
+ * 8-bit samples go through greyscale_rows(), 16-bit ones through the 16-bit
+ * kernels of `kernels`; float samples have a single portable loop.
+ *
+ * @param stride Bytes between the starts of two rows.
+ */
+void greyscale_samples(const greyscale_kernels_t *kernels, void *pixels, size_t width, size_t height,
+                       size_t stride, int channels, image_sample_t sample);
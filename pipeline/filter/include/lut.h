@@ -0,0 +1,177 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <image.h>
+
+/*
+ * Per-channel lookup tables for point-wise filters.
+ *
+ * Any filter whose output byte depends only on the input byte of the same
+ * channel (posterize, gamma, brightness/contrast, curves, ...) compiles down to
+ * a 256-entry table, and a chain of them composes into a single table. Applying
+ * a table is one pass over the pixels; on CPUs with AVX-512 VBMI the whole
+ * table fits in four registers and is applied with byte permutes (selected
+ * once via cpuid).
+ *
+ * Wide tables do the same for 16-bit and float samples: the functions are
+ * sampled at every 16-bit value, so 16-bit pixels index the table directly
+ * and float pixels interpolate between two entries.
+ */
+
+/** @brief Applies the table to every channel of the pixel. */
+#define LUT_ALL_CHANNELS 0xFu
+
+/**
+ * @brief A byte-to-byte lookup table.
+ */
+typedef struct {
+    _Alignas(64) uint8_t table[256];    /**< Output value for every input byte. */
+} pixel_lut_t;
+
+/**
+ * @brief Applies `lut` to `count` bytes in place.
+ *
+ * `select` is NULL (transform every byte) or a LUT_SELECT_PERIOD-byte pattern
+ * of 0x00 / 0xFF entries, repeating from the start of `bytes`, that marks the
+ * bytes to transform.
+ */
+typedef void (*lut_apply_fn)(const pixel_lut_t *lut, unsigned char *bytes, size_t count, const uint8_t *select);
+
+/** @brief Period of a channel selection pattern: a multiple of every channel count (1..4) and vector width. */
+#define LUT_SELECT_PERIOD 192
+
+/**
+ * @brief Sets `lut` to the identity.
+ */
+void lut_init_identity(pixel_lut_t *lut);
+
+/**
+ * @brief out[x] = second[first[x]]: one table doing `first`, then `second`.
+ *
+ * `out` may alias either input.
+ */
+void lut_compose(pixel_lut_t *out, const pixel_lut_t *first, const pixel_lut_t *second);
+
+/**
+ * @brief Posterize: x -> (x / (256 / levels)) * (256 / levels).
+ *
+ * @return 0 on success, -1 if `levels` is outside 1..256.
+ */
+int lut_build_posterize(pixel_lut_t *lut, int levels);
+
+/**
+ * @brief Gamma correction: x -> 255 * (x / 255) ^ (1 / gamma), rounded.
+ *
+ * @return 0 on success, -1 if `gamma` is not positive.
+ */
+int lut_build_gamma(pixel_lut_t *lut, double gamma);
+
+/**
+ * @brief Brightness and contrast: x -> (x - 128) * contrast + 128 + brightness, clamped to 0..255.
+ */
+void lut_build_brightness_contrast(pixel_lut_t *lut, int brightness, double contrast);
+
+/**
+ * @brief Tone curve through `count` control points, linearly interpolated.
+ *
+ * @param inputs Strictly increasing input values of the control points.
+ * @param outputs Output values of the control points.
+ * @return 0 on success, -1 if fewer than two points or `inputs` is not increasing.
+ */
+int lut_build_curve(pixel_lut_t *lut, const uint8_t *inputs, const uint8_t *outputs, size_t count);
+
+/**
+ * @brief Name of the kernel the dispatcher selected, e.g. "avx512vbmi".
+ */
+const char *lut_kernel_name(void);
+
+/**
+ * @brief The scalar reference kernel (for verification).
+ */
+lut_apply_fn lut_scalar_kernel(void);
+
+/**
+ * @brief The fastest kernel for the running CPU (detected on first use).
+ */
+lut_apply_fn lut_kernel(void);
+
+/**
+ * @brief Applies `lut` to the selected channels of a strided block of pixels.
+ *
+ * @param lut The table.
+ * @param pixels First pixel of the block.
+ * @param width Pixels per row.
+ * @param height Number of rows.
+ * @param stride Bytes between the starts of two rows.
+ * @param channels Interleaved channels per pixel (1 to 4).
+ * @param channel_mask Bit c set = transform channel c (LUT_ALL_CHANNELS for all).
+ */
+void lut_apply(const pixel_lut_t *lut, unsigned char *pixels, size_t width, size_t height,
+               size_t stride, int channels, unsigned channel_mask);
+
+/**
+ * @brief Shared posterize table for `levels`, built on first use and cached for
+ *        the lifetime of the process (safe to call from any thread).
+ *
+ * @return The table, or NULL if `levels` is outside 1..256 or allocation failed.
+ */
+const pixel_lut_t *lut_posterize_cached(int levels);
+
+/** @brief Values a wide table holds the function at: v / 65535 for every 16-bit v. */
+#define LUT_WIDE_ENTRIES 65536
+
+/**
+ * @brief A point function on normalised intensities (0..1).
+ */
+typedef float (*lut_point_fn)(float value, const void *context);
+
+/**
+ * @brief A lookup table for 16-bit or float samples.
+ *
+ * Float samples are clamped to 0..1 before the lookup, as 8-bit ones are
+ * clamped to 0..255 by the table filters.
+ */
+typedef struct {
+    image_sample_t sample;  /**< IMAGE_SAMPLE_U16 or IMAGE_SAMPLE_F32. */
+    void *table;            /**< LUT_WIDE_ENTRIES + 1 outputs of the sample type (the last repeats the one before). */
+} pixel_lut_wide_t;
+
+/**
+ * @brief Allocates an identity table for `sample`.
+ *
+ * @return 0 on success, -1 for 8-bit samples or on allocation failure.
+ */
+int lut_wide_init(pixel_lut_wide_t *lut, image_sample_t sample);
+
+/**
+ * @brief Follows every output of the table with `fn`: the table then does itself, then `fn`.
+ *
+ * Outputs are clamped to 0..1; 16-bit tables round them to 16 bits.
+ */
+void lut_wide_map(pixel_lut_wide_t *lut, lut_point_fn fn, const void *context);
+
+/**
+ * @brief True if both tables map every value alike.
+ */
+bool lut_wide_equal(const pixel_lut_wide_t *a, const pixel_lut_wide_t *b);
+
+/**
+ * @brief True if the table maps every value to itself.
+ */
+bool lut_wide_is_identity(const pixel_lut_wide_t *lut);
+
+/**
+ * @brief Applies a wide table to the selected channels of a strided block of pixels.
+ *
+ * Same parameters as lut_apply(); the samples must be of the table's type.
+ */
+void lut_wide_apply(const pixel_lut_wide_t *lut, void *pixels, size_t width, size_t height,
+                    size_t stride, int channels, unsigned channel_mask);
+
+/**
+ * @brief Releases the table (safe on a zeroed or destroyed one).
+ */
+void lut_wide_destroy(pixel_lut_wide_t *lut);
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include <image.h>
+
+/*
+ * Resampling.
+ *
+ * An image is resized by a horizontal pass over every source row it needs,
+ * into float rows of the output width, then a vertical pass down those rows.
+ * Each pass uses a weight table per axis: output pixel x takes `taps` source
+ * pixels from `start[x]` on, weighted by the filter centred on
+ * (x + 0.5) * in / out - 0.5 and widened by in / out when downscaling.
+ * The weights only depend on x modulo out / gcd(in, out) (the phase), so a
+ * table holds one set of taps per phase. Tables are built once per
+ * (source size, output size) pair and shared by every tile and image of that
+ * size.
+ *
+ * In the pipeline, resizing is the last stage of a chain: a tile becomes the
+ * output pixels whose centres fall on its interior, reading the filter's
+ * reach from its halo, and reconstruction assembles the output image from
+ * those tiles. Tiles give the same output as resizing the whole image.
+ *
+ * Every channel is resampled, alpha included (it is not premultiplied).
+ * Pixels outside the halo are copies of the nearest edge pixel.
+ */
+
+/**
+ * @brief Resampling filters.
+ */
+typedef enum {
+    RESIZE_BOX,         /**< Area average when downscaling, nearest neighbour when upscaling (support 0.5). */
+    RESIZE_BILINEAR,    /**< Triangle filter (support 1). */
+    RESIZE_LANCZOS      /**< Lanczos-3 windowed sinc (support 3), the default. */
+} resize_filter_t;
+
+/**
+ * @brief Output size of a resize, relative to the source or absolute.
+ */
+typedef struct {
+    resize_filter_t filter;
+    double percent;         /**< > 0: both sides scaled by percent / 100 (`width` and `height` unused). */
+    size_t width, height;   /**< Output size; one of them may be 0 to keep the aspect ratio. */
+} resize_spec_t;
+
+/**
+ * @brief The weights of one axis for a (source size, output size) pair.
+ */
+typedef struct resize_axis {
+    size_t in_size, out_size;
+    int taps;                   /**< Source pixels per output pixel. */
+    size_t phases;              /**< Distinct weight sets: out_size / gcd(in_size, out_size). */
+    long *start;                /**< First source pixel of every output pixel (may be < 0 or past the end: clamp). */
+    float *weights;             /**< `phases` x `taps` weights, each set summing to 1. */
+    struct resize_axis *next;   /**< Next table in the cache. */
+} resize_axis_t;
+
+/**
+ * @brief A resize ready to run. Tables are added to its cache as sizes are met,
+ *        so one resize is shared by every filter thread.
+ */
+typedef struct {
+    resize_spec_t spec;
+    double support;             /**< Filter support in source pixels at scale 1. */
+    pthread_mutex_t *lock;      /**< Guards `axes`. */
+    resize_axis_t **axes;       /**< Head of the table cache. */
+} resize_t;
+
+/**
+ * @brief Parses a filter name: box, bilinear or lanczos.
+ *
+ * @return 0 on success, -1 for an unknown name.
+ */
+int resize_filter_from_string(const char *name, resize_filter_t *filter);
+
+/**
+ * @brief Short name of a filter, e.g. "lanczos".
+ */
+const char *resize_filter_name(resize_filter_t filter);
+
+/**
+ * @brief Prepares a resize.
+ *
+ * @return 0 on success, -1 if the spec is invalid (no size, both sides 0, or a
+ *         percentage that is not positive) or allocation failed.
+ */
+int resize_init(resize_t *resize, const resize_spec_t *spec);
+
+/**
+ * @brief Releases a resize and its cached tables.
+ */
+void resize_destroy(resize_t *resize);
+
+/**
+ * @brief Output size for a `width` x `height` source (at least 1 x 1).
+ */
+void resize_output_size(const resize_spec_t *spec, size_t width, size_t height, size_t *out_width, size_t *out_height);
+
+/**
+ * @brief Source pixels a tile of a `width` x `height` image needs on each side.
+ */
+void resize_reach(const resize_t *resize, size_t width, size_t height, size_t *reach_x, size_t *reach_y);
+
+/**
+ * @brief Smallest reach of any image (upscaling): the filter support plus one.
+ */
+size_t resize_min_reach(const resize_t *resize);
+
+/**
+ * @brief The table for resampling `in_size` pixels to `out_size`, built on first use.
+ *
+ * @return The table (owned by the resize), or NULL on allocation failure.
+ */
+const resize_axis_t *resize_axis(const resize_t *resize, size_t in_size, size_t out_size);
+
+/**
+ * @brief Instruction set levels the pass kernels are built for.
+ */
+typedef enum {
+    RESIZE_ISA_SCALAR,  /**< Portable reference implementation. */
+    RESIZE_ISA_AVX2,    /**< AVX2 + FMA: one pixel per vector (3 and 4 channels) or 8 gathered pixels (1 channel)
+                             horizontally, 8 samples per instruction vertically. */
+    RESIZE_ISA_COUNT
+} resize_isa_t;
+
+/**
+ * @brief Pass kernels over float rows.
+ */
+typedef struct {
+    resize_isa_t isa;
+    const char *name;
+
+    /**
+     * @brief Output pixels first .. first + count - 1 of `axis` from one row of `channels` interleaved samples.
+     *
+     * `in` holds source pixels from `in_origin` on, plus one spare float; `out`
+     * receives count * channels floats plus one spare.
+     */
+    void (*horizontal)(const float *in, long in_origin, int channels, const resize_axis_t *axis,
+                       size_t first, size_t count, float *out);
+
+    /** @brief out[i] = sum over k of weights[k] * rows[k][i], for i < count. */
+    void (*vertical)(const float *const *rows, const float *weights, int taps, float *out, size_t count);
+} resize_kernels_t;
+
+/**
+ * @brief Fills `out` with the kernels of one ISA level.
+ *
+ * @return 0 on success, -1 if the CPU (or the build) does not support `isa`.
+ */
+int resize_kernels_get(resize_isa_t isa, resize_kernels_t *out);
+
+/**
+ * @brief The fastest kernels for the running CPU (detected on first use).
+ */
+const resize_kernels_t *resize_kernels(void);
+
+/**
+ * @brief Replaces a chunk's pixels with its part of the resized image.
+ *
+ * The chunk's `original_image_width` / `original_image_height` give the source
+ * size. Afterwards the chunk is a tile of the output image, without halo, in
+ * the same layout and sample type, with the output size as its original image
+ * size. It may be empty (0 pixels wide or high) when downscaling. The old
+ * buffer is freed (or the view released) and the memory budget adjusted.
+ */
+void resize_apply(const resize_t *resize, const resize_kernels_t *kernels, image_chunk_t *chunk);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <image.h>
+
+/*
+ * Channel access for filters that work in float.
+ *
+ * The neighbourhood filters copy one channel of a row of pixels into a float
+ * buffer, filter it and store it back. These helpers do the copy for every
+ * sample type: 8-bit and 16-bit values are rounded and clamped on the way
+ * back, float values are stored as they are.
+ */
+
+/**
+ * @brief Reads one channel of `count` pixels into floats.
+ *
+ * @param src First sample to read (the channel of the first pixel).
+ * @param channels Samples per pixel: distance between two consecutive reads.
+ */
+static inline void samples_load(const unsigned char *src, image_sample_t sample, int channels, size_t count, float *dst) {
+    if (sample == IMAGE_SAMPLE_U8) {
+        for (size_t x = 0; x < count; x++)
+            dst[x] = src[x * channels];
+    } else if (sample == IMAGE_SAMPLE_U16) {
+        const uint16_t *values = (const uint16_t *)src;
+        for (size_t x = 0; x < count; x++)
+            dst[x] = values[x * channels];
+    } else {
+        const float *values = (const float *)src;
+        for (size_t x = 0; x < count; x++)
+            dst[x] = values[x * channels];
+    }
+}
+
+/**
+ * @brief Writes `count` floats back to one channel of a row of pixels.
+ *
+ * @param dst First sample to write (the channel of the first pixel).
+ * @param channels Samples per pixel: distance between two consecutive writes.
+ */
+static inline void samples_store(const float *src, unsigned char *dst, image_sample_t sample, int channels, size_t count) {
+    if (sample == IMAGE_SAMPLE_U8) {
+        for (size_t x = 0; x < count; x++) {
+            float v = src[x] + 0.5f;
+            dst[x * channels] = (v <= 0.0f)? 0: (v >= 255.0f)? 255: (unsigned char)v;
+        }
+    } else if (sample == IMAGE_SAMPLE_U16) {
+        uint16_t *values = (uint16_t *)dst;
+        for (size_t x = 0; x < count; x++) {
+            float v = src[x] + 0.5f;
+            values[x * channels] = (v <= 0.0f)? 0: (v >= 65535.0f)? 65535: (uint16_t)v;
+        }
+    } else {
+        float *values = (float *)dst;
+        for (size_t x = 0; x < count; x++)
+            values[x * channels] = src[x];
+    }
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include <image.h>
+
+/**
+ * @brief Growable circular array backing a ws_deque_t.
+ *
+ * Arrays replaced by a resize are kept on the `retired` list until the deque is
+ * destroyed, because a thief may still be reading from them.
+ */
+typedef struct ws_array {
+    size_t capacity;                    /**< Number of slots (power of two). */
+    struct ws_array *retired;           /**< Previously replaced array, freed on destroy. */
+    _Atomic(image_chunk_t *) slots[];   /**< Chunk pointers, indexed modulo `capacity`. */
+} ws_array_t;
+
+/**
+ * @brief Chase-Lev work-stealing deque of chunk pointers.
+ *
+ * Exactly one thread (the owner) pushes and takes at the bottom; any thread may
+ * steal from the top. Memory orderings follow Lê et al., "Correct and Efficient
+ * Work-Stealing for Weak Memory Models" (PPoPP 2013).
+ */
+typedef struct {
+    _Alignas(64) _Atomic int64_t top;       /**< Next index thieves steal from. */
+    _Alignas(64) _Atomic int64_t bottom;    /**< Next index the owner pushes to. */
+    _Alignas(64) _Atomic(ws_array_t *) array;
+} ws_deque_t;
+
+/**
+ * @brief Scheduler state shared by the filter workers and the chunker threads.
+ *
+ * Deques `[0, num_workers)` belong to filter workers, the remaining ones to
+ * registered producers (chunker threads). Chunks produced by any other thread go
+ * through the global injection queue.
+ */
+typedef struct {
+    ws_deque_t *deques;                 /**< `num_workers + num_producers` deques. */
+    size_t num_workers;                 /**< Deques owned by filter workers. */
+    size_t num_deques;                  /**< Total number of deques. */
+    _Atomic size_t next_producer;       /**< Next producer deque handed out by registration. */
+    chunk_queue_t *injector;            /**< Global injection queue (not owned). */
+
+    pthread_mutex_t idle_lock;          /**< Protects sleeping on `idle_cond`. */
+    pthread_cond_t idle_cond;           /**< Idle workers park here until work is published. */
+    _Atomic size_t sleepers;            /**< Number of workers parked (or about to park) on `idle_cond`. */
+} ws_scheduler_t;
+
+/**
+ * @brief Initializes an empty deque.
+ *
+ * @param d The deque.
+ * @param initial_capacity Initial number of slots (rounded up to a power of two).
+ * @return 0 on success, -1 on allocation failure.
+ */
+int ws_deque_init(ws_deque_t *d, size_t initial_capacity);
+
+/**
+ * @brief Pushes a chunk at the bottom. Owner thread only.
+ *
+ * @return 0 on success, -1 if the deque had to grow and the allocation failed.
+ */
+int ws_deque_push(ws_deque_t *d, image_chunk_t *chunk);
+
+/**
+ * @brief Takes the most recently pushed chunk. Owner thread only.
+ *
+ * @return The chunk, or NULL if the deque is empty.
+ */
+image_chunk_t *ws_deque_take(ws_deque_t *d);
+
+/**
+ * @brief Steals the oldest chunk. Any thread.
+ *
+ * @param d The deque.
+ * @param contended Set to true if the steal lost a race (the deque may still hold work).
+ * @return The chunk, or NULL if the deque was empty or the steal lost a race.
+ */
+image_chunk_t *ws_deque_steal(ws_deque_t *d, bool *contended);
+
+/**
+ * @brief Approximate number of chunks in the deque.
+ */
+size_t ws_deque_size(ws_deque_t *d);
+
+/**
+ * @brief Frees the deque's arrays and any chunks still stored in it.
+ */
+void ws_deque_destroy(ws_deque_t *d);
+
+/**
+ * @brief Initializes the scheduler.
+ *
+ * @param s The scheduler.
+ * @param num_workers Number of filter workers (one deque each).
+ * @param num_producers Maximum number of producer threads that may register a local deque.
+ * @param injector Global injection queue; must outlive the scheduler.
+ * @return 0 on success, -1 on allocation or synchronization primitive failure.
+ */
+int ws_scheduler_init(ws_scheduler_t *s, size_t num_workers, size_t num_producers, chunk_queue_t *injector);
+
+/**
+ * @brief Hands a producer thread its own deque.
+ *
+ * @return The deque index, or -1 if every producer deque is taken.
+ */
+int ws_scheduler_register_producer(ws_scheduler_t *s);
+
+/**
+ * @brief Pushes chunks onto deque `index` (owned by the caller) and wakes idle workers.
+ *
+ * @return Number of chunks pushed; the caller keeps ownership of the rest.
+ */
+size_t ws_scheduler_push_local(ws_scheduler_t *s, size_t index, image_chunk_t **chunks, size_t n);
+
+/**
+ * @brief Enqueues chunks on the global injection queue and wakes idle workers.
+ *
+ * @return Number of chunks enqueued; the caller keeps ownership of the rest.
+ */
+size_t ws_scheduler_inject(ws_scheduler_t *s, image_chunk_t **chunks, size_t n);
+
+/**
+ * @brief Finds the next chunk for worker `self` without blocking.
+ *
+ * Order: own deque (LIFO, hottest first), then a batch from the injection queue
+ * (extra chunks are pushed onto the own deque where others can steal them), then
+ * steals from randomly chosen victims. Injected chunks that fit neither the own
+ * deque nor back into the injection queue are freed and their images discarded.
+ *
+ * @param s The scheduler.
+ * @param self Index of the calling worker's deque.
+ * @param rng Per-worker random state used for victim selection (must be non-zero).
+ * @return A chunk, or NULL if no work was found.
+ */
+image_chunk_t *ws_scheduler_find_work(ws_scheduler_t *s, size_t self, uint64_t *rng);
+
+/**
+ * @brief Parks the calling worker until new work may be available.
+ *
+ * Returns immediately if work is already visible.
+ *
+ * @return false once `stop_flag` is set and no work is left anywhere, true otherwise.
+ */
+bool ws_scheduler_wait_for_work(ws_scheduler_t *s);
+
+/**
+ * @brief Wakes every parked worker (used on shutdown).
+ */
+void ws_scheduler_wake_all(ws_scheduler_t *s);
+
+/**
+ * @brief Destroys the deques (freeing chunks left in them) and the synchronization primitives.
+ */
+void ws_scheduler_destroy(ws_scheduler_t *s);
@@ -3,48 +3,327 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <stdio.h>
+#include <time.h>
 #include <image_chunker.h>
 #include <chunk_threader.h>
 #include <filter.h>
+#include <filter_chain.h>
+#include <work_stealing.h>
+#include <log.h>
+
+/** @brief Maximum number of chunks a filter worker takes from the queue per lock acquisition. */
+#define FILTER_BATCH_SIZE 8
 
 extern volatile sig_atomic_t stop_flag;
 
-void *process_chunk(void *arg) {
-    image_chunk_t *chunk = chunk_dequeue(&chunker_filtering_queue);
-    
-    if (chunk == NULL || stop_flag) {
-        // If the queue is empty, wait or check for stop_flag
-        pthread_exit(NULL);
+static filter_pool_t filter_pool = { NULL, 0, FILTER_SCHEDULER_QUEUE, false, 0, 0 };
+static ws_scheduler_t filter_scheduler;
+
+// Filters the chunks of every route go through; greyscale alone when no plan was set
+static const filter_plan_t *filter_plans[IMAGE_MAX_ROUTES];
+
+// Deque index of a registered producer thread, -1 if it submits through the injection queue
+static _Thread_local int producer_deque = -1;
+
+static inline uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline void filter_chunk(image_chunk_t *chunk) {
+    const filter_plan_t *filter_plan = filter_plans[chunk->route];
+
+    if (filter_plan != NULL)
+        filter_plan_apply(filter_plan, chunk);
+    else
+        greyscale(chunk);
+    chunk->processing_status = CHUNK_STATUS_FILTERED;
+}
+
+void filter_pool_set_plan(int route, const filter_plan_t *plan) {
+    if (route >= 0 && route < IMAGE_MAX_ROUTES)
+        filter_plans[route] = plan;
+}
+
+/*
+    Filtered chunks the reconstruction queue did not take over (shutdown or allocation failure): their images
+    can no longer be completed, so each image is discarded once per run of its chunks and the chunks freed.
+*/
+static void drop_filtered(image_chunk_t **chunks, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        LOG_ERROR_RATELIMITED(1000, "Error: Failed to enqueue filtered chunk (ID: %d).", chunks[i]->chunk_id);
+
+        if (i == 0 || chunks[i]->ingest != chunks[i - 1]->ingest)
+            discard_image(chunks[i]->original_image_name, chunks[i]->route);
+        free_image_chunk(chunks[i]);
     }
-    // Process the chunk (e.g., apply greyscale filter)
-    greyscale(chunk);
+}
+
+int process_chunk(image_chunk_t *chunk) {
+    if (chunk == NULL)
+        return -1;
+
+    filter_chunk(chunk);
 
     // Enqueue the filtered chunk into the next queue
     if (chunk_enqueue(&filtering_reconstruction_queue, chunk) != 0) {
-        fprintf(stderr, "Error: Failed to enqueue filtered chunk (ID: %d).\n", chunk->chunk_id);
-        free_image_chunk(chunk); // Free the chunk if enqueueing fails
+        drop_filtered(&chunk, 1);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void *filter_worker_thread(void *arg) {
+    filter_worker_t *worker = (filter_worker_t *)arg;
+    image_chunk_t *batch[FILTER_BATCH_SIZE];
+
+    while (1) {
+        uint64_t wait_start = monotonic_ns();
+
+        // Blocks until a chunk is available; returns 0 once stop_flag is set and the queue is drained
+        size_t taken = chunk_dequeue_batch(&chunker_filtering_queue, batch, FILTER_BATCH_SIZE, -1);
+
+        uint64_t work_start = monotonic_ns();
+        worker->idle_ns += work_start - wait_start;
+
+        if (taken == 0) {
+            if (stop_flag)
+                break;
+            continue;
+        }
+
+        for (size_t i = 0; i < taken; i++)
+            filter_chunk(batch[i]);
+
+        size_t forwarded = chunk_enqueue_batch(&filtering_reconstruction_queue, batch, taken);
+        drop_filtered(batch + forwarded, taken - forwarded);
+
+        worker->chunks_processed += forwarded;
+        worker->busy_ns += monotonic_ns() - work_start;
     }
 
     return NULL;
 }
 
-void assign_threads_to_chunk(void) {
-    while (!stop_flag) {
+/*
+    Forwards the filtered chunks buffered by a stealing worker. Buffering keeps the reconstruction queue
+    at one lock acquisition per FILTER_BATCH_SIZE chunks, as in queue mode.
+*/
+static void flush_filtered(filter_worker_t *worker, image_chunk_t **filtered, size_t *count) {
+    if (*count == 0)
+        return;
+
+    size_t forwarded = chunk_enqueue_batch(&filtering_reconstruction_queue, filtered, *count);
+    drop_filtered(filtered + forwarded, *count - forwarded);
+
+    worker->chunks_processed += forwarded;
+    *count = 0;
+}
+
+static void *filter_steal_worker_thread(void *arg) {
+    filter_worker_t *worker = (filter_worker_t *)arg;
+    image_chunk_t *filtered[FILTER_BATCH_SIZE];
+    size_t filtered_count = 0;
+
+    // Any non-zero seed works for xorshift; spread the workers' victim sequences apart
+    uint64_t rng = 0x9E3779B97F4A7C15ull * (worker->index + 1);
+
+    while (1) {
+        uint64_t work_start = monotonic_ns();
+        image_chunk_t *chunk = ws_scheduler_find_work(&filter_scheduler, worker->index, &rng);
 
-        // Create a new thread for the chunk
-        pthread_t thread;
-        int result = pthread_create(&thread, NULL, process_chunk, (void*) NULL);
-        
-        if (result) {
-            perror("Error creating thread for chunk");
+        if (chunk != NULL) {
+            filter_chunk(chunk);
+            filtered[filtered_count++] = chunk;
+
+            if (filtered_count == FILTER_BATCH_SIZE)
+                flush_filtered(worker, filtered, &filtered_count);
+
+            worker->busy_ns += monotonic_ns() - work_start;
             continue;
         }
-        
-        // Detach the thread to avoid needing to join it later
-        pthread_detach(thread);
+
+        // Out of work: do not sit on finished chunks while parked
+        flush_filtered(worker, filtered, &filtered_count);
+
+        uint64_t wait_start = monotonic_ns();
+        worker->busy_ns += wait_start - work_start;
+
+        bool keep_running = ws_scheduler_wait_for_work(&filter_scheduler);
+        worker->idle_ns += monotonic_ns() - wait_start;
+
+        if (!keep_running)
+            break;
+    }
+
+    return NULL;
+}
+
+int filter_pool_start(size_t num_workers, size_t num_producers, filter_scheduler_t scheduler) {
+    if (num_workers == 0 || filter_pool.workers != NULL)
+        return -1;
+
+    if (scheduler == FILTER_SCHEDULER_STEAL &&
+        ws_scheduler_init(&filter_scheduler, num_workers, num_producers, &chunker_filtering_queue) != 0)
+        return -1;
+
+    filter_pool.scheduler = scheduler;
+    filter_pool.workers = (filter_worker_t *)calloc(num_workers, sizeof(filter_worker_t));
+    if (filter_pool.workers == NULL) {
+        perror("filter_pool_start: Failed to allocate memory for filter workers");
+        if (scheduler == FILTER_SCHEDULER_STEAL)
+            ws_scheduler_destroy(&filter_scheduler);
+        return -1;
+    }
+
+    void *(*worker_routine)(void *) = (scheduler == FILTER_SCHEDULER_STEAL)?
+        filter_steal_worker_thread: filter_worker_thread;
+
+    for (size_t i = 0; i < num_workers; i++) {
+        filter_worker_t *worker = &filter_pool.workers[i];
+        worker->index = i;
+
+        if (pthread_create(&worker->thread, NULL, worker_routine, worker) != 0) {
+            perror("filter_pool_start: Failed to create a filter worker thread");
+
+            // Stop the workers that did start before reporting the failure
+            stop_flag = 1;
+            filter_pool.num_workers = i;
+            filter_pool_stop();
+            filter_pool_destroy();
+            return -1;
+        }
+
+        filter_pool.num_workers = i + 1;
     }
 
-    pthread_mutex_lock(&chunker_filtering_queue.lock);
-        pthread_cond_broadcast(&chunker_filtering_queue.cond_not_empty);
-    pthread_mutex_unlock(&chunker_filtering_queue.lock);
-}
\ No newline at end of file
+    return 0;
+}
+
+void filter_pool_register_producer(void) {
+    if (filter_pool.workers == NULL || filter_pool.scheduler != FILTER_SCHEDULER_STEAL)
+        return;
+
+    producer_deque = ws_scheduler_register_producer(&filter_scheduler);
+}
+
+size_t filter_pool_submit(image_chunk_t **chunks, size_t n) {
+    if (filter_pool.scheduler != FILTER_SCHEDULER_STEAL)
+        return chunk_enqueue_batch(&chunker_filtering_queue, chunks, n);
+
+    size_t submitted = 0;
+    if (producer_deque >= 0)
+        submitted = ws_scheduler_push_local(&filter_scheduler, (size_t)producer_deque, chunks, n);
+
+    // Unregistered thread, or the local deque could not grow
+    if (submitted < n)
+        submitted += ws_scheduler_inject(&filter_scheduler, chunks + submitted, n - submitted);
+
+    return submitted;
+}
+
+int filter_pool_enable_fusion(size_t backlog_threshold) {
+    if (filter_pool.workers == NULL || filter_pool.scheduler != FILTER_SCHEDULER_STEAL)
+        return -1;
+
+    filter_pool.fuse_threshold = backlog_threshold;
+    filter_pool.fused = true;
+    return 0;
+}
+
+bool filter_pool_fused(void) {
+    return filter_pool.fused;
+}
+
+static int filter_fused_chunk(image_chunk_t *chunk) {
+    if (process_chunk(chunk) != 0)
+        return -1;
+
+    atomic_fetch_add_explicit(&filter_pool.fused_chunks, 1, memory_order_relaxed);
+    return 0;
+}
+
+int filter_pool_submit_fused(image_chunk_t *chunk) {
+    // No deque to share from (threshold 0, unregistered thread or a deque that cannot grow): filter now
+    if (filter_pool.fuse_threshold == 0 || producer_deque < 0 ||
+        ws_scheduler_push_local(&filter_scheduler, (size_t)producer_deque, &chunk, 1) != 1)
+        return filter_fused_chunk(chunk);
+
+    ws_deque_t *own = &filter_scheduler.deques[producer_deque];
+    int status = 0;
+
+    // LIFO: the tile just pushed is the one still hot in cache
+    while (ws_deque_size(own) > filter_pool.fuse_threshold) {
+        image_chunk_t *next = ws_deque_take(own);
+        if (next == NULL)
+            break;
+
+        if (filter_fused_chunk(next) != 0)
+            status = -1;
+    }
+
+    return status;
+}
+
+void filter_pool_drain_fused(void) {
+    if (!filter_pool.fused || producer_deque < 0)
+        return;
+
+    image_chunk_t *chunk;
+    while ((chunk = ws_deque_take(&filter_scheduler.deques[producer_deque])) != NULL)
+        filter_fused_chunk(chunk);
+}
+
+void filter_pool_stop(void) {
+    if (filter_pool.workers == NULL)
+        return;
+
+    chunk_queue_wake_all(&chunker_filtering_queue);
+    if (filter_pool.scheduler == FILTER_SCHEDULER_STEAL)
+        ws_scheduler_wake_all(&filter_scheduler);
+
+    for (size_t i = 0; i < filter_pool.num_workers; i++)
+        pthread_join(filter_pool.workers[i].thread, NULL);
+}
+
+void filter_pool_report(void) {
+    if (filter_pool.workers == NULL)
+        return;
+
+    uint64_t total_chunks = 0;
+
+    printf("Filter pool report (%zu workers, %s scheduler):\n", filter_pool.num_workers,
+        (filter_pool.scheduler == FILTER_SCHEDULER_STEAL)? "work-stealing": "shared queue");
+    for (size_t i = 0; i < filter_pool.num_workers; i++) {
+        const filter_worker_t *worker = &filter_pool.workers[i];
+        uint64_t total_ns = worker->busy_ns + worker->idle_ns;
+        double utilisation = (total_ns > 0)? 100.0 * (double)worker->busy_ns / (double)total_ns: 0.0;
+
+        printf("  worker %zu: %llu chunks, busy %.3f s, idle %.3f s, utilisation %.1f%%\n",
+            worker->index, (unsigned long long)worker->chunks_processed,
+            worker->busy_ns / 1e9, worker->idle_ns / 1e9, utilisation);
+
+        total_chunks += worker->chunks_processed;
+    }
+
+    if (filter_pool.fused) {
+        uint64_t fused_chunks = atomic_load(&filter_pool.fused_chunks);
+        printf("  fused on chunker threads: %llu chunks\n", (unsigned long long)fused_chunks);
+        total_chunks += fused_chunks;
+    }
+
+    printf("  total: %llu chunks\n", (unsigned long long)total_chunks);
+}
+
+void filter_pool_destroy(void) {
+    if (filter_pool.workers != NULL && filter_pool.scheduler == FILTER_SCHEDULER_STEAL)
+        ws_scheduler_destroy(&filter_scheduler);
+
+    free(filter_pool.workers);
+    filter_pool.workers = NULL;
+    filter_pool.num_workers = 0;
+    filter_pool.fused = false;
+    atomic_store(&filter_pool.fused_chunks, 0);
+}
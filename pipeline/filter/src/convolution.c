@@ -0,0 +1,608 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include <convolution.h>
+#include <samples.h>
+#include <log.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CONVOLUTION_X86 1
+#include <immintrin.h>
+#endif
+
+/** @brief Largest fractional precision of the quantised weights. */
+#define CONVOLUTION_MAX_SHIFT 14
+
+/** @brief Largest fractional precision kept in the 16-bit intermediates of the separable path. */
+#define CONVOLUTION_MAX_INTERMEDIATE_BITS 6
+
+/** @brief Relative residual below which a kernel counts as rank 1. */
+#define CONVOLUTION_RANK1_TOLERANCE 1e-6
+
+typedef struct {
+    const char *name;
+    int width, height;
+    float weights[25];
+    float scale, bias;
+} convolution_preset_t;
+
+static const convolution_preset_t presets[] = {
+    { "sharpen",   3, 3, {  0, -1,  0, -1,  5, -1,  0, -1,  0 }, 1.0f, 0.0f },
+    { "emboss",    3, 3, { -2, -1,  0, -1,  1,  1,  0,  1,  2 }, 1.0f, 0.0f },
+    { "edge",      3, 3, { -1, -1, -1, -1,  8, -1, -1, -1, -1 }, 1.0f, 0.0f },
+    { "laplacian", 3, 3, {  0,  1,  0,  1, -4,  1,  0,  1,  0 }, 1.0f, 128.0f },
+    { "sobel-x",   3, 3, { -1,  0,  1, -2,  0,  2, -1,  0,  1 }, 1.0f, 128.0f },
+    { "sobel-y",   3, 3, { -1, -2, -1,  0,  0,  0,  1,  2,  1 }, 1.0f, 128.0f },
+    { "box3",      3, 3, {  1,  1,  1,  1,  1,  1,  1,  1,  1 }, 1.0f / 9.0f, 0.0f },
+    { "box5",      5, 5, {  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+                            1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1 }, 1.0f / 25.0f, 0.0f },
+};
+
+int convolution_kernel_preset(const char *name, convolution_kernel_t *kernel) {
+    for (size_t i = 0; i < sizeof(presets) / sizeof(presets[0]); i++) {
+        if (strcmp(name, presets[i].name) != 0)
+            continue;
+
+        memset(kernel, 0, sizeof(*kernel));
+        kernel->width = presets[i].width;
+        kernel->height = presets[i].height;
+        memcpy(kernel->weights, presets[i].weights, sizeof(float) * (size_t)(kernel->width * kernel->height));
+        kernel->scale = presets[i].scale;
+        kernel->bias = presets[i].bias;
+        return 0;
+    }
+
+    return -1;
+}
+
+/*
+    Picks the largest shift for which every weight fits in 16 bits and the sum of
+    |weight| * max_input stays well inside an int32, so neither the pmaddwd pairs nor
+    the accumulation can overflow whatever the input.
+*/
+static int quantize(const double *weights, int count, double max_input, int16_t *out, int *shift) {
+    for (int s = CONVOLUTION_MAX_SHIFT; s >= 0; s--) {
+        double total = 0.0;
+        int fits = 1;
+
+        for (int i = 0; i < count && fits; i++) {
+            double q = nearbyint(weights[i] * (double)(1 << s));
+            if (fabs(q) > 32767.0)
+                fits = 0;
+            total += fabs(q);
+        }
+
+        if (!fits || total * max_input >= (double)(1 << 30))
+            continue;
+
+        for (int i = 0; i < count; i++)
+            out[i] = (int16_t)nearbyint(weights[i] * (double)(1 << s));
+        *shift = s;
+        return 0;
+    }
+
+    return -1;
+}
+
+/*
+    Dominant singular triplet of the height x width matrix `k` by power iteration on
+    K^T K, then the residual of the rank-1 reconstruction. Kernels are at most 15 x 15,
+    so this costs nothing next to a single tile.
+*/
+static int rank1_factor(const double *k, int width, int height, double *column, double *row) {
+    double norm = 0.0;
+    int best = 0;
+
+    for (int y = 0; y < height; y++) {
+        double row_norm = 0.0;
+        for (int x = 0; x < width; x++)
+            row_norm += k[y * width + x] * k[y * width + x];
+        if (row_norm > norm) {
+            norm = row_norm;
+            best = y;
+        }
+    }
+
+    if (norm == 0.0)
+        return -1;
+
+    // Start from the strongest row: it lies in the row space, so it is never orthogonal to v
+    double v[CONVOLUTION_MAX_SIZE], u[CONVOLUTION_MAX_SIZE], sigma = 0.0;
+    for (int x = 0; x < width; x++)
+        v[x] = k[best * width + x] / sqrt(norm);
+
+    for (int iteration = 0; iteration < 100; iteration++) {
+        double length = 0.0;
+        for (int y = 0; y < height; y++) {
+            u[y] = 0.0;
+            for (int x = 0; x < width; x++)
+                u[y] += k[y * width + x] * v[x];
+            length += u[y] * u[y];
+        }
+        length = sqrt(length);
+        for (int y = 0; y < height; y++)
+            u[y] /= length;
+
+        sigma = 0.0;
+        for (int x = 0; x < width; x++) {
+            v[x] = 0.0;
+            for (int y = 0; y < height; y++)
+                v[x] += k[y * width + x] * u[y];
+            sigma += v[x] * v[x];
+        }
+        sigma = sqrt(sigma);
+        for (int x = 0; x < width; x++)
+            v[x] /= sigma;
+    }
+
+    double total = 0.0, residual = 0.0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            double d = k[y * width + x] - sigma * u[y] * v[x];
+            residual += d * d;
+            total += k[y * width + x] * k[y * width + x];
+        }
+    }
+
+    if (residual > CONVOLUTION_RANK1_TOLERANCE * CONVOLUTION_RANK1_TOLERANCE * total)
+        return -1;
+
+    // Split sigma evenly; make the largest vertical tap positive
+    int peak = 0;
+    for (int y = 1; y < height; y++)
+        if (fabs(u[y]) > fabs(u[peak]))
+            peak = y;
+    double sign = (u[peak] < 0.0)? -1.0: 1.0;
+
+    for (int y = 0; y < height; y++)
+        column[y] = sign * sqrt(sigma) * u[y];
+    for (int x = 0; x < width; x++)
+        row[x] = sign * sqrt(sigma) * v[x];
+    return 0;
+}
+
+static int init_separable(convolution_t *conv, const double *k) {
+    double column[CONVOLUTION_MAX_SIZE], row[CONVOLUTION_MAX_SIZE];
+
+    if (rank1_factor(k, conv->width, conv->height, column, row) != 0)
+        return -1;
+
+    if (quantize(column, conv->height, 255.0, conv->column, &conv->column_shift) != 0)
+        return -1;
+
+    // Keep as many fractional bits between the passes as the largest intermediate allows
+    double gain = 0.0;
+    for (int y = 0; y < conv->height; y++)
+        gain += abs(conv->column[y]) * 255.0;
+
+    int bits = 0;
+    while (bits < CONVOLUTION_MAX_INTERMEDIATE_BITS && bits < conv->column_shift &&
+           ldexp(gain, bits + 1 - conv->column_shift) < 32767.0)
+        bits++;
+    conv->intermediate_bits = bits;
+
+    double max_intermediate = ceil(ldexp(gain, bits - conv->column_shift)) + 1.0;
+    if (max_intermediate > 32767.0 || quantize(row, conv->width, max_intermediate, conv->row, &conv->row_shift) != 0)
+        return -1;
+
+    return 0;
+}
+
+static int count_taps(const int16_t *weights, int count) {
+    int taps = 0;
+    for (int i = 0; i < count; i++)
+        taps += (weights[i] != 0);
+    return taps;
+}
+
+int convolution_init(convolution_t *conv, const convolution_kernel_t *kernel) {
+    memset(conv, 0, sizeof(*conv));
+
+    if (kernel->width < 1 || kernel->width > CONVOLUTION_MAX_SIZE || kernel->width % 2 == 0 ||
+        kernel->height < 1 || kernel->height > CONVOLUTION_MAX_SIZE || kernel->height % 2 == 0)
+        return -1;
+
+    conv->width = kernel->width;
+    conv->height = kernel->height;
+    conv->reach_x = (size_t)(kernel->width / 2);
+    conv->reach_y = (size_t)(kernel->height / 2);
+    conv->bias = (int)lrint(kernel->bias);
+    conv->exact_bias = kernel->bias;
+
+    int count = kernel->width * kernel->height;
+    double k[CONVOLUTION_MAX_SIZE * CONVOLUTION_MAX_SIZE];
+    int nonzero = 0;
+
+    for (int i = 0; i < count; i++) {
+        k[i] = (double)kernel->weights[i] * (double)kernel->scale;
+        conv->exact[i] = (float)k[i];
+        nonzero |= (k[i] != 0.0);
+    }
+
+    if (!nonzero || quantize(k, count, 255.0, conv->weights, &conv->shift) != 0)
+        return -1;
+
+    // A 1 x N or N x 1 kernel is already one pass
+    if (conv->width > 1 && conv->height > 1)
+        conv->rank1 = (init_separable(conv, k) == 0);
+
+    if (conv->rank1) {
+        int taps_2d = count_taps(conv->weights, count);
+        int taps_1d = count_taps(conv->column, conv->height) + count_taps(conv->row, conv->width);
+        conv->separable = (taps_2d > 2 * taps_1d);
+    }
+
+    return 0;
+}
+
+/*
+    Scalar kernels. finish() matches the vector path: arithmetic shift after adding half,
+    bias, then saturation to the output type.
+*/
+
+static inline int round_shift(int acc, int shift) {
+    return (shift > 0)? (acc + (1 << (shift - 1))) >> shift: acc;
+}
+
+static void bytes_to_bytes_scalar(const unsigned char *in, const ptrdiff_t *offsets, const int16_t *weights, int taps,
+                                  int shift, int bias, unsigned char *out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int acc = 0;
+        for (int t = 0; t < taps; t++)
+            acc += weights[t] * in[(ptrdiff_t)i + offsets[t]];
+
+        int v = round_shift(acc, shift) + bias;
+        out[i] = (v < 0)? 0: (v > 255)? 255: (unsigned char)v;
+    }
+}
+
+static void bytes_to_words_scalar(const unsigned char *in, const ptrdiff_t *offsets, const int16_t *weights, int taps,
+                                  int shift, int16_t *out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int acc = 0;
+        for (int t = 0; t < taps; t++)
+            acc += weights[t] * in[(ptrdiff_t)i + offsets[t]];
+
+        int v = round_shift(acc, shift);
+        out[i] = (int16_t)((v < -32768)? -32768: (v > 32767)? 32767: v);
+    }
+}
+
+static void words_to_bytes_scalar(const int16_t *in, const ptrdiff_t *offsets, const int16_t *weights, int taps,
+                                  int shift, int bias, unsigned char *out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int acc = 0;
+        for (int t = 0; t < taps; t++)
+            acc += weights[t] * in[(ptrdiff_t)i + offsets[t]];
+
+        int v = round_shift(acc, shift) + bias;
+        out[i] = (v < 0)? 0: (v > 255)? 255: (unsigned char)v;
+    }
+}
+
+#ifdef CONVOLUTION_X86
+
+/*
+    16 outputs per iteration. Two taps are interleaved sample by sample (unpacklo/hi) and
+    multiplied by the matching (w0, w1) pair with pmaddwd, which sums each pair into a
+    32-bit lane. The two accumulators hold outputs 0-3/8-11 and 4-7/12-15; packssdw
+    undoes that interleaving and saturates to 16 bits.
+*/
+#define CONVOLVE_TAPS_AVX2(load)                                                                     \
+    __m256i acc_lo = _mm256_setzero_si256(), acc_hi = _mm256_setzero_si256();                         \
+    for (int t = 0; t < taps; t += 2) {                                                               \
+        __m256i a = load(offsets[t]);                                                                 \
+        __m256i b = (t + 1 < taps)? load(offsets[t + 1]): _mm256_setzero_si256();                     \
+        int16_t w1 = (t + 1 < taps)? weights[t + 1]: 0;                                               \
+        __m256i pair = _mm256_set1_epi32((int)(((uint32_t)(uint16_t)w1 << 16) | (uint16_t)weights[t]));\
+        acc_lo = _mm256_add_epi32(acc_lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), pair));      \
+        acc_hi = _mm256_add_epi32(acc_hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), pair));      \
+    }                                                                                                 \
+    acc_lo = _mm256_add_epi32(_mm256_srai_epi32(_mm256_add_epi32(acc_lo, rounding), shift), offset);  \
+    acc_hi = _mm256_add_epi32(_mm256_srai_epi32(_mm256_add_epi32(acc_hi, rounding), shift), offset);  \
+    __m256i words = _mm256_packs_epi32(acc_lo, acc_hi);
+
+#define LOAD_BYTES_AVX2(offset) _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(in + (ptrdiff_t)i + (offset))))
+#define LOAD_WORDS_AVX2(offset) _mm256_loadu_si256((const __m256i *)(in + (ptrdiff_t)i + (offset)))
+
+// 16 words to 16 saturated bytes in order: packuswb works per 128-bit lane
+#define STORE_BYTES_AVX2(dst, words)                                                                 \
+    _mm_storeu_si128((__m128i *)(dst),                                                                \
+                     _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), 0x08)))
+
+__attribute__((target("avx2")))
+static void bytes_to_bytes_avx2(const unsigned char *in, const ptrdiff_t *offsets, const int16_t *weights, int taps,
+                                int shift, int bias, unsigned char *out, size_t count) {
+    const __m256i rounding = _mm256_set1_epi32((shift > 0)? 1 << (shift - 1): 0);
+    const __m256i offset = _mm256_set1_epi32(bias);
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        CONVOLVE_TAPS_AVX2(LOAD_BYTES_AVX2)
+        STORE_BYTES_AVX2(out + i, words);
+    }
+
+    if (i < count)
+        bytes_to_bytes_scalar(in + i, offsets, weights, taps, shift, bias, out + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void bytes_to_words_avx2(const unsigned char *in, const ptrdiff_t *offsets, const int16_t *weights, int taps,
+                                int shift, int16_t *out, size_t count) {
+    const __m256i rounding = _mm256_set1_epi32((shift > 0)? 1 << (shift - 1): 0);
+    const __m256i offset = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        CONVOLVE_TAPS_AVX2(LOAD_BYTES_AVX2)
+        _mm256_storeu_si256((__m256i *)(out + i), words);
+    }
+
+    if (i < count)
+        bytes_to_words_scalar(in + i, offsets, weights, taps, shift, out + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void words_to_bytes_avx2(const int16_t *in, const ptrdiff_t *offsets, const int16_t *weights, int taps,
+                                int shift, int bias, unsigned char *out, size_t count) {
+    const __m256i rounding = _mm256_set1_epi32((shift > 0)? 1 << (shift - 1): 0);
+    const __m256i offset = _mm256_set1_epi32(bias);
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        CONVOLVE_TAPS_AVX2(LOAD_WORDS_AVX2)
+        STORE_BYTES_AVX2(out + i, words);
+    }
+
+    if (i < count)
+        words_to_bytes_scalar(in + i, offsets, weights, taps, shift, bias, out + i, count - i);
+}
+
+#undef CONVOLVE_TAPS_AVX2
+#undef LOAD_BYTES_AVX2
+#undef LOAD_WORDS_AVX2
+#undef STORE_BYTES_AVX2
+
+#endif /* CONVOLUTION_X86 */
+
+static const convolution_kernels_t scalar_kernels = {
+    CONVOLUTION_ISA_SCALAR, "scalar", bytes_to_bytes_scalar, bytes_to_words_scalar, words_to_bytes_scalar
+};
+
+int convolution_kernels_get(convolution_isa_t isa, convolution_kernels_t *out) {
+    switch (isa) {
+        case CONVOLUTION_ISA_SCALAR:
+            *out = scalar_kernels;
+            return 0;
+#ifdef CONVOLUTION_X86
+        case CONVOLUTION_ISA_AVX2:
+            __builtin_cpu_init();
+            if (!__builtin_cpu_supports("avx2"))
+                return -1;
+            *out = (convolution_kernels_t){
+                CONVOLUTION_ISA_AVX2, "avx2", bytes_to_bytes_avx2, bytes_to_words_avx2, words_to_bytes_avx2
+            };
+            return 0;
+#endif
+        default:
+            return -1;
+    }
+}
+
+static convolution_kernels_t best_kernels;
+static pthread_once_t best_once = PTHREAD_ONCE_INIT;
+
+static void select_best(void) {
+    best_kernels = scalar_kernels;
+
+    for (int isa = CONVOLUTION_ISA_COUNT - 1; isa > CONVOLUTION_ISA_SCALAR; isa--) {
+        if (convolution_kernels_get((convolution_isa_t)isa, &best_kernels) == 0)
+            return;
+    }
+}
+
+const convolution_kernels_t *convolution_kernels(void) {
+    pthread_once(&best_once, select_best);
+    return &best_kernels;
+}
+
+static inline size_t min_size(size_t a, size_t b) {
+    return (a < b)? a: b;
+}
+
+static inline ptrdiff_t clamp_index(ptrdiff_t v, ptrdiff_t lo, ptrdiff_t hi) {
+    return (v < lo)? lo: (v > hi)? hi: v;
+}
+
+// Zero taps cost a multiply-add each; drop them (sharpen has 5 of 9, Sobel 6 of 9)
+static int gather_taps(const int16_t *weights, int count, const ptrdiff_t *all_offsets,
+                       int16_t *tap_weights, ptrdiff_t *tap_offsets) {
+    int taps = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (weights[i] == 0)
+            continue;
+        tap_weights[taps] = weights[i];
+        tap_offsets[taps] = all_offsets[i];
+        taps++;
+    }
+
+    return taps;
+}
+
+// 16-bit and float samples: one colour channel at a time as a padded float plane, direct 2D taps
+static void convolution_apply_wide(const convolution_t *conv, image_chunk_t *chunk) {
+    int channels = chunk->channels;
+    int colour_channels = (channels == 2 || channels == 4)? channels - 1: channels;
+    size_t width = chunk->width, height = chunk->height;
+    size_t sample_bytes = image_sample_bytes(chunk->sample);
+
+    size_t rx = conv->reach_x, ry = conv->reach_y;
+    ptrdiff_t left = (ptrdiff_t)min_size(chunk->halo_left, rx), right = (ptrdiff_t)min_size(chunk->halo_right, rx);
+    ptrdiff_t top = (ptrdiff_t)min_size(chunk->halo_top, ry), bottom = (ptrdiff_t)min_size(chunk->halo_bottom, ry);
+    ptrdiff_t first_x = -left, last_x = (ptrdiff_t)width - 1 + right;
+    size_t run_start = rx - (size_t)left, run = (size_t)(last_x - first_x + 1);
+
+    size_t padded_width = width + 2 * rx, padded_rows = height + 2 * ry;
+    float *padded = malloc((padded_rows * padded_width + width) * sizeof(float));
+    if (padded == NULL) {
+        LOG_ERROR("Error: failed to allocate convolution scratch for a %zux%zu chunk", padded_width, padded_rows);
+        return;
+    }
+    float *out = padded + padded_rows * padded_width;
+
+    ptrdiff_t tap_offsets[CONVOLUTION_MAX_SIZE * CONVOLUTION_MAX_SIZE];
+    float tap_weights[CONVOLUTION_MAX_SIZE * CONVOLUTION_MAX_SIZE];
+    int taps = 0;
+
+    for (int ky = 0; ky < conv->height; ky++) {
+        for (int kx = 0; kx < conv->width; kx++) {
+            float weight = conv->exact[ky * conv->width + kx];
+            if (weight == 0.0f)
+                continue;
+            tap_weights[taps] = weight;
+            tap_offsets[taps++] = (ptrdiff_t)(ky * padded_width) + kx;
+        }
+    }
+
+    float bias = conv->exact_bias * image_sample_max(chunk->sample) / 255.0f;
+
+    for (int c = 0; c < colour_channels; c++) {
+        for (size_t py = 0; py < padded_rows; py++) {
+            ptrdiff_t sy = clamp_index((ptrdiff_t)py - (ptrdiff_t)ry, -top, (ptrdiff_t)height - 1 + bottom);
+            const unsigned char *src = chunk->pixel_data + sy * (ptrdiff_t)chunk->row_stride + (size_t)c * sample_bytes;
+            float *dst = padded + py * padded_width;
+
+            samples_load(src + first_x * channels * (ptrdiff_t)sample_bytes, chunk->sample, channels, run, dst + run_start);
+
+            for (size_t px = 0; px < run_start; px++)
+                dst[px] = dst[run_start];
+            for (size_t px = run_start + run; px < padded_width; px++)
+                dst[px] = dst[run_start + run - 1];
+        }
+
+        for (size_t y = 0; y < height; y++) {
+            const float *in = padded + y * padded_width;
+
+            for (size_t x = 0; x < width; x++) {
+                float total = bias;
+                for (int t = 0; t < taps; t++)
+                    total += tap_weights[t] * in[x + tap_offsets[t]];
+                out[x] = total;
+            }
+
+            samples_store(out, chunk->pixel_data + y * chunk->row_stride + (size_t)c * sample_bytes, chunk->sample,
+                          channels, width);
+        }
+    }
+
+    free(padded);
+}
+
+void convolution_apply(const convolution_t *conv, const convolution_kernels_t *kernels, image_chunk_t *chunk) {
+    if (!chunk || !chunk->pixel_data) {
+        LOG_ERROR("Error: chunk or pixel_data is NULL");
+        return;
+    }
+
+    int channels = chunk->channels;
+    size_t width = chunk->width, height = chunk->height;
+
+    if (width == 0 || height == 0 || channels <= 0)
+        return;
+
+    if (chunk->sample != IMAGE_SAMPLE_U8) {
+        convolution_apply_wide(conv, chunk);
+        return;
+    }
+
+    size_t rx = conv->reach_x, ry = conv->reach_y;
+    ptrdiff_t left = (ptrdiff_t)min_size(chunk->halo_left, rx), right = (ptrdiff_t)min_size(chunk->halo_right, rx);
+    ptrdiff_t top = (ptrdiff_t)min_size(chunk->halo_top, ry), bottom = (ptrdiff_t)min_size(chunk->halo_bottom, ry);
+
+    /*
+        padded:       height + 2 ry rows of width + 2 rx pixels: the chunk, its halo and replicated edges
+        intermediate: height rows of the same width after the vertical pass (separable path only)
+    */
+    size_t padded_width = width + 2 * rx;
+    size_t padded_stride = padded_width * (size_t)channels;
+    size_t padded_rows = height + 2 * ry;
+    size_t padded_bytes = (padded_rows * padded_stride + 31) & ~(size_t)31;
+    size_t intermediate_bytes = conv->separable? height * padded_stride * sizeof(int16_t): 0;
+
+    unsigned char *padded = malloc(padded_bytes + intermediate_bytes);
+    if (padded == NULL) {
+        LOG_ERROR("Error: failed to allocate convolution scratch for a %zux%zu chunk", padded_width, padded_rows);
+        return;
+    }
+    int16_t *intermediate = (int16_t *)(padded + padded_bytes);
+
+    // Available columns are copied in one run; the rest repeat the outermost available pixel
+    ptrdiff_t first_x = -left, last_x = (ptrdiff_t)width - 1 + right;
+    size_t run_start = rx - (size_t)left;
+    size_t run_bytes = (size_t)(last_x - first_x + 1) * (size_t)channels;
+
+    for (size_t py = 0; py < padded_rows; py++) {
+        ptrdiff_t sy = clamp_index((ptrdiff_t)py - (ptrdiff_t)ry, -top, (ptrdiff_t)height - 1 + bottom);
+        const unsigned char *src = chunk->pixel_data + sy * (ptrdiff_t)chunk->row_stride;
+        unsigned char *dst = padded + py * padded_stride;
+
+        memcpy(dst + run_start * (size_t)channels, src + first_x * channels, run_bytes);
+
+        for (size_t px = 0; px < run_start; px++)
+            memcpy(dst + px * (size_t)channels, src + first_x * channels, (size_t)channels);
+        for (size_t px = run_start + (size_t)(last_x - first_x + 1); px < padded_width; px++)
+            memcpy(dst + px * (size_t)channels, src + last_x * channels, (size_t)channels);
+    }
+
+    ptrdiff_t offsets[CONVOLUTION_MAX_SIZE * CONVOLUTION_MAX_SIZE];
+    ptrdiff_t tap_offsets[CONVOLUTION_MAX_SIZE * CONVOLUTION_MAX_SIZE];
+    int16_t tap_weights[CONVOLUTION_MAX_SIZE * CONVOLUTION_MAX_SIZE];
+    size_t row_bytes = width * (size_t)channels;
+
+    if (conv->separable) {
+        // Vertical pass over every padded column, then horizontal over the intermediates
+        for (int k = 0; k < conv->height; k++)
+            offsets[k] = (ptrdiff_t)(k * padded_stride);
+        int taps = gather_taps(conv->column, conv->height, offsets, tap_weights, tap_offsets);
+
+        for (size_t y = 0; y < height; y++)
+            kernels->bytes_to_words(padded + y * padded_stride, tap_offsets, tap_weights, taps,
+                                    conv->column_shift - conv->intermediate_bits,
+                                    intermediate + y * padded_stride, padded_stride);
+
+        for (int k = 0; k < conv->width; k++)
+            offsets[k] = (ptrdiff_t)k * channels;
+        taps = gather_taps(conv->row, conv->width, offsets, tap_weights, tap_offsets);
+
+        for (size_t y = 0; y < height; y++)
+            kernels->words_to_bytes(intermediate + y * padded_stride, tap_offsets, tap_weights, taps,
+                                    conv->row_shift + conv->intermediate_bits, conv->bias,
+                                    chunk->pixel_data + y * chunk->row_stride, row_bytes);
+    } else {
+        for (int ky = 0; ky < conv->height; ky++)
+            for (int kx = 0; kx < conv->width; kx++)
+                offsets[ky * conv->width + kx] = (ptrdiff_t)(ky * padded_stride) + (ptrdiff_t)kx * channels;
+        int taps = gather_taps(conv->weights, conv->width * conv->height, offsets, tap_weights, tap_offsets);
+
+        for (size_t y = 0; y < height; y++)
+            kernels->bytes_to_bytes(padded + y * padded_stride, tap_offsets, tap_weights, taps, conv->shift, conv->bias,
+                                    chunk->pixel_data + y * chunk->row_stride, row_bytes);
+    }
+
+    // The rows were convolved as plain bytes; put alpha back
+    if (channels == 2 || channels == 4) {
+        for (size_t y = 0; y < height; y++) {
+            const unsigned char *src = padded + (y + ry) * padded_stride + rx * (size_t)channels;
+            unsigned char *dst = chunk->pixel_data + y * chunk->row_stride;
+
+            for (size_t x = 0; x < width; x++)
+                dst[x * channels + channels - 1] = src[x * channels + channels - 1];
+        }
+    }
+
+    free(padded);
+}
@@ -1,94 +1,419 @@
 #include "filter.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <greyscale.h>
+#include <lut.h>
+#include <samples.h>
+#include <log.h>
 
 extern chunk_queue_t filtering_reconstruction_queue;
 
 void greyscale(image_chunk_t* chunk) {
     
     if (!chunk) {
-        fprintf(stderr, "Error: chunk is NULL\n");
+        LOG_ERROR("Error: chunk is NULL");
         return;
     }
 
     if (!chunk->pixel_data) {
-        fprintf(stderr, "Error: pixel_data is NULL\n");
+        LOG_ERROR("Error: pixel_data is NULL");
         return;
     }
 
-    int width = chunk->width; 
-    int height = chunk->height;
+    // Fixed-point BT.601 with the fastest kernels for this CPU (see greyscale.h)
+    if (chunk->layout == IMAGE_LAYOUT_PLANAR) {
+        if (chunk->channels < 3)
+            return;
+
+        unsigned char* const planes[3] = { image_chunk_plane(chunk, 0), image_chunk_plane(chunk, 1), image_chunk_plane(chunk, 2) };
+        greyscale_planes(greyscale_kernels(), planes, chunk->width, chunk->height, chunk->row_stride);
+        return;
+    }
+
+    greyscale_samples(greyscale_kernels(), chunk->pixel_data, chunk->width, chunk->height, chunk->row_stride,
+                      chunk->channels, chunk->sample);
+}
+
+// 16-bit and float samples: the same running mean, over one channel of the row at a time in float
+static void directional_blur_wide(image_chunk_t* chunk, int line_size, int colour_channels,
+                                  long reach_left, long reach_right, long first, long last, size_t span) {
     int channels = chunk->channels;
+    size_t pixel_bytes = (size_t)channels * image_sample_bytes(chunk->sample);
 
-    for (int i=0; i<width*height*channels; i+=channels) {
-        unsigned char* pixel = chunk->pixel_data;
-        unsigned char gray = (unsigned char)(0.299 * pixel[i+0] + 0.587 * pixel[i+1] + 0.114 * pixel[i+2]); // assuming RGB
-        pixel[0] = gray;
-        pixel[1] = gray;
-        pixel[2] = gray;
+    // One channel of the row with its halo, then the blurred interior
+    float* row_copy = malloc((span + chunk->width) * sizeof(float));
+    if (!row_copy) {
+        LOG_ERROR("Error: failed to allocate a %zu-pixel blur row", span);
+        return;
     }
+    float* blurred = row_copy + span;
+
+    for (size_t y = 0; y < chunk->height; y++) {
+        unsigned char* row = chunk->pixel_data + y * chunk->row_stride;
+
+        for (int c = 0; c < colour_channels; c++) {
+            size_t channel_offset = (size_t)c * image_sample_bytes(chunk->sample);
+            samples_load(row + first * (long)pixel_bytes + channel_offset, chunk->sample, channels, span, row_copy);
+
+            double total = 0.0;
+            for (long k = -reach_left; k <= reach_right; k++) {
+                long x = (k < first)? first: (k > last)? last: k;
+                total += row_copy[x - first];
+            }
+
+            for (long x = 0; x < (long)chunk->width; x++) {
+                blurred[x] = (float)(total / line_size);
+
+                long enter = x + reach_right + 1, leave = x - reach_left;
+                enter = (enter > last)? last: enter;
+                leave = (leave < first)? first: leave;
+                total += row_copy[enter - first] - row_copy[leave - first];
+            }
+
+            samples_store(blurred, row + channel_offset, chunk->sample, channels, chunk->width);
+        }
+    }
+
+    free(row_copy);
 }
 
+/*
+    Horizontal motion blur: every pixel becomes the mean of the `line_size` pixels of its row centred on it,
+    with a running sum per channel. The window reaches into the halo and is clamped at its edge, which is
+    the image edge for tiles that border it, so tiled output matches the whole-image output.
+*/
 void directional_blur(image_chunk_t* chunk, int line_size) {
     
     if (!chunk) {
-        fprintf(stderr, "Error: chunk is NULL\n");
+        LOG_ERROR("Error: chunk is NULL");
         return;
     }
 
     if (!chunk->pixel_data) {
-        fprintf(stderr, "Error: pixel_data is NULL\n");
+        LOG_ERROR("Error: pixel_data is NULL");
         return;
     }
 
-    int width = chunk->width; 
-    int height = chunk->height;
     int channels = chunk->channels;
-    unsigned char* pixel = chunk->pixel_data;
+    // Alpha (last of 2 or 4 channels) is not blurred
+    int colour_channels = (channels == 2 || channels == 4)? channels - 1: channels;
+
+    if (line_size <= 1 || channels <= 0)
+        return;
+
+    long reach_left = (line_size - 1) / 2;
+    long reach_right = line_size / 2;
+    long first = -(long)chunk->halo_left;
+    long last = (long)(chunk->width + chunk->halo_right) - 1;
+    size_t span = (size_t)(last - first + 1);
+
+    if (chunk->sample != IMAGE_SAMPLE_U8) {
+        directional_blur_wide(chunk, line_size, colour_channels, reach_left, reach_right, first, last, span);
+        return;
+    }
+
+    // The row is rewritten in place, so the window reads from a copy
+    unsigned char* row_copy = malloc(span * channels);
+    if (!row_copy) {
+        LOG_ERROR("Error: failed to allocate a %zu-pixel blur row", span);
+        return;
+    }
+
+    for (size_t y = 0; y < chunk->height; y++) {
+        unsigned char* row = chunk->pixel_data + y * chunk->row_stride;
+        memcpy(row_copy, row + first * channels, span * channels);
+
+        for (int c = 0; c < colour_channels; c++) {
+            const unsigned char* src = row_copy + c;
+            int total = 0;
 
-    for (long long int i = 0; i < width * height * channels; i+=channels*line_size) {
-        int total_r = 0;
-        int total_g = 0;
-        int total_b = 0;
+            for (long k = -reach_left; k <= reach_right; k++) {
+                long x = (k < first)? first: (k > last)? last: k;
+                total += src[(x - first) * channels];
+            }
 
-        for (int j=0; j<line_size*channels; j+=channels) {
-            total_r += pixel[i+j+0];
-            total_g += pixel[i+j+1];
-            total_b += pixel[i+j+2];
+            for (long x = 0; x < (long)chunk->width; x++) {
+                row[x * channels + c] = (unsigned char)((total + line_size / 2) / line_size);
+
+                long enter = x + reach_right + 1, leave = x - reach_left;
+                enter = (enter > last)? last: enter;
+                leave = (leave < first)? first: leave;
+                total += src[(enter - first) * channels] - src[(leave - first) * channels];
+            }
         }
-        
-        unsigned char r = total_r/line_size;
-        unsigned char b = total_b/line_size;
-        unsigned char g = total_g/line_size;
-        
-        for (int j=0; j<line_size*channels; j+=channels) {
-            pixel[i+j+0] =r;
-            pixel[i+j+1] = g;
-            pixel[i+j+2] = b;
+    }
+
+    free(row_copy);
+}
+
+/*
+    Perreault & Hebert, "Median Filtering in Constant Time" (2007). Every column of the chunk keeps a
+    histogram of the 2r + 1 pixels around the current row, updated with one add and one remove per row.
+    The window histogram is the sum of 2r + 1 column histograms and slides right by adding one column and
+    removing another. Histograms have two levels: 16 coarse bins (high nibble), always kept current, and
+    256 fine bins, of which only the 16 under the coarse bin holding the median are brought up to date,
+    lazily. None of the per-pixel work depends on the radius.
+*/
+
+/** @brief Histogram levels: 16 coarse bins of 16 fine bins each. */
+#define MEDIAN_COARSE_BINS 16
+#define MEDIAN_FINE_BINS 256
+
+typedef struct {
+    uint16_t coarse[MEDIAN_COARSE_BINS];
+    uint16_t fine[MEDIAN_FINE_BINS];
+} median_histogram_t;
+
+static inline long clamp_long(long value, long low, long high) {
+    return (value < low)? low: (value > high)? high: value;
+}
+
+static inline void histogram_add(median_histogram_t* h, unsigned char value) {
+    h->coarse[value >> 4]++;
+    h->fine[value]++;
+}
+
+static inline void histogram_remove(median_histogram_t* h, unsigned char value) {
+    h->coarse[value >> 4]--;
+    h->fine[value]--;
+}
+
+// Rearranges `values` so that values[rank] is the one a sort would put there (Hoare's selection)
+static float select_rank(float* values, long count, long rank) {
+    long low = 0, high = count - 1;
+
+    while (low < high) {
+        float pivot = values[low + (high - low) / 2];
+        long i = low, j = high;
+
+        while (i <= j) {
+            while (values[i] < pivot)
+                i++;
+            while (values[j] > pivot)
+                j--;
+            if (i <= j) {
+                float swap = values[i];
+                values[i++] = values[j];
+                values[j--] = swap;
+            }
         }
+
+        if (rank <= j)
+            high = j;
+        else if (rank >= i)
+            low = i;
+        else
+            break;
     }
+
+    return values[rank];
 }
 
-void posterize(image_chunk_t* chunk, int levels) {
+/*
+    16-bit and float samples do not fit the 256-bin histograms: every window is gathered and its median
+    selected, O(r^2) per pixel instead of constant time. Same clamped window as the histogram version.
+*/
+static void median_filter_wide(image_chunk_t* chunk, int radius, int colour_channels,
+                               long first_x, long last_x, long first_y, long last_y) {
+    int channels = chunk->channels;
+    size_t sample_bytes = image_sample_bytes(chunk->sample);
+    size_t ext_width = (size_t)(last_x - first_x + 1), ext_height = (size_t)(last_y - first_y + 1);
+    long window = 2L * radius + 1;
+
+    float* plane = malloc((ext_width * ext_height + chunk->width + (size_t)(window * window)) * sizeof(float));
+    if (!plane) {
+        LOG_ERROR("Error: failed to allocate a median window for a %zux%zu chunk", ext_width, ext_height);
+        return;
+    }
+    float* out_row = plane + ext_width * ext_height;
+    float* samples = out_row + chunk->width;
+
+    const unsigned char* origin = image_chunk_halo_origin(chunk);
+
+    for (int c = 0; c < colour_channels; c++) {
+        for (size_t y = 0; y < ext_height; y++)
+            samples_load(origin + y * chunk->row_stride + c * sample_bytes, chunk->sample, channels, ext_width,
+                         plane + y * ext_width);
+
+        for (long y = 0; y < (long)chunk->height; y++) {
+            for (long x = 0; x < (long)chunk->width; x++) {
+                long count = 0;
+
+                for (long j = y - radius; j <= y + radius; j++) {
+                    const float* row = plane + (clamp_long(j, first_y, last_y) - first_y) * ext_width;
+                    for (long i = x - radius; i <= x + radius; i++)
+                        samples[count++] = row[clamp_long(i, first_x, last_x) - first_x];
+                }
+
+                out_row[x] = select_rank(samples, count, count / 2);
+            }
+
+            samples_store(out_row, chunk->pixel_data + y * chunk->row_stride + c * sample_bytes, chunk->sample,
+                          channels, chunk->width);
+        }
+    }
+
+    free(plane);
+}
+
+void median_filter(image_chunk_t* chunk, int radius) {
+
     if (!chunk) {
-        fprintf(stderr, "Error: chunk is NULL\n");
+        LOG_ERROR("Error: chunk is NULL");
         return;
     }
+
     if (!chunk->pixel_data) {
-        fprintf(stderr, "Error: pixel_data is NULL\n");
+        LOG_ERROR("Error: pixel_data is NULL");
         return;
     }
 
-    int width = chunk->width;
-    int height = chunk->height;
     int channels = chunk->channels;
-    unsigned char* pixel = chunk->pixel_data;
+    int colour_channels = (channels == 2 || channels == 4)? channels - 1: channels;
 
-    int step = 256 / levels;
+    if (radius <= 0 || radius > MEDIAN_MAX_RADIUS || channels <= 0 || chunk->width == 0 || chunk->height == 0)
+        return;
 
-    for (int i = 0; i < width * height * channels; i += channels) {
-        for (int c = 0; c < channels; ++c) {
-            pixel[i + c] = (pixel[i + c] / step) * step;
+    // Available pixels, relative to the first interior pixel; the window is clamped to them
+    long first_x = -(long)chunk->halo_left, last_x = (long)(chunk->width + chunk->halo_right) - 1;
+    long first_y = -(long)chunk->halo_top, last_y = (long)(chunk->height + chunk->halo_bottom) - 1;
+    size_t ext_width = (size_t)(last_x - first_x + 1), ext_height = (size_t)(last_y - first_y + 1);
+    size_t ext_row = ext_width * channels;
+
+    if (chunk->sample != IMAGE_SAMPLE_U8) {
+        median_filter_wide(chunk, radius, colour_channels, first_x, last_x, first_y, last_y);
+        return;
+    }
+
+    // The chunk is overwritten row by row, but rows above the current one are still removed from the columns
+    unsigned char* input = malloc(ext_height * ext_row);
+    median_histogram_t* columns = malloc(ext_width * sizeof(median_histogram_t));
+
+    if (!input || !columns) {
+        LOG_ERROR("Error: failed to allocate median histograms for a %zux%zu chunk", ext_width, ext_height);
+        free(input);
+        free(columns);
+        return;
+    }
+
+    const unsigned char* origin = image_chunk_halo_origin(chunk);
+    for (size_t y = 0; y < ext_height; y++)
+        memcpy(input + y * ext_row, origin + y * chunk->row_stride, ext_row);
+
+    long window = 2L * radius + 1;
+    long rank = window * window / 2;    // Zero-based rank of the median among window * window samples
+
+    for (int c = 0; c < colour_channels; c++) {
+        #define INPUT(x, y) input[((y) - first_y) * ext_row + ((x) - first_x) * channels + c]
+
+        // Column histograms for interior row 0
+        memset(columns, 0, ext_width * sizeof(median_histogram_t));
+        for (long x = first_x; x <= last_x; x++) {
+            for (long k = -radius; k <= radius; k++)
+                histogram_add(&columns[x - first_x], INPUT(x, clamp_long(k, first_y, last_y)));
         }
+
+        for (long y = 0; y < (long)chunk->height; y++) {
+            if (y > 0) {
+                long leave = clamp_long(y - radius - 1, first_y, last_y);
+                long enter = clamp_long(y + radius, first_y, last_y);
+
+                for (long x = first_x; x <= last_x; x++) {
+                    histogram_remove(&columns[x - first_x], INPUT(x, leave));
+                    histogram_add(&columns[x - first_x], INPUT(x, enter));
+                }
+            }
+
+            median_histogram_t kernel;
+            long synced[MEDIAN_COARSE_BINS];    // Position the fine bins of each coarse bin are valid for
+
+            memset(&kernel, 0, sizeof(kernel));
+            for (long k = -radius; k <= radius; k++) {
+                const median_histogram_t* column = &columns[clamp_long(k, first_x, last_x) - first_x];
+                for (int b = 0; b < MEDIAN_COARSE_BINS; b++)
+                    kernel.coarse[b] += column->coarse[b];
+            }
+            for (int b = 0; b < MEDIAN_COARSE_BINS; b++)
+                synced[b] = LONG_MIN;
+
+            unsigned char* out = chunk->pixel_data + y * chunk->row_stride + c;
+
+            for (long x = 0; x < (long)chunk->width; x++) {
+                if (x > 0) {
+                    const median_histogram_t* enter = &columns[clamp_long(x + radius, first_x, last_x) - first_x];
+                    const median_histogram_t* leave = &columns[clamp_long(x - radius - 1, first_x, last_x) - first_x];
+
+                    for (int b = 0; b < MEDIAN_COARSE_BINS; b++)
+                        kernel.coarse[b] += enter->coarse[b] - leave->coarse[b];
+                }
+
+                // Coarse bin holding the median
+                int b = 0;
+                long below = 0;
+                while (below + kernel.coarse[b] <= rank)
+                    below += kernel.coarse[b++];
+
+                uint16_t* fine = kernel.fine + b * 16;
+
+                if (synced[b] == LONG_MIN || x - synced[b] > window) {
+                    // Too far behind: rebuild this coarse bin's fine bins from the 2r + 1 columns
+                    memset(fine, 0, 16 * sizeof(uint16_t));
+                    for (long k = x - radius; k <= x + radius; k++) {
+                        const uint16_t* column = columns[clamp_long(k, first_x, last_x) - first_x].fine + b * 16;
+                        for (int i = 0; i < 16; i++)
+                            fine[i] += column[i];
+                    }
+                } else {
+                    // Catch up column by column from where they were last used
+                    for (long step = synced[b] + 1; step <= x; step++) {
+                        const uint16_t* enter = columns[clamp_long(step + radius, first_x, last_x) - first_x].fine + b * 16;
+                        const uint16_t* leave = columns[clamp_long(step - radius - 1, first_x, last_x) - first_x].fine + b * 16;
+                        for (int i = 0; i < 16; i++)
+                            fine[i] += enter[i] - leave[i];
+                    }
+                }
+                synced[b] = x;
+
+                int i = 0;
+                while (below + fine[i] <= rank)
+                    below += fine[i++];
+
+                out[x * channels] = (unsigned char)(b * 16 + i);
+            }
+        }
+
+        #undef INPUT
+    }
+
+    free(input);
+    free(columns);
+}
+
+void posterize(image_chunk_t* chunk, int levels) {
+    if (!chunk) {
+        LOG_ERROR("Error: chunk is NULL");
+        return;
     }
+    if (!chunk->pixel_data) {
+        LOG_ERROR("Error: pixel_data is NULL");
+        return;
+    }
+
+    if (chunk->sample != IMAGE_SAMPLE_U8) {
+        LOG_ERROR("Error: posterize() takes 8-bit samples; use a filter plan for wider ones");
+        return;
+    }
+
+    // The table for each level count is built once and shared by every worker
+    const pixel_lut_t* lut = lut_posterize_cached(levels);
+    if (!lut) {
+        LOG_ERROR("Error: invalid posterize levels %d", levels);
+        return;
+    }
+
+    lut_apply(lut, chunk->pixel_data, chunk->width, chunk->height, chunk->row_stride, chunk->channels, LUT_ALL_CHANNELS);
 }
\ No newline at end of file
@@ -0,0 +1,832 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include <filter_chain.h>
+#include <filter.h>
+#include <greyscale.h>
+#include <log.h>
+
+/** @brief Bytes of a tile a fused stage works on at a time (fits in L1 next to the tables). */
+#define FILTER_BAND_BYTES (16 * 1024)
+
+static int parse_int(const char *arg, long min, long max, int *out) {
+    char *end = NULL;
+    errno = 0;
+    long value = (arg != NULL)? strtol(arg, &end, 10): 0;
+
+    if (arg == NULL || errno != 0 || end == arg || *end != '\0' || value < min || value > max)
+        return -1;
+
+    *out = (int)value;
+    return 0;
+}
+
+static int parse_double(const char *arg, double *out) {
+    char *end = NULL;
+    errno = 0;
+    double value = (arg != NULL)? strtod(arg, &end): 0.0;
+
+    if (arg == NULL || errno != 0 || end == arg || *end != '\0')
+        return -1;
+
+    *out = value;
+    return 0;
+}
+
+// "IN=OUT/IN=OUT/..."
+static int parse_curve(char *arg, filter_desc_t *filter) {
+    char *save = NULL;
+    size_t count = 0;
+
+    for (char *point = strtok_r(arg, "/", &save); point != NULL; point = strtok_r(NULL, "/", &save)) {
+        char *equals = strchr(point, '=');
+        int in, out;
+
+        if (equals == NULL || count == FILTER_CURVE_MAX_POINTS)
+            return -1;
+
+        *equals = '\0';
+        if (parse_int(point, 0, 255, &in) != 0 || parse_int(equals + 1, 0, 255, &out) != 0)
+            return -1;
+
+        filter->params.curve.inputs[count] = (uint8_t)in;
+        filter->params.curve.outputs[count] = (uint8_t)out;
+        count++;
+    }
+
+    filter->params.curve.count = count;
+
+    // Reject what lut_build_curve() would reject now rather than when the plan is built
+    pixel_lut_t probe;
+    return lut_build_curve(&probe, filter->params.curve.inputs, filter->params.curve.outputs, count);
+}
+
+// "PRESET" or "WxH:W0/W1/...[:SCALE[:BIAS]]"
+static int parse_kernel(char *size, char *weights, char *scale, char *bias, filter_desc_t *filter) {
+    convolution_kernel_t *kernel = &filter->params.kernel;
+
+    if (weights == NULL)
+        return (size != NULL)? convolution_kernel_preset(size, kernel): -1;
+
+    char *times = strchr(size, 'x');
+    if (times == NULL)
+        return -1;
+
+    *times = '\0';
+    if (parse_int(size, 1, CONVOLUTION_MAX_SIZE, &kernel->width) != 0 ||
+        parse_int(times + 1, 1, CONVOLUTION_MAX_SIZE, &kernel->height) != 0)
+        return -1;
+
+    char *save = NULL;
+    int count = 0;
+
+    for (char *weight = strtok_r(weights, "/", &save); weight != NULL; weight = strtok_r(NULL, "/", &save)) {
+        double value;
+        if (count == kernel->width * kernel->height || parse_double(weight, &value) != 0)
+            return -1;
+        kernel->weights[count++] = (float)value;
+    }
+
+    double value = 1.0;
+    if (count != kernel->width * kernel->height || (scale != NULL && parse_double(scale, &value) != 0))
+        return -1;
+    kernel->scale = (float)value;
+
+    value = 0.0;
+    if (bias != NULL && parse_double(bias, &value) != 0)
+        return -1;
+    kernel->bias = (float)value;
+
+    // Reject what convolution_init() would reject now rather than when the plan is built
+    convolution_t probe;
+    return convolution_init(&probe, kernel);
+}
+
+// "WxH" or "PERCENT%", then an optional filter name
+static int parse_resize(char *size, char *method, filter_desc_t *filter) {
+    resize_spec_t *spec = &filter->params.resize;
+    spec->filter = RESIZE_LANCZOS;
+
+    if (size == NULL || (method != NULL && resize_filter_from_string(method, &spec->filter) != 0))
+        return -1;
+
+    size_t length = strlen(size);
+    if (length > 1 && size[length - 1] == '%') {
+        size[length - 1] = '\0';
+        if (parse_double(size, &spec->percent) != 0 || !(spec->percent > 0.0))
+            return -1;
+    } else {
+        char *times = strchr(size, 'x');
+        int width, height;
+
+        if (times == NULL)
+            return -1;
+        *times = '\0';
+        if (parse_int(size, 0, 65536, &width) != 0 || parse_int(times + 1, 0, 65536, &height) != 0)
+            return -1;
+
+        spec->width = (size_t)width;
+        spec->height = (size_t)height;
+    }
+
+    // Reject what resize_init() would reject now rather than when the plan is built
+    resize_t probe;
+    if (resize_init(&probe, spec) != 0)
+        return -1;
+
+    resize_destroy(&probe);
+    return 0;
+}
+
+static int parse_filter(char *token, filter_desc_t *filter) {
+    char *save = NULL;
+    char *name = strtok_r(token, ":", &save);
+    char *arg1 = strtok_r(NULL, ":", &save);
+    char *arg2 = strtok_r(NULL, ":", &save);
+    char *arg3 = strtok_r(NULL, ":", &save);
+    char *arg4 = strtok_r(NULL, ":", &save);
+
+    if (name == NULL || strtok_r(NULL, ":", &save) != NULL)
+        return -1;
+
+    memset(filter, 0, sizeof(*filter));
+
+    if (strcmp(name, "conv") == 0) {
+        filter->kind = FILTER_CONVOLVE;
+        return parse_kernel(arg1, arg2, arg3, arg4, filter);
+    }
+
+    // Only custom kernels take more than two parameters
+    if (arg3 != NULL)
+        return -1;
+
+    if (strcmp(name, "greyscale") == 0 || strcmp(name, "grey") == 0) {
+        filter->kind = FILTER_GREYSCALE;
+        return (arg1 == NULL)? 0: -1;
+    }
+
+    if (strcmp(name, "posterize") == 0) {
+        filter->kind = FILTER_POSTERIZE;
+        return (arg2 == NULL)? parse_int(arg1, 1, 256, &filter->params.levels): -1;
+    }
+
+    if (strcmp(name, "brightness") == 0) {
+        filter->kind = FILTER_BRIGHTNESS;
+        filter->params.tone.contrast = 1.0;
+
+        if (parse_int(arg1, -255, 255, &filter->params.tone.brightness) != 0)
+            return -1;
+        if (arg2 != NULL && (parse_double(arg2, &filter->params.tone.contrast) != 0 || filter->params.tone.contrast < 0.0))
+            return -1;
+        return 0;
+    }
+
+    if (strcmp(name, "gamma") == 0) {
+        filter->kind = FILTER_GAMMA;
+        if (arg2 != NULL || parse_double(arg1, &filter->params.gamma) != 0 || !(filter->params.gamma > 0.0))
+            return -1;
+        return 0;
+    }
+
+    if (strcmp(name, "curve") == 0) {
+        filter->kind = FILTER_CURVE;
+        return (arg1 != NULL && arg2 == NULL)? parse_curve(arg1, filter): -1;
+    }
+
+    if (strcmp(name, "gaussian") == 0) {
+        filter->kind = FILTER_GAUSSIAN;
+        filter->params.gaussian.method = GAUSSIAN_AUTO;
+
+        if (arg2 != NULL && strcmp(arg2, "fir") == 0)
+            filter->params.gaussian.method = GAUSSIAN_FIR;
+        else if (arg2 != NULL && strcmp(arg2, "iir") == 0)
+            filter->params.gaussian.method = GAUSSIAN_IIR;
+        else if (arg2 != NULL)
+            return -1;
+
+        // Reject what gaussian_init() would reject now rather than when the plan is built
+        gaussian_t probe;
+        if (parse_double(arg1, &filter->params.gaussian.sigma) != 0 ||
+            gaussian_init(&probe, filter->params.gaussian.sigma, filter->params.gaussian.method) != 0)
+            return -1;
+
+        gaussian_destroy(&probe);
+        return 0;
+    }
+
+    if (strcmp(name, "median") == 0) {
+        filter->kind = FILTER_MEDIAN;
+        return (arg2 == NULL)? parse_int(arg1, 1, MEDIAN_MAX_RADIUS, &filter->params.radius): -1;
+    }
+
+    if (strcmp(name, "resize") == 0) {
+        filter->kind = FILTER_RESIZE;
+        return parse_resize(arg1, arg2, filter);
+    }
+
+    if (strcmp(name, "blur") == 0) {
+        filter->kind = FILTER_BLUR;
+        return (arg2 == NULL)? parse_int(arg1, 1, 65536, &filter->params.line_size): -1;
+    }
+
+    return -1;
+}
+
+int filter_chain_parse(const char *spec, filter_chain_t *chain) {
+    char *copy = strdup(spec);
+    if (copy == NULL) {
+        perror("filter_chain_parse: Failed to copy the specification");
+        return -1;
+    }
+
+    char *save = NULL;
+    int status = 0;
+    chain->count = 0;
+
+    for (char *token = strtok_r(copy, ",", &save); token != NULL; token = strtok_r(NULL, ",", &save)) {
+        if (chain->count == FILTER_CHAIN_MAX) {
+            LOG_ERROR("Filter chain is longer than %d filters", FILTER_CHAIN_MAX);
+            status = -1;
+            break;
+        }
+
+        // parse_filter() tokenizes in place; keep the original for the error message
+        char original[128];
+        snprintf(original, sizeof(original), "%s", token);
+
+        if (parse_filter(token, &chain->filters[chain->count]) != 0) {
+            LOG_ERROR("Invalid filter '%s'", original);
+            status = -1;
+            break;
+        }
+
+        chain->count++;
+    }
+
+    // Filters after a resize would need a halo around the resized tiles
+    for (size_t i = 0; status == 0 && i + 1 < chain->count; i++) {
+        if (chain->filters[i].kind == FILTER_RESIZE) {
+            LOG_ERROR("A resize must be the last filter of the chain");
+            status = -1;
+        }
+    }
+
+    free(copy);
+    return status;
+}
+
+static bool is_point_wise(filter_kind_t kind) {
+    return kind != FILTER_BLUR && kind != FILTER_GAUSSIAN && kind != FILTER_MEDIAN && kind != FILTER_CONVOLVE &&
+           kind != FILTER_RESIZE;
+}
+
+// Colour and alpha tables of a lookup-table filter; alpha is only posterized
+static void build_tables(const filter_desc_t *filter, pixel_lut_t *colour, pixel_lut_t *alpha) {
+    lut_init_identity(alpha);
+
+    switch (filter->kind) {
+        case FILTER_POSTERIZE:
+            lut_build_posterize(colour, filter->params.levels);
+            *alpha = *colour;
+            break;
+        case FILTER_BRIGHTNESS:
+            lut_build_brightness_contrast(colour, filter->params.tone.brightness, filter->params.tone.contrast);
+            break;
+        case FILTER_GAMMA:
+            lut_build_gamma(colour, filter->params.gamma);
+            break;
+        case FILTER_CURVE:
+            lut_build_curve(colour, filter->params.curve.inputs, filter->params.curve.outputs, filter->params.curve.count);
+            break;
+        default:
+            lut_init_identity(colour);
+            break;
+    }
+}
+
+static void classify_tables(filter_op_t *op) {
+    pixel_lut_t identity;
+    lut_init_identity(&identity);
+
+    op->alpha_is_colour = memcmp(op->colour.table, op->alpha.table, sizeof(op->colour.table)) == 0;
+    op->alpha_is_identity = memcmp(op->alpha.table, identity.table, sizeof(identity.table)) == 0;
+}
+
+static bool is_identity_op(const filter_op_t *op) {
+    return op->alpha_is_colour && op->alpha_is_identity;
+}
+
+// The function of a lookup-table filter on normalised intensities, in the 8-bit units of its parameters
+static float point_function(float value, const void *context) {
+    const filter_desc_t *filter = (const filter_desc_t *)context;
+    float x = value * 255.0f;
+
+    switch (filter->kind) {
+        case FILTER_POSTERIZE: {
+            float step = (float)(256 / filter->params.levels);
+            return floorf(x / step) * step / 255.0f;
+        }
+        case FILTER_BRIGHTNESS:
+            return (float)((x - 128.0f) * filter->params.tone.contrast + 128.0 + filter->params.tone.brightness) / 255.0f;
+        case FILTER_GAMMA:
+            return powf(value, (float)(1.0 / filter->params.gamma));
+        case FILTER_CURVE: {
+            const uint8_t *inputs = filter->params.curve.inputs, *outputs = filter->params.curve.outputs;
+            size_t last = filter->params.curve.count - 1;
+
+            if (x <= inputs[0])
+                return outputs[0] / 255.0f;
+            if (x >= inputs[last])
+                return outputs[last] / 255.0f;
+
+            size_t segment = 0;
+            while (x > inputs[segment + 1])
+                segment++;
+
+            float x0 = inputs[segment], x1 = inputs[segment + 1];
+            float y0 = outputs[segment], y1 = outputs[segment + 1];
+            return (y0 + (y1 - y0) * (x - x0) / (x1 - x0)) / 255.0f;
+        }
+        default:
+            return value;
+    }
+}
+
+static void classify_wide_tables(filter_op_t *op) {
+    op->alpha_is_colour = lut_wide_equal(&op->wide_colour, &op->wide_alpha);
+    op->alpha_is_identity = lut_wide_is_identity(&op->wide_alpha);
+}
+
+// Wide samples: the filter's function is folded into the table op at the end of the stage (or a new one)
+static int add_wide_tables(filter_stage_t *point, const filter_desc_t *filter, image_sample_t sample) {
+    filter_op_t *last = (point->num_ops > 0)? &point->ops[point->num_ops - 1]: NULL;
+
+    if (last == NULL || last->kind != FILTER_OP_LUT) {
+        last = &point->ops[point->num_ops++];
+        last->kind = FILTER_OP_LUT;
+
+        if (lut_wide_init(&last->wide_colour, sample) != 0 || lut_wide_init(&last->wide_alpha, sample) != 0)
+            return -1;
+    }
+
+    lut_wide_map(&last->wide_colour, point_function, filter);
+    // Alpha is only posterized
+    if (filter->kind == FILTER_POSTERIZE)
+        lut_wide_map(&last->wide_alpha, point_function, filter);
+
+    classify_wide_tables(last);
+
+    if (is_identity_op(last)) {
+        lut_wide_destroy(&last->wide_colour);
+        lut_wide_destroy(&last->wide_alpha);
+        point->num_ops--;
+    }
+
+    return 0;
+}
+
+int filter_plan_build(const filter_chain_t *chain, image_sample_t sample, filter_plan_t *plan) {
+    memset(plan, 0, sizeof(*plan));
+    plan->num_filters = chain->count;
+    plan->sample = sample;
+
+    if (chain->count == 0)
+        return 0;
+
+    // Never more stages or ops than filters
+    plan->stages = calloc(chain->count, sizeof(filter_stage_t));
+    if (plan->stages == NULL) {
+        perror("filter_plan_build: Failed to allocate stages");
+        return -1;
+    }
+
+    filter_stage_t *point = NULL;
+    // R = G = B after greyscale; every filter here keeps it that way, so another greyscale is a no-op
+    bool grey = false;
+
+    for (size_t i = 0; i < chain->count; i++) {
+        const filter_desc_t *filter = &chain->filters[i];
+
+        if (!is_point_wise(filter->kind)) {
+            point = NULL;
+
+            filter_stage_t *stage = &plan->stages[plan->num_stages++];
+
+            if (filter->kind == FILTER_GAUSSIAN) {
+                stage->kind = FILTER_STAGE_GAUSSIAN;
+                if (gaussian_init(&stage->gaussian, filter->params.gaussian.sigma, filter->params.gaussian.method) != 0) {
+                    LOG_ERROR("Failed to prepare a Gaussian blur with sigma %g", filter->params.gaussian.sigma);
+                    filter_plan_destroy(plan);
+                    return -1;
+                }
+                stage->reach_x = stage->reach_y = stage->gaussian.reach;
+                continue;
+            }
+
+            if (filter->kind == FILTER_CONVOLVE) {
+                stage->kind = FILTER_STAGE_CONVOLVE;
+                if (convolution_init(&stage->convolution, &filter->params.kernel) != 0) {
+                    LOG_ERROR("Failed to prepare a %dx%d convolution kernel",
+                              filter->params.kernel.width, filter->params.kernel.height);
+                    filter_plan_destroy(plan);
+                    return -1;
+                }
+                stage->reach_x = stage->convolution.reach_x;
+                stage->reach_y = stage->convolution.reach_y;
+                continue;
+            }
+
+            if (filter->kind == FILTER_RESIZE) {
+                stage->kind = FILTER_STAGE_RESIZE;
+                if (resize_init(&stage->resize, &filter->params.resize) != 0) {
+                    perror("filter_plan_build: Failed to prepare a resize");
+                    filter_plan_destroy(plan);
+                    return -1;
+                }
+                // The rest of the reach depends on the image: see filter_plan_halo()
+                stage->reach_x = stage->reach_y = resize_min_reach(&stage->resize);
+                plan->resizes = true;
+                continue;
+            }
+
+            if (filter->kind == FILTER_MEDIAN) {
+                stage->kind = FILTER_STAGE_MEDIAN;
+                stage->radius = filter->params.radius;
+                stage->reach_x = stage->reach_y = (size_t)filter->params.radius;
+                continue;
+            }
+
+            stage->kind = FILTER_STAGE_BLUR;
+            stage->line_size = filter->params.line_size;
+            stage->reach_x = (size_t)filter->params.line_size / 2;
+            continue;
+        }
+
+        if (filter->kind == FILTER_GREYSCALE && grey)
+            continue;
+
+        if (point == NULL) {
+            point = &plan->stages[plan->num_stages++];
+            point->kind = FILTER_STAGE_POINT;
+            // calloc() does not honour the 64-byte alignment of the tables
+            point->ops = aligned_alloc(_Alignof(filter_op_t), chain->count * sizeof(filter_op_t));
+
+            if (point->ops == NULL) {
+                perror("filter_plan_build: Failed to allocate stage operations");
+                filter_plan_destroy(plan);
+                return -1;
+            }
+
+            memset(point->ops, 0, chain->count * sizeof(filter_op_t));
+        }
+
+        if (filter->kind == FILTER_GREYSCALE) {
+            point->ops[point->num_ops++].kind = FILTER_OP_GREYSCALE;
+            grey = true;
+            continue;
+        }
+
+        if (sample != IMAGE_SAMPLE_U8) {
+            if (add_wide_tables(point, filter, sample) != 0) {
+                perror("filter_plan_build: Failed to allocate lookup tables");
+                filter_plan_destroy(plan);
+                return -1;
+            }
+            continue;
+        }
+
+        filter_op_t op = { .kind = FILTER_OP_LUT };
+        build_tables(filter, &op.colour, &op.alpha);
+
+        // Adjacent tables collapse into one: x -> second(first(x))
+        filter_op_t *last = (point->num_ops > 0)? &point->ops[point->num_ops - 1]: NULL;
+        if (last != NULL && last->kind == FILTER_OP_LUT) {
+            lut_compose(&last->colour, &last->colour, &op.colour);
+            lut_compose(&last->alpha, &last->alpha, &op.alpha);
+            classify_tables(last);
+
+            if (is_identity_op(last))
+                point->num_ops--;
+        } else {
+            classify_tables(&op);
+
+            if (!is_identity_op(&op))
+                point->ops[point->num_ops++] = op;
+        }
+    }
+
+    // Drop point stages whose tables all cancelled out
+    size_t kept = 0;
+    for (size_t s = 0; s < plan->num_stages; s++) {
+        if (plan->stages[s].kind == FILTER_STAGE_POINT && plan->stages[s].num_ops == 0) {
+            // Tables are destroyed as they cancel out; none are left here
+            free(plan->stages[s].ops);
+            continue;
+        }
+        plan->stages[kept++] = plan->stages[s];
+    }
+    plan->num_stages = kept;
+
+    // Back to front: a stage must also produce every pixel the stages after it read
+    for (size_t s = plan->num_stages; s-- > 0;) {
+        filter_stage_t *stage = &plan->stages[s];
+
+        stage->extent_x = plan->halo_x;
+        stage->extent_y = plan->halo_y;
+        plan->halo_x += stage->reach_x;
+        plan->halo_y += stage->reach_y;
+    }
+
+    return 0;
+}
+
+static void apply_op_rows(const filter_op_t *op, unsigned char *pixels, size_t width, size_t height,
+                          size_t stride, int channels, image_sample_t sample) {
+    if (op->kind == FILTER_OP_GREYSCALE) {
+        greyscale_samples(greyscale_kernels(), pixels, width, height, stride, channels, sample);
+        return;
+    }
+
+    bool has_alpha = (channels == 2 || channels == 4);
+    unsigned alpha_bit = 1u << (channels - 1);
+
+    if (sample != IMAGE_SAMPLE_U8) {
+        if (!has_alpha || op->alpha_is_colour) {
+            lut_wide_apply(&op->wide_colour, pixels, width, height, stride, channels, LUT_ALL_CHANNELS);
+            return;
+        }
+
+        lut_wide_apply(&op->wide_colour, pixels, width, height, stride, channels, LUT_ALL_CHANNELS & ~alpha_bit);
+        if (!op->alpha_is_identity)
+            lut_wide_apply(&op->wide_alpha, pixels, width, height, stride, channels, alpha_bit);
+        return;
+    }
+
+    if (!has_alpha || op->alpha_is_colour) {
+        lut_apply(&op->colour, pixels, width, height, stride, channels, LUT_ALL_CHANNELS);
+        return;
+    }
+
+    lut_apply(&op->colour, pixels, width, height, stride, channels, LUT_ALL_CHANNELS & ~alpha_bit);
+    if (!op->alpha_is_identity)
+        lut_apply(&op->alpha, pixels, width, height, stride, channels, alpha_bit);
+}
+
+// Planar chunks: greyscale reads the R, G and B planes together, the tables map every plane on its own
+static void apply_op_planes(const filter_op_t *op, const image_chunk_t *chunk, size_t y, size_t rows) {
+    int channels = chunk->channels;
+    size_t width = (size_t)chunk->width;
+    size_t offset = y * chunk->row_stride;
+
+    if (op->kind == FILTER_OP_GREYSCALE) {
+        if (channels < 3)
+            return;
+
+        unsigned char *const planes[3] = { image_chunk_plane(chunk, 0) + offset, image_chunk_plane(chunk, 1) + offset,
+                                           image_chunk_plane(chunk, 2) + offset };
+        greyscale_planes(greyscale_kernels(), planes, width, rows, chunk->row_stride);
+        return;
+    }
+
+    bool has_alpha = (channels == 2 || channels == 4);
+
+    for (int c = 0; c < channels; c++) {
+        const pixel_lut_t *lut = &op->colour;
+
+        if (has_alpha && c == channels - 1 && !op->alpha_is_colour) {
+            if (op->alpha_is_identity)
+                continue;
+            lut = &op->alpha;
+        }
+
+        lut_apply(lut, image_chunk_plane(chunk, c) + offset, width, rows, chunk->row_stride, 1, LUT_ALL_CHANNELS);
+    }
+}
+
+static void apply_point_stage(const filter_stage_t *stage, image_chunk_t *chunk) {
+    bool planar = (chunk->layout == IMAGE_LAYOUT_PLANAR);
+    size_t width = (size_t)chunk->width;
+    size_t height = (size_t)chunk->height;
+    size_t row_bytes = width * (size_t)chunk->channels * image_sample_bytes(chunk->sample);
+
+    // One operation: nothing to fuse, let it see the whole chunk
+    size_t band = height;
+    if (stage->num_ops > 1 && row_bytes > 0) {
+        band = FILTER_BAND_BYTES / row_bytes;
+        if (band == 0)
+            band = 1;
+    }
+
+    for (size_t y = 0; y < height; y += band) {
+        size_t rows = (y + band > height)? height - y: band;
+        unsigned char *pixels = chunk->pixel_data + y * chunk->row_stride;
+
+        for (size_t i = 0; i < stage->num_ops; i++) {
+            if (planar)
+                apply_op_planes(&stage->ops[i], chunk, y, rows);
+            else
+                apply_op_rows(&stage->ops[i], pixels, width, rows, chunk->row_stride, chunk->channels, chunk->sample);
+        }
+    }
+}
+
+static inline size_t min_size(size_t a, size_t b) {
+    return (a < b)? a: b;
+}
+
+// The chunk grown by up to `extent_x` / `extent_y` pixels of its halo on every side
+static image_chunk_t chunk_region(const image_chunk_t *chunk, size_t extent_x, size_t extent_y) {
+    image_chunk_t region = *chunk;
+
+    size_t left = min_size(extent_x, chunk->halo_left), right = min_size(extent_x, chunk->halo_right);
+    size_t top = min_size(extent_y, chunk->halo_top), bottom = min_size(extent_y, chunk->halo_bottom);
+    size_t pixel_step = (chunk->layout == IMAGE_LAYOUT_PLANAR)? 1: (size_t)chunk->channels * image_sample_bytes(chunk->sample);
+
+    region.pixel_data -= top * chunk->row_stride + left * pixel_step;
+    region.offset_x -= left;
+    region.offset_y -= top;
+    region.width += left + right;
+    region.height += top + bottom;
+    region.halo_left -= left;
+    region.halo_right -= right;
+    region.halo_top -= top;
+    region.halo_bottom -= bottom;
+
+    return region;
+}
+
+// Reach of the resize at the end of the plan beyond the one assumed at build time, for a given image
+static void resize_extra_reach(const filter_plan_t *plan, size_t width, size_t height, size_t *extra_x, size_t *extra_y) {
+    *extra_x = *extra_y = 0;
+    if (!plan->resizes)
+        return;
+
+    const filter_stage_t *stage = &plan->stages[plan->num_stages - 1];
+    size_t reach_x, reach_y;
+    resize_reach(&stage->resize, width, height, &reach_x, &reach_y);
+
+    *extra_x = reach_x - stage->reach_x;
+    *extra_y = reach_y - stage->reach_y;
+}
+
+void filter_plan_halo(size_t width, size_t height, size_t *halo_x, size_t *halo_y, const void *context) {
+    const filter_plan_t *plan = (const filter_plan_t *)context;
+    size_t extra_x, extra_y;
+
+    resize_extra_reach(plan, width, height, &extra_x, &extra_y);
+    *halo_x = plan->halo_x + extra_x;
+    *halo_y = plan->halo_y + extra_y;
+}
+
+static void apply_neighbourhood_stage(const filter_stage_t *stage, image_chunk_t *chunk) {
+    if (stage->kind == FILTER_STAGE_GAUSSIAN)
+        gaussian_blur(&stage->gaussian, gaussian_kernels(), chunk);
+    else if (stage->kind == FILTER_STAGE_MEDIAN)
+        median_filter(chunk, stage->radius);
+    else if (stage->kind == FILTER_STAGE_CONVOLVE)
+        convolution_apply(&stage->convolution, convolution_kernels(), chunk);
+    else
+        directional_blur(chunk, stage->line_size);
+}
+
+/*
+    The neighbourhood filters leave alpha alone and treat colour channels independently, so on a planar chunk
+    each colour plane is filtered as a single-channel interleaved chunk: same output, unit-stride rows.
+*/
+static void apply_neighbourhood_planes(const filter_stage_t *stage, const image_chunk_t *chunk) {
+    int channels = chunk->channels;
+    int colour_channels = (channels == 2 || channels == 4)? channels - 1: channels;
+
+    for (int c = 0; c < colour_channels; c++) {
+        image_chunk_t plane = *chunk;
+        plane.pixel_data = image_chunk_plane(chunk, c);
+        plane.channels = 1;
+        plane.layout = IMAGE_LAYOUT_INTERLEAVED;
+        plane.plane_size = 0;
+
+        apply_neighbourhood_stage(stage, &plane);
+    }
+}
+
+void filter_plan_apply(const filter_plan_t *plan, image_chunk_t *chunk) {
+    if (!chunk || !chunk->pixel_data) {
+        LOG_ERROR("Error: chunk or pixel_data is NULL");
+        return;
+    }
+
+    if (chunk->sample != plan->sample) {
+        LOG_ERROR("Chunk of %s has %d-byte samples; the filter plan was built for %d-byte samples",
+                  chunk->original_image_name, (int)image_sample_bytes(chunk->sample), (int)image_sample_bytes(plan->sample));
+        return;
+    }
+
+    size_t extra_x, extra_y;
+    resize_extra_reach(plan, (size_t)chunk->original_image_width, (size_t)chunk->original_image_height,
+                       &extra_x, &extra_y);
+
+    for (size_t s = 0; s < plan->num_stages; s++) {
+        const filter_stage_t *stage = &plan->stages[s];
+
+        // Last stage: the chunk itself becomes a tile of the output
+        if (stage->kind == FILTER_STAGE_RESIZE) {
+            resize_apply(&stage->resize, resize_kernels(), chunk);
+            break;
+        }
+
+        // Every stage before a resize also covers the part of its reach that depends on the image
+        image_chunk_t region = chunk_region(chunk, stage->extent_x + extra_x, stage->extent_y + extra_y);
+
+        if (stage->kind == FILTER_STAGE_POINT)
+            apply_point_stage(stage, &region);
+        else if (region.layout == IMAGE_LAYOUT_PLANAR)
+            apply_neighbourhood_planes(stage, &region);
+        else
+            apply_neighbourhood_stage(stage, &region);
+    }
+}
+
+void filter_plan_describe(const filter_plan_t *plan, char *buffer, size_t size) {
+    size_t used = 0;
+
+    if (size == 0)
+        return;
+
+    buffer[0] = '\0';
+    if (plan->num_stages == 0) {
+        snprintf(buffer, size, "(no-op)");
+        return;
+    }
+
+    for (size_t s = 0; s < plan->num_stages && used < size; s++) {
+        const filter_stage_t *stage = &plan->stages[s];
+
+        used += snprintf(buffer + used, size - used, "%s[", (s > 0)? " -> ": "");
+
+        if (stage->kind == FILTER_STAGE_BLUR) {
+            if (used < size)
+                used += snprintf(buffer + used, size - used, "blur:%d]", stage->line_size);
+            continue;
+        }
+
+        if (stage->kind == FILTER_STAGE_RESIZE) {
+            const resize_spec_t *spec = &stage->resize.spec;
+            if (used < size && spec->percent > 0.0)
+                used += snprintf(buffer + used, size - used, "resize-%s:%g%%]", resize_filter_name(spec->filter), spec->percent);
+            else if (used < size)
+                used += snprintf(buffer + used, size - used, "resize-%s:%zux%zu]", resize_filter_name(spec->filter),
+                                 spec->width, spec->height);
+            continue;
+        }
+
+        if (stage->kind == FILTER_STAGE_MEDIAN) {
+            if (used < size)
+                used += snprintf(buffer + used, size - used, "median:%d]", stage->radius);
+            continue;
+        }
+
+        if (stage->kind == FILTER_STAGE_CONVOLVE) {
+            if (used < size)
+                used += snprintf(buffer + used, size - used, "conv-%s:%dx%d]",
+                                 stage->convolution.separable? "separable": "2d",
+                                 stage->convolution.width, stage->convolution.height);
+            continue;
+        }
+
+        if (stage->kind == FILTER_STAGE_GAUSSIAN) {
+            if (used < size)
+                used += snprintf(buffer + used, size - used, "gaussian-%s:%g]",
+                                 (stage->gaussian.method == GAUSSIAN_FIR)? "fir": "iir", stage->gaussian.sigma);
+            continue;
+        }
+
+        for (size_t i = 0; i < stage->num_ops && used < size; i++) {
+            used += snprintf(buffer + used, size - used, "%s%s", (i > 0)? "+": "",
+                             (stage->ops[i].kind == FILTER_OP_GREYSCALE)? "greyscale": "lut");
+        }
+
+        if (used < size)
+            used += snprintf(buffer + used, size - used, "]");
+    }
+}
+
+void filter_plan_destroy(filter_plan_t *plan) {
+    if (plan->stages != NULL) {
+        for (size_t s = 0; s < plan->num_stages; s++) {
+            for (size_t i = 0; i < plan->stages[s].num_ops; i++) {
+                lut_wide_destroy(&plan->stages[s].ops[i].wide_colour);
+                lut_wide_destroy(&plan->stages[s].ops[i].wide_alpha);
+            }
+            free(plan->stages[s].ops);
+            if (plan->stages[s].kind == FILTER_STAGE_GAUSSIAN)
+                gaussian_destroy(&plan->stages[s].gaussian);
+            else if (plan->stages[s].kind == FILTER_STAGE_RESIZE)
+                resize_destroy(&plan->stages[s].resize);
+        }
+        free(plan->stages);
+    }
+
+    memset(plan, 0, sizeof(*plan));
+}
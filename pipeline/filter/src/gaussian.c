@@ -0,0 +1,441 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include <gaussian.h>
+#include <samples.h>
+#include <log.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GAUSSIAN_X86 1
+#include <immintrin.h>
+#endif
+
+/** @brief Floats per row block of a column pass (keeps 2 * radius + 1 block rows in L1/L2). */
+#define GAUSSIAN_COLUMN_BLOCK 256
+
+int gaussian_init(gaussian_t *gaussian, double sigma, gaussian_method_t method) {
+    memset(gaussian, 0, sizeof(*gaussian));
+
+    if (!(sigma > 0.0) || sigma > GAUSSIAN_MAX_SIGMA)
+        return -1;
+
+    if (method == GAUSSIAN_AUTO)
+        method = (sigma <= GAUSSIAN_FIR_MAX_SIGMA)? GAUSSIAN_FIR: GAUSSIAN_IIR;
+
+    gaussian->method = method;
+    gaussian->sigma = sigma;
+
+    if (method == GAUSSIAN_FIR) {
+        int radius = (int)ceil(3.0 * sigma);
+        float *weights = malloc((2 * (size_t)radius + 1) * sizeof(float));
+
+        if (weights == NULL) {
+            perror("gaussian_init: Failed to allocate the kernel");
+            return -1;
+        }
+
+        double sum = 0.0;
+        for (int k = -radius; k <= radius; k++)
+            sum += exp(-(double)(k * k) / (2.0 * sigma * sigma));
+
+        for (int k = -radius; k <= radius; k++)
+            weights[k + radius] = (float)(exp(-(double)(k * k) / (2.0 * sigma * sigma)) / sum);
+
+        gaussian->radius = radius;
+        gaussian->weights = weights;
+        gaussian->reach = (size_t)radius;
+        return 0;
+    }
+
+    // Young & van Vliet, "Recursive implementation of the Gaussian filter" (1995)
+    if (sigma < 0.5)
+        return -1;
+
+    double q = (sigma >= 2.5)? 0.98711 * sigma - 0.96330: 3.97156 - 4.14554 * sqrt(1.0 - 0.26891 * sigma);
+    double b0 = 1.57825 + 2.44413 * q + 1.4281 * q * q + 0.422205 * q * q * q;
+    double b1 = 2.44413 * q + 2.85619 * q * q + 1.26661 * q * q * q;
+    double b2 = -(1.4281 * q * q + 1.26661 * q * q * q);
+    double b3 = 0.422205 * q * q * q;
+
+    gaussian->iir[0] = (float)(1.0 - (b1 + b2 + b3) / b0);
+    gaussian->iir[1] = (float)(b1 / b0);
+    gaussian->iir[2] = (float)(b2 / b0);
+    gaussian->iir[3] = (float)(b3 / b0);
+
+    // The response never ends; past 4 sigma it is below 1 / 30000 of the centre
+    gaussian->reach = (size_t)ceil(4.0 * sigma);
+    return 0;
+}
+
+void gaussian_destroy(gaussian_t *gaussian) {
+    free(gaussian->weights);
+    memset(gaussian, 0, sizeof(*gaussian));
+}
+
+/*
+    Scalar kernels. The vector kernels do the same operations in the same order, so without FMA
+    contraction their results are bit-identical.
+*/
+
+static void fir_columns_scalar(const float *in, float *out, size_t width, size_t rows, size_t stride,
+                               const float *weights, int radius) {
+    for (size_t y = 0; y < rows; y++) {
+        for (size_t x = 0; x < width; x++) {
+            float acc = 0.0f;
+            for (int k = 0; k <= 2 * radius; k++)
+                acc += weights[k] * in[(y + k) * stride + x];
+            out[y * stride + x] = acc;
+        }
+    }
+}
+
+static void iir_columns_scalar(float *data, size_t width, size_t rows, size_t stride, const float c[4]) {
+    if (rows == 0)
+        return;
+
+    for (size_t x = 0; x < width; x++) {
+        float *column = data + x;
+
+        // Steady state of a constant edge: the filters have unit gain
+        float w1 = column[0], w2 = w1, w3 = w1;
+        for (size_t y = 0; y < rows; y++) {
+            float w = c[0] * column[y * stride] + (c[1] * w1 + c[2] * w2 + c[3] * w3);
+            column[y * stride] = w;
+            w3 = w2; w2 = w1; w1 = w;
+        }
+
+        w1 = column[(rows - 1) * stride]; w2 = w1; w3 = w1;
+        for (size_t y = rows; y-- > 0;) {
+            float w = c[0] * column[y * stride] + (c[1] * w1 + c[2] * w2 + c[3] * w3);
+            column[y * stride] = w;
+            w3 = w2; w2 = w1; w1 = w;
+        }
+    }
+}
+
+static void transpose_scalar(const float *in, size_t in_stride, float *out, size_t out_stride, size_t rows, size_t cols) {
+    // 8 x 8 blocks so both sides stay within a few cache lines
+    for (size_t y0 = 0; y0 < rows; y0 += 8) {
+        for (size_t x0 = 0; x0 < cols; x0 += 8) {
+            size_t y_end = (y0 + 8 < rows)? y0 + 8: rows;
+            size_t x_end = (x0 + 8 < cols)? x0 + 8: cols;
+
+            for (size_t y = y0; y < y_end; y++)
+                for (size_t x = x0; x < x_end; x++)
+                    out[x * out_stride + y] = in[y * in_stride + x];
+        }
+    }
+}
+
+#ifdef GAUSSIAN_X86
+
+__attribute__((target("avx2")))
+static void fir_columns_avx2(const float *in, float *out, size_t width, size_t rows, size_t stride,
+                             const float *weights, int radius) {
+    for (size_t y = 0; y < rows; y++) {
+        size_t x = 0;
+
+        for (; x + 16 <= width; x += 16) {
+            __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+
+            for (int k = 0; k <= 2 * radius; k++) {
+                const float *row = in + (y + k) * stride + x;
+                __m256 w = _mm256_broadcast_ss(&weights[k]);
+                acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(w, _mm256_loadu_ps(row)));
+                acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(w, _mm256_loadu_ps(row + 8)));
+            }
+
+            _mm256_storeu_ps(out + y * stride + x, acc0);
+            _mm256_storeu_ps(out + y * stride + x + 8, acc1);
+        }
+
+        for (; x + 8 <= width; x += 8) {
+            __m256 acc = _mm256_setzero_ps();
+
+            for (int k = 0; k <= 2 * radius; k++)
+                acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_broadcast_ss(&weights[k]), _mm256_loadu_ps(in + (y + k) * stride + x)));
+
+            _mm256_storeu_ps(out + y * stride + x, acc);
+        }
+
+        for (; x < width; x++) {
+            float acc = 0.0f;
+            for (int k = 0; k <= 2 * radius; k++)
+                acc += weights[k] * in[(y + k) * stride + x];
+            out[y * stride + x] = acc;
+        }
+    }
+}
+
+// One step of the recursion for 8 columns
+#define IIR_STEP_AVX2(value, w1, w2, w3)                                                              \
+    _mm256_add_ps(_mm256_mul_ps(c0, value),                                                           \
+                  _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c1, w1), _mm256_mul_ps(c2, w2)), _mm256_mul_ps(c3, w3)))
+
+/*
+    The recursion is sequential down a column, so the work is spread across columns: 32 at a time (four
+    independent dependency chains to hide the add latency), then 8, then the scalar tail.
+*/
+__attribute__((target("avx2")))
+static void iir_columns_avx2(float *data, size_t width, size_t rows, size_t stride, const float c[4]) {
+    if (rows == 0)
+        return;
+
+    const __m256 c0 = _mm256_set1_ps(c[0]), c1 = _mm256_set1_ps(c[1]);
+    const __m256 c2 = _mm256_set1_ps(c[2]), c3 = _mm256_set1_ps(c[3]);
+    size_t x = 0;
+
+    for (; x + 32 <= width; x += 32) {
+        __m256 w1[4], w2[4], w3[4];
+
+        for (int j = 0; j < 4; j++)
+            w1[j] = w2[j] = w3[j] = _mm256_loadu_ps(data + x + 8 * j);
+
+        for (size_t y = 0; y < rows; y++) {
+            float *row = data + y * stride + x;
+            for (int j = 0; j < 4; j++) {
+                __m256 w = IIR_STEP_AVX2(_mm256_loadu_ps(row + 8 * j), w1[j], w2[j], w3[j]);
+                _mm256_storeu_ps(row + 8 * j, w);
+                w3[j] = w2[j]; w2[j] = w1[j]; w1[j] = w;
+            }
+        }
+
+        for (int j = 0; j < 4; j++)
+            w1[j] = w2[j] = w3[j] = _mm256_loadu_ps(data + (rows - 1) * stride + x + 8 * j);
+
+        for (size_t y = rows; y-- > 0;) {
+            float *row = data + y * stride + x;
+            for (int j = 0; j < 4; j++) {
+                __m256 w = IIR_STEP_AVX2(_mm256_loadu_ps(row + 8 * j), w1[j], w2[j], w3[j]);
+                _mm256_storeu_ps(row + 8 * j, w);
+                w3[j] = w2[j]; w2[j] = w1[j]; w1[j] = w;
+            }
+        }
+    }
+
+    for (; x + 8 <= width; x += 8) {
+        __m256 w1 = _mm256_loadu_ps(data + x), w2 = w1, w3 = w1;
+
+        for (size_t y = 0; y < rows; y++) {
+            __m256 w = IIR_STEP_AVX2(_mm256_loadu_ps(data + y * stride + x), w1, w2, w3);
+            _mm256_storeu_ps(data + y * stride + x, w);
+            w3 = w2; w2 = w1; w1 = w;
+        }
+
+        w1 = _mm256_loadu_ps(data + (rows - 1) * stride + x); w2 = w1; w3 = w1;
+        for (size_t y = rows; y-- > 0;) {
+            __m256 w = IIR_STEP_AVX2(_mm256_loadu_ps(data + y * stride + x), w1, w2, w3);
+            _mm256_storeu_ps(data + y * stride + x, w);
+            w3 = w2; w2 = w1; w1 = w;
+        }
+    }
+
+    if (x < width)
+        iir_columns_scalar(data + x, width - x, rows, stride, c);
+}
+
+#undef IIR_STEP_AVX2
+
+// 8 x 8 in-register transpose: unpack pairs, then quads, then swap 128-bit halves
+__attribute__((target("avx2")))
+static void transpose_avx2(const float *in, size_t in_stride, float *out, size_t out_stride, size_t rows, size_t cols) {
+    size_t full_rows = rows & ~(size_t)7, full_cols = cols & ~(size_t)7;
+
+    for (size_t y = 0; y < full_rows; y += 8) {
+        for (size_t x = 0; x < full_cols; x += 8) {
+            const float *src = in + y * in_stride + x;
+            __m256 r0 = _mm256_loadu_ps(src + 0 * in_stride), r1 = _mm256_loadu_ps(src + 1 * in_stride);
+            __m256 r2 = _mm256_loadu_ps(src + 2 * in_stride), r3 = _mm256_loadu_ps(src + 3 * in_stride);
+            __m256 r4 = _mm256_loadu_ps(src + 4 * in_stride), r5 = _mm256_loadu_ps(src + 5 * in_stride);
+            __m256 r6 = _mm256_loadu_ps(src + 6 * in_stride), r7 = _mm256_loadu_ps(src + 7 * in_stride);
+
+            __m256 t0 = _mm256_unpacklo_ps(r0, r1), t1 = _mm256_unpackhi_ps(r0, r1);
+            __m256 t2 = _mm256_unpacklo_ps(r2, r3), t3 = _mm256_unpackhi_ps(r2, r3);
+            __m256 t4 = _mm256_unpacklo_ps(r4, r5), t5 = _mm256_unpackhi_ps(r4, r5);
+            __m256 t6 = _mm256_unpacklo_ps(r6, r7), t7 = _mm256_unpackhi_ps(r6, r7);
+
+            __m256 s0 = _mm256_shuffle_ps(t0, t2, 0x44), s1 = _mm256_shuffle_ps(t0, t2, 0xEE);
+            __m256 s2 = _mm256_shuffle_ps(t1, t3, 0x44), s3 = _mm256_shuffle_ps(t1, t3, 0xEE);
+            __m256 s4 = _mm256_shuffle_ps(t4, t6, 0x44), s5 = _mm256_shuffle_ps(t4, t6, 0xEE);
+            __m256 s6 = _mm256_shuffle_ps(t5, t7, 0x44), s7 = _mm256_shuffle_ps(t5, t7, 0xEE);
+
+            float *dst = out + x * out_stride + y;
+            _mm256_storeu_ps(dst + 0 * out_stride, _mm256_permute2f128_ps(s0, s4, 0x20));
+            _mm256_storeu_ps(dst + 1 * out_stride, _mm256_permute2f128_ps(s1, s5, 0x20));
+            _mm256_storeu_ps(dst + 2 * out_stride, _mm256_permute2f128_ps(s2, s6, 0x20));
+            _mm256_storeu_ps(dst + 3 * out_stride, _mm256_permute2f128_ps(s3, s7, 0x20));
+            _mm256_storeu_ps(dst + 4 * out_stride, _mm256_permute2f128_ps(s0, s4, 0x31));
+            _mm256_storeu_ps(dst + 5 * out_stride, _mm256_permute2f128_ps(s1, s5, 0x31));
+            _mm256_storeu_ps(dst + 6 * out_stride, _mm256_permute2f128_ps(s2, s6, 0x31));
+            _mm256_storeu_ps(dst + 7 * out_stride, _mm256_permute2f128_ps(s3, s7, 0x31));
+        }
+    }
+
+    // Ragged right and bottom edges
+    if (full_cols < cols)
+        transpose_scalar(in + full_cols, in_stride, out + full_cols * out_stride, out_stride, rows, cols - full_cols);
+    if (full_rows < rows)
+        transpose_scalar(in + full_rows * in_stride, in_stride, out + full_rows, out_stride, rows - full_rows, full_cols);
+}
+
+#endif /* GAUSSIAN_X86 */
+
+static const gaussian_kernels_t scalar_kernels = {
+    GAUSSIAN_ISA_SCALAR, "scalar", fir_columns_scalar, iir_columns_scalar, transpose_scalar
+};
+
+int gaussian_kernels_get(gaussian_isa_t isa, gaussian_kernels_t *out) {
+    switch (isa) {
+        case GAUSSIAN_ISA_SCALAR:
+            *out = scalar_kernels;
+            return 0;
+#ifdef GAUSSIAN_X86
+        case GAUSSIAN_ISA_AVX2:
+            __builtin_cpu_init();
+            if (!__builtin_cpu_supports("avx2"))
+                return -1;
+            *out = (gaussian_kernels_t){ GAUSSIAN_ISA_AVX2, "avx2", fir_columns_avx2, iir_columns_avx2, transpose_avx2 };
+            return 0;
+#endif
+        default:
+            return -1;
+    }
+}
+
+static gaussian_kernels_t best_kernels;
+static pthread_once_t best_once = PTHREAD_ONCE_INIT;
+
+static void select_best(void) {
+    best_kernels = scalar_kernels;
+
+    for (int isa = GAUSSIAN_ISA_COUNT - 1; isa > GAUSSIAN_ISA_SCALAR; isa--) {
+        if (gaussian_kernels_get((gaussian_isa_t)isa, &best_kernels) == 0)
+            return;
+    }
+}
+
+const gaussian_kernels_t *gaussian_kernels(void) {
+    pthread_once(&best_once, select_best);
+    return &best_kernels;
+}
+
+static inline size_t round_up8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+static inline size_t min_size(size_t a, size_t b) {
+    return (a < b)? a: b;
+}
+
+// Column pass in blocks of columns, so the rows a block reads stay in cache
+static void columns_pass(const gaussian_t *g, const gaussian_kernels_t *kernels, float *in, float *out,
+                         size_t width, size_t rows, size_t stride) {
+    for (size_t x = 0; x < width; x += GAUSSIAN_COLUMN_BLOCK) {
+        size_t block = min_size(GAUSSIAN_COLUMN_BLOCK, width - x);
+
+        if (g->method == GAUSSIAN_FIR)
+            kernels->fir_columns(in + x, out + x, block, rows, stride, g->weights, g->radius);
+        else
+            kernels->iir_columns(in + x, block, rows, stride, g->iir);
+    }
+}
+
+// Repeats the first and last of `rows` rows `pad` times above and below them
+static void replicate_rows(float *plane, size_t rows, size_t pad, size_t stride, size_t width) {
+    for (size_t i = 0; i < pad; i++) {
+        memcpy(plane + i * stride, plane + pad * stride, width * sizeof(float));
+        memcpy(plane + (pad + rows + i) * stride, plane + (pad + rows - 1) * stride, width * sizeof(float));
+    }
+}
+
+void gaussian_blur(const gaussian_t *g, const gaussian_kernels_t *kernels, image_chunk_t *chunk) {
+    if (!chunk || !chunk->pixel_data) {
+        LOG_ERROR("Error: chunk or pixel_data is NULL");
+        return;
+    }
+
+    int channels = chunk->channels;
+    int colour_channels = (channels == 2 || channels == 4)? channels - 1: channels;
+
+    // Only the halo within reach matters; the IIR uses it as run-in
+    size_t left = min_size(chunk->halo_left, g->reach), right = min_size(chunk->halo_right, g->reach);
+    size_t top = min_size(chunk->halo_top, g->reach), bottom = min_size(chunk->halo_bottom, g->reach);
+
+    size_t width = chunk->width, height = chunk->height;
+    size_t ext_width = left + width + right, ext_height = top + height + bottom;
+    size_t pad = (g->method == GAUSSIAN_FIR)? (size_t)g->radius: 0;
+
+    if (width == 0 || height == 0 || channels <= 0)
+        return;
+
+    /*
+        plane:      ext_height (+ 2 pad) rows of ext_width, one channel as floats
+        vertical:   the `height` interior rows after the vertical pass (FIR only; IIR works in place)
+        transposed: ext_width (+ 2 pad) rows of `height`, the vertical result turned on its side
+        horizontal: the `width` interior rows after the horizontal pass (FIR only)
+        result:     `height` rows of `width`, turned back
+    */
+    size_t plane_stride = round_up8(ext_width), transposed_stride = round_up8(height);
+    size_t plane_floats = (ext_height + 2 * pad) * plane_stride;
+    size_t transposed_floats = (ext_width + 2 * pad) * transposed_stride;
+    size_t vertical_floats = (pad > 0)? height * plane_stride: 0;
+    size_t horizontal_floats = (pad > 0)? width * transposed_stride: 0;
+    size_t result_stride = round_up8(width);
+
+    float *scratch = malloc((plane_floats + vertical_floats + transposed_floats + horizontal_floats +
+                             height * result_stride) * sizeof(float));
+    if (scratch == NULL) {
+        LOG_ERROR("Error: failed to allocate Gaussian scratch for a %zux%zu chunk", ext_width, ext_height);
+        return;
+    }
+
+    float *plane = scratch;
+    float *vertical = plane + plane_floats;
+    float *transposed = vertical + vertical_floats;
+    float *horizontal = transposed + transposed_floats;
+    float *result = horizontal + horizontal_floats;
+
+    size_t sample_bytes = image_sample_bytes(chunk->sample);
+    const unsigned char *origin = chunk->pixel_data - top * chunk->row_stride - left * (size_t)channels * sample_bytes;
+
+    for (int c = 0; c < colour_channels; c++) {
+        for (size_t y = 0; y < ext_height; y++)
+            samples_load(origin + y * chunk->row_stride + c * sample_bytes, chunk->sample, channels, ext_width,
+                         plane + (pad + y) * plane_stride);
+
+        // Vertical pass: interior rows, every column the horizontal pass will read
+        float *rows_done;
+        if (pad > 0) {
+            replicate_rows(plane, ext_height, pad, plane_stride, ext_width);
+            columns_pass(g, kernels, plane + top * plane_stride, vertical, ext_width, height, plane_stride);
+            rows_done = vertical;
+        } else {
+            columns_pass(g, kernels, plane, plane, ext_width, ext_height, plane_stride);
+            rows_done = plane + top * plane_stride;
+        }
+
+        // Horizontal pass as a vertical pass over the transposed rows
+        kernels->transpose(rows_done, plane_stride, transposed + pad * transposed_stride, transposed_stride, height, ext_width);
+
+        float *columns_done;
+        if (pad > 0) {
+            replicate_rows(transposed, ext_width, pad, transposed_stride, height);
+            columns_pass(g, kernels, transposed + left * transposed_stride, horizontal, height, width, transposed_stride);
+            columns_done = horizontal;
+        } else {
+            columns_pass(g, kernels, transposed, transposed, height, ext_width, transposed_stride);
+            columns_done = transposed + left * transposed_stride;
+        }
+
+        kernels->transpose(columns_done, transposed_stride, result, result_stride, width, height);
+
+        for (size_t y = 0; y < height; y++)
+            samples_store(result + y * result_stride, chunk->pixel_data + y * chunk->row_stride + c * sample_bytes,
+                          chunk->sample, channels, width);
+    }
+
+    free(scratch);
+}
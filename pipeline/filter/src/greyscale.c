@@ -0,0 +1,611 @@
+#include <stdint.h>
+#include <pthread.h>
+
+#include <greyscale.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GREYSCALE_X86 1
+#include <immintrin.h>
+#endif
+
+static inline unsigned char grey_value(unsigned r, unsigned g, unsigned b) {
+    return (unsigned char)((GREY_WEIGHT_R * r + GREY_WEIGHT_G * g + GREY_WEIGHT_B * b + 128) >> 8);
+}
+
+static void greyscale_rgb_scalar(unsigned char *row, size_t width) {
+    for (size_t x = 0; x < width; x++) {
+        unsigned char *pixel = row + 3 * x;
+        unsigned char grey = grey_value(pixel[0], pixel[1], pixel[2]);
+
+        pixel[0] = grey;
+        pixel[1] = grey;
+        pixel[2] = grey;
+    }
+}
+
+static void greyscale_rgba_scalar(unsigned char *row, size_t width) {
+    for (size_t x = 0; x < width; x++) {
+        unsigned char *pixel = row + 4 * x;
+        unsigned char grey = grey_value(pixel[0], pixel[1], pixel[2]);
+
+        pixel[0] = grey;
+        pixel[1] = grey;
+        pixel[2] = grey;
+    }
+}
+
+static void greyscale_planes_scalar(unsigned char *r, unsigned char *g, unsigned char *b, size_t width) {
+    for (size_t x = 0; x < width; x++) {
+        unsigned char grey = grey_value(r[x], g[x], b[x]);
+
+        r[x] = grey;
+        g[x] = grey;
+        b[x] = grey;
+    }
+}
+
+static inline uint16_t grey_value16(uint32_t r, uint32_t g, uint32_t b) {
+    return (uint16_t)((GREY_WEIGHT_R * r + GREY_WEIGHT_G * g + GREY_WEIGHT_B * b + 128) >> 8);
+}
+
+static void greyscale_rgb16_scalar(uint16_t *row, size_t width) {
+    for (size_t x = 0; x < width; x++) {
+        uint16_t *pixel = row + 3 * x;
+        uint16_t grey = grey_value16(pixel[0], pixel[1], pixel[2]);
+
+        pixel[0] = grey;
+        pixel[1] = grey;
+        pixel[2] = grey;
+    }
+}
+
+static void greyscale_rgba16_scalar(uint16_t *row, size_t width) {
+    for (size_t x = 0; x < width; x++) {
+        uint16_t *pixel = row + 4 * x;
+        uint16_t grey = grey_value16(pixel[0], pixel[1], pixel[2]);
+
+        pixel[0] = grey;
+        pixel[1] = grey;
+        pixel[2] = grey;
+    }
+}
+
+static void greyscale_float_row(float *row, size_t width, int channels) {
+    const float wr = GREY_WEIGHT_R / 256.0f, wg = GREY_WEIGHT_G / 256.0f, wb = GREY_WEIGHT_B / 256.0f;
+
+    for (size_t x = 0; x < width; x++) {
+        float *pixel = row + (size_t)channels * x;
+        float grey = wr * pixel[0] + wg * pixel[1] + wb * pixel[2];
+
+        pixel[0] = grey;
+        pixel[1] = grey;
+        pixel[2] = grey;
+    }
+}
+
+#ifdef GREYSCALE_X86
+
+/*
+    All interleaved vector kernels work on 32-bit lanes holding one pixel as R | G << 8 | B << 16 | A << 24 (RGB data is
+    first expanded to that layout). The weighted sum is at most 256 * 255 + 128 and fits the low 16 bits of
+    the lane, so 16-bit multiplies are exact and the upper half of every lane stays zero.
+*/
+
+/* Expands 4 packed RGB pixels (12 bytes) to RGB0 lanes, and compacts grey lanes back to 12 bytes. */
+#define RGB_EXPAND_SHUFFLE  0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1
+#define RGB_COMPACT_SHUFFLE 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1
+
+static inline __m128i grey_lanes_sse2(__m128i v) {
+    const __m128i low_byte = _mm_set1_epi32(0xFF);
+
+    __m128i r = _mm_and_si128(v, low_byte);
+    __m128i g = _mm_and_si128(_mm_srli_epi32(v, 8), low_byte);
+    __m128i b = _mm_and_si128(_mm_srli_epi32(v, 16), low_byte);
+
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi32(GREY_WEIGHT_R)),
+                                _mm_mullo_epi16(g, _mm_set1_epi32(GREY_WEIGHT_G)));
+    sum = _mm_add_epi16(sum, _mm_mullo_epi16(b, _mm_set1_epi32(GREY_WEIGHT_B)));
+    sum = _mm_add_epi16(sum, _mm_set1_epi32(128));
+
+    __m128i grey = _mm_srli_epi32(sum, 8);
+    return _mm_or_si128(grey, _mm_or_si128(_mm_slli_epi32(grey, 8), _mm_slli_epi32(grey, 16)));
+}
+
+static void greyscale_rgba_sse2(unsigned char *row, size_t width) {
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000u);
+    size_t x = 0;
+
+    for (; x + 4 <= width; x += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(row + 4 * x));
+        _mm_storeu_si128((__m128i *)(row + 4 * x), _mm_or_si128(grey_lanes_sse2(v), _mm_and_si128(v, alpha)));
+    }
+
+    greyscale_rgba_scalar(row + 4 * x, width - x);
+}
+
+/*
+    16 RGB pixels = 48 bytes = three full vectors, so nothing is read or written outside the row: neighbouring
+    pixels may belong to a chunk another thread is filtering. Each vector group of 4 pixels is realigned with
+    palignr, expanded to lanes, converted and compacted, then the four 12-byte results are stitched back.
+*/
+__attribute__((target("ssse3")))
+static void greyscale_rgb_ssse3(unsigned char *row, size_t width) {
+    const __m128i expand = _mm_setr_epi8(RGB_EXPAND_SHUFFLE);
+    const __m128i compact = _mm_setr_epi8(RGB_COMPACT_SHUFFLE);
+    size_t x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        __m128i *p = (__m128i *)(row + 3 * x);
+        __m128i v0 = _mm_loadu_si128(p), v1 = _mm_loadu_si128(p + 1), v2 = _mm_loadu_si128(p + 2);
+
+        __m128i c0 = _mm_shuffle_epi8(grey_lanes_sse2(_mm_shuffle_epi8(v0, expand)), compact);
+        __m128i c1 = _mm_shuffle_epi8(grey_lanes_sse2(_mm_shuffle_epi8(_mm_alignr_epi8(v1, v0, 12), expand)), compact);
+        __m128i c2 = _mm_shuffle_epi8(grey_lanes_sse2(_mm_shuffle_epi8(_mm_alignr_epi8(v2, v1, 8), expand)), compact);
+        __m128i c3 = _mm_shuffle_epi8(grey_lanes_sse2(_mm_shuffle_epi8(_mm_srli_si128(v2, 4), expand)), compact);
+
+        _mm_storeu_si128(p,     _mm_or_si128(c0, _mm_slli_si128(c1, 12)));
+        _mm_storeu_si128(p + 1, _mm_or_si128(_mm_srli_si128(c1, 4), _mm_slli_si128(c2, 8)));
+        _mm_storeu_si128(p + 2, _mm_or_si128(_mm_srli_si128(c2, 8), _mm_slli_si128(c3, 4)));
+    }
+
+    greyscale_rgb_scalar(row + 3 * x, width - x);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i grey_lanes_avx2(__m256i v) {
+    const __m256i low_byte = _mm256_set1_epi32(0xFF);
+
+    __m256i r = _mm256_and_si256(v, low_byte);
+    __m256i g = _mm256_and_si256(_mm256_srli_epi32(v, 8), low_byte);
+    __m256i b = _mm256_and_si256(_mm256_srli_epi32(v, 16), low_byte);
+
+    __m256i sum = _mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi32(GREY_WEIGHT_R)),
+                                   _mm256_mullo_epi16(g, _mm256_set1_epi32(GREY_WEIGHT_G)));
+    sum = _mm256_add_epi16(sum, _mm256_mullo_epi16(b, _mm256_set1_epi32(GREY_WEIGHT_B)));
+    sum = _mm256_add_epi16(sum, _mm256_set1_epi32(128));
+
+    __m256i grey = _mm256_srli_epi32(sum, 8);
+    return _mm256_or_si256(grey, _mm256_or_si256(_mm256_slli_epi32(grey, 8), _mm256_slli_epi32(grey, 16)));
+}
+
+__attribute__((target("avx2")))
+static void greyscale_rgba_avx2(unsigned char *row, size_t width) {
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000u);
+    size_t x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(row + 4 * x));
+        _mm256_storeu_si256((__m256i *)(row + 4 * x), _mm256_or_si256(grey_lanes_avx2(v), _mm256_and_si256(v, alpha)));
+    }
+
+    greyscale_rgba_sse2(row + 4 * x, width - x);
+}
+
+/* Same realignment as the SSSE3 kernel; the arithmetic runs on two 4-pixel groups per instruction. */
+__attribute__((target("avx2")))
+static void greyscale_rgb_avx2(unsigned char *row, size_t width) {
+    const __m256i expand = _mm256_setr_epi8(RGB_EXPAND_SHUFFLE, RGB_EXPAND_SHUFFLE);
+    const __m256i compact = _mm256_setr_epi8(RGB_COMPACT_SHUFFLE, RGB_COMPACT_SHUFFLE);
+    size_t x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        __m128i *p = (__m128i *)(row + 3 * x);
+        __m128i v0 = _mm_loadu_si128(p), v1 = _mm_loadu_si128(p + 1), v2 = _mm_loadu_si128(p + 2);
+
+        __m256i q01 = _mm256_set_m128i(_mm_alignr_epi8(v1, v0, 12), v0);
+        __m256i q23 = _mm256_set_m128i(_mm_srli_si128(v2, 4), _mm_alignr_epi8(v2, v1, 8));
+
+        __m256i r01 = _mm256_shuffle_epi8(grey_lanes_avx2(_mm256_shuffle_epi8(q01, expand)), compact);
+        __m256i r23 = _mm256_shuffle_epi8(grey_lanes_avx2(_mm256_shuffle_epi8(q23, expand)), compact);
+
+        __m128i c0 = _mm256_castsi256_si128(r01), c1 = _mm256_extracti128_si256(r01, 1);
+        __m128i c2 = _mm256_castsi256_si128(r23), c3 = _mm256_extracti128_si256(r23, 1);
+
+        _mm_storeu_si128(p,     _mm_or_si128(c0, _mm_slli_si128(c1, 12)));
+        _mm_storeu_si128(p + 1, _mm_or_si128(_mm_srli_si128(c1, 4), _mm_slli_si128(c2, 8)));
+        _mm_storeu_si128(p + 2, _mm_or_si128(_mm_srli_si128(c2, 8), _mm_slli_si128(c3, 4)));
+    }
+
+    greyscale_rgb_scalar(row + 3 * x, width - x);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i grey_lanes_avx512(__m512i v) {
+    const __m512i low_byte = _mm512_set1_epi32(0xFF);
+
+    __m512i r = _mm512_and_si512(v, low_byte);
+    __m512i g = _mm512_and_si512(_mm512_srli_epi32(v, 8), low_byte);
+    __m512i b = _mm512_and_si512(_mm512_srli_epi32(v, 16), low_byte);
+
+    __m512i sum = _mm512_add_epi16(_mm512_mullo_epi16(r, _mm512_set1_epi32(GREY_WEIGHT_R)),
+                                   _mm512_mullo_epi16(g, _mm512_set1_epi32(GREY_WEIGHT_G)));
+    sum = _mm512_add_epi16(sum, _mm512_mullo_epi16(b, _mm512_set1_epi32(GREY_WEIGHT_B)));
+    sum = _mm512_add_epi16(sum, _mm512_set1_epi32(128));
+
+    __m512i grey = _mm512_srli_epi32(sum, 8);
+    return _mm512_or_si512(grey, _mm512_or_si512(_mm512_slli_epi32(grey, 8), _mm512_slli_epi32(grey, 16)));
+}
+
+/* Masked loads and stores cover the tail of the row, so there is no scalar remainder loop. */
+__attribute__((target("avx512f,avx512bw")))
+static void greyscale_rgba_avx512(unsigned char *row, size_t width) {
+    const __m512i alpha = _mm512_set1_epi32((int)0xFF000000u);
+
+    for (size_t x = 0; x < width; x += 16) {
+        size_t n = (width - x < 16)? width - x: 16;
+        __mmask16 mask = (__mmask16)((1u << n) - 1);
+
+        __m512i v = _mm512_maskz_loadu_epi32(mask, row + 4 * x);
+        _mm512_mask_storeu_epi32(row + 4 * x, mask, _mm512_or_si512(grey_lanes_avx512(v), _mm512_and_si512(v, alpha)));
+    }
+}
+
+/* Byte i of lane p comes from byte 3p + i of the packed pixels (the 4th lane byte is masked to zero)... */
+static const uint8_t rgb_expand_index[64] = {
+    0, 1, 2, 0, 3, 4, 5, 3, 6, 7, 8, 6, 9, 10, 11, 9,
+    12, 13, 14, 12, 15, 16, 17, 15, 18, 19, 20, 18, 21, 22, 23, 21,
+    24, 25, 26, 24, 27, 28, 29, 27, 30, 31, 32, 30, 33, 34, 35, 33,
+    36, 37, 38, 36, 39, 40, 41, 39, 42, 43, 44, 42, 45, 46, 47, 45
+};
+
+/* ...and byte 3p + i of the packed result from byte i of lane p. */
+static const uint8_t rgb_compact_index[64] = {
+    0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 16, 17, 18, 20,
+    21, 22, 24, 25, 26, 28, 29, 30, 32, 33, 34, 36, 37, 38, 40, 41,
+    42, 44, 45, 46, 48, 49, 50, 52, 53, 54, 56, 57, 58, 60, 61, 62,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+/* Output vector k of a 64-pixel block is stitched from compacted groups k and k + 1 (48 bytes each). */
+static const uint8_t rgb_stitch_index[3][64] = {
+    {
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+        16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+        32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47,
+        64, 65, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79
+    },
+    {
+        16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+        32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47,
+        64, 65, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79,
+        80, 81, 82, 83, 84, 85, 86, 87, 88, 89, 90, 91, 92, 93, 94, 95
+    },
+    {
+        32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47,
+        64, 65, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79,
+        80, 81, 82, 83, 84, 85, 86, 87, 88, 89, 90, 91, 92, 93, 94, 95,
+        96, 97, 98, 99, 100, 101, 102, 103, 104, 105, 106, 107, 108, 109, 110, 111
+    }
+};
+
+/*
+    VBMI byte permutes expand packed RGB pixels to lanes and compact them back in one instruction each. Whole
+    64-pixel blocks (three full vectors) use plain loads and stores, with two-source permutes pulling each
+    16-pixel group out of whichever vectors it straddles; masked byte stores are kept for the tail only.
+*/
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static void greyscale_rgb_avx512vbmi(unsigned char *row, size_t width) {
+    const __m512i expand = _mm512_loadu_si512(rgb_expand_index);
+    const __m512i compact = _mm512_loadu_si512(rgb_compact_index);
+    const __mmask64 colour_bytes = 0x7777777777777777ull;   // zero the 4th byte of every lane
+    size_t x = 0;
+
+    for (; x + 64 <= width; x += 64) {
+        unsigned char *p = row + 3 * x;
+        __m512i v0 = _mm512_loadu_si512(p), v1 = _mm512_loadu_si512(p + 64), v2 = _mm512_loadu_si512(p + 128);
+
+        // Group k starts at byte 48k of the block
+        __m512i l0 = _mm512_maskz_permutexvar_epi8(colour_bytes, expand, v0);
+        __m512i l1 = _mm512_maskz_permutex2var_epi8(colour_bytes, v0, _mm512_add_epi8(expand, _mm512_set1_epi8(48)), v1);
+        __m512i l2 = _mm512_maskz_permutex2var_epi8(colour_bytes, v1, _mm512_add_epi8(expand, _mm512_set1_epi8(32)), v2);
+        __m512i l3 = _mm512_maskz_permutexvar_epi8(colour_bytes, _mm512_add_epi8(expand, _mm512_set1_epi8(16)), v2);
+
+        __m512i r0 = _mm512_permutexvar_epi8(compact, grey_lanes_avx512(l0));
+        __m512i r1 = _mm512_permutexvar_epi8(compact, grey_lanes_avx512(l1));
+        __m512i r2 = _mm512_permutexvar_epi8(compact, grey_lanes_avx512(l2));
+        __m512i r3 = _mm512_permutexvar_epi8(compact, grey_lanes_avx512(l3));
+
+        _mm512_storeu_si512(p,       _mm512_permutex2var_epi8(r0, _mm512_loadu_si512(rgb_stitch_index[0]), r1));
+        _mm512_storeu_si512(p + 64,  _mm512_permutex2var_epi8(r1, _mm512_loadu_si512(rgb_stitch_index[1]), r2));
+        _mm512_storeu_si512(p + 128, _mm512_permutex2var_epi8(r2, _mm512_loadu_si512(rgb_stitch_index[2]), r3));
+    }
+
+    for (; x < width; x += 16) {
+        size_t n = (width - x < 16)? width - x: 16;
+        __mmask64 mask = (1ull << (3 * n)) - 1;
+
+        __m512i packed = _mm512_maskz_loadu_epi8(mask, row + 3 * x);
+        __m512i lanes = _mm512_maskz_permutexvar_epi8(colour_bytes, expand, packed);
+        __m512i grey = _mm512_permutexvar_epi8(compact, grey_lanes_avx512(lanes));
+
+        _mm512_mask_storeu_epi8(row + 3 * x, mask, grey);
+    }
+}
+
+/*
+    Planar kernels need no shuffles: bytes are widened to 16 bits, weighted and summed (at most 65408, so the
+    unsigned 16-bit lanes cannot wrap), shifted and narrowed back, the same arithmetic as grey_value().
+*/
+static inline __m128i grey_words_sse2(__m128i r, __m128i g, __m128i b) {
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(GREY_WEIGHT_R)),
+                                _mm_mullo_epi16(g, _mm_set1_epi16(GREY_WEIGHT_G)));
+    sum = _mm_add_epi16(sum, _mm_mullo_epi16(b, _mm_set1_epi16(GREY_WEIGHT_B)));
+    return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(128)), 8);
+}
+
+static void greyscale_planes_sse2(unsigned char *r, unsigned char *g, unsigned char *b, size_t width) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        __m128i vr = _mm_loadu_si128((const __m128i *)(r + x));
+        __m128i vg = _mm_loadu_si128((const __m128i *)(g + x));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + x));
+
+        __m128i lo = grey_words_sse2(_mm_unpacklo_epi8(vr, zero), _mm_unpacklo_epi8(vg, zero), _mm_unpacklo_epi8(vb, zero));
+        __m128i hi = grey_words_sse2(_mm_unpackhi_epi8(vr, zero), _mm_unpackhi_epi8(vg, zero), _mm_unpackhi_epi8(vb, zero));
+        __m128i grey = _mm_packus_epi16(lo, hi);
+
+        _mm_storeu_si128((__m128i *)(r + x), grey);
+        _mm_storeu_si128((__m128i *)(g + x), grey);
+        _mm_storeu_si128((__m128i *)(b + x), grey);
+    }
+
+    greyscale_planes_scalar(r + x, g + x, b + x, width - x);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i grey_words_avx2(const unsigned char *r, const unsigned char *g, const unsigned char *b) {
+    __m256i vr = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)r));
+    __m256i vg = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)g));
+    __m256i vb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)b));
+
+    __m256i sum = _mm256_add_epi16(_mm256_mullo_epi16(vr, _mm256_set1_epi16(GREY_WEIGHT_R)),
+                                   _mm256_mullo_epi16(vg, _mm256_set1_epi16(GREY_WEIGHT_G)));
+    sum = _mm256_add_epi16(sum, _mm256_mullo_epi16(vb, _mm256_set1_epi16(GREY_WEIGHT_B)));
+    return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(128)), 8);
+}
+
+__attribute__((target("avx2")))
+static void greyscale_planes_avx2(unsigned char *r, unsigned char *g, unsigned char *b, size_t width) {
+    size_t x = 0;
+
+    for (; x + 32 <= width; x += 32) {
+        __m256i lo = grey_words_avx2(r + x, g + x, b + x);
+        __m256i hi = grey_words_avx2(r + x + 16, g + x + 16, b + x + 16);
+
+        // packus interleaves the 128-bit halves of its inputs; put them back in order
+        __m256i grey = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+
+        _mm256_storeu_si256((__m256i *)(r + x), grey);
+        _mm256_storeu_si256((__m256i *)(g + x), grey);
+        _mm256_storeu_si256((__m256i *)(b + x), grey);
+    }
+
+    greyscale_planes_sse2(r + x, g + x, b + x, width - x);
+}
+
+/*
+    Full blocks of 32 pixels use plain 256-bit moves; the tail uses the 512-bit byte-masked moves with only the
+    low 32 lanes enabled, which keeps AVX512VL out of the requirements. Results fit in a byte, so narrowing
+    truncates nothing.
+*/
+__attribute__((target("avx512f,avx512bw")))
+static inline __m256i grey_bytes_avx512(__m256i r, __m256i g, __m256i b) {
+    __m512i sum = _mm512_add_epi16(_mm512_mullo_epi16(_mm512_cvtepu8_epi16(r), _mm512_set1_epi16(GREY_WEIGHT_R)),
+                                   _mm512_mullo_epi16(_mm512_cvtepu8_epi16(g), _mm512_set1_epi16(GREY_WEIGHT_G)));
+    sum = _mm512_add_epi16(sum, _mm512_mullo_epi16(_mm512_cvtepu8_epi16(b), _mm512_set1_epi16(GREY_WEIGHT_B)));
+    return _mm512_cvtepi16_epi8(_mm512_srli_epi16(_mm512_add_epi16(sum, _mm512_set1_epi16(128)), 8));
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void greyscale_planes_avx512(unsigned char *r, unsigned char *g, unsigned char *b, size_t width) {
+    size_t x = 0;
+
+    for (; x + 32 <= width; x += 32) {
+        __m256i grey = grey_bytes_avx512(_mm256_loadu_si256((const __m256i *)(r + x)),
+                                         _mm256_loadu_si256((const __m256i *)(g + x)),
+                                         _mm256_loadu_si256((const __m256i *)(b + x)));
+        _mm256_storeu_si256((__m256i *)(r + x), grey);
+        _mm256_storeu_si256((__m256i *)(g + x), grey);
+        _mm256_storeu_si256((__m256i *)(b + x), grey);
+    }
+
+    if (x < width) {
+        __mmask64 mask = (__mmask64)(((uint64_t)1 << (width - x)) - 1);
+
+        __m512i grey = _mm512_castsi256_si512(
+            grey_bytes_avx512(_mm512_castsi512_si256(_mm512_maskz_loadu_epi8(mask, r + x)),
+                              _mm512_castsi512_si256(_mm512_maskz_loadu_epi8(mask, g + x)),
+                              _mm512_castsi512_si256(_mm512_maskz_loadu_epi8(mask, b + x))));
+        _mm512_mask_storeu_epi8(r + x, mask, grey);
+        _mm512_mask_storeu_epi8(g + x, mask, grey);
+        _mm512_mask_storeu_epi8(b + x, mask, grey);
+    }
+}
+
+/*
+    16-bit samples, two pixels of four words (R, G, B and alpha or padding) per 128-bit half. mullo and mulhi
+    give the two halves of every 32-bit product; unpacking them side by side lines up the products of one
+    pixel, and two horizontal adds leave each pixel's sum (at most 256 * 65535 + 128) in a dword.
+*/
+#define GREY16_WEIGHTS GREY_WEIGHT_R, GREY_WEIGHT_G, GREY_WEIGHT_B, 0
+
+/* Words 0-2 of each pixel from the dword sums, and RGB16 pixels expanded to / compacted from four words. */
+#define GREY16_SPREAD_SHUFFLE  0, 1, 0, 1, 0, 1, -1, -1, 4, 5, 4, 5, 4, 5, -1, -1
+#define GREY16_COMPACT_SHUFFLE 0, 1, 0, 1, 0, 1, 4, 5, 4, 5, 4, 5, -1, -1, -1, -1
+#define RGB16_EXPAND_SHUFFLE   0, 1, 2, 3, 4, 5, -1, -1, 6, 7, 8, 9, 10, 11, -1, -1
+
+__attribute__((target("avx2")))
+static inline __m256i grey_sums16_avx2(__m256i v) {
+    const __m256i weights = _mm256_setr_epi16(GREY16_WEIGHTS, GREY16_WEIGHTS, GREY16_WEIGHTS, GREY16_WEIGHTS);
+
+    __m256i lo = _mm256_mullo_epi16(v, weights);
+    __m256i hi = _mm256_mulhi_epu16(v, weights);
+    __m256i sums = _mm256_hadd_epi32(_mm256_unpacklo_epi16(lo, hi), _mm256_unpackhi_epi16(lo, hi));
+
+    sums = _mm256_hadd_epi32(sums, sums);
+    return _mm256_srli_epi32(_mm256_add_epi32(sums, _mm256_set1_epi32(128)), 8);
+}
+
+__attribute__((target("avx2")))
+static void greyscale_rgba16_avx2(uint16_t *row, size_t width) {
+    const __m256i spread = _mm256_setr_epi8(GREY16_SPREAD_SHUFFLE, GREY16_SPREAD_SHUFFLE);
+    const __m256i alpha = _mm256_set1_epi64x((long long)0xFFFF000000000000ull);
+    size_t x = 0;
+
+    for (; x + 4 <= width; x += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(row + 4 * x));
+        __m256i grey = _mm256_shuffle_epi8(grey_sums16_avx2(v), spread);
+        _mm256_storeu_si256((__m256i *)(row + 4 * x), _mm256_or_si256(grey, _mm256_and_si256(v, alpha)));
+    }
+
+    greyscale_rgba16_scalar(row + 4 * x, width - x);
+}
+
+/*
+    Four RGB16 pixels are 24 bytes: each half loads 16 bytes at pixel 0 and pixel 2 and keeps the first 12.
+    The second load reaches 4 bytes into pixel 4, so the loop stops while a fifth pixel is left in the row;
+    stores write exactly the 24 bytes converted.
+*/
+__attribute__((target("avx2")))
+static void greyscale_rgb16_avx2(uint16_t *row, size_t width) {
+    const __m256i expand = _mm256_setr_epi8(RGB16_EXPAND_SHUFFLE, RGB16_EXPAND_SHUFFLE);
+    const __m256i compact = _mm256_setr_epi8(GREY16_COMPACT_SHUFFLE, GREY16_COMPACT_SHUFFLE);
+    size_t x = 0;
+
+    for (; x + 5 <= width; x += 4) {
+        uint16_t *p = row + 3 * x;
+        __m256i v = _mm256_set_m128i(_mm_loadu_si128((const __m128i *)(p + 6)), _mm_loadu_si128((const __m128i *)p));
+        __m256i grey = _mm256_shuffle_epi8(grey_sums16_avx2(_mm256_shuffle_epi8(v, expand)), compact);
+
+        __m128i c0 = _mm256_castsi256_si128(grey), c1 = _mm256_extracti128_si256(grey, 1);
+        _mm_storeu_si128((__m128i *)p, _mm_or_si128(c0, _mm_slli_si128(c1, 12)));
+        _mm_storel_epi64((__m128i *)(p + 8), _mm_srli_si128(c1, 4));
+    }
+
+    greyscale_rgb16_scalar(row + 3 * x, width - x);
+}
+
+#endif /* GREYSCALE_X86 */
+
+int greyscale_kernels_get(greyscale_isa_t isa, greyscale_kernels_t *out) {
+    *out = (greyscale_kernels_t){ GREYSCALE_ISA_SCALAR, "scalar", greyscale_rgb_scalar, greyscale_rgba_scalar,
+                                  greyscale_planes_scalar, greyscale_rgb16_scalar, greyscale_rgba16_scalar };
+
+    if (isa == GREYSCALE_ISA_SCALAR)
+        return 0;
+
+#ifdef GREYSCALE_X86
+    __builtin_cpu_init();
+
+    switch (isa) {
+        case GREYSCALE_ISA_SSE2: {
+            if (!__builtin_cpu_supports("sse2"))
+                return -1;
+
+            // The RGB deinterleave needs SSSE3 byte shuffles
+            int ssse3 = __builtin_cpu_supports("ssse3");
+            *out = (greyscale_kernels_t){ isa, ssse3? "sse2+ssse3": "sse2",
+                                          ssse3? greyscale_rgb_ssse3: greyscale_rgb_scalar, greyscale_rgba_sse2,
+                                          greyscale_planes_sse2, greyscale_rgb16_scalar, greyscale_rgba16_scalar };
+            return 0;
+        }
+
+        case GREYSCALE_ISA_AVX2:
+            if (!__builtin_cpu_supports("avx2"))
+                return -1;
+
+            *out = (greyscale_kernels_t){ isa, "avx2", greyscale_rgb_avx2, greyscale_rgba_avx2, greyscale_planes_avx2,
+                                          greyscale_rgb16_avx2, greyscale_rgba16_avx2 };
+            return 0;
+
+        case GREYSCALE_ISA_AVX512:
+            if (!__builtin_cpu_supports("avx512f") || !__builtin_cpu_supports("avx512bw"))
+                return -1;
+
+            // Without VBMI the byte permutes are unavailable; the AVX2 RGB kernel is the next best thing.
+            // 16-bit samples keep the AVX2 kernels.
+            if (__builtin_cpu_supports("avx512vbmi"))
+                *out = (greyscale_kernels_t){ isa, "avx512bw+vbmi", greyscale_rgb_avx512vbmi, greyscale_rgba_avx512,
+                                              greyscale_planes_avx512, greyscale_rgb16_avx2, greyscale_rgba16_avx2 };
+            else
+                *out = (greyscale_kernels_t){ isa, "avx512bw", greyscale_rgb_avx2, greyscale_rgba_avx512,
+                                              greyscale_planes_avx512, greyscale_rgb16_avx2, greyscale_rgba16_avx2 };
+            return 0;
+
+        default:
+            return -1;
+    }
+#else
+    return -1;
+#endif
+}
+
+static greyscale_kernels_t greyscale_best;
+static pthread_once_t greyscale_once = PTHREAD_ONCE_INIT;
+
+static void greyscale_select(void) {
+    for (int isa = GREYSCALE_ISA_COUNT - 1; isa >= GREYSCALE_ISA_SCALAR; isa--) {
+        if (greyscale_kernels_get((greyscale_isa_t)isa, &greyscale_best) == 0)
+            return;
+    }
+}
+
+const greyscale_kernels_t *greyscale_kernels(void) {
+    pthread_once(&greyscale_once, greyscale_select);
+    return &greyscale_best;
+}
+
+void greyscale_rows(const greyscale_kernels_t *kernels, unsigned char *pixels,
+                    size_t width, size_t height, size_t stride, int channels) {
+    greyscale_row_fn row_fn = (channels == 3)? kernels->rgb: (channels == 4)? kernels->rgba: NULL;
+
+    // Grey and grey+alpha rows are already grey
+    if (row_fn == NULL)
+        return;
+
+    // Owned chunks and strips are one contiguous run of pixels
+    if (stride == width * (size_t)channels) {
+        row_fn(pixels, width * height);
+        return;
+    }
+
+    for (size_t y = 0; y < height; y++)
+        row_fn(pixels + y * stride, width);
+}
+
+void greyscale_planes(const greyscale_kernels_t *kernels, unsigned char *const planes[3],
+                      size_t width, size_t height, size_t stride) {
+    for (size_t y = 0; y < height; y++)
+        kernels->planar(planes[0] + y * stride, planes[1] + y * stride, planes[2] + y * stride, width);
+}
+
+void greyscale_samples(const greyscale_kernels_t *kernels, void *pixels, size_t width, size_t height,
+                       size_t stride, int channels, image_sample_t sample) {
+    if (sample == IMAGE_SAMPLE_U8) {
+        greyscale_rows(kernels, pixels, width, height, stride, channels);
+        return;
+    }
+
+    if (channels != 3 && channels != 4)
+        return;
+
+    // Contiguous rows are one long row
+    size_t row_bytes = width * (size_t)channels * image_sample_bytes(sample);
+    if (stride == row_bytes) {
+        width *= height;
+        height = 1;
+    }
+
+    for (size_t y = 0; y < height; y++) {
+        unsigned char *row = (unsigned char *)pixels + y * stride;
+
+        if (sample == IMAGE_SAMPLE_F32)
+            greyscale_float_row((float *)row, width, channels);
+        else if (channels == 3)
+            kernels->rgb16((uint16_t *)row, width);
+        else
+            kernels->rgba16((uint16_t *)row, width);
+    }
+}
@@ -0,0 +1,348 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <pthread.h>
+
+#include <lut.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LUT_X86 1
+#include <immintrin.h>
+#endif
+
+void lut_init_identity(pixel_lut_t *lut) {
+    for (int x = 0; x < 256; x++)
+        lut->table[x] = (uint8_t)x;
+}
+
+void lut_compose(pixel_lut_t *out, const pixel_lut_t *first, const pixel_lut_t *second) {
+    pixel_lut_t composed;
+
+    for (int x = 0; x < 256; x++)
+        composed.table[x] = second->table[first->table[x]];
+
+    *out = composed;
+}
+
+int lut_build_posterize(pixel_lut_t *lut, int levels) {
+    if (levels < 1 || levels > 256)
+        return -1;
+
+    int step = 256 / levels;
+
+    for (int x = 0; x < 256; x++)
+        lut->table[x] = (uint8_t)((x / step) * step);
+
+    return 0;
+}
+
+int lut_build_gamma(pixel_lut_t *lut, double gamma) {
+    if (!(gamma > 0.0))
+        return -1;
+
+    for (int x = 0; x < 256; x++)
+        lut->table[x] = (uint8_t)lround(255.0 * pow(x / 255.0, 1.0 / gamma));
+
+    return 0;
+}
+
+static inline uint8_t clamp_byte(double value) {
+    return (value <= 0.0)? 0: (value >= 255.0)? 255: (uint8_t)lround(value);
+}
+
+void lut_build_brightness_contrast(pixel_lut_t *lut, int brightness, double contrast) {
+    for (int x = 0; x < 256; x++)
+        lut->table[x] = clamp_byte((x - 128) * contrast + 128 + brightness);
+}
+
+int lut_build_curve(pixel_lut_t *lut, const uint8_t *inputs, const uint8_t *outputs, size_t count) {
+    if (count < 2)
+        return -1;
+
+    for (size_t i = 1; i < count; i++) {
+        if (inputs[i] <= inputs[i - 1])
+            return -1;
+    }
+
+    // Flat before the first and after the last control point
+    size_t segment = 0;
+    for (int x = 0; x < 256; x++) {
+        while (segment + 2 < count && x > inputs[segment + 1])
+            segment++;
+
+        int x0 = inputs[segment], x1 = inputs[segment + 1];
+        int y0 = outputs[segment], y1 = outputs[segment + 1];
+
+        if (x <= x0)
+            lut->table[x] = (uint8_t)y0;
+        else if (x >= x1)
+            lut->table[x] = (uint8_t)y1;
+        else
+            lut->table[x] = clamp_byte(y0 + (double)(y1 - y0) * (x - x0) / (x1 - x0));
+    }
+
+    return 0;
+}
+
+static void lut_apply_scalar(const pixel_lut_t *lut, unsigned char *bytes, size_t count, const uint8_t *select) {
+    const uint8_t *table = lut->table;
+
+    if (select == NULL) {
+        for (size_t i = 0; i < count; i++)
+            bytes[i] = table[bytes[i]];
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (select[i % LUT_SELECT_PERIOD])
+            bytes[i] = table[bytes[i]];
+    }
+}
+
+#ifdef LUT_X86
+
+/*
+    One two-source VBMI byte permute covers 128 table entries, so two permutes and a blend on the top bit look
+    up 64 bytes. Masked loads and stores handle the tail.
+
+    There is no AVX2 kernel: without VBMI the widest byte shuffle indexes 16 entries, and splitting the table
+    into 16 pshufb lookups measured no faster than the scalar loads.
+*/
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static void lut_apply_avx512vbmi(const pixel_lut_t *lut, unsigned char *bytes, size_t count, const uint8_t *select) {
+    // Unaligned loads: a table embedded in a heap block may not keep its 64-byte alignment
+    const __m512i t0 = _mm512_loadu_si512(lut->table), t1 = _mm512_loadu_si512(lut->table + 64);
+    const __m512i t2 = _mm512_loadu_si512(lut->table + 128), t3 = _mm512_loadu_si512(lut->table + 192);
+
+    for (size_t i = 0; i < count; i += 64) {
+        size_t n = (count - i < 64)? count - i: 64;
+        __mmask64 mask = (n == 64)? ~0ull: ((1ull << n) - 1);
+
+        __m512i v = _mm512_maskz_loadu_epi8(mask, bytes + i);
+        __m512i low_half = _mm512_permutex2var_epi8(t0, v, t1);
+        __m512i high_half = _mm512_permutex2var_epi8(t2, v, t3);
+        __m512i result = _mm512_mask_blend_epi8(_mm512_movepi8_mask(v), low_half, high_half);
+
+        if (select != NULL) {
+            __mmask64 selected = _mm512_movepi8_mask(_mm512_loadu_si512(select + i % LUT_SELECT_PERIOD));
+            mask &= selected;
+        }
+
+        _mm512_mask_storeu_epi8(bytes + i, mask, result);
+    }
+}
+
+#endif /* LUT_X86 */
+
+static lut_apply_fn lut_best = lut_apply_scalar;
+static const char *lut_best_name = "scalar";
+static pthread_once_t lut_once = PTHREAD_ONCE_INIT;
+
+static void lut_select(void) {
+#ifdef LUT_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vbmi")) {
+        lut_best = lut_apply_avx512vbmi;
+        lut_best_name = "avx512vbmi";
+    }
+#endif
+}
+
+lut_apply_fn lut_kernel(void) {
+    pthread_once(&lut_once, lut_select);
+    return lut_best;
+}
+
+const char *lut_kernel_name(void) {
+    pthread_once(&lut_once, lut_select);
+    return lut_best_name;
+}
+
+lut_apply_fn lut_scalar_kernel(void) {
+    return lut_apply_scalar;
+}
+
+void lut_apply(const pixel_lut_t *lut, unsigned char *pixels, size_t width, size_t height,
+               size_t stride, int channels, unsigned channel_mask) {
+    if (channels < 1 || channels > 4)
+        return;
+
+    unsigned all = (1u << channels) - 1;
+    channel_mask &= all;
+    if (channel_mask == 0)
+        return;
+
+    // Every row starts at channel 0, and LUT_SELECT_PERIOD is a multiple of `channels`
+    uint8_t pattern[LUT_SELECT_PERIOD];
+    const uint8_t *select = NULL;
+
+    if (channel_mask != all) {
+        for (int i = 0; i < LUT_SELECT_PERIOD; i++)
+            pattern[i] = (channel_mask & (1u << (i % channels)))? 0xFF: 0x00;
+        select = pattern;
+    }
+
+    lut_apply_fn apply = lut_kernel();
+    size_t row_bytes = width * (size_t)channels;
+
+    if (stride == row_bytes) {
+        apply(lut, pixels, row_bytes * height, select);
+        return;
+    }
+
+    for (size_t y = 0; y < height; y++)
+        apply(lut, pixels + y * stride, row_bytes, select);
+}
+
+// One slot per `levels` value; a table is built by whichever thread asks first and never freed
+static _Atomic(pixel_lut_t *) posterize_cache[257];
+
+const pixel_lut_t *lut_posterize_cached(int levels) {
+    if (levels < 1 || levels > 256)
+        return NULL;
+
+    pixel_lut_t *lut = atomic_load_explicit(&posterize_cache[levels], memory_order_acquire);
+    if (lut != NULL)
+        return lut;
+
+    pixel_lut_t *built = (pixel_lut_t *)aligned_alloc(64, sizeof(pixel_lut_t));
+    if (built == NULL)
+        return NULL;
+
+    lut_build_posterize(built, levels);
+
+    // Racing builders produce identical tables; the loser frees its copy
+    if (!atomic_compare_exchange_strong_explicit(&posterize_cache[levels], &lut, built,
+                                                 memory_order_acq_rel, memory_order_acquire)) {
+        free(built);
+        return lut;
+    }
+
+    return built;
+}
+
+static inline float clamp_unit(float value) {
+    return (value <= 0.0f)? 0.0f: (value >= 1.0f)? 1.0f: value;
+}
+
+int lut_wide_init(pixel_lut_wide_t *lut, image_sample_t sample) {
+    lut->sample = sample;
+    lut->table = NULL;
+
+    if (sample == IMAGE_SAMPLE_U16) {
+        uint16_t *table = (uint16_t *)malloc((LUT_WIDE_ENTRIES + 1) * sizeof(uint16_t));
+        if (table == NULL)
+            return -1;
+
+        for (size_t i = 0; i < LUT_WIDE_ENTRIES; i++)
+            table[i] = (uint16_t)i;
+        table[LUT_WIDE_ENTRIES] = table[LUT_WIDE_ENTRIES - 1];
+        lut->table = table;
+        return 0;
+    }
+
+    if (sample == IMAGE_SAMPLE_F32) {
+        float *table = (float *)malloc((LUT_WIDE_ENTRIES + 1) * sizeof(float));
+        if (table == NULL)
+            return -1;
+
+        for (size_t i = 0; i < LUT_WIDE_ENTRIES; i++)
+            table[i] = (float)i / (LUT_WIDE_ENTRIES - 1);
+        table[LUT_WIDE_ENTRIES] = table[LUT_WIDE_ENTRIES - 1];
+        lut->table = table;
+        return 0;
+    }
+
+    return -1;
+}
+
+void lut_wide_map(pixel_lut_wide_t *lut, lut_point_fn fn, const void *context) {
+    const float max = LUT_WIDE_ENTRIES - 1;
+
+    if (lut->sample == IMAGE_SAMPLE_U16) {
+        uint16_t *table = (uint16_t *)lut->table;
+        for (size_t i = 0; i < LUT_WIDE_ENTRIES; i++)
+            table[i] = (uint16_t)(clamp_unit(fn(table[i] / max, context)) * max + 0.5f);
+        table[LUT_WIDE_ENTRIES] = table[LUT_WIDE_ENTRIES - 1];
+    } else {
+        float *table = (float *)lut->table;
+        for (size_t i = 0; i < LUT_WIDE_ENTRIES; i++)
+            table[i] = clamp_unit(fn(table[i], context));
+        table[LUT_WIDE_ENTRIES] = table[LUT_WIDE_ENTRIES - 1];
+    }
+}
+
+bool lut_wide_equal(const pixel_lut_wide_t *a, const pixel_lut_wide_t *b) {
+    return a->sample == b->sample &&
+           memcmp(a->table, b->table, LUT_WIDE_ENTRIES * image_sample_bytes(a->sample)) == 0;
+}
+
+bool lut_wide_is_identity(const pixel_lut_wide_t *lut) {
+    pixel_lut_wide_t identity;
+    if (lut_wide_init(&identity, lut->sample) != 0)
+        return false;
+
+    bool equal = lut_wide_equal(lut, &identity);
+    lut_wide_destroy(&identity);
+    return equal;
+}
+
+static void lut_wide_row_u16(const uint16_t *table, uint16_t *row, size_t width, int channels, unsigned mask) {
+    for (size_t x = 0; x < width; x++) {
+        uint16_t *pixel = row + (size_t)channels * x;
+        for (int c = 0; c < channels; c++) {
+            if (mask & (1u << c))
+                pixel[c] = table[pixel[c]];
+        }
+    }
+}
+
+static void lut_wide_row_f32(const float *table, float *row, size_t width, int channels, unsigned mask) {
+    const float max = LUT_WIDE_ENTRIES - 1;
+
+    for (size_t x = 0; x < width; x++) {
+        float *pixel = row + (size_t)channels * x;
+        for (int c = 0; c < channels; c++) {
+            if (!(mask & (1u << c)))
+                continue;
+
+            float position = clamp_unit(pixel[c]) * max;
+            size_t i = (size_t)position;
+            float fraction = position - (float)i;
+            pixel[c] = table[i] + fraction * (table[i + 1] - table[i]);
+        }
+    }
+}
+
+void lut_wide_apply(const pixel_lut_wide_t *lut, void *pixels, size_t width, size_t height,
+                    size_t stride, int channels, unsigned channel_mask) {
+    if (channels < 1 || channels > 4 || lut->table == NULL)
+        return;
+
+    channel_mask &= (1u << channels) - 1;
+    if (channel_mask == 0)
+        return;
+
+    // Contiguous rows are one long row
+    if (stride == width * (size_t)channels * image_sample_bytes(lut->sample)) {
+        width *= height;
+        height = 1;
+    }
+
+    for (size_t y = 0; y < height; y++) {
+        void *row = (unsigned char *)pixels + y * stride;
+
+        if (lut->sample == IMAGE_SAMPLE_U16)
+            lut_wide_row_u16((const uint16_t *)lut->table, (uint16_t *)row, width, channels, channel_mask);
+        else
+            lut_wide_row_f32((const float *)lut->table, (float *)row, width, channels, channel_mask);
+    }
+}
+
+void lut_wide_destroy(pixel_lut_wide_t *lut) {
+    free(lut->table);
+    lut->table = NULL;
+}
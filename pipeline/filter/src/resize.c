@@ -0,0 +1,588 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include <resize.h>
+#include <planar.h>
+#include <samples.h>
+#include <log.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RESIZE_X86 1
+#include <immintrin.h>
+#endif
+
+/** @brief Largest output side (keeps the weight tables and output tiles reasonable). */
+#define RESIZE_MAX_SIZE 65536
+
+#define RESIZE_PI 3.14159265358979323846
+
+int resize_filter_from_string(const char *name, resize_filter_t *filter) {
+    if (strcmp(name, "box") == 0)
+        *filter = RESIZE_BOX;
+    else if (strcmp(name, "bilinear") == 0)
+        *filter = RESIZE_BILINEAR;
+    else if (strcmp(name, "lanczos") == 0)
+        *filter = RESIZE_LANCZOS;
+    else
+        return -1;
+
+    return 0;
+}
+
+const char *resize_filter_name(resize_filter_t filter) {
+    switch (filter) {
+        case RESIZE_BOX:
+            return "box";
+        case RESIZE_BILINEAR:
+            return "bilinear";
+        default:
+            return "lanczos";
+    }
+}
+
+static double filter_support(resize_filter_t filter) {
+    return (filter == RESIZE_BOX)? 0.5: (filter == RESIZE_BILINEAR)? 1.0: 3.0;
+}
+
+static double sinc(double x) {
+    if (x == 0.0)
+        return 1.0;
+    x *= RESIZE_PI;
+    return sin(x) / x;
+}
+
+static double filter_weight(resize_filter_t filter, double t) {
+    switch (filter) {
+        case RESIZE_BOX:
+            return (t >= -0.5 && t < 0.5)? 1.0: 0.0;
+        case RESIZE_BILINEAR:
+            t = fabs(t);
+            return (t < 1.0)? 1.0 - t: 0.0;
+        default:
+            return (fabs(t) < 3.0)? sinc(t) * sinc(t / 3.0): 0.0;
+    }
+}
+
+int resize_init(resize_t *resize, const resize_spec_t *spec) {
+    memset(resize, 0, sizeof(*resize));
+
+    if (spec->percent < 0.0 || (spec->percent == 0.0 && spec->width == 0 && spec->height == 0) ||
+        spec->width > RESIZE_MAX_SIZE || spec->height > RESIZE_MAX_SIZE)
+        return -1;
+
+    resize->spec = *spec;
+    resize->support = filter_support(spec->filter);
+    resize->lock = malloc(sizeof(pthread_mutex_t));
+    resize->axes = calloc(1, sizeof(resize_axis_t *));
+
+    if (resize->lock == NULL || resize->axes == NULL || pthread_mutex_init(resize->lock, NULL) != 0) {
+        free(resize->lock);
+        free(resize->axes);
+        memset(resize, 0, sizeof(*resize));
+        return -1;
+    }
+
+    return 0;
+}
+
+static void free_axis(resize_axis_t *axis) {
+    free(axis->start);
+    free(axis->weights);
+    free(axis);
+}
+
+void resize_destroy(resize_t *resize) {
+    if (resize->axes != NULL) {
+        resize_axis_t *axis = *resize->axes;
+        while (axis != NULL) {
+            resize_axis_t *next = axis->next;
+            free_axis(axis);
+            axis = next;
+        }
+        free(resize->axes);
+    }
+
+    if (resize->lock != NULL) {
+        pthread_mutex_destroy(resize->lock);
+        free(resize->lock);
+    }
+
+    memset(resize, 0, sizeof(*resize));
+}
+
+static size_t scaled_size(size_t size, double factor) {
+    double scaled = floor((double)size * factor + 0.5);
+    return (scaled < 1.0)? 1: (scaled > RESIZE_MAX_SIZE)? RESIZE_MAX_SIZE: (size_t)scaled;
+}
+
+void resize_output_size(const resize_spec_t *spec, size_t width, size_t height, size_t *out_width, size_t *out_height) {
+    if (spec->percent > 0.0) {
+        *out_width = scaled_size(width, spec->percent / 100.0);
+        *out_height = scaled_size(height, spec->percent / 100.0);
+    } else if (spec->width == 0) {
+        *out_width = scaled_size(width, (double)spec->height / (double)height);
+        *out_height = spec->height;
+    } else if (spec->height == 0) {
+        *out_width = spec->width;
+        *out_height = scaled_size(height, (double)spec->width / (double)width);
+    } else {
+        *out_width = spec->width;
+        *out_height = spec->height;
+    }
+}
+
+// Half-width of the filter in source pixels: widened by the scale when downscaling
+static double axis_support(const resize_t *resize, size_t in_size, size_t out_size) {
+    double scale = (double)in_size / (double)out_size;
+    return resize->support * ((scale > 1.0)? scale: 1.0);
+}
+
+static size_t axis_reach(const resize_t *resize, size_t in_size, size_t out_size) {
+    return (size_t)ceil(axis_support(resize, in_size, out_size)) + 1;
+}
+
+void resize_reach(const resize_t *resize, size_t width, size_t height, size_t *reach_x, size_t *reach_y) {
+    size_t out_width, out_height;
+    resize_output_size(&resize->spec, width, height, &out_width, &out_height);
+
+    *reach_x = axis_reach(resize, width, out_width);
+    *reach_y = axis_reach(resize, height, out_height);
+}
+
+size_t resize_min_reach(const resize_t *resize) {
+    return (size_t)ceil(resize->support) + 1;
+}
+
+static size_t gcd(size_t a, size_t b) {
+    while (b != 0) {
+        size_t r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+static resize_axis_t *build_axis(const resize_t *resize, size_t in_size, size_t out_size) {
+    double scale = (double)in_size / (double)out_size;
+    double stretch = (scale > 1.0)? scale: 1.0;
+    double support = axis_support(resize, in_size, out_size);
+
+    size_t common = gcd(in_size, out_size);
+    size_t phases = out_size / common, step = in_size / common;
+    int taps = (int)floor(2.0 * support) + 1;
+
+    resize_axis_t *axis = calloc(1, sizeof(resize_axis_t));
+    if (axis == NULL)
+        return NULL;
+
+    axis->in_size = in_size;
+    axis->out_size = out_size;
+    axis->taps = taps;
+    axis->phases = phases;
+    axis->start = malloc(out_size * sizeof(long));
+    axis->weights = malloc(phases * (size_t)taps * sizeof(float));
+
+    if (axis->start == NULL || axis->weights == NULL) {
+        free_axis(axis);
+        return NULL;
+    }
+
+    // Output pixels phase and phase + k * phases sit k * step source pixels apart, with the same weights
+    for (size_t x = 0; x < phases; x++) {
+        double centre = ((double)x + 0.5) * scale - 0.5;
+        long first = (long)ceil(centre - support);
+        float *weights = axis->weights + x * (size_t)taps;
+        double total = 0.0;
+
+        for (int k = 0; k < taps; k++) {
+            double w = filter_weight(resize->spec.filter, ((double)(first + k) - centre) / stretch);
+            weights[k] = (float)w;
+            total += w;
+        }
+
+        if (total != 0.0) {
+            for (int k = 0; k < taps; k++)
+                weights[k] = (float)(weights[k] / total);
+        } else {
+            // Nothing under the filter (cannot happen with these supports): nearest pixel
+            long nearest = (long)floor(centre + 0.5) - first;
+            memset(weights, 0, (size_t)taps * sizeof(float));
+            weights[(nearest < 0)? 0: (nearest >= taps)? taps - 1: nearest] = 1.0f;
+        }
+
+        axis->start[x] = first;
+    }
+
+    for (size_t x = phases; x < out_size; x++)
+        axis->start[x] = axis->start[x % phases] + (long)((x / phases) * step);
+
+    return axis;
+}
+
+const resize_axis_t *resize_axis(const resize_t *resize, size_t in_size, size_t out_size) {
+    pthread_mutex_lock(resize->lock);
+
+    resize_axis_t *axis = *resize->axes;
+    while (axis != NULL && (axis->in_size != in_size || axis->out_size != out_size))
+        axis = axis->next;
+
+    if (axis == NULL) {
+        axis = build_axis(resize, in_size, out_size);
+        if (axis != NULL) {
+            axis->next = *resize->axes;
+            *resize->axes = axis;
+        }
+    }
+
+    pthread_mutex_unlock(resize->lock);
+    return axis;
+}
+
+static void horizontal_scalar(const float *in, long in_origin, int channels, const resize_axis_t *axis,
+                              size_t first, size_t count, float *out) {
+    int taps = axis->taps;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t x = first + i;
+        const float *weights = axis->weights + (x % axis->phases) * (size_t)taps;
+        const float *src = in + (axis->start[x] - in_origin) * channels;
+
+        for (int c = 0; c < channels; c++) {
+            float total = 0.0f;
+            for (int k = 0; k < taps; k++)
+                total += weights[k] * src[k * channels + c];
+            out[i * channels + c] = total;
+        }
+    }
+}
+
+static void vertical_scalar(const float *const *rows, const float *weights, int taps, float *out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        float total = 0.0f;
+        for (int k = 0; k < taps; k++)
+            total += weights[k] * rows[k][i];
+        out[i] = total;
+    }
+}
+
+#ifdef RESIZE_X86
+
+/*
+    Three and four channels: a pixel per 128-bit vector, so every tap is one broadcast and one FMA (three
+    channels load and store a fourth float, which the next pixel or the spare float absorbs). One channel:
+    eight output pixels at a time, gathering tap k of each. Two channels and the leftovers go one sample
+    at a time, still with fused multiply-adds, so every layout and tiling rounds alike.
+*/
+__attribute__((target("avx2,fma")))
+static void horizontal_fma(const float *in, long in_origin, int channels, const resize_axis_t *axis,
+                           size_t first, size_t count, float *out) {
+    int taps = axis->taps;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t x = first + i;
+        const float *weights = axis->weights + (x % axis->phases) * (size_t)taps;
+        const float *src = in + (axis->start[x] - in_origin) * channels;
+
+        for (int c = 0; c < channels; c++) {
+            float total = 0.0f;
+            for (int k = 0; k < taps; k++)
+                total = fmaf(weights[k], src[k * channels + c], total);
+            out[i * channels + c] = total;
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void horizontal_avx2(const float *in, long in_origin, int channels, const resize_axis_t *axis,
+                            size_t first, size_t count, float *out) {
+    int taps = axis->taps;
+    size_t i = 0;
+
+    if (channels == 3 || channels == 4) {
+        for (; i < count; i++) {
+            size_t x = first + i;
+            const float *weights = axis->weights + (x % axis->phases) * (size_t)taps;
+            const float *src = in + (axis->start[x] - in_origin) * channels;
+            __m128 total = _mm_setzero_ps();
+
+            for (int k = 0; k < taps; k++)
+                total = _mm_fmadd_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(src + k * channels), total);
+
+            _mm_storeu_ps(out + i * channels, total);
+        }
+        return;
+    }
+
+    if (channels == 1) {
+        for (; i + 8 <= count; i += 8) {
+            int starts[8], phases[8];
+            for (int j = 0; j < 8; j++) {
+                size_t x = first + i + j;
+                starts[j] = (int)(axis->start[x] - in_origin);
+                phases[j] = (int)((x % axis->phases) * (size_t)taps);
+            }
+
+            __m256i src = _mm256_loadu_si256((const __m256i *)starts);
+            __m256i weight = _mm256_loadu_si256((const __m256i *)phases);
+            __m256 total = _mm256_setzero_ps();
+            const __m256i one = _mm256_set1_epi32(1);
+
+            for (int k = 0; k < taps; k++) {
+                total = _mm256_fmadd_ps(_mm256_i32gather_ps(axis->weights, weight, 4),
+                                        _mm256_i32gather_ps(in, src, 4), total);
+                src = _mm256_add_epi32(src, one);
+                weight = _mm256_add_epi32(weight, one);
+            }
+
+            _mm256_storeu_ps(out + i, total);
+        }
+    }
+
+    horizontal_fma(in, in_origin, channels, axis, first + i, count - i, out + i * channels);
+}
+
+__attribute__((target("avx2,fma")))
+static void vertical_avx2(const float *const *rows, const float *weights, int taps, float *out, size_t count) {
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        __m256 a = _mm256_setzero_ps(), b = _mm256_setzero_ps();
+        for (int k = 0; k < taps; k++) {
+            __m256 w = _mm256_set1_ps(weights[k]);
+            a = _mm256_fmadd_ps(w, _mm256_loadu_ps(rows[k] + i), a);
+            b = _mm256_fmadd_ps(w, _mm256_loadu_ps(rows[k] + i + 8), b);
+        }
+        _mm256_storeu_ps(out + i, a);
+        _mm256_storeu_ps(out + i + 8, b);
+    }
+
+    for (; i + 8 <= count; i += 8) {
+        __m256 a = _mm256_setzero_ps();
+        for (int k = 0; k < taps; k++)
+            a = _mm256_fmadd_ps(_mm256_set1_ps(weights[k]), _mm256_loadu_ps(rows[k] + i), a);
+        _mm256_storeu_ps(out + i, a);
+    }
+
+    for (; i < count; i++) {
+        float total = 0.0f;
+        for (int k = 0; k < taps; k++)
+            total = fmaf(weights[k], rows[k][i], total);
+        out[i] = total;
+    }
+}
+
+#endif /* RESIZE_X86 */
+
+static const resize_kernels_t scalar_kernels = {
+    RESIZE_ISA_SCALAR, "scalar", horizontal_scalar, vertical_scalar
+};
+
+int resize_kernels_get(resize_isa_t isa, resize_kernels_t *out) {
+    switch (isa) {
+        case RESIZE_ISA_SCALAR:
+            *out = scalar_kernels;
+            return 0;
+#ifdef RESIZE_X86
+        case RESIZE_ISA_AVX2:
+            __builtin_cpu_init();
+            if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("fma"))
+                return -1;
+            *out = (resize_kernels_t){ RESIZE_ISA_AVX2, "avx2", horizontal_avx2, vertical_avx2 };
+            return 0;
+#endif
+        default:
+            return -1;
+    }
+}
+
+static resize_kernels_t best_kernels;
+static pthread_once_t best_once = PTHREAD_ONCE_INIT;
+
+static void select_best(void) {
+    best_kernels = scalar_kernels;
+
+    for (int isa = RESIZE_ISA_COUNT - 1; isa > RESIZE_ISA_SCALAR; isa--) {
+        if (resize_kernels_get((resize_isa_t)isa, &best_kernels) == 0)
+            return;
+    }
+}
+
+const resize_kernels_t *resize_kernels(void) {
+    pthread_once(&best_once, select_best);
+    return &best_kernels;
+}
+
+static inline long clamp_long(long value, long low, long high) {
+    return (value < low)? low: (value > high)? high: value;
+}
+
+// First output pixel whose centre, (x + 0.5) * in / out, is at or past source pixel `position`
+static size_t output_begin(size_t position, size_t in_size, size_t out_size) {
+    long long numerator = 2LL * (long long)position * (long long)out_size - (long long)in_size;
+    if (numerator <= 0)
+        return 0;
+    return (size_t)((numerator + 2LL * (long long)in_size - 1) / (2LL * (long long)in_size));
+}
+
+/*
+    Resamples the output block (out_x, out_y, out_width, out_height) from the source pixels available in
+    `src`: `src_width` x `src_height` samples of `channels` interleaved channels, src[0] being source pixel
+    (src_x, src_y). Every source row the block needs goes through the horizontal pass once.
+*/
+static int resize_block(const resize_axis_t *ax, const resize_axis_t *ay, const resize_kernels_t *kernels,
+                        const unsigned char *src, size_t src_stride, image_sample_t sample, int channels,
+                        long src_x, long src_y, size_t src_width, size_t src_height,
+                        size_t out_x, size_t out_y, size_t out_width, size_t out_height,
+                        unsigned char *dst, size_t dst_stride) {
+    size_t sample_bytes = image_sample_bytes(sample);
+    long last_x = src_x + (long)src_width - 1, last_y = src_y + (long)src_height - 1;
+
+    // Source columns and rows under the block's taps, the columns before clamping
+    long first_column = ax->start[out_x];
+    long last_column = ax->start[out_x + out_width - 1] + ax->taps - 1;
+    long first_row = clamp_long(ay->start[out_y], src_y, last_y);
+    long last_row = clamp_long(ay->start[out_y + out_height - 1] + ay->taps - 1, src_y, last_y);
+
+    size_t columns = (size_t)(last_column - first_column + 1);
+    size_t rows = (size_t)(last_row - first_row + 1);
+    size_t row_floats = out_width * (size_t)channels + 1;
+
+    /*
+        padded:       one source row over the tap columns, edges replicated (+1 spare float)
+        intermediate: the horizontal pass of every source row in first_row .. last_row
+        result:       one output row after the vertical pass
+    */
+    float *padded = malloc((columns * (size_t)channels + 1 + rows * row_floats + row_floats) * sizeof(float));
+    const float **taps = malloc((size_t)ay->taps * sizeof(float *));
+
+    if (padded == NULL || taps == NULL) {
+        free(padded);
+        free(taps);
+        return -1;
+    }
+
+    float *intermediate = padded + columns * (size_t)channels + 1;
+    float *result = intermediate + rows * row_floats;
+
+    long run_first = clamp_long(first_column, src_x, last_x), run_last = clamp_long(last_column, src_x, last_x);
+    size_t run_start = (size_t)(run_first - first_column), run = (size_t)(run_last - run_first + 1);
+    size_t pixel_bytes = (size_t)channels * sample_bytes;
+
+    padded[columns * (size_t)channels] = 0.0f;
+
+    for (long y = first_row; y <= last_row; y++) {
+        const unsigned char *row = src + (size_t)(y - src_y) * src_stride + (size_t)(run_first - src_x) * pixel_bytes;
+
+        samples_load(row, sample, 1, run * (size_t)channels, padded + run_start * (size_t)channels);
+
+        for (size_t x = 0; x < run_start; x++)
+            memcpy(padded + x * channels, padded + run_start * channels, (size_t)channels * sizeof(float));
+        for (size_t x = run_start + run; x < columns; x++)
+            memcpy(padded + x * channels, padded + (run_start + run - 1) * channels, (size_t)channels * sizeof(float));
+
+        kernels->horizontal(padded, first_column, channels, ax, out_x, out_width,
+                            intermediate + (size_t)(y - first_row) * row_floats);
+    }
+
+    for (size_t y = out_y; y < out_y + out_height; y++) {
+        const float *weights = ay->weights + (y % ay->phases) * (size_t)ay->taps;
+
+        for (int k = 0; k < ay->taps; k++)
+            taps[k] = intermediate + (size_t)(clamp_long(ay->start[y] + k, first_row, last_row) - first_row) * row_floats;
+
+        kernels->vertical(taps, weights, ay->taps, result, out_width * (size_t)channels);
+        samples_store(result, dst + (y - out_y) * dst_stride, sample, 1, out_width * (size_t)channels);
+    }
+
+    free(padded);
+    free(taps);
+    return 0;
+}
+
+// Frees the chunk's pixels (or its view) and returns their reservation to the budget
+static void release_pixels(image_chunk_t *chunk) {
+    if (chunk->source != NULL) {
+        image_buffer_release(chunk->source);
+        chunk->source = NULL;
+    } else if (chunk->pixel_data != NULL) {
+        chunk_memory_release(chunk->data_size_bytes);
+        free(image_chunk_halo_origin(chunk));
+    }
+}
+
+void resize_apply(const resize_t *resize, const resize_kernels_t *kernels, image_chunk_t *chunk) {
+    if (!chunk || !chunk->pixel_data) {
+        LOG_ERROR("Error: chunk or pixel_data is NULL");
+        return;
+    }
+
+    size_t in_width = (size_t)chunk->original_image_width, in_height = (size_t)chunk->original_image_height;
+    size_t out_width, out_height;
+    resize_output_size(&resize->spec, in_width, in_height, &out_width, &out_height);
+
+    // The output pixels whose centres fall on the interior
+    size_t x0 = output_begin(chunk->offset_x, in_width, out_width);
+    size_t x1 = output_begin(chunk->offset_x + chunk->width, in_width, out_width);
+    size_t y0 = output_begin(chunk->offset_y, in_height, out_height);
+    size_t y1 = output_begin(chunk->offset_y + chunk->height, in_height, out_height);
+    size_t width = x1 - x0, height = y1 - y0;
+
+    const resize_axis_t *ax = resize_axis(resize, in_width, out_width);
+    const resize_axis_t *ay = resize_axis(resize, in_height, out_height);
+
+    bool planar = (chunk->layout == IMAGE_LAYOUT_PLANAR);
+    int channels = chunk->channels;
+    size_t pixel_bytes = (size_t)channels * image_sample_bytes(chunk->sample);
+
+    // Planes keep aligned rows, so their size is a multiple of the alignment as aligned_alloc() wants
+    size_t row_stride = planar? planar_row_stride(width): width * pixel_bytes;
+    size_t plane_size = planar? row_stride * height: 0;
+    size_t bytes = planar? plane_size * (size_t)channels: row_stride * height;
+    unsigned char *buffer = planar? aligned_alloc(PLANAR_ALIGNMENT, (bytes > 0)? bytes: PLANAR_ALIGNMENT):
+                                    malloc((bytes > 0)? bytes: 1);
+
+    int status = (ax == NULL || ay == NULL || buffer == NULL)? -1: 0;
+
+    if (status == 0 && width > 0 && height > 0) {
+        long src_x = (long)(chunk->offset_x - chunk->halo_left), src_y = (long)(chunk->offset_y - chunk->halo_top);
+        size_t src_width = chunk->halo_left + chunk->width + chunk->halo_right;
+        size_t src_height = chunk->halo_top + chunk->height + chunk->halo_bottom;
+        const unsigned char *origin = image_chunk_halo_origin(chunk);
+
+        if (planar) {
+            for (int c = 0; c < channels && status == 0; c++)
+                status = resize_block(ax, ay, kernels, origin + (size_t)c * chunk->plane_size, chunk->row_stride,
+                                      chunk->sample, 1, src_x, src_y, src_width, src_height, x0, y0, width, height,
+                                      buffer + (size_t)c * plane_size, row_stride);
+        } else {
+            status = resize_block(ax, ay, kernels, origin, chunk->row_stride, chunk->sample, channels,
+                                  src_x, src_y, src_width, src_height, x0, y0, width, height, buffer, row_stride);
+        }
+    }
+
+    if (status != 0) {
+        // Still hand reconstruction a tile of the output image, an empty one, so the image completes
+        LOG_ERROR("Error: failed to resize chunk %d of %s to %zux%zu", chunk->chunk_id, chunk->original_image_name,
+                  out_width, out_height);
+        width = height = 0;
+        bytes = 0;
+    }
+
+    release_pixels(chunk);
+    chunk_memory_charge(bytes);
+
+    chunk->pixel_data = buffer;
+    chunk->data_size_bytes = bytes;
+    chunk->row_stride = row_stride;
+    chunk->plane_size = plane_size;
+    chunk->halo_left = chunk->halo_top = chunk->halo_right = chunk->halo_bottom = 0;
+    chunk->offset_x = x0;
+    chunk->offset_y = y0;
+    chunk->width = width;
+    chunk->height = height;
+    chunk->original_image_width = (int)out_width;
+    chunk->original_image_height = (int)out_height;
+}
@@ -0,0 +1,336 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <image_chunker.h>
+#include <work_stealing.h>
+#include <log.h>
+
+/** @brief Number of chunks a worker pulls from the injection queue at once. */
+#define WS_INJECT_BATCH 8
+
+/** @brief Initial number of slots of every deque. */
+#define WS_DEQUE_INITIAL_CAPACITY 256
+
+extern volatile sig_atomic_t stop_flag;
+
+static ws_array_t *ws_array_create(size_t capacity) {
+    ws_array_t *array = (ws_array_t *)malloc(sizeof(ws_array_t) + capacity * sizeof(array->slots[0]));
+    if (array == NULL)
+        return NULL;
+
+    array->capacity = capacity;
+    array->retired = NULL;
+
+    return array;
+}
+
+static inline image_chunk_t *ws_array_get(ws_array_t *array, int64_t index) {
+    return atomic_load_explicit(&array->slots[(size_t)index & (array->capacity - 1)], memory_order_relaxed);
+}
+
+static inline void ws_array_put(ws_array_t *array, int64_t index, image_chunk_t *chunk) {
+    atomic_store_explicit(&array->slots[(size_t)index & (array->capacity - 1)], chunk, memory_order_relaxed);
+}
+
+int ws_deque_init(ws_deque_t *d, size_t initial_capacity) {
+    size_t capacity = 2;
+    while (capacity < initial_capacity)
+        capacity <<= 1;
+
+    ws_array_t *array = ws_array_create(capacity);
+    if (array == NULL) {
+        perror("ws_deque_init: Failed to allocate memory for deque");
+        return -1;
+    }
+
+    atomic_init(&d->top, 0);
+    atomic_init(&d->bottom, 0);
+    atomic_init(&d->array, array);
+
+    return 0;
+}
+
+int ws_deque_push(ws_deque_t *d, image_chunk_t *chunk) {
+    int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+    ws_array_t *array = atomic_load_explicit(&d->array, memory_order_relaxed);
+
+    if (b - t > (int64_t)array->capacity - 1) {
+        // Full: copy the live range into an array twice the size; thieves may still read the old one
+        ws_array_t *grown = ws_array_create(array->capacity * 2);
+        if (grown == NULL)
+            return -1;
+
+        for (int64_t i = t; i < b; i++)
+            ws_array_put(grown, i, ws_array_get(array, i));
+
+        grown->retired = array;
+        atomic_store_explicit(&d->array, grown, memory_order_release);
+        array = grown;
+    }
+
+    ws_array_put(array, b, chunk);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+
+    return 0;
+}
+
+image_chunk_t *ws_deque_take(ws_deque_t *d) {
+    int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    ws_array_t *array = atomic_load_explicit(&d->array, memory_order_relaxed);
+
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+    if (t > b) {
+        // Empty: restore bottom
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    image_chunk_t *chunk = ws_array_get(array, b);
+
+    if (t == b) {
+        // Last element: race the thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                     memory_order_seq_cst, memory_order_relaxed))
+            chunk = NULL;
+
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+
+    return chunk;
+}
+
+image_chunk_t *ws_deque_steal(ws_deque_t *d, bool *contended) {
+    int64_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+
+    if (t >= b)
+        return NULL;
+
+    ws_array_t *array = atomic_load_explicit(&d->array, memory_order_acquire);
+    image_chunk_t *chunk = ws_array_get(array, t);
+
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed)) {
+        *contended = true;
+        return NULL;
+    }
+
+    return chunk;
+}
+
+size_t ws_deque_size(ws_deque_t *d) {
+    int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+    return (b > t)? (size_t)(b - t): 0;
+}
+
+void ws_deque_destroy(ws_deque_t *d) {
+    ws_array_t *array = atomic_load_explicit(&d->array, memory_order_relaxed);
+    if (array == NULL)
+        return;
+
+    int64_t t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+
+    for (int64_t i = t; i < b; i++)
+        free_image_chunk(ws_array_get(array, i));
+
+    while (array != NULL) {
+        ws_array_t *retired = array->retired;
+        free(array);
+        array = retired;
+    }
+
+    atomic_store_explicit(&d->array, NULL, memory_order_relaxed);
+}
+
+int ws_scheduler_init(ws_scheduler_t *s, size_t num_workers, size_t num_producers, chunk_queue_t *injector) {
+    s->num_workers = num_workers;
+    s->num_deques = num_workers + num_producers;
+    s->injector = injector;
+    atomic_init(&s->next_producer, num_workers);
+    atomic_init(&s->sleepers, 0);
+
+    s->deques = (ws_deque_t *)aligned_alloc(64, s->num_deques * sizeof(ws_deque_t));
+    if (s->deques == NULL) {
+        perror("ws_scheduler_init: Failed to allocate memory for deques");
+        return -1;
+    }
+
+    for (size_t i = 0; i < s->num_deques; i++) {
+        if (ws_deque_init(&s->deques[i], WS_DEQUE_INITIAL_CAPACITY) != 0) {
+            for (size_t j = 0; j < i; j++)
+                ws_deque_destroy(&s->deques[j]);
+
+            free(s->deques);
+            return -1;
+        }
+    }
+
+    if (pthread_mutex_init(&s->idle_lock, NULL) != 0 || pthread_cond_init(&s->idle_cond, NULL) != 0) {
+        perror("ws_scheduler_init: Failed to initialize idle synchronization");
+        for (size_t i = 0; i < s->num_deques; i++)
+            ws_deque_destroy(&s->deques[i]);
+
+        free(s->deques);
+        return -1;
+    }
+
+    return 0;
+}
+
+int ws_scheduler_register_producer(ws_scheduler_t *s) {
+    size_t index = atomic_fetch_add(&s->next_producer, 1);
+    return (index < s->num_deques)? (int)index: -1;
+}
+
+static void ws_scheduler_notify(ws_scheduler_t *s, size_t published) {
+    // Pairs with the fence in ws_scheduler_wait_for_work(): a parking worker either sees the new work
+    // or is seen here as a sleeper
+    atomic_thread_fence(memory_order_seq_cst);
+    if (published == 0 || atomic_load_explicit(&s->sleepers, memory_order_relaxed) == 0)
+        return;
+
+    pthread_mutex_lock(&s->idle_lock);
+    if (published == 1)
+        pthread_cond_signal(&s->idle_cond);
+    else
+        pthread_cond_broadcast(&s->idle_cond);
+    pthread_mutex_unlock(&s->idle_lock);
+}
+
+size_t ws_scheduler_push_local(ws_scheduler_t *s, size_t index, image_chunk_t **chunks, size_t n) {
+    size_t pushed = 0;
+
+    while (pushed < n && ws_deque_push(&s->deques[index], chunks[pushed]) == 0)
+        pushed++;
+
+    ws_scheduler_notify(s, pushed);
+    return pushed;
+}
+
+size_t ws_scheduler_inject(ws_scheduler_t *s, image_chunk_t **chunks, size_t n) {
+    size_t enqueued = chunk_enqueue_batch(s->injector, chunks, n);
+
+    ws_scheduler_notify(s, enqueued);
+    return enqueued;
+}
+
+static inline uint64_t ws_next_random(uint64_t *state) {
+    // xorshift64
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+image_chunk_t *ws_scheduler_find_work(ws_scheduler_t *s, size_t self, uint64_t *rng) {
+    image_chunk_t *chunk = ws_deque_take(&s->deques[self]);
+    if (chunk != NULL)
+        return chunk;
+
+    image_chunk_t *batch[WS_INJECT_BATCH];
+    size_t taken = chunk_dequeue_batch(s->injector, batch, WS_INJECT_BATCH, 0);
+
+    if (taken > 0) {
+        // Keep the first, expose the rest to thieves on the own deque
+        size_t rest = taken - 1;
+        size_t pushed = (rest > 0)? ws_scheduler_push_local(s, self, batch + 1, rest): 0;
+
+        // A deque that failed to grow leaves the tail with us: hand it back to the injection queue
+        if (pushed < rest) {
+            size_t returned = chunk_enqueue_batch(s->injector, batch + 1 + pushed, rest - pushed);
+
+            // Nowhere left to put the rest (shutdown or no memory): their images can no longer complete
+            for (size_t i = 1 + pushed + returned; i < taken; i++) {
+                LOG_ERROR_RATELIMITED(1000, "Error: No room to requeue chunk %d of %s.", batch[i]->chunk_id, batch[i]->original_image_name);
+                if (i == 1 + pushed + returned || batch[i]->ingest != batch[i - 1]->ingest)
+                    discard_image(batch[i]->original_image_name, batch[i]->route);
+                free_image_chunk(batch[i]);
+            }
+        }
+
+        return batch[0];
+    }
+
+    if (s->num_deques < 2)
+        return NULL;
+
+    // Random victims; retry while steals lose races, since the victim may still hold work
+    bool contended;
+    do {
+        contended = false;
+
+        size_t start = (size_t)(ws_next_random(rng) % s->num_deques);
+        for (size_t i = 0; i < s->num_deques; i++) {
+            size_t victim = (start + i) % s->num_deques;
+            if (victim == self)
+                continue;
+
+            chunk = ws_deque_steal(&s->deques[victim], &contended);
+            if (chunk != NULL)
+                return chunk;
+        }
+    } while (contended);
+
+    return NULL;
+}
+
+static bool ws_scheduler_has_work(ws_scheduler_t *s) {
+    if (chunk_queue_size(s->injector) > 0)
+        return true;
+
+    for (size_t i = 0; i < s->num_deques; i++) {
+        if (ws_deque_size(&s->deques[i]) > 0)
+            return true;
+    }
+
+    return false;
+}
+
+bool ws_scheduler_wait_for_work(ws_scheduler_t *s) {
+    pthread_mutex_lock(&s->idle_lock);
+
+    atomic_fetch_add_explicit(&s->sleepers, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    bool has_work = ws_scheduler_has_work(s);
+    bool keep_running = has_work || !stop_flag;
+
+    if (!has_work && !stop_flag)
+        pthread_cond_wait(&s->idle_cond, &s->idle_lock);
+
+    atomic_fetch_sub_explicit(&s->sleepers, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&s->idle_lock);
+
+    return keep_running;
+}
+
+void ws_scheduler_wake_all(ws_scheduler_t *s) {
+    pthread_mutex_lock(&s->idle_lock);
+    pthread_cond_broadcast(&s->idle_cond);
+    pthread_mutex_unlock(&s->idle_lock);
+}
+
+void ws_scheduler_destroy(ws_scheduler_t *s) {
+    if (s->deques == NULL)
+        return;
+
+    for (size_t i = 0; i < s->num_deques; i++)
+        ws_deque_destroy(&s->deques[i]);
+
+    free(s->deques);
+    s->deques = NULL;
+
+    pthread_mutex_destroy(&s->idle_lock);
+    pthread_cond_destroy(&s->idle_cond);
+}
@@ -1,10 +1,12 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 
 #include <assert.h>
+#include <pthread.h>
 #include "stb_image_write.h"
 #include "image.h"
 #include "image_unchunk.h"
 #include "image_chunker.h"
+#include "planar.h"
 
 const char *generate_suffix(const char **effects, int num_effects) {
     return "processed"; // simple for now
@@ -64,14 +66,16 @@ const char *result_path(const char *output_dir, const char *original_path, const
     return new_path;
 }
 
-static inline image_t create_empty_image(int width, int height, int channels) {
+static inline image_t create_empty_image(int width, int height, int channels, image_sample_t sample) {
     image_t image;
     image.width = width;
     image.height = height;
     image.channels = channels;
+    image.sample = sample;
 
-    image.pixel_data = (unsigned char *)malloc(width * height * channels);
-    memset(image.pixel_data, 0, width * height * channels);
+    size_t bytes = (size_t)width * height * channels * image_sample_bytes(sample);
+    image.pixel_data = (unsigned char *)malloc(bytes);
+    memset(image.pixel_data, 0, bytes);
 
     return image;
 }
@@ -80,12 +84,155 @@ static inline size_t convert_to_index(int x, int y, size_t width, size_t cell_si
     return (y * width + x) * cell_size;
 }
 
-static inline void write_image(image_t *image, const char *path) {
-    // write the image to a file
+static inline uint16_t float_to_u16(float v) {
+    return (v <= 0.0f)? 0: (v >= 1.0f)? 65535: (uint16_t)(v * 65535.0f + 0.5f);
+}
+
+// Sample `i` of a wide image at 16 bits
+static inline uint16_t sample_u16(const image_t *image, size_t i) {
+    if (image->sample == IMAGE_SAMPLE_F32)
+        return float_to_u16(((const float *)image->pixel_data)[i]);
+    return ((const uint16_t *)image->pixel_data)[i];
+}
+
+// Rounds wide samples to 8 bits for stbi_write_png()
+static unsigned char *narrow_to_bytes(const image_t *image) {
+    size_t count = image->width * image->height * image->channels;
+    unsigned char *bytes = (unsigned char *)malloc(count);
+
+    if (bytes == NULL)
+        return NULL;
+
+    for (size_t i = 0; i < count; i++)
+        bytes[i] = (unsigned char)((sample_u16(image, i) * 255u + 32767u) / 65535u);
+
+    return bytes;
+}
+
+/*
+    16-bit PNG: stb_image_write only emits 8-bit files, so the chunks are assembled here around its zlib
+    compressor. Samples are big-endian; every row gets the Sub filter, which suits smooth photographs.
+*/
+
+static uint32_t png_crc_table[256];
+static pthread_once_t png_crc_once = PTHREAD_ONCE_INIT;
+
+static void png_crc_init(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1)? 0xEDB88320u ^ (c >> 1): c >> 1;
+        png_crc_table[n] = c;
+    }
+}
+
+static inline void put_be32(unsigned char *out, uint32_t v) {
+    out[0] = (unsigned char)(v >> 24);
+    out[1] = (unsigned char)(v >> 16);
+    out[2] = (unsigned char)(v >> 8);
+    out[3] = (unsigned char)v;
+}
+
+static int write_png_chunk(FILE *file, const char *type, const unsigned char *data, size_t length) {
+    unsigned char header[8], trailer[4];
+    uint32_t crc = 0xFFFFFFFFu;
+
+    put_be32(header, (uint32_t)length);
+    memcpy(header + 4, type, 4);
+
+    for (size_t i = 4; i < 8; i++)
+        crc = png_crc_table[(crc ^ header[i]) & 0xFF] ^ (crc >> 8);
+    for (size_t i = 0; i < length; i++)
+        crc = png_crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    put_be32(trailer, ~crc);
+
+    if (fwrite(header, 1, 8, file) != 8 || (length > 0 && fwrite(data, 1, length, file) != length) ||
+        fwrite(trailer, 1, 4, file) != 4)
+        return -1;
+    return 0;
+}
+
+static int write_png16(const image_t *image, const char *path) {
+    static const unsigned char colour_types[] = { 0, 0, 4, 2, 6 };  // grey, grey+alpha, RGB, RGBA
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+    pthread_once(&png_crc_once, png_crc_init);
+
+    if (image->channels < 1 || image->channels > 4)
+        return -1;
+
+    size_t pixel_bytes = image->channels * 2;
+    size_t row_bytes = 1 + image->width * pixel_bytes;
+    unsigned char *filtered = (unsigned char *)malloc(row_bytes * image->height);
+    if (filtered == NULL)
+        return -1;
+
+    for (size_t y = 0; y < image->height; y++) {
+        unsigned char *row = filtered + y * row_bytes;
+        row[0] = 1;     // Sub: every byte minus the same byte of the previous pixel
+
+        unsigned char *bytes = row + 1;
+        size_t first = y * image->width * image->channels;
+        for (size_t i = 0; i < image->width * image->channels; i++) {
+            uint16_t v = sample_u16(image, first + i);
+            bytes[2 * i] = (unsigned char)(v >> 8);
+            bytes[2 * i + 1] = (unsigned char)v;
+        }
+
+        for (size_t i = image->width * pixel_bytes; i-- > pixel_bytes;)
+            bytes[i] = (unsigned char)(bytes[i] - bytes[i - pixel_bytes]);
+    }
+
+    int compressed_size = 0;
+    unsigned char *compressed = stbi_zlib_compress(filtered, (int)(row_bytes * image->height), &compressed_size, 8);
+    free(filtered);
+    if (compressed == NULL)
+        return -1;
+
+    unsigned char header[13];
+    put_be32(header, (uint32_t)image->width);
+    put_be32(header + 4, (uint32_t)image->height);
+    header[8] = 16;
+    header[9] = colour_types[image->channels];
+    header[10] = header[11] = header[12] = 0;   // deflate, adaptive filtering, no interlace
+
+    int status = -1;
+    FILE *file = fopen(path, "wb");
+
+    if (file != NULL) {
+        if (fwrite(signature, 1, sizeof(signature), file) == sizeof(signature) &&
+            write_png_chunk(file, "IHDR", header, sizeof(header)) == 0 &&
+            write_png_chunk(file, "IDAT", compressed, (size_t)compressed_size) == 0 &&
+            write_png_chunk(file, "IEND", NULL, 0) == 0)
+            status = 0;
+
+        if (fclose(file) != 0)
+            status = -1;
+    }
+
+    STBIW_FREE(compressed);
+    return status;
+}
+
+int write_image(image_t *image, const char *path, int bits) {
+    // write the image to a file; a failed write is reported to the caller rather than aborting the pipeline
     assert(image != NULL && path != NULL);
 
-    int result = stbi_write_png(path, image->width, image->height, image->channels, image->pixel_data, image->width * image->channels);
-    assert(result != 0);
+    if (image->sample != IMAGE_SAMPLE_U8 && bits == 16)
+        return write_png16(image, path);
+
+    if (image->sample == IMAGE_SAMPLE_U8) {
+        int result = stbi_write_png(path, image->width, image->height, image->channels, image->pixel_data, image->width * image->channels);
+        return (result != 0)? 0: -1;
+    }
+
+    unsigned char *bytes = narrow_to_bytes(image);
+    if (bytes == NULL)
+        return -1;
+
+    int result = stbi_write_png(path, image->width, image->height, image->channels, bytes, image->width * image->channels);
+    free(bytes);
+    return (result != 0)? 0: -1;
 }
 
 image_t image_from_chunks(image_chunk_t *chunks, int num_chunks) {
@@ -96,23 +243,31 @@ image_t image_from_chunks(image_chunk_t *chunks, int num_chunks) {
     int width = chunks[0].original_image_width;
     int height = chunks[0].original_image_height;
     int channels = chunks[0].channels;
-    image_t image = create_empty_image(width, height, channels);
+    image_t image = create_empty_image(width, height, channels, chunks[0].sample);
 
-    size_t cell_size = channels;
+    size_t cell_size = channels * image_sample_bytes(image.sample);
 
     // now, fill the image with the pixel data from the chunks
     for (int i = 0; i < num_chunks; ++i) {
         image_chunk_t *chunk = &chunks[i];
         assert(chunk->pixel_data != NULL);
 
-        for (int y = 0; y < chunk->height; ++y) {
-            for (int x = 0; x < chunk->width; ++x) {
+        if (chunk->layout == IMAGE_LAYOUT_PLANAR) {
+            unsigned char *planes[PLANAR_MAX_CHANNELS];
+            for (int c = 0; c < channels; c++)
+                planes[c] = image_chunk_plane(chunk, c);
 
-                size_t src_index = convert_to_index(x, y, chunk->width, cell_size);
-                size_t dst_index = convert_to_index(chunk->offset_x + x, chunk->offset_y + y, width, cell_size);
+            planar_interleave(planes, chunk->row_stride, channels, chunk->width, chunk->height,
+                              image.pixel_data + convert_to_index(chunk->offset_x, chunk->offset_y, width, cell_size),
+                              width * cell_size);
+            continue;
+        }
+
+        // One memcpy per chunk row; `row_stride` also covers chunks that are views into a larger buffer
+        for (int y = 0; y < chunk->height; ++y) {
+            size_t dst_index = convert_to_index(chunk->offset_x, chunk->offset_y + y, width, cell_size);
 
-                memcpy(image.pixel_data + dst_index, chunk->pixel_data + src_index, cell_size);
-            }
+            memcpy(image.pixel_data + dst_index, chunk->pixel_data + y * chunk->row_stride, chunk->width * cell_size);
         }
     }
 
@@ -7,6 +7,8 @@
 #include "image.h"
 
 image_t image_from_chunks(image_chunk_t *chunks, int num_chunks);
-void write_image(image_t *image, const char *path);
+const char *result_path(const char *output_dir, const char *original_path, const char *suffix);
+/** @brief Writes a PNG; wide samples become a 16-bit file when `bits` is 16 and are rounded to 8 bits otherwise. */
+int write_image(image_t *image, const char *path, int bits);
 void cleanup_chunks(image_chunk_t *chunks, int num_chunks);
 void cleanup_image(image_t *image);
\ No newline at end of file
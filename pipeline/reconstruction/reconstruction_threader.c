@@ -0,0 +1,441 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "reconstruction_threader.h"
+#include "image_unchunk.h"
+#include "image_chunker.h"
+#include "directory_monitor.h"
+#include "content_dedup.h"
+#include "planar.h"
+#include "log.h"
+
+/** @brief Maximum number of chunks a reconstruction worker takes from the queue at once. */
+#define RECONSTRUCTION_BATCH_SIZE 16
+
+extern volatile sig_atomic_t stop_flag;
+
+static struct {
+    reconstruction_worker_t *workers;
+    size_t num_workers;
+    struct {
+        const char *input_dir;
+        const char *output_dir;         // NULL: the route was never set
+    } routes[IMAGE_MAX_ROUTES];
+    int output_bits;                    // 8 or 16; only matters for wide samples
+
+    reconstruction_entry_t *images;     // uthash table of images in progress
+    pthread_mutex_t images_lock;        // protects `images` (not the pixel buffers)
+
+    _Atomic bool upstream_done;         // set once no more chunks can be enqueued
+} reconstruction = { NULL, 0, { { NULL, NULL } }, 16, NULL, PTHREAD_MUTEX_INITIALIZER, false };
+
+static void free_entry(reconstruction_entry_t *entry) {
+    if (entry->source != NULL)
+        image_buffer_release(entry->source);
+    else
+        free(entry->image.pixel_data);
+
+    free(entry->name);
+    free(entry);
+}
+
+static void release_entry(reconstruction_entry_t *entry) {
+    if (atomic_fetch_sub_explicit(&entry->refs, 1, memory_order_acq_rel) == 1)
+        free_entry(entry);
+}
+
+/*
+    Whether the chunk fits the image the entry assembles: the same decode, the same image geometry and sample
+    type, and bounds inside the destination buffer.
+*/
+static bool chunk_matches_entry(const reconstruction_entry_t *entry, const image_chunk_t *chunk) {
+    return chunk->original_image_num_chunks == entry->num_chunks &&
+           (size_t)chunk->original_image_width == entry->image.width &&
+           (size_t)chunk->original_image_height == entry->image.height &&
+           (uint32_t)chunk->channels == entry->image.channels &&
+           chunk->sample == entry->image.sample &&
+           chunk->source == entry->source &&
+           chunk->offset_x <= entry->image.width && chunk->width <= entry->image.width - chunk->offset_x &&
+           chunk->offset_y <= entry->image.height && chunk->height <= entry->image.height - chunk->offset_y;
+}
+
+typedef enum {
+    ENTRY_FOUND,        // `*entry` holds a reference for the caller
+    ENTRY_STALE,        // the chunk belongs to a superseded decode
+    ENTRY_MISMATCH,     // the chunk does not fit its own decode's image
+    ENTRY_FAILED        // allocation failure
+} entry_lookup_t;
+
+/*
+    Finds the entry of the chunk's image, creating it (and its destination buffer) for the first chunk, and
+    takes a reference to it. Chunks that are views need no buffer: the entry keeps the shared source alive and
+    writes it directly. An entry left behind by an older decode of the same file is unlinked here; the
+    threads still blitting into it keep it alive until they are done.
+*/
+static entry_lookup_t find_or_create_entry(const image_chunk_t *chunk, reconstruction_entry_t **found) {
+    reconstruction_entry_t *entry;
+
+    pthread_mutex_lock(&reconstruction.images_lock);
+    HASH_FIND_STR(reconstruction.images, chunk->original_image_name, entry);
+
+    if (entry != NULL && entry->ingest > chunk->ingest) {
+        pthread_mutex_unlock(&reconstruction.images_lock);
+        return ENTRY_STALE;
+    }
+
+    if (entry != NULL && entry->ingest < chunk->ingest) {
+        LOG_WARN("Reconstruction: Dropping %s from an abandoned decode (%d of %d chunks).",
+            entry->name, atomic_load(&entry->received), entry->num_chunks);
+        HASH_DEL(reconstruction.images, entry);
+        release_entry(entry);
+        entry = NULL;
+    }
+
+    if (entry == NULL) {
+        entry = (reconstruction_entry_t *)calloc(1, sizeof(reconstruction_entry_t));
+        if (entry == NULL) {
+            perror("find_or_create_entry: Failed to allocate memory for reconstruction entry");
+            pthread_mutex_unlock(&reconstruction.images_lock);
+            return ENTRY_FAILED;
+        }
+
+        entry->name = strdup(chunk->original_image_name);
+        entry->route = chunk->route;
+        entry->ingest = chunk->ingest;
+        entry->num_chunks = chunk->original_image_num_chunks;
+        entry->image.width = chunk->original_image_width;
+        entry->image.height = chunk->original_image_height;
+        entry->image.channels = chunk->channels;
+        entry->image.sample = chunk->sample;
+        atomic_init(&entry->received, 0);
+        atomic_init(&entry->refs, 1);
+
+        if (chunk->source != NULL) {
+            image_buffer_retain(chunk->source);
+            entry->source = chunk->source;
+            entry->image.pixel_data = chunk->source->pixels;
+        } else {
+            entry->image.pixel_data = (unsigned char *)malloc(entry->image.width * entry->image.height * entry->image.channels *
+                                                              image_sample_bytes(entry->image.sample));
+        }
+
+        if (entry->name == NULL || entry->image.pixel_data == NULL) {
+            perror("find_or_create_entry: Failed to allocate memory for reconstructed image");
+            free_entry(entry);
+            pthread_mutex_unlock(&reconstruction.images_lock);
+            return ENTRY_FAILED;
+        }
+
+        HASH_ADD_KEYPTR(hh, reconstruction.images, entry->name, strlen(entry->name), entry);
+    }
+
+    if (!chunk_matches_entry(entry, chunk)) {
+        pthread_mutex_unlock(&reconstruction.images_lock);
+        return ENTRY_MISMATCH;
+    }
+
+    atomic_fetch_add_explicit(&entry->refs, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&reconstruction.images_lock);
+
+    *found = entry;
+    return ENTRY_FOUND;
+}
+
+static void blit_chunk(reconstruction_entry_t *entry, const image_chunk_t *chunk) {
+    // Views were filtered in place inside the very buffer we are about to write
+    if (entry->source != NULL)
+        return;
+
+    size_t cell_size = entry->image.channels * image_sample_bytes(entry->image.sample);
+    size_t dst_stride = entry->image.width * cell_size;
+    unsigned char *dst = entry->image.pixel_data + chunk->offset_y * dst_stride + chunk->offset_x * cell_size;
+
+    if (chunk->layout == IMAGE_LAYOUT_PLANAR) {
+        unsigned char *planes[PLANAR_MAX_CHANNELS];
+        for (int c = 0; c < chunk->channels; c++)
+            planes[c] = image_chunk_plane(chunk, c);
+
+        planar_interleave(planes, chunk->row_stride, chunk->channels, chunk->width, chunk->height, dst, dst_stride);
+        return;
+    }
+
+    // Full-width strips are contiguous on both sides
+    if (chunk->row_stride == dst_stride && chunk->width == entry->image.width) {
+        memcpy(dst, chunk->pixel_data, chunk->height * dst_stride);
+        return;
+    }
+
+    for (size_t y = 0; y < chunk->height; y++)
+        memcpy(dst + y * dst_stride, chunk->pixel_data + y * chunk->row_stride, chunk->width * cell_size);
+}
+
+/*
+    Output directory of an image: its route's output directory, plus the subdirectories between the input root
+    and the image (created here). NULL on allocation failure or for a route that was never set.
+*/
+static char *output_dir_for(const char *name, int route) {
+    if (route < 0 || route >= IMAGE_MAX_ROUTES)
+        return NULL;
+
+    const char *input_dir = reconstruction.routes[route].input_dir;
+    const char *output_dir = reconstruction.routes[route].output_dir;
+    const char *relative = "";
+    size_t root_length = (input_dir != NULL)? strlen(input_dir): 0;
+
+    if (input_dir != NULL && strncmp(name, input_dir, root_length) == 0 && name[root_length] == '/')
+        relative = name + root_length + 1;
+
+    if (output_dir == NULL)
+        return NULL;
+
+    const char *last_slash = strrchr(relative, '/');
+    int subdir_length = (last_slash != NULL)? (int)(last_slash - relative): 0;
+
+    char *dir = (char *)malloc(strlen(output_dir) + subdir_length + 2);
+    if (dir == NULL)
+        return NULL;
+
+    if (subdir_length == 0) {
+        strcpy(dir, output_dir);
+        return dir;
+    }
+
+    sprintf(dir, "%s/%.*s", output_dir, subdir_length, relative);
+
+    // mkdir -p below the output directory; other workers may be creating the same ones
+    for (char *p = dir + strlen(output_dir) + 1; ; p++) {
+        if (*p == '/' || *p == '\0') {
+            char end = *p;
+            *p = '\0';
+            if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+                LOG_ERROR("Reconstruction: Failed to create %s: %s", dir, strerror(errno));
+            *p = end;
+            if (end == '\0')
+                break;
+        }
+    }
+
+    return dir;
+}
+
+char *reconstruction_output_path(const char *name, int route) {
+    char *dir = output_dir_for(name, route);
+    char *path = (dir != NULL)? (char *)result_path(dir, name, "processed.png"): NULL;
+    free(dir);
+    return path;
+}
+
+/*
+    Written under a temporary name and renamed into place: readers of the output directory never see half a
+    PNG, and an output rewritten later gets a new inode instead of changing the earlier image's hard links.
+*/
+static int write_output(image_t *image, const char *path) {
+    char *tmp_path = malloc(strlen(path) + 5);
+    if (tmp_path == NULL)
+        return -1;
+    sprintf(tmp_path, "%s.tmp", path);
+
+    int status = write_image(image, tmp_path, reconstruction.output_bits);
+    if (status == 0 && rename(tmp_path, path) != 0) {
+        LOG_ERROR("Reconstruction: Failed to rename %s: %s", tmp_path, strerror(errno));
+        status = -1;
+    }
+    if (status != 0)
+        unlink(tmp_path);
+
+    free(tmp_path);
+    return status;
+}
+
+static void finish_image(reconstruction_worker_t *worker, reconstruction_entry_t *entry) {
+    reconstruction_entry_t *current;
+
+    pthread_mutex_lock(&reconstruction.images_lock);
+    HASH_FIND_STR(reconstruction.images, entry->name, current);
+    if (current == entry)
+        HASH_DEL(reconstruction.images, entry);
+    pthread_mutex_unlock(&reconstruction.images_lock);
+
+    // A newer decode of the file replaced the entry while its last chunks were in flight: that one is written
+    if (current != entry)
+        return;
+
+    char *path = reconstruction_output_path(entry->name, entry->route);
+
+    if (path == NULL || write_output(&entry->image, path) != 0) {
+        LOG_ERROR("Reconstruction: Failed to write %s.", (path != NULL)? path: entry->name);
+        discard_image(entry->name, entry->route);
+    } else {
+        LOG_INFO("Reconstruction: Wrote %s (%d chunks).", path, entry->num_chunks);
+        dedup_complete(entry->name, path);
+        directory_monitor_commit(entry->name, entry->route);
+        worker->images_written++;
+    }
+
+    free(path);
+    release_entry(entry);
+}
+
+static void assemble_chunk(reconstruction_worker_t *worker, image_chunk_t *chunk) {
+    reconstruction_entry_t *entry = NULL;
+
+    switch (find_or_create_entry(chunk, &entry)) {
+    case ENTRY_FOUND:
+        break;
+    case ENTRY_STALE:
+        // Its decode was discarded already; the file has been queued again since
+        LOG_DEBUG("Reconstruction: Dropping chunk %d of an abandoned decode of %s.", chunk->chunk_id, chunk->original_image_name);
+        free_image_chunk(chunk);
+        return;
+    case ENTRY_MISMATCH:
+        LOG_ERROR("Reconstruction: Chunk %d of %s does not match its image's geometry.", chunk->chunk_id, chunk->original_image_name);
+        /* fall through */
+    case ENTRY_FAILED:
+        discard_image(chunk->original_image_name, chunk->route);
+        free_image_chunk(chunk);
+        return;
+    }
+
+    blit_chunk(entry, chunk);
+    free_image_chunk(chunk);
+    worker->chunks_assembled++;
+
+    // acq_rel: the thread that sees the last increment also sees every other thread's blit
+    if (atomic_fetch_add_explicit(&entry->received, 1, memory_order_acq_rel) + 1 == entry->num_chunks)
+        finish_image(worker, entry);
+
+    release_entry(entry);
+}
+
+static void *reconstruction_worker_thread(void *arg) {
+    reconstruction_worker_t *worker = (reconstruction_worker_t *)arg;
+    image_chunk_t *batch[RECONSTRUCTION_BATCH_SIZE];
+
+    while (1) {
+        size_t taken = chunk_dequeue_batch(&filtering_reconstruction_queue, batch, RECONSTRUCTION_BATCH_SIZE, -1);
+
+        if (taken == 0) {
+            if (!stop_flag)
+                continue;
+
+            if (atomic_load(&reconstruction.upstream_done))
+                break;
+
+            // Shutting down, but the filters are still draining into the queue: poll until they are joined
+            struct timespec delay = { 0, 1000000L };
+            nanosleep(&delay, NULL);
+            continue;
+        }
+
+        for (size_t i = 0; i < taken; i++)
+            assemble_chunk(worker, batch[i]);
+    }
+
+    return NULL;
+}
+
+void reconstruction_set_output_bits(int bits) {
+    reconstruction.output_bits = (bits == 8)? 8: 16;
+}
+
+int reconstruction_set_route(int route, const char *input_dir, const char *output_dir) {
+    if (route < 0 || route >= IMAGE_MAX_ROUTES || output_dir == NULL)
+        return -1;
+
+    if (mkdir(output_dir, 0755) != 0 && errno != EEXIST) {
+        perror("reconstruction_set_route: Failed to create output directory");
+        return -1;
+    }
+
+    reconstruction.routes[route].input_dir = input_dir;
+    reconstruction.routes[route].output_dir = output_dir;
+    return 0;
+}
+
+int reconstruction_start(size_t num_workers) {
+    if (num_workers == 0 || reconstruction.workers != NULL)
+        return -1;
+
+    atomic_store(&reconstruction.upstream_done, false);
+
+    reconstruction.workers = (reconstruction_worker_t *)calloc(num_workers, sizeof(reconstruction_worker_t));
+    if (reconstruction.workers == NULL) {
+        perror("reconstruction_start: Failed to allocate memory for reconstruction workers");
+        return -1;
+    }
+
+    for (size_t i = 0; i < num_workers; i++) {
+        reconstruction_worker_t *worker = &reconstruction.workers[i];
+        worker->index = i;
+
+        if (pthread_create(&worker->thread, NULL, reconstruction_worker_thread, worker) != 0) {
+            perror("reconstruction_start: Failed to create a reconstruction worker thread");
+
+            stop_flag = 1;
+            reconstruction.num_workers = i;
+            reconstruction_stop();
+            reconstruction_destroy();
+            return -1;
+        }
+
+        reconstruction.num_workers = i + 1;
+    }
+
+    return 0;
+}
+
+void reconstruction_stop(void) {
+    if (reconstruction.workers == NULL)
+        return;
+
+    atomic_store(&reconstruction.upstream_done, true);
+    chunk_queue_wake_all(&filtering_reconstruction_queue);
+
+    for (size_t i = 0; i < reconstruction.num_workers; i++)
+        pthread_join(reconstruction.workers[i].thread, NULL);
+}
+
+void reconstruction_report(void) {
+    if (reconstruction.workers == NULL)
+        return;
+
+    uint64_t total_chunks = 0, total_images = 0;
+
+    printf("Reconstruction report (%zu workers):\n", reconstruction.num_workers);
+    for (size_t i = 0; i < reconstruction.num_workers; i++) {
+        const reconstruction_worker_t *worker = &reconstruction.workers[i];
+
+        printf("  worker %zu: %llu chunks, %llu images written\n", worker->index,
+            (unsigned long long)worker->chunks_assembled, (unsigned long long)worker->images_written);
+
+        total_chunks += worker->chunks_assembled;
+        total_images += worker->images_written;
+    }
+
+    printf("  total: %llu chunks, %llu images written, %u incomplete\n", (unsigned long long)total_chunks,
+        (unsigned long long)total_images, HASH_COUNT(reconstruction.images));
+}
+
+void reconstruction_destroy(void) {
+    reconstruction_entry_t *entry, *tmp;
+
+    pthread_mutex_lock(&reconstruction.images_lock);
+    HASH_ITER(hh, reconstruction.images, entry, tmp) {
+        LOG_WARN("Reconstruction: %s incomplete at shutdown (%d of %d chunks).",
+            entry->name, atomic_load(&entry->received), entry->num_chunks);
+
+        HASH_DEL(reconstruction.images, entry);
+        release_entry(entry);
+    }
+    pthread_mutex_unlock(&reconstruction.images_lock);
+
+    free(reconstruction.workers);
+    reconstruction.workers = NULL;
+    reconstruction.num_workers = 0;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "image.h"
+#include "uthash.h"
+
+/**
+ * @brief An image being assembled from its filtered chunks.
+ *
+ * Created when the first chunk of an image arrives. Chunks are blitted into
+ * `image` as they come in; the thread that delivers the last one removes the
+ * entry from the table and writes the image out.
+ *
+ * An entry belongs to one decode of its file (`ingest`). When the file is
+ * queued again after an abandoned decode, the first chunk of the new decode
+ * replaces the stale entry; chunks of the older decode are dropped from then on.
+ */
+typedef struct {
+    char *name;                 /**< Source image path (hash key). */
+    int route;                  /**< Input root of the image: where it is written. */
+    image_t image;              /**< Destination buffer (points into `source` for views). */
+    image_buffer_t *source;     /**< Shared buffer when the chunks are views; nothing to blit then. */
+    uint64_t ingest;            /**< Decode the entry is assembling (see image_chunk_t). */
+    int num_chunks;             /**< Chunks the image was split into. */
+    _Atomic int received;       /**< Chunks blitted so far. */
+    _Atomic int refs;           /**< The table's reference plus one per chunk being blitted; freed at zero. */
+    UT_hash_handle hh;          /**< uthash handle, keyed by `name`. */
+} reconstruction_entry_t;
+
+/**
+ * @brief Bookkeeping for a single reconstruction worker thread.
+ */
+typedef struct {
+    pthread_t thread;           /**< Handle of the worker thread. */
+    size_t index;               /**< Position of this worker in the stage. */
+    uint64_t chunks_assembled;  /**< Chunks blitted (or accepted as views). */
+    uint64_t images_written;    /**< Images this worker completed and wrote. */
+} reconstruction_worker_t;
+
+/**
+ * @brief Sets where the images of a route are written.
+ *
+ * An image found at `input_dir`/a/b/x.jpg is written to
+ * `output_dir`/a/b/x.jpg_processed.png: subdirectories of the input root are
+ * mirrored (and created as needed). Must be called before `reconstruction_start()`.
+ *
+ * @param input_dir The route's input root, without a trailing slash.
+ * @param output_dir Directory the finished images are written to; created if missing.
+ *        Both strings must outlive the stage.
+ * @return 0 on success, -1 if the route is out of range or the directory cannot be created.
+ */
+int reconstruction_set_route(int route, const char *input_dir, const char *output_dir);
+
+/**
+ * @brief Path an image is (or would be) written to, per its route (see
+ *        `reconstruction_set_route()`); the subdirectories leading to it are created.
+ *
+ * @param name The image's input path, as queued.
+ * @return A malloc'd path, or NULL for an unset route or on allocation failure.
+ */
+char *reconstruction_output_path(const char *name, int route);
+
+/**
+ * @brief Starts the reconstruction stage draining `filtering_reconstruction_queue`.
+ *
+ * @param num_workers Number of worker threads (must be > 0).
+ * @return 0 on success, -1 on failure (workers already started are stopped and joined).
+ */
+int reconstruction_start(size_t num_workers);
+
+/**
+ * @brief Bits per sample of the PNGs written for images with wide samples (8 or 16, default 16).
+ *
+ * 8-bit images are always written with 8 bits. Must be called before `reconstruction_start()`.
+ */
+void reconstruction_set_output_bits(int bits);
+
+/**
+ * @brief Lets the workers finish the queue and joins them.
+ *
+ * Call after `stop_flag` is set and the filter stage has been joined, so no
+ * more chunks can arrive. Safe to call if the stage was never started.
+ */
+void reconstruction_stop(void);
+
+/**
+ * @brief Prints per-worker chunk and image counts. Call after `reconstruction_stop()`.
+ */
+void reconstruction_report(void);
+
+/**
+ * @brief Frees the worker slots and every image that never received all its chunks.
+ */
+void reconstruction_destroy(void);
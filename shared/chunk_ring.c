@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "chunk_ring.h"
+
+_Static_assert(sizeof(chunk_ring_cell_t) == CHUNK_RING_CACHE_LINE, "ring cells must fill exactly one cache line");
+
+chunk_ring_t *chunk_ring_create(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+
+    chunk_ring_t *ring = (chunk_ring_t *)aligned_alloc(CHUNK_RING_CACHE_LINE, sizeof(chunk_ring_t));
+    if (ring == NULL) {
+        perror("chunk_ring_create: Failed to allocate memory for ring");
+        return NULL;
+    }
+
+    ring->cells = (chunk_ring_cell_t *)aligned_alloc(CHUNK_RING_CACHE_LINE, size * sizeof(chunk_ring_cell_t));
+    if (ring->cells == NULL) {
+        perror("chunk_ring_create: Failed to allocate memory for ring cells");
+        free(ring);
+        return NULL;
+    }
+
+    // Slot i is initially free for the producer that claims position i
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&ring->cells[i].sequence, i);
+        ring->cells[i].chunk = NULL;
+    }
+
+    ring->mask = size - 1;
+    atomic_init(&ring->enqueue_pos, 0);
+    atomic_init(&ring->dequeue_pos, 0);
+    atomic_init(&ring->sleeping_consumers, 0);
+    atomic_init(&ring->sleeping_producers, 0);
+
+    return ring;
+}
+
+bool chunk_ring_try_push(chunk_ring_t *ring, image_chunk_t *chunk) {
+    chunk_ring_cell_t *cell;
+    size_t pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+
+    while (1) {
+        cell = &ring->cells[pos & ring->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            // Slot is free for this lap; claim the position
+            if (atomic_compare_exchange_weak_explicit(&ring->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+
+        else if (diff < 0)
+            return false;   // The consumer of the previous lap has not released this slot: full
+
+        else
+            pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+    }
+
+    cell->chunk = chunk;
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+
+    return true;
+}
+
+image_chunk_t *chunk_ring_try_pop(chunk_ring_t *ring) {
+    chunk_ring_cell_t *cell;
+    size_t pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+
+    while (1) {
+        cell = &ring->cells[pos & ring->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+
+        else if (diff < 0)
+            return NULL;    // Nothing published at this position yet: empty
+
+        else
+            pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+    }
+
+    image_chunk_t *chunk = cell->chunk;
+
+    // Hand the slot to the producer of the next lap
+    atomic_store_explicit(&cell->sequence, pos + ring->mask + 1, memory_order_release);
+
+    return chunk;
+}
+
+size_t chunk_ring_size(chunk_ring_t *ring) {
+    size_t tail = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+
+    return (tail > head)? tail - head: 0;
+}
+
+void chunk_ring_destroy(chunk_ring_t *ring) {
+    if (ring == NULL)
+        return;
+
+    free(ring->cells);
+    free(ring);
+}
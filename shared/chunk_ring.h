@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "image.h"
+
+/** @brief Assumed size of a cache line; used to keep hot atomics on separate lines. */
+#define CHUNK_RING_CACHE_LINE 64
+
+/**
+ * @brief A slot of the ring. `sequence` tells producers and consumers whose turn it is.
+ *
+ * Padded to a full cache line so neighbouring producers/consumers do not false-share.
+ */
+typedef struct {
+    _Atomic size_t sequence;    /**< Slot ticket, see Vyukov's bounded MPMC queue. */
+    image_chunk_t *chunk;       /**< Payload, valid while the slot is published. */
+    char pad[CHUNK_RING_CACHE_LINE - sizeof(size_t) - sizeof(image_chunk_t *)];
+} chunk_ring_cell_t;
+
+/**
+ * @brief Fixed-capacity, lock-free multi-producer/multi-consumer ring of chunk pointers.
+ *
+ * Producers and consumers each claim a position with a CAS on their own counter,
+ * then hand the slot over through the slot's sequence number. No locks are taken
+ * on the fast path; the owning chunk_queue_t only falls back to its condition
+ * variables when the ring is empty (or full) and a caller asked to wait.
+ */
+typedef struct chunk_ring {
+    _Alignas(CHUNK_RING_CACHE_LINE) _Atomic size_t enqueue_pos;   /**< Next position producers claim. */
+    _Alignas(CHUNK_RING_CACHE_LINE) _Atomic size_t dequeue_pos;   /**< Next position consumers claim. */
+    _Alignas(CHUNK_RING_CACHE_LINE) _Atomic size_t sleeping_consumers; /**< Consumers parked on cond_not_empty. */
+    _Alignas(CHUNK_RING_CACHE_LINE) _Atomic size_t sleeping_producers; /**< Producers parked on cond_not_full. */
+    _Alignas(CHUNK_RING_CACHE_LINE) chunk_ring_cell_t *cells;     /**< `mask + 1` slots. */
+    size_t mask;                                                  /**< Capacity - 1 (capacity is a power of two). */
+} chunk_ring_t;
+
+/**
+ * @brief Allocates a ring able to hold at least `capacity` chunks.
+ *
+ * @param capacity Requested capacity, rounded up to the next power of two (minimum 2).
+ * @return The new ring, or NULL on allocation failure.
+ */
+chunk_ring_t *chunk_ring_create(size_t capacity);
+
+/**
+ * @brief Publishes a chunk without blocking.
+ *
+ * @return true on success, false if the ring is full.
+ */
+bool chunk_ring_try_push(chunk_ring_t *ring, image_chunk_t *chunk);
+
+/**
+ * @brief Takes the oldest chunk without blocking.
+ *
+ * @return The chunk, or NULL if the ring is empty.
+ */
+image_chunk_t *chunk_ring_try_pop(chunk_ring_t *ring);
+
+/**
+ * @brief Approximate number of queued chunks (exact when no operation is in progress).
+ */
+size_t chunk_ring_size(chunk_ring_t *ring);
+
+/**
+ * @brief Frees the ring. Chunks still stored in it are NOT freed; drain it first.
+ */
+void chunk_ring_destroy(chunk_ring_t *ring);
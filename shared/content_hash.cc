@@ -0,0 +1,13 @@
+#include <city.h>
+
+#include <content_hash.h>
+
+content_hash_t content_hash(const void *data, size_t length) {
+    uint128 hash = CityHash128(static_cast<const char *>(data), length);
+    content_hash_t result = { Uint128Low64(hash), Uint128High64(hash) };
+    return result;
+}
+
+uint64_t content_hash64(const void *data, size_t length) {
+    return CityHash64(static_cast<const char *>(data), length);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * C interface to CityHash (C++, fetched by the build). Used to recognise
+ * input files whose bytes were seen before; not a cryptographic hash.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief A 128-bit CityHash value. */
+typedef struct {
+    uint64_t low;
+    uint64_t high;
+} content_hash_t;
+
+/**
+ * @brief CityHash128 of `length` bytes.
+ */
+content_hash_t content_hash(const void *data, size_t length);
+
+/**
+ * @brief CityHash64 of `length` bytes.
+ */
+uint64_t content_hash64(const void *data, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
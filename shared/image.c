@@ -4,23 +4,88 @@
 #include<image.h>
 #include<stdio.h>
 #include<errno.h> 
+#include<string.h>
+#include<time.h>
+#include<assert.h>
+#include<chunk_ring.h>
+#include<log.h>
+
+/** @brief Number of non-blocking retries on an empty/full ring before parking on the condition variable. */
+#define CHUNK_RING_SPIN_LIMIT 32
 
 extern volatile sig_atomic_t stop_flag;
 
+typedef enum {
+    QUEUE_WAIT_BLOCK,   /**< Wait until the operation can complete or stop_flag is raised. */
+    QUEUE_WAIT_TIMED,   /**< Wait at most until the deadline. */
+    QUEUE_WAIT_NONE,    /**< Fail immediately if the operation cannot complete. */
+} queue_wait_mode_t;
+
+static int init_monotonic_cond(pthread_cond_t *cond) {
+    pthread_condattr_t attr;
+    if (pthread_condattr_init(&attr) != 0)
+        return -1;
+
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    int result = pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    return result;
+}
+
+static void deadline_after_ms(struct timespec *deadline, long timeout_ms) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += timeout_ms / 1000;
+    deadline->tv_nsec += (timeout_ms % 1000) * 1000000L;
+
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec += 1;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+static inline bool chunk_queue_has_room(const chunk_queue_t *q, size_t bytes) {
+    if (q->max_items != 0 && q->count >= q->max_items)
+        return false;
+
+    // An oversized chunk is let through when the queue is empty, otherwise it would block forever
+    if (q->max_bytes != 0 && q->count > 0 && q->bytes + bytes > q->max_bytes)
+        return false;
+
+    return true;
+}
+
 int chunk_queue_init(chunk_queue_t* q) {
+    return chunk_queue_init_bounded(q, 0, 0);
+}
+
+int chunk_queue_init_bounded(chunk_queue_t* q, size_t max_items, size_t max_bytes) {
     if (q == NULL) 
         return EINVAL; 
 
+    q->backend = CHUNK_QUEUE_LIST;
+    q->ring = NULL;
     q->head = NULL;
     q->tail = NULL;
+    q->count = 0;
+    q->bytes = 0;
+    q->max_items = max_items;
+    q->max_bytes = max_bytes;
 
     if (pthread_mutex_init(&q->lock, NULL) != 0) {
         perror("chunk_queue_init: Failed to initialize mutex");
         return -1;
     }
 
-    if (pthread_cond_init(&q->cond_not_empty, NULL) != 0) {
+    if (init_monotonic_cond(&q->cond_not_empty) != 0) {
+        perror("chunk_queue_init: Failed to initialize condition variable");
+        pthread_mutex_destroy(&q->lock); 
+        return -1;
+    }
+
+    if (init_monotonic_cond(&q->cond_not_full) != 0) {
         perror("chunk_queue_init: Failed to initialize condition variable");
+        pthread_cond_destroy(&q->cond_not_empty);
         pthread_mutex_destroy(&q->lock); 
         return -1;
     }
@@ -28,10 +93,139 @@ int chunk_queue_init(chunk_queue_t* q) {
     return 0;
 }
 
-int chunk_enqueue(chunk_queue_t* q, image_chunk_t* c) {
+int chunk_queue_init_ring(chunk_queue_t* q, size_t capacity) {
+    if (q == NULL || capacity == 0) 
+        return EINVAL; 
+
+    if (chunk_queue_init_bounded(q, 0, 0) != 0)
+        return -1;
+
+    q->ring = chunk_ring_create(capacity);
+    if (q->ring == NULL) {
+        pthread_mutex_destroy(&q->lock);
+        pthread_cond_destroy(&q->cond_not_empty);
+        pthread_cond_destroy(&q->cond_not_full);
+        return -1;
+    }
+
+    q->backend = CHUNK_QUEUE_RING;
+    q->max_items = q->ring->mask + 1;
+
+    return 0;
+}
+
+static inline void chunk_ring_wake(chunk_queue_t* q, _Atomic size_t *sleepers, pthread_cond_t *cond) {
+    // Pairs with the fence in chunk_ring_park(): either the sleeper sees our update, or we see the sleeper
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(sleepers, memory_order_relaxed) == 0)
+        return;
+
+    pthread_mutex_lock(&q->lock);
+    pthread_cond_signal(cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static inline void chunk_ring_park(_Atomic size_t *sleepers) {
+    atomic_fetch_add_explicit(sleepers, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+static int chunk_ring_enqueue(chunk_queue_t* q, image_chunk_t* c, queue_wait_mode_t mode, long timeout_ms) {
+    chunk_ring_t *ring = q->ring;
+    int status = 0;
+
+    for (int spin = 0; spin < CHUNK_RING_SPIN_LIMIT; spin++) {
+        if (chunk_ring_try_push(ring, c))
+            goto published;
+
+        if (mode == QUEUE_WAIT_NONE)
+            return EAGAIN;
+    }
+
+    struct timespec deadline;
+    if (mode == QUEUE_WAIT_TIMED)
+        deadline_after_ms(&deadline, timeout_ms);
+
+    pthread_mutex_lock(&q->lock);
+    chunk_ring_park(&ring->sleeping_producers);
+
+    while (!chunk_ring_try_push(ring, c)) {
+        if (stop_flag) {
+            status = ECANCELED;
+            break;
+        }
+
+        if (mode == QUEUE_WAIT_TIMED) {
+            if (pthread_cond_timedwait(&q->cond_not_full, &q->lock, &deadline) == ETIMEDOUT) {
+                status = chunk_ring_try_push(ring, c)? 0: ETIMEDOUT;
+                break;
+            }
+        }
+
+        else
+            pthread_cond_wait(&q->cond_not_full, &q->lock);
+    }
+
+    atomic_fetch_sub_explicit(&ring->sleeping_producers, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&q->lock);
+
+    if (status != 0)
+        return status;
+
+published:
+    chunk_ring_wake(q, &ring->sleeping_consumers, &q->cond_not_empty);
+    return 0;
+}
+
+static image_chunk_t* chunk_ring_dequeue(chunk_queue_t* q, queue_wait_mode_t mode, long timeout_ms) {
+    chunk_ring_t *ring = q->ring;
+    image_chunk_t *chunk = NULL;
+
+    for (int spin = 0; spin < CHUNK_RING_SPIN_LIMIT; spin++) {
+        if ((chunk = chunk_ring_try_pop(ring)) != NULL)
+            goto taken;
+
+        if (mode == QUEUE_WAIT_NONE)
+            return NULL;
+    }
+
+    struct timespec deadline;
+    if (mode == QUEUE_WAIT_TIMED)
+        deadline_after_ms(&deadline, timeout_ms);
+
+    pthread_mutex_lock(&q->lock);
+    chunk_ring_park(&ring->sleeping_consumers);
+
+    while ((chunk = chunk_ring_try_pop(ring)) == NULL && !stop_flag) {
+        if (mode == QUEUE_WAIT_TIMED) {
+            if (pthread_cond_timedwait(&q->cond_not_empty, &q->lock, &deadline) == ETIMEDOUT) {
+                chunk = chunk_ring_try_pop(ring);
+                break;
+            }
+        }
+
+        else
+            pthread_cond_wait(&q->cond_not_empty, &q->lock);
+    }
+
+    atomic_fetch_sub_explicit(&ring->sleeping_consumers, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&q->lock);
+
+    if (chunk == NULL)
+        return NULL;
+
+taken:
+    chunk_ring_wake(q, &ring->sleeping_producers, &q->cond_not_full);
+    return chunk;
+}
+
+static int chunk_enqueue_internal(chunk_queue_t* q, image_chunk_t* c, queue_wait_mode_t mode, long timeout_ms) {
     if (q == NULL || c == NULL) 
         return EINVAL;
 
+    if (q->backend == CHUNK_QUEUE_RING)
+        return chunk_ring_enqueue(q, c, mode, timeout_ms);
+
     chunk_queue_node_t *new_node = (chunk_queue_node_t*)malloc(sizeof(chunk_queue_node_t));
     if (new_node == NULL) {
         perror("chunk_enqueue: Failed to allocate memory for new queue node");
@@ -41,11 +235,37 @@ int chunk_enqueue(chunk_queue_t* q, image_chunk_t* c) {
     new_node->next = NULL;
     new_node->chunk = c; 
 
+    struct timespec deadline;
+    if (mode == QUEUE_WAIT_TIMED)
+        deadline_after_ms(&deadline, timeout_ms);
+
     pthread_mutex_lock(&q->lock);
 
+    while (!chunk_queue_has_room(q, c->data_size_bytes)) {
+        int status = 0;
+
+        if (mode == QUEUE_WAIT_NONE)
+            status = EAGAIN;
+        else if (stop_flag)
+            status = ECANCELED;
+        else if (mode == QUEUE_WAIT_TIMED)
+            status = pthread_cond_timedwait(&q->cond_not_full, &q->lock, &deadline);
+        else
+            pthread_cond_wait(&q->cond_not_full, &q->lock);
+
+        if (status == ETIMEDOUT && chunk_queue_has_room(q, c->data_size_bytes))
+            break;
+
+        if (status != 0) {
+            pthread_mutex_unlock(&q->lock);
+            free(new_node);
+            return status;
+        }
+    }
+
     if (q->tail == NULL) { 
         if (q->head != NULL) {
-            fprintf(stderr, "chunk_enqueue: Queue inconsistency detected (tail is NULL, head is not)\n");
+            LOG_ERROR("chunk_enqueue: Queue inconsistency detected (tail is NULL, head is not)");
             pthread_mutex_unlock(&q->lock);
             free(new_node);
             return -1; 
@@ -60,25 +280,55 @@ int chunk_enqueue(chunk_queue_t* q, image_chunk_t* c) {
         q->tail = new_node;
     }
 
+    q->count++;
+    q->bytes += c->data_size_bytes;
+
     pthread_cond_signal(&q->cond_not_empty);
     pthread_mutex_unlock(&q->lock);
 
-    printf("Chunk enqueued successfully (ID: %d)\n", c->chunk_id); 
+    LOG_TRACE("Chunk enqueued successfully (ID: %d)", c->chunk_id);
 
     return 0;
 }
 
-image_chunk_t* chunk_dequeue(chunk_queue_t* q) {
+int chunk_enqueue(chunk_queue_t* q, image_chunk_t* c) {
+    return chunk_enqueue_internal(q, c, QUEUE_WAIT_BLOCK, 0);
+}
+
+int chunk_enqueue_timed(chunk_queue_t* q, image_chunk_t* c, long timeout_ms) {
+    return chunk_enqueue_internal(q, c, QUEUE_WAIT_TIMED, timeout_ms);
+}
+
+int chunk_try_enqueue(chunk_queue_t* q, image_chunk_t* c) {
+    return chunk_enqueue_internal(q, c, QUEUE_WAIT_NONE, 0);
+}
+
+static image_chunk_t* chunk_dequeue_internal(chunk_queue_t* q, queue_wait_mode_t mode, long timeout_ms) {
     if (q == NULL) 
         return NULL;
 
+    if (q->backend == CHUNK_QUEUE_RING)
+        return chunk_ring_dequeue(q, mode, timeout_ms);
+
+    struct timespec deadline;
+    if (mode == QUEUE_WAIT_TIMED)
+        deadline_after_ms(&deadline, timeout_ms);
+
     pthread_mutex_lock(&q->lock);
-    while (q->head == NULL && !stop_flag) 
-        pthread_cond_wait(&q->cond_not_empty, &q->lock);
+    while (q->head == NULL && !stop_flag && mode != QUEUE_WAIT_NONE) {
+        if (mode == QUEUE_WAIT_TIMED) {
+            if (pthread_cond_timedwait(&q->cond_not_empty, &q->lock, &deadline) == ETIMEDOUT)
+                break;
+        }
+
+        else
+            pthread_cond_wait(&q->cond_not_empty, &q->lock);
+    }
 
-    if (stop_flag && q->head == NULL) {
+    if (q->head == NULL) {
         pthread_mutex_unlock(&q->lock);
-        printf("chunk_dequeue: Stop flag detected, returning NULL.\n"); 
+        if (stop_flag)
+            LOG_DEBUG("chunk_dequeue: Stop flag detected, returning NULL.");
         return NULL;
     }
 
@@ -90,14 +340,220 @@ image_chunk_t* chunk_dequeue(chunk_queue_t* q) {
     if (q->head == NULL) 
         q->tail = NULL;
 
+    q->count--;
+    q->bytes -= chunk->data_size_bytes;
+
+    if (q->max_items != 0 || q->max_bytes != 0)
+        pthread_cond_signal(&q->cond_not_full);
+
     pthread_mutex_unlock(&q->lock);
     free(dequeue_node); 
 
-    printf("Chunk dequeued successfully (ID: %d)\n", chunk->chunk_id); 
+    LOG_TRACE("Chunk dequeued successfully (ID: %d)", chunk->chunk_id);
 
     return chunk;
 }
 
+image_chunk_t* chunk_dequeue(chunk_queue_t* q) {
+    return chunk_dequeue_internal(q, QUEUE_WAIT_BLOCK, 0);
+}
+
+image_chunk_t* chunk_dequeue_timed(chunk_queue_t* q, long timeout_ms) {
+    return chunk_dequeue_internal(q, QUEUE_WAIT_TIMED, timeout_ms);
+}
+
+image_chunk_t* chunk_try_dequeue(chunk_queue_t* q) {
+    return chunk_dequeue_internal(q, QUEUE_WAIT_NONE, 0);
+}
+
+/*
+    Stops at the first chunk a blocking enqueue could not place (shutdown): the count returned is the prefix
+    now owned by the queue, and `chunks[done..n-1]` stay with the caller, as chunk_enqueue_batch() documents.
+*/
+static size_t chunk_ring_enqueue_batch(chunk_queue_t* q, image_chunk_t** chunks, size_t n) {
+    chunk_ring_t *ring = q->ring;
+    size_t done = 0;
+
+    while (done < n) {
+        // Publish everything that fits without waiting, then wake consumers once
+        while (done < n && chunk_ring_try_push(ring, chunks[done]))
+            done++;
+
+        if (done == n)
+            break;
+
+        if (chunk_ring_enqueue(q, chunks[done], QUEUE_WAIT_BLOCK, 0) != 0)
+            break;
+
+        done++;
+    }
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (done > 0 && atomic_load_explicit(&ring->sleeping_consumers, memory_order_relaxed) > 0) {
+        pthread_mutex_lock(&q->lock);
+        pthread_cond_broadcast(&q->cond_not_empty);
+        pthread_mutex_unlock(&q->lock);
+    }
+
+    return done;
+}
+
+size_t chunk_enqueue_batch(chunk_queue_t* q, image_chunk_t** chunks, size_t n) {
+    if (q == NULL || chunks == NULL || n == 0) 
+        return 0;
+
+    if (q->backend == CHUNK_QUEUE_RING)
+        return chunk_ring_enqueue_batch(q, chunks, n);
+
+    chunk_queue_node_t **nodes = (chunk_queue_node_t**)malloc(n * sizeof(chunk_queue_node_t*));
+    if (nodes == NULL) {
+        perror("chunk_enqueue_batch: Failed to allocate memory for node array");
+        return 0;
+    }
+
+    // Allocate outside the lock; a partial allocation still enqueues the prefix
+    size_t allocated = 0;
+    for (; allocated < n; allocated++) {
+        nodes[allocated] = (chunk_queue_node_t*)malloc(sizeof(chunk_queue_node_t));
+        if (nodes[allocated] == NULL) {
+            perror("chunk_enqueue_batch: Failed to allocate memory for new queue node");
+            break;
+        }
+
+        nodes[allocated]->next = NULL;
+        nodes[allocated]->chunk = chunks[allocated];
+    }
+
+    size_t done = 0;
+
+    pthread_mutex_lock(&q->lock);
+
+    while (done < allocated) {
+        size_t appended = 0;
+
+        while (done < allocated && chunk_queue_has_room(q, chunks[done]->data_size_bytes)) {
+            if (q->tail == NULL) 
+                q->head = nodes[done];
+            else 
+                q->tail->next = nodes[done];
+
+            q->tail = nodes[done];
+            q->count++;
+            q->bytes += chunks[done]->data_size_bytes;
+            done++;
+            appended++;
+        }
+
+        if (appended > 0)
+            pthread_cond_broadcast(&q->cond_not_empty);
+
+        if (done == allocated || stop_flag)
+            break;
+
+        pthread_cond_wait(&q->cond_not_full, &q->lock);
+    }
+
+    pthread_mutex_unlock(&q->lock);
+
+    for (size_t i = done; i < allocated; i++)
+        free(nodes[i]);
+
+    free(nodes);
+
+    return done;
+}
+
+size_t chunk_dequeue_batch(chunk_queue_t* q, image_chunk_t** out, size_t max, long timeout_ms) {
+    if (q == NULL || out == NULL || max == 0) 
+        return 0;
+
+    queue_wait_mode_t mode = (timeout_ms < 0)? QUEUE_WAIT_BLOCK: (timeout_ms == 0)? QUEUE_WAIT_NONE: QUEUE_WAIT_TIMED;
+
+    if (q->backend == CHUNK_QUEUE_RING) {
+        // Only the first chunk may wait; the rest is whatever is already published
+        out[0] = chunk_ring_dequeue(q, mode, timeout_ms);
+        if (out[0] == NULL)
+            return 0;
+
+        size_t taken = 1;
+        while (taken < max && (out[taken] = chunk_ring_try_pop(q->ring)) != NULL)
+            taken++;
+
+        if (taken > 1)
+            chunk_ring_wake(q, &q->ring->sleeping_producers, &q->cond_not_full);
+
+        return taken;
+    }
+
+    struct timespec deadline;
+    if (mode == QUEUE_WAIT_TIMED)
+        deadline_after_ms(&deadline, timeout_ms);
+
+    pthread_mutex_lock(&q->lock);
+    while (q->head == NULL && !stop_flag && mode != QUEUE_WAIT_NONE) {
+        if (mode == QUEUE_WAIT_TIMED) {
+            if (pthread_cond_timedwait(&q->cond_not_empty, &q->lock, &deadline) == ETIMEDOUT)
+                break;
+        }
+
+        else
+            pthread_cond_wait(&q->cond_not_empty, &q->lock);
+    }
+
+    chunk_queue_node_t* first = q->head;
+    size_t taken = 0;
+
+    while (taken < max && q->head != NULL) {
+        image_chunk_t* chunk = q->head->chunk;
+
+        out[taken++] = chunk;
+        q->count--;
+        q->bytes -= chunk->data_size_bytes;
+        q->head = q->head->next;
+    }
+
+    if (q->head == NULL) 
+        q->tail = NULL;
+
+    if (taken > 0 && (q->max_items != 0 || q->max_bytes != 0))
+        pthread_cond_broadcast(&q->cond_not_full);
+
+    pthread_mutex_unlock(&q->lock);
+
+    // The detached nodes form a chain of exactly `taken` links starting at `first`
+    for (size_t i = 0; i < taken; i++) {
+        chunk_queue_node_t* next = first->next;
+        free(first);
+        first = next;
+    }
+
+    return taken;
+}
+
+size_t chunk_queue_size(chunk_queue_t* q) {
+    if (q == NULL)
+        return 0;
+
+    if (q->backend == CHUNK_QUEUE_RING)
+        return chunk_ring_size(q->ring);
+
+    pthread_mutex_lock(&q->lock);
+    size_t count = q->count;
+    pthread_mutex_unlock(&q->lock);
+
+    return count;
+}
+
+void chunk_queue_wake_all(chunk_queue_t* q) {
+    if (q == NULL)
+        return;
+
+    pthread_mutex_lock(&q->lock);
+    pthread_cond_broadcast(&q->cond_not_empty);
+    pthread_cond_broadcast(&q->cond_not_full);
+    pthread_mutex_unlock(&q->lock);
+}
+
 void chunk_queue_destroy(chunk_queue_t* q) {
     if (q == NULL) 
         return;
@@ -112,13 +568,169 @@ void chunk_queue_destroy(chunk_queue_t* q) {
         free(temp);     
     }
 
+    if (q->ring != NULL) {
+        image_chunk_t* chunk;
+        while ((chunk = chunk_ring_try_pop(q->ring)) != NULL)
+            free_image_chunk(chunk);
+
+        chunk_ring_destroy(q->ring);
+        q->ring = NULL;
+    }
+
     q->head = NULL;
     q->tail = NULL;
+    q->count = 0;
+    q->bytes = 0;
 
     pthread_mutex_destroy(&q->lock);
     pthread_cond_destroy(&q->cond_not_empty);
+    pthread_cond_destroy(&q->cond_not_full);
+
+    LOG_DEBUG("Chunk queue destroyed successfully");
+}
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond_released;
+    size_t in_flight;
+    size_t max_bytes;
+} chunk_memory_budget = { .in_flight = 0, .max_bytes = 0 };
+
+int chunk_memory_budget_init(size_t max_bytes) {
+    chunk_memory_budget.in_flight = 0;
+    chunk_memory_budget.max_bytes = max_bytes;
+
+    if (pthread_mutex_init(&chunk_memory_budget.lock, NULL) != 0) {
+        perror("chunk_memory_budget_init: Failed to initialize mutex");
+        return -1;
+    }
+
+    if (pthread_cond_init(&chunk_memory_budget.cond_released, NULL) != 0) {
+        perror("chunk_memory_budget_init: Failed to initialize condition variable");
+        pthread_mutex_destroy(&chunk_memory_budget.lock);
+        return -1;
+    }
+
+    return 0;
+}
+
+int chunk_memory_acquire(size_t bytes) {
+    if (chunk_memory_budget.max_bytes == 0)
+        return 0;
+
+    pthread_mutex_lock(&chunk_memory_budget.lock);
+
+    while (chunk_memory_budget.in_flight > 0 &&
+           chunk_memory_budget.in_flight + bytes > chunk_memory_budget.max_bytes) {
+        if (stop_flag) {
+            pthread_mutex_unlock(&chunk_memory_budget.lock);
+            return ECANCELED;
+        }
+
+        pthread_cond_wait(&chunk_memory_budget.cond_released, &chunk_memory_budget.lock);
+    }
+
+    chunk_memory_budget.in_flight += bytes;
+    pthread_mutex_unlock(&chunk_memory_budget.lock);
+
+    return 0;
+}
+
+int chunk_memory_try_acquire(size_t bytes) {
+    if (chunk_memory_budget.max_bytes == 0)
+        return 0;
+
+    int status = 0;
+
+    pthread_mutex_lock(&chunk_memory_budget.lock);
+    if (chunk_memory_budget.in_flight > 0 &&
+        chunk_memory_budget.in_flight + bytes > chunk_memory_budget.max_bytes)
+        status = EAGAIN;
+    else
+        chunk_memory_budget.in_flight += bytes;
+    pthread_mutex_unlock(&chunk_memory_budget.lock);
+
+    return status;
+}
+
+void chunk_memory_charge(size_t bytes) {
+    if (chunk_memory_budget.max_bytes == 0 || bytes == 0)
+        return;
+
+    pthread_mutex_lock(&chunk_memory_budget.lock);
+    chunk_memory_budget.in_flight += bytes;
+    pthread_mutex_unlock(&chunk_memory_budget.lock);
+}
+
+void chunk_memory_release(size_t bytes) {
+    if (chunk_memory_budget.max_bytes == 0 || bytes == 0)
+        return;
+
+    pthread_mutex_lock(&chunk_memory_budget.lock);
+
+    // More returned than was reserved: a double release or a charge that was never made
+    if (bytes > chunk_memory_budget.in_flight) {
+        LOG_ERROR("chunk_memory_release: Releasing %zu bytes with only %zu in flight", bytes,
+                  chunk_memory_budget.in_flight);
+        assert(bytes <= chunk_memory_budget.in_flight);
+        bytes = chunk_memory_budget.in_flight;
+    }
+
+    chunk_memory_budget.in_flight -= bytes;
+    pthread_cond_broadcast(&chunk_memory_budget.cond_released);
+    pthread_mutex_unlock(&chunk_memory_budget.lock);
+}
+
+void chunk_memory_wake_all(void) {
+    if (chunk_memory_budget.max_bytes == 0)
+        return;
+
+    pthread_mutex_lock(&chunk_memory_budget.lock);
+    pthread_cond_broadcast(&chunk_memory_budget.cond_released);
+    pthread_mutex_unlock(&chunk_memory_budget.lock);
+}
 
-    printf("Chunk queue destroyed successfully\n");
+void chunk_memory_budget_destroy(void) {
+    pthread_mutex_destroy(&chunk_memory_budget.lock);
+    pthread_cond_destroy(&chunk_memory_budget.cond_released);
+}
+
+image_buffer_t* image_buffer_create(unsigned char *pixels, size_t width, size_t height, int channels,
+                                    image_sample_t sample, void (*free_pixels)(void *), size_t budget_bytes) {
+    image_buffer_t *buffer = (image_buffer_t *)malloc(sizeof(image_buffer_t));
+    if (buffer == NULL) {
+        perror("image_buffer_create: Failed to allocate memory for image buffer");
+        return NULL;
+    }
+
+    buffer->pixels = pixels;
+    buffer->width = width;
+    buffer->height = height;
+    buffer->channels = channels;
+    buffer->sample = sample;
+    buffer->row_stride = width * (size_t)channels * image_sample_bytes(sample);
+    buffer->budget_bytes = budget_bytes;
+    buffer->free_pixels = free_pixels;
+    atomic_init(&buffer->refcount, 1);
+
+    return buffer;
+}
+
+void image_buffer_retain(image_buffer_t *buffer) {
+    atomic_fetch_add_explicit(&buffer->refcount, 1, memory_order_relaxed);
+}
+
+void image_buffer_release(image_buffer_t *buffer) {
+    if (buffer == NULL)
+        return;
+
+    // acq_rel: every holder's pixel writes happen-before the free below
+    if (atomic_fetch_sub_explicit(&buffer->refcount, 1, memory_order_acq_rel) != 1)
+        return;
+
+    buffer->free_pixels(buffer->pixels);
+    chunk_memory_release(buffer->budget_bytes);
+    free(buffer);
 }
 
 discarded_image_entry_t* discarded_images_head = NULL;
@@ -129,6 +741,8 @@ int discarded_images_init(void) {
         perror("discard_images_init - Cannot initialize mutex");
         return -1;
     }
+
+    return 0;
 }
 
 int discarded_images_table_add(const char *filename) {
@@ -141,6 +755,7 @@ int discarded_images_table_add(const char *filename) {
         entry = (discarded_image_entry_t*)malloc(sizeof(discarded_image_entry_t));
         if (!entry) {
             perror("discarded_images_table_add - Failed to allocate memory for hash entry");
+            pthread_mutex_unlock(&discarded_images_lock);
             return -1;
         }     
 
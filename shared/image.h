@@ -5,6 +5,14 @@
 #include<pthread.h> // For pthread types
 #include<uthash.h>
 #include<stdbool.h>
+#include<stdatomic.h>
+
+/**
+ * @brief Most input roots (routes) one process can watch. Each root has its
+ *        own output directory and filter chain; chunks carry the index of the
+ *        root their image came from.
+ */
+#define IMAGE_MAX_ROUTES 64
 
 /**
  * @brief Represents the processing state of an image chunk.
@@ -16,16 +24,84 @@ typedef enum {
     // Add more states if needed, e.g., CHUNK_STATUS_RECONSTRUCTED
 } chunk_processing_status_t;
 
+/**
+ * @brief How one channel of a pixel is stored.
+ *
+ * 8-bit samples are the default. Wide samples keep the precision of 16-bit
+ * sources through a whole filter chain: 16-bit samples span 0..65535, float
+ * samples are nominally 0..1 (decoded HDR files may exceed 1). Filters take
+ * their parameters in 8-bit units and scale them to the sample range.
+ */
+typedef enum {
+    IMAGE_SAMPLE_U8,    /**< unsigned char, 0..255. */
+    IMAGE_SAMPLE_U16,   /**< uint16_t in native byte order, 0..65535. */
+    IMAGE_SAMPLE_F32    /**< float, 0..1 nominal. */
+} image_sample_t;
+
+/**
+ * @brief Bytes of one sample.
+ */
+static inline size_t image_sample_bytes(image_sample_t sample) {
+    return (sample == IMAGE_SAMPLE_U16)? 2: (sample == IMAGE_SAMPLE_F32)? 4: 1;
+}
+
+/**
+ * @brief Value of full intensity: 255, 65535 or 1.
+ */
+static inline float image_sample_max(image_sample_t sample) {
+    return (sample == IMAGE_SAMPLE_U16)? 65535.0f: (sample == IMAGE_SAMPLE_F32)? 1.0f: 255.0f;
+}
+
+/**
+ * @brief A decoded image shared by the chunks that view into it.
+ *
+ * Every view chunk holds one reference; the pixels are freed (and their bytes
+ * returned to the memory budget) when the last reference is released.
+ */
+typedef struct {
+    unsigned char *pixels;          /**< Decoded pixel rows, `row_stride` bytes apart. */
+    size_t width, height;           /**< Image dimensions in pixels. */
+    int channels;                   /**< Number of color channels per pixel. */
+    image_sample_t sample;          /**< Type of every channel value. */
+    size_t row_stride;              /**< Bytes between the starts of two consecutive rows. */
+    size_t budget_bytes;            /**< Bytes reserved with chunk_memory_acquire() for this buffer. */
+    void (*free_pixels)(void *);    /**< Deallocator matching whoever allocated `pixels`. */
+    _Atomic int refcount;           /**< Number of holders (views plus the creator's own reference). */
+} image_buffer_t;
+
+/**
+ * @brief How a chunk stores the channels of its pixels.
+ */
+typedef enum {
+    IMAGE_LAYOUT_INTERLEAVED,   /**< One buffer of `channels` samples per pixel (RGBRGB...). */
+    IMAGE_LAYOUT_PLANAR         /**< One byte per pixel in each of `channels` planes (RRR... GGG... BBB...). */
+} image_layout_t;
+
 /**
  * @brief Represents a rectangular chunk of a larger image.
  *
  * Contains metadata about the chunk's position and dimensions relative
- * to the original image, as well as a pointer to its own pixel data buffer.
+ * to the original image, as well as a pointer to its pixel data. The pixel
+ * data is either a buffer owned by the chunk (`source == NULL`) or a strided
+ * view into a shared image_buffer_t; filters work on both through `row_stride`.
+ *
+ * An owned chunk may carry a halo: copies of the neighbouring pixels around
+ * its `width` x `height` interior (clipped at the image edges), so neighbourhood
+ * filters see the same input as on the whole image. Only the interior is
+ * written back by reconstruction.
+ *
+ * An owned chunk may also be planar: every channel is a separate plane of
+ * `plane_size` bytes, with `row_stride` (a multiple of 64) bytes per row and
+ * 64-byte aligned plane origins, so filters run plain byte loops over each
+ * plane. `pixel_data` is then the first interior pixel of plane 0. Views are
+ * always interleaved. Planar chunks always hold 8-bit samples.
  */
 typedef struct {
     // Identification
     int chunk_id;               /**< Unique identifier for this chunk within its original image. */
     char* original_image_name;  /**< Dynamically allocated name of the source image file. Caller must manage memory. */
+    int route;                  /**< Input root the image was found under (< IMAGE_MAX_ROUTES): selects its filter plan and output directory. */
+    uint64_t ingest;            /**< Decode of the image this chunk comes from, unique within a run: tells the chunks of a file queued again from those of an abandoned earlier decode. */
 
     // Geometry
     size_t offset_x;            /**< X-coordinate of the top-left corner of this chunk in the original image's coordinate system. */
@@ -34,9 +110,18 @@ typedef struct {
     size_t height;              /**< Height of this chunk in pixels. */
 
     // Pixel Data
-    unsigned char* pixel_data;  /**< Pointer to the buffer containing the chunk's pixel data (allocated separately). */
-    size_t data_size_bytes;     /**< Size of the pixel_data buffer in bytes (width * height * channels). */
+    unsigned char* pixel_data;  /**< First interior pixel of the chunk: inside its own buffer, or a position inside `source`. */
+    size_t data_size_bytes;     /**< Bytes of pixels held by the chunk, halo included. */
+    size_t row_stride;          /**< Bytes between the starts of two consecutive chunk rows (halo included when owned). */
+    size_t halo_left;           /**< Read-only border pixels left of the interior (at negative offsets from `pixel_data`). */
+    size_t halo_top;            /**< Read-only border rows above the interior. */
+    size_t halo_right;          /**< Read-only border pixels right of the interior. */
+    size_t halo_bottom;         /**< Read-only border rows below the interior. */
+    image_buffer_t* source;     /**< Shared buffer this chunk views into, or NULL if `pixel_data` is owned. */
     int channels;               /**< Number of color channels per pixel (e.g., 1 for Grayscale, 3 for RGB, 4 for RGBA). */
+    image_sample_t sample;      /**< Type of every channel value; a pixel is `channels` samples. */
+    image_layout_t layout;      /**< Interleaved, or planar (owned chunks only). */
+    size_t plane_size;          /**< Planar only: bytes from a pixel of one plane to the same pixel of the next. */
 
     // Optional Metadata (Currently commented out)
     int original_image_num_chunks;
@@ -46,11 +131,27 @@ typedef struct {
 
 } image_chunk_t;
 
+/**
+ * @brief First byte of a chunk's pixels, halo included (the start of its buffer when owned).
+ */
+static inline unsigned char *image_chunk_halo_origin(const image_chunk_t *chunk) {
+    size_t pixel_bytes = (chunk->layout == IMAGE_LAYOUT_PLANAR)? 1: (size_t)chunk->channels * image_sample_bytes(chunk->sample);
+    return chunk->pixel_data - chunk->halo_top * chunk->row_stride - chunk->halo_left * pixel_bytes;
+}
+
+/**
+ * @brief First interior pixel of plane `channel` of a planar chunk.
+ */
+static inline unsigned char *image_chunk_plane(const image_chunk_t *chunk, int channel) {
+    return chunk->pixel_data + (size_t)channel * chunk->plane_size;
+}
+
 typedef struct {
     unsigned char *pixel_data;
 
     size_t width, height;
     uint32_t channels;
+    image_sample_t sample;
 } image_t;
 
 /**
@@ -66,45 +167,114 @@ typedef struct chunk_queue_node
     image_chunk_t* chunk;           /**< The image chunk data stored in this node. Consider using a pointer instead. */
 } chunk_queue_node_t;               // Renamed type
 
+/**
+ * @brief Storage strategy behind a chunk_queue_t, chosen at init time.
+ */
+typedef enum {
+    CHUNK_QUEUE_LIST,   /**< Mutex-protected linked list (optionally bounded). */
+    CHUNK_QUEUE_RING,   /**< Fixed-capacity lock-free MPMC ring (see chunk_ring.h). */
+} chunk_queue_backend_t;
+
+struct chunk_ring;
+
 /**
  * @brief Manages a thread-safe queue of image chunks.
  *
  * Contains pointers to the head and tail nodes, along with synchronization
  * primitives (mutex and condition variable) for thread-safe operations.
+ * With the ring backend the list fields are unused and the mutex/condition
+ * variables are only touched when a caller has to wait for the ring to become
+ * non-empty (or non-full).
  * IMPORTANT: The image_chunk_t* is created only once and changes ownership, make sure to free it after reconstruction.
  */
 typedef struct {
+    chunk_queue_backend_t backend;  /**< Which of the two implementations below is in use. */
+    struct chunk_ring *ring;        /**< Lock-free ring, only for CHUNK_QUEUE_RING. */
+
     chunk_queue_node_t *head;       /**< Pointer to the first node in the queue (or NULL if empty). */
     chunk_queue_node_t *tail;       /**< Pointer to the last node in the queue (or NULL if empty). */
     pthread_mutex_t lock;           /**< Mutex to protect access to the queue structure. */
     pthread_cond_t cond_not_empty;  /**< Condition variable to signal when the queue is not empty. */
-    // Add cond_not_full if implementing a bounded queue
+    pthread_cond_t cond_not_full;   /**< Condition variable to signal when a bounded queue has room again. */
+
+    size_t count;                   /**< Number of chunks currently queued. */
+    size_t bytes;                   /**< Sum of `data_size_bytes` of the queued chunks. */
+    size_t max_items;               /**< Capacity in chunks, 0 for unbounded. */
+    size_t max_bytes;               /**< Capacity in pixel bytes, 0 for unbounded. */
 } chunk_queue_t;
 
 /**
- * @brief Initializes a chunk queue.
+ * @brief Initializes an unbounded chunk queue.
  *
- * Sets head and tail to NULL and initializes the mutex and condition variable.
- * Must be called before using the queue.
+ * Sets head and tail to NULL and initializes the mutex and condition variables.
+ * Must be called before using the queue. Equivalent to
+ * `chunk_queue_init_bounded(q, 0, 0)`.
  *
  * @param q Pointer to the chunk_queue_t structure to initialize.
  * @return 0 on success, non-zero on error initializing mutex or condition variable.
  */
 int chunk_queue_init(chunk_queue_t* q);
 
+/**
+ * @brief Initializes a bounded chunk queue.
+ *
+ * Producers block (or time out / fail, depending on the enqueue variant) while the
+ * queue holds `max_items` chunks or while adding the chunk would exceed `max_bytes`
+ * of pixel data. A single chunk larger than `max_bytes` is still accepted when the
+ * queue is empty so that it cannot stall the pipeline forever.
+ *
+ * @param q Pointer to the chunk_queue_t structure to initialize.
+ * @param max_items Maximum number of queued chunks, 0 for no limit.
+ * @param max_bytes Maximum sum of `data_size_bytes` of queued chunks, 0 for no limit.
+ * @return 0 on success, non-zero on error initializing mutex or condition variables.
+ */
+int chunk_queue_init_bounded(chunk_queue_t* q, size_t max_items, size_t max_bytes);
+
+/**
+ * @brief Initializes a chunk queue backed by a lock-free MPMC ring.
+ *
+ * Enqueue/dequeue never take the mutex while the ring is neither full nor empty
+ * and never allocate. The queue is bounded by `capacity` (rounded up to a power
+ * of two); it does not enforce a byte limit, use the global chunk memory budget
+ * for that.
+ *
+ * @param q Pointer to the chunk_queue_t structure to initialize.
+ * @param capacity Number of slots in the ring.
+ * @return 0 on success, non-zero on allocation or synchronization primitive failure.
+ */
+int chunk_queue_init_ring(chunk_queue_t* q, size_t capacity);
+
 /**
  * @brief Enqueues an image chunk into the thread-safe queue.
  *
  * Creates a new node, takes the ownership of chunk data pointer,
  * adds it to the tail of the queue, and signals any waiting consumers.
+ * Blocks while a bounded queue is full.
  * IMPORTANT: The image_chunk_t* is created only once and changes ownership, make sure to free it after reconstruction.
  *
  * @param q Pointer to the chunk_queue_t structure.
- * @param c Pointer to the image chunk data to enqueue. The queue takes ownership.
- * @return 0 on success, non-zero on failure (e.g., memory allocation).
+ * @param c Pointer to the image chunk data to enqueue. The queue takes ownership on success.
+ * @return 0 on success, ECANCELED if `stop_flag` was raised while waiting for room,
+ *         other non-zero values on failure (e.g., memory allocation). On failure the
+ *         caller keeps ownership of the chunk.
  */
 int chunk_enqueue(chunk_queue_t* q, image_chunk_t* c);
 
+/**
+ * @brief Same as chunk_enqueue(), but gives up after `timeout_ms` milliseconds.
+ *
+ * @return 0 on success, ETIMEDOUT if the queue stayed full, ECANCELED on shutdown,
+ *         other non-zero values on failure.
+ */
+int chunk_enqueue_timed(chunk_queue_t* q, image_chunk_t* c, long timeout_ms);
+
+/**
+ * @brief Enqueues the chunk only if there is room right now.
+ *
+ * @return 0 on success, EAGAIN if the queue is full, other non-zero values on failure.
+ */
+int chunk_try_enqueue(chunk_queue_t* q, image_chunk_t* c);
+
 /**
  * @brief Dequeues an image chunk from the thread-safe queue.
  *
@@ -118,6 +288,68 @@ int chunk_enqueue(chunk_queue_t* q, image_chunk_t* c);
  */
 image_chunk_t* chunk_dequeue(chunk_queue_t* q);
 
+/**
+ * @brief Same as chunk_dequeue(), but gives up after `timeout_ms` milliseconds.
+ *
+ * @return The dequeued chunk, or NULL on timeout or shutdown.
+ */
+image_chunk_t* chunk_dequeue_timed(chunk_queue_t* q, long timeout_ms);
+
+/**
+ * @brief Dequeues a chunk only if one is available right now.
+ *
+ * @return The dequeued chunk, or NULL if the queue is empty.
+ */
+image_chunk_t* chunk_try_dequeue(chunk_queue_t* q);
+
+/**
+ * @brief Enqueues up to `n` chunks with as few lock acquisitions as possible.
+ *
+ * Nodes are allocated before taking the lock, then every chunk that fits is
+ * appended under a single acquisition and consumers are woken with one
+ * broadcast. On a bounded queue the call blocks for room like chunk_enqueue()
+ * and may append the batch in several runs.
+ *
+ * @param q Pointer to the chunk_queue_t structure.
+ * @param chunks Array of `n` chunk pointers.
+ * @param n Number of chunks in the array.
+ * @return Number of chunks taken over by the queue, in order from the start of
+ *         the array. Fewer than `n` means shutdown or an allocation failure; the
+ *         caller keeps ownership of `chunks[returned..n-1]`.
+ */
+size_t chunk_enqueue_batch(chunk_queue_t* q, image_chunk_t** chunks, size_t n);
+
+/**
+ * @brief Dequeues up to `max` chunks under a single lock acquisition.
+ *
+ * Waits for at least one chunk, then takes every queued chunk up to `max`.
+ *
+ * @param q Pointer to the chunk_queue_t structure.
+ * @param out Array receiving up to `max` chunk pointers (ownership transferred).
+ * @param max Capacity of `out`.
+ * @param timeout_ms Maximum wait for the first chunk: < 0 waits until a chunk
+ *        arrives or shutdown, 0 does not wait at all.
+ * @return Number of chunks written to `out`; 0 on timeout or shutdown.
+ */
+size_t chunk_dequeue_batch(chunk_queue_t* q, image_chunk_t** out, size_t max, long timeout_ms);
+
+/**
+ * @brief Number of chunks currently in the queue (a snapshot; may change immediately).
+ *
+ * @param q Pointer to the chunk_queue_t structure.
+ */
+size_t chunk_queue_size(chunk_queue_t* q);
+
+/**
+ * @brief Wakes every producer and consumer blocked on the queue.
+ *
+ * Used during shutdown after `stop_flag` has been set so that blocked threads
+ * re-check the flag.
+ *
+ * @param q Pointer to the chunk_queue_t structure.
+ */
+void chunk_queue_wake_all(chunk_queue_t* q);
+
 /**
  * @brief Destroys a chunk queue, freeing all nodes and associated resources.
  *
@@ -129,6 +361,93 @@ image_chunk_t* chunk_dequeue(chunk_queue_t* q);
  */
 void chunk_queue_destroy(chunk_queue_t* q);
 
+// --- In-flight Pixel Memory Budget ---
+// Caps the pixel bytes owned by chunks anywhere in the pipeline (queued or being
+// filtered), independently of the per-queue limits above.
+
+/**
+ * @brief Initializes the global in-flight chunk memory budget.
+ *
+ * @param max_bytes Maximum number of chunk pixel bytes alive at once, 0 for no limit.
+ * @return 0 on success, -1 if the synchronization primitives cannot be initialized.
+ */
+int chunk_memory_budget_init(size_t max_bytes);
+
+/**
+ * @brief Reserves `bytes` of the budget, blocking until enough has been released.
+ *
+ * A request larger than the whole budget is granted once nothing else is in flight.
+ *
+ * @param bytes Number of bytes to reserve.
+ * @return 0 on success, ECANCELED if `stop_flag` was raised while waiting.
+ */
+int chunk_memory_acquire(size_t bytes);
+
+/**
+ * @brief Non-blocking variant of chunk_memory_acquire().
+ *
+ * @param bytes Number of bytes to reserve.
+ * @return 0 on success, EAGAIN if the reservation would have to wait.
+ */
+int chunk_memory_try_acquire(size_t bytes);
+
+/**
+ * @brief Reserves `bytes` without waiting, even past the budget.
+ *
+ * For pixels that replace those of a chunk already in flight (a resized tile):
+ * waiting there could wait on the very chunks queued behind it.
+ *
+ * @param bytes Number of bytes to reserve.
+ */
+void chunk_memory_charge(size_t bytes);
+
+/**
+ * @brief Returns `bytes` previously reserved with chunk_memory_acquire().
+ *
+ * Returning more than is in flight is an accounting bug: it is logged (and
+ * asserted in debug builds) before the budget drops to zero.
+ *
+ * @param bytes Number of bytes to release.
+ */
+void chunk_memory_release(size_t bytes);
+
+/**
+ * @brief Wakes every thread blocked in chunk_memory_acquire() (used on shutdown).
+ */
+void chunk_memory_wake_all(void);
+
+/**
+ * @brief Destroys the budget's synchronization primitives.
+ */
+void chunk_memory_budget_destroy(void);
+
+/**
+ * @brief Wraps decoded pixels in a reference-counted buffer.
+ *
+ * The buffer takes ownership of `pixels` and starts with one reference held
+ * by the caller.
+ *
+ * @param pixels Tightly packed pixel rows (`width * channels` samples each).
+ * @param sample Type of the samples in `pixels`.
+ * @param free_pixels Deallocator for `pixels`, called with the last release.
+ * @param budget_bytes Bytes already reserved with chunk_memory_acquire() for
+ *        this buffer; returned to the budget with the last release (0 for none).
+ * @return The buffer, or NULL on allocation failure (`pixels` and the
+ *         reservation then still belong to the caller).
+ */
+image_buffer_t* image_buffer_create(unsigned char *pixels, size_t width, size_t height, int channels,
+                                    image_sample_t sample, void (*free_pixels)(void *), size_t budget_bytes);
+
+/**
+ * @brief Adds a reference to the buffer.
+ */
+void image_buffer_retain(image_buffer_t *buffer);
+
+/**
+ * @brief Drops a reference; the last one frees the pixels and the buffer.
+ */
+void image_buffer_release(image_buffer_t *buffer);
+
 // --- Global Shared Variables ---
 // These represent shared queues between pipeline stages.
 // Ensure they are properly initialized using chunk_queue_init()
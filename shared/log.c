@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <strings.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "log.h"
+
+/** @brief Longest and shortest sleep of the writer thread between two drains. */
+#define LOG_WRITER_MIN_SLEEP_MS 1
+#define LOG_WRITER_MAX_SLEEP_MS 100
+
+typedef struct {
+    uint64_t timestamp_ns;
+    int level;
+    char message[LOG_MESSAGE_SIZE];
+} log_entry_t;
+
+/*
+    One ring per thread. Only the owning thread advances `head`, only the writer advances `tail`, so a
+    release store on one side and an acquire load on the other is all the synchronisation needed.
+*/
+typedef struct log_ring {
+    _Alignas(64) _Atomic size_t head;   // next slot the producer writes
+    _Alignas(64) _Atomic size_t tail;   // next slot the writer reads
+    _Alignas(64) _Atomic uint64_t dropped;
+    _Atomic bool in_use;                // false once the owning thread exited; the ring can be adopted
+    unsigned thread_index;
+    struct log_ring *next;
+    log_entry_t entries[LOG_RING_CAPACITY];
+} log_ring_t;
+
+_Atomic int log_runtime_level = LOG_LEVEL_INFO;
+
+static _Atomic(log_ring_t *) log_rings = NULL;
+static _Atomic unsigned log_thread_counter = 0;
+static _Atomic bool log_async = false;
+static _Atomic bool log_writer_stop = false;
+static pthread_t log_writer;
+static pthread_key_t log_ring_key;
+static pthread_once_t log_key_once = PTHREAD_ONCE_INIT;
+static _Thread_local log_ring_t *log_thread_ring = NULL;
+static uint64_t log_start_ns = 0;
+
+static const char *const log_level_names[] = { "TRACE", "DEBUG", "INFO", "WARN", "ERROR" };
+
+static inline uint64_t log_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void log_release_ring(void *arg) {
+    log_ring_t *ring = (log_ring_t *)arg;
+    atomic_store_explicit(&ring->in_use, false, memory_order_release);
+}
+
+static void log_create_key(void) {
+    pthread_key_create(&log_ring_key, log_release_ring);
+}
+
+// Lock-free push onto the global list
+static void log_push_ring(log_ring_t *ring) {
+    ring->next = atomic_load_explicit(&log_rings, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&log_rings, &ring->next, ring,
+                                                  memory_order_release, memory_order_relaxed))
+        ;
+}
+
+static log_ring_t *log_acquire_ring(void) {
+    if (log_thread_ring != NULL)
+        return log_thread_ring;
+
+    pthread_once(&log_key_once, log_create_key);
+
+    // Adopt the ring of a thread that has exited before growing the list
+    for (log_ring_t *ring = atomic_load_explicit(&log_rings, memory_order_acquire); ring != NULL; ring = ring->next) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong_explicit(&ring->in_use, &expected, true,
+                                                    memory_order_acquire, memory_order_relaxed)) {
+            log_thread_ring = ring;
+            pthread_setspecific(log_ring_key, ring);
+            return ring;
+        }
+    }
+
+    log_ring_t *ring = (log_ring_t *)aligned_alloc(64, sizeof(log_ring_t));
+    if (ring == NULL)
+        return NULL;
+
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->dropped, 0);
+    atomic_init(&ring->in_use, true);
+    ring->thread_index = atomic_fetch_add(&log_thread_counter, 1);
+
+    // Rings are never unlinked: they live until the process exits
+    log_push_ring(ring);
+
+    log_thread_ring = ring;
+    pthread_setspecific(log_ring_key, ring);
+
+    return ring;
+}
+
+static void log_emit(FILE *out, uint64_t timestamp_ns, int level, unsigned thread_index, const char *message) {
+    double seconds = (double)(timestamp_ns - log_start_ns) / 1e9;
+    fprintf(out, "[%10.6f] %-5s T%02u: %s\n", seconds, log_level_names[level], thread_index, message);
+}
+
+void log_write(int level, const char *fmt, ...) {
+    if (level < LOG_LEVEL_TRACE || level > LOG_LEVEL_ERROR)
+        return;
+
+    va_list args;
+    va_start(args, fmt);
+
+    log_ring_t *ring = atomic_load_explicit(&log_async, memory_order_acquire)? log_acquire_ring(): NULL;
+
+    if (ring == NULL) {
+        // Not started (or already stopped): write synchronously
+        char message[LOG_MESSAGE_SIZE];
+        vsnprintf(message, sizeof(message), fmt, args);
+        va_end(args);
+
+        log_emit((level >= LOG_LEVEL_WARN)? stderr: stdout, log_now_ns(), level, 0, message);
+        return;
+    }
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head - tail >= LOG_RING_CAPACITY) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        va_end(args);
+        return;
+    }
+
+    log_entry_t *entry = &ring->entries[head % LOG_RING_CAPACITY];
+    entry->timestamp_ns = log_now_ns();
+    entry->level = level;
+    vsnprintf(entry->message, sizeof(entry->message), fmt, args);
+    va_end(args);
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+static size_t log_drain(void) {
+    size_t written = 0;
+
+    for (log_ring_t *ring = atomic_load_explicit(&log_rings, memory_order_acquire); ring != NULL; ring = ring->next) {
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        for (; tail != head; tail++, written++) {
+            const log_entry_t *entry = &ring->entries[tail % LOG_RING_CAPACITY];
+            log_emit((entry->level >= LOG_LEVEL_WARN)? stderr: stdout,
+                     entry->timestamp_ns, entry->level, ring->thread_index, entry->message);
+        }
+
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+        uint64_t dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+        if (dropped > 0) {
+            char message[LOG_MESSAGE_SIZE];
+            snprintf(message, sizeof(message), "log ring full, %llu messages dropped", (unsigned long long)dropped);
+            log_emit(stderr, log_now_ns(), LOG_LEVEL_WARN, ring->thread_index, message);
+        }
+    }
+
+    if (written > 0)
+        fflush(stdout);
+
+    return written;
+}
+
+static void *log_writer_thread(void *arg) {
+    (void)arg;
+    long sleep_ms = LOG_WRITER_MIN_SLEEP_MS;
+
+    while (!atomic_load_explicit(&log_writer_stop, memory_order_acquire)) {
+        // Back off while idle so an idle pipeline costs (almost) no wakeups
+        if (log_drain() > 0)
+            sleep_ms = LOG_WRITER_MIN_SLEEP_MS;
+        else if (sleep_ms < LOG_WRITER_MAX_SLEEP_MS)
+            sleep_ms *= 2;
+
+        struct timespec delay = { sleep_ms / 1000, (sleep_ms % 1000) * 1000000L };
+        nanosleep(&delay, NULL);
+    }
+
+    log_drain();
+    return NULL;
+}
+
+int log_init(int level) {
+    atomic_store(&log_runtime_level, level);
+    log_start_ns = log_now_ns();
+    atomic_store(&log_writer_stop, false);
+
+    if (pthread_create(&log_writer, NULL, log_writer_thread, NULL) != 0) {
+        perror("log_init: Failed to create log writer thread");
+        return -1;
+    }
+
+    atomic_store_explicit(&log_async, true, memory_order_release);
+    return 0;
+}
+
+void log_shutdown(void) {
+    if (!atomic_exchange(&log_async, false))
+        return;
+
+    atomic_store_explicit(&log_writer_stop, true, memory_order_release);
+    pthread_join(log_writer, NULL);
+
+    /*
+        Threads still running log synchronously from now on. No ring is freed: a thread that saw log_async
+        just before it was cleared may still be walking the list, and threads keep pointing at their ring
+        (the key destructor writes it when they exit). Rings of exited threads stay listed for adoption,
+        and every ring is drained again by the writer of the next log_init().
+    */
+    fflush(stdout);
+}
+
+int log_level_from_string(const char *name) {
+    static const char *const names[] = { "trace", "debug", "info", "warn", "error", "off" };
+
+    for (int level = LOG_LEVEL_TRACE; level <= LOG_LEVEL_OFF; level++) {
+        if (strcasecmp(name, names[level]) == 0)
+            return level;
+    }
+
+    return -1;
+}
+
+int log_ratelimit_allow(log_ratelimit_t *state, uint64_t interval_ms, uint64_t *suppressed) {
+    uint64_t now = log_now_ns();
+    uint64_t next = atomic_load_explicit(&state->next_allowed_ns, memory_order_relaxed);
+
+    if (now < next || !atomic_compare_exchange_strong_explicit(&state->next_allowed_ns, &next,
+                                                               now + interval_ms * 1000000ull,
+                                                               memory_order_relaxed, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&state->suppressed, 1, memory_order_relaxed);
+        return 0;
+    }
+
+    *suppressed = atomic_exchange_explicit(&state->suppressed, 0, memory_order_relaxed);
+    return 1;
+}
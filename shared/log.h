@@ -0,0 +1,144 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Leveled, asynchronous logging.
+ *
+ * Every thread formats its messages into its own single-producer/single-consumer
+ * ring buffer; a background writer thread drains all rings to stdout/stderr.
+ * A pipeline worker never takes a lock or waits on I/O to log: if its ring is
+ * full the message is dropped and counted. Before log_init() and after
+ * log_shutdown() messages are written synchronously instead.
+ *
+ * Levels below LOG_COMPILE_LEVEL compile to nothing, so trace/debug calls can
+ * stay in hot paths. The remaining levels are also filtered at run time.
+ */
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_WARN  3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_OFF   5
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#endif
+
+/** @brief Size of one formatted message including the terminator; longer messages are truncated. */
+#define LOG_MESSAGE_SIZE 240
+
+/** @brief Number of messages each per-thread ring can hold before it starts dropping. */
+#define LOG_RING_CAPACITY 256
+
+/**
+ * @brief Per-call-site state for rate-limited messages (see LOG_ERROR_RATELIMITED).
+ */
+typedef struct {
+    _Atomic uint64_t next_allowed_ns;   /**< Monotonic time before which the call site stays silent. */
+    _Atomic uint64_t suppressed;        /**< Messages swallowed since the last one that was emitted. */
+} log_ratelimit_t;
+
+/** @brief Messages below this level are discarded at run time. */
+extern _Atomic int log_runtime_level;
+
+/**
+ * @brief Starts the background writer thread.
+ *
+ * @param level Run-time minimum level (one of the LOG_LEVEL_* values).
+ * @return 0 on success, -1 if the writer thread could not be started (logging
+ *         then stays synchronous).
+ */
+int log_init(int level);
+
+/**
+ * @brief Drains every ring, reports dropped messages and stops the writer thread.
+ *
+ * Messages logged afterwards are written synchronously. The per-thread rings
+ * are not freed: they stay allocated until the process exits, are adopted by
+ * new threads, and are drained again after another log_init(), so threads
+ * need not be joined first.
+ */
+void log_shutdown(void);
+
+/**
+ * @brief Parses "trace", "debug", "info", "warn", "error" or "off".
+ *
+ * @return The LOG_LEVEL_* value, or -1 if the name is unknown.
+ */
+int log_level_from_string(const char *name);
+
+/**
+ * @brief Formats a message into the calling thread's ring. Use the LOG_* macros instead.
+ */
+void log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Returns non-zero if the call site may log now, at most once per `interval_ms`.
+ *
+ * @param state Per-call-site state.
+ * @param interval_ms Minimum time between two emitted messages.
+ * @param suppressed Receives how many messages were skipped since the last emitted one.
+ */
+int log_ratelimit_allow(log_ratelimit_t *state, uint64_t interval_ms, uint64_t *suppressed);
+
+#define LOG_AT(level, ...) \
+    do { \
+        if ((level) >= atomic_load_explicit(&log_runtime_level, memory_order_relaxed)) \
+            log_write((level), __VA_ARGS__); \
+    } while (0)
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_TRACE
+#define LOG_TRACE(...) LOG_AT(LOG_LEVEL_TRACE, __VA_ARGS__)
+#else
+#define LOG_TRACE(...) ((void)0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
+
+/**
+ * @brief Logs an error at most once per `interval_ms` from this call site.
+ *
+ * The number of messages suppressed in between is appended to the next one
+ * that gets through.
+ */
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR_RATELIMITED(interval_ms, fmt, ...) \
+    do { \
+        static log_ratelimit_t log_ratelimit_state_; \
+        uint64_t log_suppressed_; \
+        if (log_ratelimit_allow(&log_ratelimit_state_, (interval_ms), &log_suppressed_)) { \
+            if (log_suppressed_ > 0) \
+                LOG_ERROR(fmt " (%llu similar messages suppressed)", ##__VA_ARGS__, (unsigned long long)log_suppressed_); \
+            else \
+                LOG_ERROR(fmt, ##__VA_ARGS__); \
+        } \
+    } while (0)
+#else
+#define LOG_ERROR_RATELIMITED(interval_ms, fmt, ...) ((void)0)
+#endif
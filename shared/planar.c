@@ -0,0 +1,192 @@
+#include <string.h>
+#include <pthread.h>
+
+#include <planar.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PLANAR_X86 1
+#include <immintrin.h>
+#endif
+
+typedef void (*split_row_fn)(const unsigned char *src, unsigned char *const planes[], int channels, size_t width);
+typedef void (*merge_row_fn)(unsigned char *const planes[], int channels, size_t width, unsigned char *dst);
+
+size_t planar_row_stride(size_t width) {
+    return (width + PLANAR_ALIGNMENT - 1) & ~(size_t)(PLANAR_ALIGNMENT - 1);
+}
+
+static void split_row_scalar(const unsigned char *src, unsigned char *const planes[], int channels, size_t width) {
+    for (int c = 0; c < channels; c++) {
+        unsigned char *plane = planes[c];
+        for (size_t x = 0; x < width; x++)
+            plane[x] = src[x * channels + c];
+    }
+}
+
+static void merge_row_scalar(unsigned char *const planes[], int channels, size_t width, unsigned char *dst) {
+    for (int c = 0; c < channels; c++) {
+        const unsigned char *plane = planes[c];
+        for (size_t x = 0; x < width; x++)
+            dst[x * channels + c] = plane[x];
+    }
+}
+
+#ifdef PLANAR_X86
+
+/*
+    16 pixels of C channels are C input vectors. Byte j of plane c is byte C * j + c of the pixels, i.e. byte
+    (C * j + c) % 16 of vector (C * j + c) / 16: one pshufb per vector picks those bytes into place (and zeroes
+    the rest), and OR-ing the C results gives the plane. Merging uses the inverse tables.
+
+    [channels][vector][plane] -> pshufb control; built once when the kernels are selected.
+*/
+static _Alignas(16) unsigned char split_masks[PLANAR_MAX_CHANNELS + 1][PLANAR_MAX_CHANNELS][PLANAR_MAX_CHANNELS][16];
+static _Alignas(16) unsigned char merge_masks[PLANAR_MAX_CHANNELS + 1][PLANAR_MAX_CHANNELS][PLANAR_MAX_CHANNELS][16];
+
+static void build_masks(void) {
+    // 0x80: pshufb writes zero
+    memset(split_masks, 0x80, sizeof(split_masks));
+    memset(merge_masks, 0x80, sizeof(merge_masks));
+
+    for (int channels = 2; channels <= PLANAR_MAX_CHANNELS; channels++) {
+        for (int c = 0; c < channels; c++) {
+            for (int j = 0; j < 16; j++) {
+                int byte = channels * j + c;
+                split_masks[channels][byte / 16][c][j] = (unsigned char)(byte % 16);
+                merge_masks[channels][byte / 16][c][byte % 16] = (unsigned char)j;
+            }
+        }
+    }
+}
+
+__attribute__((target("ssse3"), always_inline))
+static inline void split_row_ssse3_n(const unsigned char *src, unsigned char *const planes[], const int channels, size_t width) {
+    size_t x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        __m128i in[PLANAR_MAX_CHANNELS];
+        for (int k = 0; k < channels; k++)
+            in[k] = _mm_loadu_si128((const __m128i *)(src + x * channels + 16 * k));
+
+        for (int c = 0; c < channels; c++) {
+            __m128i plane = _mm_setzero_si128();
+            for (int k = 0; k < channels; k++)
+                plane = _mm_or_si128(plane, _mm_shuffle_epi8(in[k], _mm_load_si128((const __m128i *)split_masks[channels][k][c])));
+            _mm_storeu_si128((__m128i *)(planes[c] + x), plane);
+        }
+    }
+
+    if (x < width) {
+        unsigned char *rest[PLANAR_MAX_CHANNELS];
+        for (int c = 0; c < channels; c++)
+            rest[c] = planes[c] + x;
+        split_row_scalar(src + x * channels, rest, channels, width - x);
+    }
+}
+
+__attribute__((target("ssse3"), always_inline))
+static inline void merge_row_ssse3_n(unsigned char *const planes[], const int channels, size_t width, unsigned char *dst) {
+    size_t x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        __m128i in[PLANAR_MAX_CHANNELS];
+        for (int c = 0; c < channels; c++)
+            in[c] = _mm_loadu_si128((const __m128i *)(planes[c] + x));
+
+        for (int k = 0; k < channels; k++) {
+            __m128i out = _mm_setzero_si128();
+            for (int c = 0; c < channels; c++)
+                out = _mm_or_si128(out, _mm_shuffle_epi8(in[c], _mm_load_si128((const __m128i *)merge_masks[channels][k][c])));
+            _mm_storeu_si128((__m128i *)(dst + x * channels + 16 * k), out);
+        }
+    }
+
+    if (x < width) {
+        unsigned char *rest[PLANAR_MAX_CHANNELS];
+        for (int c = 0; c < channels; c++)
+            rest[c] = planes[c] + x;
+        merge_row_scalar(rest, channels, width - x, dst + x * channels);
+    }
+}
+
+// One copy per channel count, so the loops over vectors and planes unroll
+__attribute__((target("ssse3")))
+static void split_row_ssse3(const unsigned char *src, unsigned char *const planes[], int channels, size_t width) {
+    switch (channels) {
+        case 2: split_row_ssse3_n(src, planes, 2, width); break;
+        case 3: split_row_ssse3_n(src, planes, 3, width); break;
+        case 4: split_row_ssse3_n(src, planes, 4, width); break;
+        default: split_row_scalar(src, planes, channels, width); break;
+    }
+}
+
+__attribute__((target("ssse3")))
+static void merge_row_ssse3(unsigned char *const planes[], int channels, size_t width, unsigned char *dst) {
+    switch (channels) {
+        case 2: merge_row_ssse3_n(planes, 2, width, dst); break;
+        case 3: merge_row_ssse3_n(planes, 3, width, dst); break;
+        case 4: merge_row_ssse3_n(planes, 4, width, dst); break;
+        default: merge_row_scalar(planes, channels, width, dst); break;
+    }
+}
+
+#endif /* PLANAR_X86 */
+
+static struct {
+    const char *name;
+    split_row_fn split;
+    merge_row_fn merge;
+} planar_best = { "scalar", split_row_scalar, merge_row_scalar };
+
+static pthread_once_t planar_once = PTHREAD_ONCE_INIT;
+
+static void planar_select(void) {
+#ifdef PLANAR_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) {
+        build_masks();
+        planar_best.name = "ssse3";
+        planar_best.split = split_row_ssse3;
+        planar_best.merge = merge_row_ssse3;
+    }
+#endif
+}
+
+const char *planar_kernel_name(void) {
+    pthread_once(&planar_once, planar_select);
+    return planar_best.name;
+}
+
+void planar_deinterleave(const unsigned char *src, size_t src_stride, int channels,
+                         size_t width, size_t height, unsigned char *const planes[], size_t plane_stride) {
+    pthread_once(&planar_once, planar_select);
+
+    unsigned char *rows[PLANAR_MAX_CHANNELS];
+
+    for (size_t y = 0; y < height; y++) {
+        for (int c = 0; c < channels; c++)
+            rows[c] = planes[c] + y * plane_stride;
+
+        if (channels == 1)
+            memcpy(rows[0], src + y * src_stride, width);
+        else
+            planar_best.split(src + y * src_stride, rows, channels, width);
+    }
+}
+
+void planar_interleave(unsigned char *const planes[], size_t plane_stride, int channels,
+                       size_t width, size_t height, unsigned char *dst, size_t dst_stride) {
+    pthread_once(&planar_once, planar_select);
+
+    unsigned char *rows[PLANAR_MAX_CHANNELS];
+
+    for (size_t y = 0; y < height; y++) {
+        for (int c = 0; c < channels; c++)
+            rows[c] = planes[c] + y * plane_stride;
+
+        if (channels == 1)
+            memcpy(dst + y * dst_stride, rows[0], width);
+        else
+            planar_best.merge(rows, channels, width, dst + y * dst_stride);
+    }
+}
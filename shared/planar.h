@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * Conversions between interleaved pixel rows (RGBRGB...) and planes
+ * (RRR... GGG... BBB...), used where planar chunks enter and leave the
+ * pipeline: the chunker splits tiles into planes, reconstruction merges them
+ * back. The vector kernel gathers the bytes of 16 pixels per plane with one
+ * byte shuffle per input vector; results are identical to the scalar loops.
+ */
+
+/** @brief Alignment of every plane origin, and the multiple plane rows are padded to. */
+#define PLANAR_ALIGNMENT 64
+
+/** @brief Largest number of channels (planes) per pixel. */
+#define PLANAR_MAX_CHANNELS 4
+
+/**
+ * @brief Bytes per plane row for `width` pixels: rounded up to PLANAR_ALIGNMENT.
+ */
+size_t planar_row_stride(size_t width);
+
+/**
+ * @brief Splits `height` rows of `width` interleaved pixels into `channels` planes.
+ *
+ * @param src First pixel, `src_stride` bytes between rows.
+ * @param planes One destination per channel, `plane_stride` bytes between rows.
+ */
+void planar_deinterleave(const unsigned char *src, size_t src_stride, int channels,
+                         size_t width, size_t height, unsigned char *const planes[], size_t plane_stride);
+
+/**
+ * @brief Merges `channels` planes back into `height` interleaved rows of `width` pixels.
+ */
+void planar_interleave(unsigned char *const planes[], size_t plane_stride, int channels,
+                       size_t width, size_t height, unsigned char *dst, size_t dst_stride);
+
+/**
+ * @brief Name of the conversion kernels selected for this CPU (e.g. "ssse3").
+ */
+const char *planar_kernel_name(void);